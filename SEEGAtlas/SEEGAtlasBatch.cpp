@@ -0,0 +1,131 @@
+/**
+ * @file SEEGAtlasBatch.cpp
+ *
+ * Command line batch analysis: anatomical location of the contacts and channels of all the patients
+ * listed in FILE_PATIENT_NAMES, as "Run Batch Analysis" of the SEEGAtlas plugin but without IBIS's
+ * GUI and with several patients at the same time (see SEEGBatchAnalysis).
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <QDir>
+#include <QStringList>
+#include "SEEGElectrodeModel.h"
+#include "SEEGFileHelper.h"
+#include "SEEGBatchAnalysis.h"
+
+using namespace std;
+using namespace seeg;
+
+static void PrintUsage(const char* program) {
+    cout << "Usage: " << program << " <baseDir> [options]" << std::endl;
+    cout << "  baseDir: directory of " << FILE_PATIENT_NAMES << " (one patient subdirectory per line)" << std::endl;
+    cout << "Options:" << std::endl;
+    cout << "  -j <n>           number of patients processed at the same time (default: number of cores)" << std::endl;
+    cout << "  -m <dir>         directory of the electrode models (*.xml, default: ~/.ibis/SEEGAtlasData)" << std::endl;
+    cout << "  -r <file>        report of the batch (default: baseDir/" << FILE_BATCH_REPORT << ")" << std::endl;
+    cout << "  -p <n>           number of patients whose atlas is read ahead (default: 2, 0: no prefetch)" << std::endl;
+    cout << "  -b <MB>          memory of the atlases read ahead (default: 1024)" << std::endl;
+    cout << "  --pre-space      use the atlas of the pre-implantation space instead of the template" << std::endl;
+    cout << "  --central-point  use the central point instead of a cylinder as model of the contact/channel" << std::endl;
+    cout << "  --per-contact    label each contact/channel with its own volume instead of one atlas walk per electrode" << std::endl;
+}
+
+// Same electrode models as the plugin: one xml file per model in its configuration directory
+static void ReadElectrodeModels(const QString& foldername, vector<SEEGElectrodeModel::Pointer>& electrodeModelList) {
+    QStringList files = QDir(foldername).entryList(QStringList() << "*.xml", QDir::Files | QDir::NoDot | QDir::NoDotDot, QDir::Name);
+    for (int i=0; i<files.size(); ++i) {
+        SEEGElectrodeModel::Pointer elec;
+        if (!ReadElectrodeModelFile(QDir(foldername).filePath(files[i]).toStdString(), elec)) {
+            cout << "Could not read electrode model " << files[i].toStdString() << std::endl;
+            continue;
+        }
+        electrodeModelList.push_back(elec);
+        cout << "Electrode model: " << elec->GetElectrodeId() << std::endl;
+    }
+    if (electrodeModelList.size() == 0) {
+        // default electrode model (MNI)
+        cout << "No electrode model in " << foldername.toStdString() << " - using " << SEEGElectrodeModel::New()->GetElectrodeId() << std::endl;
+        electrodeModelList.push_back(SEEGElectrodeModel::New());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    string baseDir = argv[1];
+    int numWorkers = 0;
+    int prefetchDepth = -1;
+    int prefetchMemoryMB = -1;
+    QString modelsDir = QDir(QDir::homePath() + "/.ibis").filePath("SEEGAtlasData");
+    string reportFile = baseDir + "/" + FILE_BATCH_REPORT;
+    bool useTemplateSpace = true;
+    bool useCylinder = true;
+    bool usePerContactLabels = false;
+    for (int iArg=2; iArg<argc; iArg++) {
+        if (strcmp(argv[iArg], "-j") == 0 && iArg + 1 < argc) {
+            numWorkers = atoi(argv[++iArg]);
+        } else if (strcmp(argv[iArg], "-m") == 0 && iArg + 1 < argc) {
+            modelsDir = QString(argv[++iArg]);
+        } else if (strcmp(argv[iArg], "-r") == 0 && iArg + 1 < argc) {
+            reportFile = argv[++iArg];
+        } else if (strcmp(argv[iArg], "-p") == 0 && iArg + 1 < argc) {
+            prefetchDepth = atoi(argv[++iArg]);
+        } else if (strcmp(argv[iArg], "-b") == 0 && iArg + 1 < argc) {
+            prefetchMemoryMB = atoi(argv[++iArg]);
+        } else if (strcmp(argv[iArg], "--pre-space") == 0) {
+            useTemplateSpace = false;
+        } else if (strcmp(argv[iArg], "--central-point") == 0) {
+            useCylinder = false;
+        } else if (strcmp(argv[iArg], "--per-contact") == 0) {
+            usePerContactLabels = true;
+        } else {
+            cerr << "Unknown option: " << argv[iArg] << std::endl;
+            PrintUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    vector<SEEGElectrodeModel::Pointer> electrodeModelList;
+    ReadElectrodeModels(modelsDir, electrodeModelList);
+
+    SEEGBatchAnalysis::Pointer batch = SEEGBatchAnalysis::New(baseDir, electrodeModelList);
+    if (numWorkers > 0) {
+        batch->SetNumberOfWorkers(numWorkers);
+    }
+    if (prefetchDepth >= 0) {
+        batch->SetPrefetchDepth(prefetchDepth);
+    }
+    if (prefetchMemoryMB >= 0) {
+        batch->SetPrefetchMemoryBudget((unsigned long long) prefetchMemoryMB * 1024 * 1024);
+    }
+    batch->SetUseTemplateSpace(useTemplateSpace);
+    batch->SetUseCylinder(useCylinder);
+    batch->SetUsePerContactLabels(usePerContactLabels);
+    if (!batch->ReadPatientNames()) {
+        return EXIT_FAILURE;
+    }
+    cout << "Processing " << batch->GetPatientNames().size() << " patients with " << batch->GetNumberOfWorkers() << " workers" << std::endl;
+
+    batch->Run();
+
+    batch->PrintSummary(cout);
+    if (batch->WriteReport(reportFile, DELIMITER_TRAJFILE)) {
+        cout << "Report: " << reportFile << std::endl;
+    }
+
+    for (unsigned int iPatient=0; iPatient<batch->GetResults().size(); iPatient++) {
+        if (!batch->GetResults()[iPatient].m_Done) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -36,12 +36,14 @@
 #include <QFileDialog>
 #include <QDateTime>
 #include <QDir>
-#include <QXmlStreamReader>
 #include <QDirIterator>
 #include <QProgressDialog>
 
 // itk includes
 #include "itkImageRegionIterator.h"
+#if ITK_VERSION_MAJOR >= 5
+#include "itkMultiThreaderBase.h"
+#endif
 
 // seeg namespace includes
 //#include "PlanningUI.h"
@@ -960,13 +962,16 @@ void SEEGAtlasWidget::onFindAnatLocation(){
     //SEEGElectrodesCohort::Pointer electrodesCohort = GetSEEGElectrodesCohort();
     int nElec = m_SEEGElectrodesCohort->GetNumberOfElectrodesInCohort();
     vector<string> electrodeNames = m_SEEGElectrodesCohort->GetElectrodeNames();
+    vector<ElectrodeInfo::Pointer> electrodes;
+    for (int iElec=0; iElec<nElec; iElec++) {
+        electrodes.push_back(m_SEEGElectrodesCohort->GetTrajectoryInBestCohort(electrodeNames[iElec]));
+    }
+    cout<<"Finding Anat location per contact -  "<< nElec <<" electrodes"<<std::endl;
+    FindAnatLocation(electrodes, false, QString(""));
+
+    //Refresh tables once all contacts are labeled
     for (int iElec=0; iElec<nElec; iElec++) {
-        ElectrodeInfo::Pointer electrode = m_SEEGElectrodesCohort->GetTrajectoryInBestCohort(electrodeNames[iElec]);
-        int indexElectrode = m_SEEGElectrodesCohort->GetTrajectoryIndexInBestCohort(electrodeNames[iElec]);
-        cout<<"Fidning Anat location per contact -  "<< electrodeNames[iElec] <<" = el: "<<indexElectrode<<std::endl;
-        onFindAnatLocation(electrode);
-        //Refresh table
-        RefreshContactsTable(indexElectrode);
+        RefreshContactsTable(m_SEEGElectrodesCohort->GetTrajectoryIndexInBestCohort(electrodeNames[iElec]));
     }
     ui->pushButtonShowContactsTable->setChecked(true);
     ui->pushButtonShowContactsTable->setText(QString("Showing CONTACTS in table"));
@@ -975,51 +980,7 @@ void SEEGAtlasWidget::onFindAnatLocation(){
 
 void SEEGAtlasWidget::onFindAnatLocation(seeg::ElectrodeInfo::Pointer electrode){
     // Find anatomical location for all contacts of the eletrode
-    int nContacts = electrode->GetNumberOfContacts();
-    FloatVolume::Pointer anatLabelsVol = openAtlasVolume();
-    if( anatLabelsVol.IsNotNull() ) {
-        map<int,string> labelsMap = ReadAtlasLabels();
-		qDebug() << " Electrode Type: " <<  m_ElectrodeModel->GetElectrodeId().c_str();
-        SEEGContactsROIPipeline::Pointer pipelineContacts = SEEGContactsROIPipeline::New( anatLabelsVol, electrode->GetElectrodeModel() ); //volume is only to have size,
-
-        bool useCylinder = ui->checkBoxUseCylinder->isChecked();
-
-        for( int iContact = 0; iContact < nContacts; iContact++ ){
-            // Find anatomical location for each contact of the eletrode
-            vector<int> labelsCount;
-            int voxelsInContactVol;
-            labelsCount = pipelineContacts->GetLabelsInContact(iContact, electrode, anatLabelsVol, voxelsInContactVol, useCylinder);
-            ContactInfo::Pointer contact = electrode->GetOneContact(iContact);
-            //Compute Most common Label (highest count)
-            //int probaMaxLabel = std::max_element(labelsCount, labelsCount.size());
-            //int indexMaxLabel = std::distance(probaMaxLabel, labelsCount);
-            int indexMaxLabel = -1;
-            int sumMaxLabel = -1;
-            int totalVoxelsLabels = 0;
-            for( int iLabel = 0; iLabel < labelsCount.size(); iLabel++ ){
-                totalVoxelsLabels += labelsCount[iLabel];
-                if( ( labelsCount[iLabel] > 0 ) && ( labelsCount[iLabel] >= sumMaxLabel ) ){  // using > or >= changes the results when 0.5 proba
-                    sumMaxLabel = labelsCount[iLabel];
-                    indexMaxLabel = iLabel;
-                    //float proba = float(sumMaxLabel)/float(totalVoxelsLabels);
-                    qDebug() << " Most Common Label so far: " << indexMaxLabel  << " - name:" << labelsMap[indexMaxLabel].c_str() << " with Number of voxels of Occupacy: " << sumMaxLabel << " out of: " << voxelsInContactVol;
-                }
-            }
-
-            //Assign most common label to contact
-            float proba = float( sumMaxLabel ) / float( voxelsInContactVol );
-			qDebug() << "Contact index: " << iContact << " Most Common Label number: " << indexMaxLabel << " - name:" << labelsMap[indexMaxLabel].c_str() << " with Percentage Occupacy: " << proba << " (voxels with labels: " << totalVoxelsLabels << " - # labels: " << labelsCount.size() << " )";
-            if( !isnan( proba ) ) {
-                if( labelsMap.size() > 0 ){
-                    contact->SetContactLocation( labelsMap[indexMaxLabel], indexMaxLabel, proba );
-                }else{
-                    stringstream ssLabel;
-                    ssLabel << indexMaxLabel;
-                    contact->SetContactLocation( ssLabel.str(), indexMaxLabel, proba );
-                }
-            }
-        }
-    }
+    FindAnatLocation(vector<ElectrodeInfo::Pointer>(1, electrode), false, QString(""));
 }
 
 
@@ -1036,13 +997,16 @@ void SEEGAtlasWidget::onFindChannelsAnatLocation(){
         QString baseDir = ui->labelDirBase->text();
         dirname = QFileDialog::getExistingDirectory(this, tr("Select Directory where Channel Model volumes go"), baseDir, QFileDialog::ShowDirsOnly | QFileDialog::DontResolveSymlinks | QFileDialog::DontUseNativeDialog);
     }
+    vector<ElectrodeInfo::Pointer> electrodes;
     for (int iEl=0; iEl<nElec; iEl++) {
-        ElectrodeInfo::Pointer electrode = m_SEEGElectrodesCohort->GetTrajectoryInBestCohort(electrodeNames[iEl]);
-        int indexElectrode = m_SEEGElectrodesCohort->GetTrajectoryIndexInBestCohort(electrodeNames[iEl]);
-		qDebug() <<"Finding Anat location per channel -  " << electrodeNames[iEl].c_str() <<" = el: "<<indexElectrode;
-        onFindChannelsAnatLocation(electrode, dirname);
-        //Refresh table
-        RefreshChannelsTable(indexElectrode);
+        electrodes.push_back(m_SEEGElectrodesCohort->GetTrajectoryInBestCohort(electrodeNames[iEl]));
+    }
+    qDebug() <<"Finding Anat location per channel -  " << nElec << " electrodes";
+    FindAnatLocation(electrodes, true, dirname);
+
+    //Refresh tables once all channels are labeled
+    for (int iEl=0; iEl<nElec; iEl++) {
+        RefreshChannelsTable(m_SEEGElectrodesCohort->GetTrajectoryIndexInBestCohort(electrodeNames[iEl]));
     }
     ui->pushButtonShowContactsTable->setChecked(false);
     ui->pushButtonShowContactsTable->setText(QString("Showing CHANNELS in table"));
@@ -1051,61 +1015,109 @@ void SEEGAtlasWidget::onFindChannelsAnatLocation(){
 void SEEGAtlasWidget::onFindChannelsAnatLocation(seeg::ElectrodeInfo::Pointer electrode, const QString dirname){
     // Find anatomical location for all bipolar channel of the eletrode
     // Bipolar channel is defined as contact i to contact i+1
-    int nContacts = electrode->GetNumberOfContacts();
-	qDebug() << "onFindChannelsAnatLocation - number of contacts: "<<nContacts;
+    FindAnatLocation(vector<ElectrodeInfo::Pointer>(1, electrode), true, dirname);
+}
+
+void SEEGAtlasWidget::FindAnatLocation(const vector<seeg::ElectrodeInfo::Pointer>& electrodes, const bool useChannels, const QString dirname){
+    // Labels all contacts (or bipolar channels) of the electrodes in parallel against the same atlas,
+    // then assigns the most common label to each contact/channel
     FloatVolume::Pointer anatLabelsVol = openAtlasVolume();
-   if (anatLabelsVol.IsNotNull()) {
-	   qDebug() << " Electrode Type: " <<  m_ElectrodeModel->GetElectrodeId().c_str();
-        SEEGContactsROIPipeline::Pointer pipelineContacts = SEEGContactsROIPipeline::New(anatLabelsVol, electrode->GetElectrodeModel()); //volume is only to have size,
-        // Find anatomical location for each bipolar channel of the eletrode (nChannels = nContacts-1)
-        bool useCylinder = ui->checkBoxUseCylinder->isChecked();
-        map <int,string> labelsMap = ReadAtlasLabels();
-        for (int iContact=0; iContact<(nContacts-1); iContact++) {
-			qDebug() <<"onFindChannelsAnatLocation - contact: " << iContact;
-            vector<int> labelsCount;
-            labelsCount = pipelineContacts->GetLabelsInChannel(iContact, iContact +1, electrode, anatLabelsVol, useCylinder);
-            ChannelInfo::Pointer channel = electrode->GetOneChannel(iContact); // channel's index is the forst of its 2 contacts.
-            //Compute Most common Label (highest count)
-            //int probaMaxLabel = std::max_element(labelsCount, labelsCount.size());
-            //int indexMaxLabel = std::distance(probaMaxLabel, labelsCount);
-            int indexMaxLabel=-1;
-            int sumMaxLabel=-1;
-            int totalVoxelsLabels =0;
-            for (int iLabel=0; iLabel<labelsCount.size(); iLabel++) {
-                totalVoxelsLabels+= labelsCount[iLabel];
-                if (labelsCount[iLabel] >sumMaxLabel) {
-                    sumMaxLabel = labelsCount[iLabel];
-                    indexMaxLabel = iLabel;
-                }
-            }
+    if (anatLabelsVol.IsNull()) {
+        return;
+    }
+    map<int,string> labelsMap = ReadAtlasLabels();
+    bool useCylinder = ui->checkBoxUseCylinder->isChecked();
+    bool usePerContactLabels = ui->checkBoxPerContactLabels->isChecked();
+    bool keepChannelVol = useChannels && (dirname != QString(""));
+    qDebug() << " Electrode Type: " <<  m_ElectrodeModel->GetElectrodeId().c_str();
 
-            //Assign most common label to channel
-            int voxelsInChannel = pipelineContacts->GetNumberVoxelsInChannelModel();
-
-            float proba = float(sumMaxLabel)/float(voxelsInChannel);
-			qDebug() <<"Contact 1 index: "<< iContact<<" - Contact 2 index: "<< iContact +1<< " - Channel Most Common Label: " << indexMaxLabel <<" with Percentage Occupacy: "<< proba<< " (total: "<<voxelsInChannel<<" voxels)";
-            if (!isnan(proba)) {
-                if ( labelsMap.size() >0) {
-                    channel->SetChannelLocation(labelsMap[indexMaxLabel], indexMaxLabel, proba);
-                } else {
-                    stringstream ssLabel;
-                    ssLabel << indexMaxLabel;
-                    channel->SetChannelLocation(ssLabel.str(), indexMaxLabel, proba);
-                }
+    //1. One task per electrode: all its contacts and channels are labeled in one walk over the atlas
+    vector<AnatLocationTask> tasks(electrodes.size());
+    for (unsigned int iElec=0; iElec<electrodes.size(); iElec++) {
+        tasks[iElec].electrode = electrodes[iElec];
+    }
+
+    //2. Label histograms of each task
+    unsigned int numThreads = 1;
+#if ITK_VERSION_MAJOR >= 5
+    numThreads = itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads();
+#endif
+    if (numThreads <= 1 || tasks.size() <= 1) {
+        for (unsigned int iTask=0; iTask<tasks.size(); iTask++) {
+            CalcAnatLocationTask(tasks[iTask], anatLabelsVol, useCylinder, usePerContactLabels, keepChannelVol);
+        }
+    } else {
+#if ITK_VERSION_MAJOR >= 5
+        // each task only writes its own results: they do not depend on scheduling
+        itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+        threader->SetMaximumNumberOfThreads(numThreads);
+        threader->SetNumberOfWorkUnits(numThreads);
+        threader->ParallelizeArray(0, tasks.size(),
+            [&](itk::SizeValueType iTask) {
+                CalcAnatLocationTask(tasks[iTask], anatLabelsVol, useCylinder, usePerContactLabels, keepChannelVol);
+            },
+            nullptr);
+#endif
+    }
+
+    //3. Assign most common label (highest count) to each contact/channel
+    for (unsigned int iTask=0; iTask<tasks.size(); iTask++) {
+        const AnatLocationTask& task = tasks[iTask];
+        const vector<LabelHistogram>& histograms = useChannels ? task.channelHistograms : task.contactHistograms;
+        for (int iContact=0; iContact<histograms.size(); iContact++) { // channel's index is the first of its 2 contacts
+            const map<int,int>& labelsCount = histograms[iContact].m_LabelCounts;
+            float proba;
+            int indexMaxLabel = SEEGContactsROIPipeline::FindMostCommonLabel(histograms[iContact], useChannels, proba);
+            int totalVoxelsLabels = 0;
+            for (map<int,int>::const_iterator itLabel = labelsCount.begin(); itLabel != labelsCount.end(); itLabel++) {
+                totalVoxelsLabels += itLabel->second;
+            }
+            string labelName;
+            if (labelsMap.size() > 0) {
+                labelName = labelsMap[indexMaxLabel];
+            } else {
+                stringstream ssLabel;
+                ssLabel << indexMaxLabel;
+                labelName = ssLabel.str();
             }
 
-            // Save channel as volume in MINC file
-            if (dirname != QString("")) {
-                FloatVolume::Pointer channelModelVol = pipelineContacts->GetChannelModelVol();
+            if (!useChannels) {
+                qDebug() << "Contact index: " << iContact << " Most Common Label number: " << indexMaxLabel << " - name:" << labelName.c_str() << " with Percentage Occupacy: " << proba << " (voxels with labels: " << totalVoxelsLabels << " - # labels: " << labelsCount.size() << " )";
+                if (!isnan(proba)) {
+                    task.electrode->GetOneContact(iContact)->SetContactLocation(labelName, indexMaxLabel, proba);
+                }
+            } else {
+                ChannelInfo::Pointer channel = task.electrode->GetOneChannel(iContact);
+                qDebug() <<"Contact 1 index: "<< iContact<<" - Contact 2 index: "<< iContact +1<< " - Channel Most Common Label: " << indexMaxLabel <<" with Percentage Occupacy: "<< proba<< " (total: "<<histograms[iContact].m_NumVoxels<<" voxels)";
+                if (!isnan(proba)) {
+                    channel->SetChannelLocation(labelName, indexMaxLabel, proba);
+                }
 
-                // Save minc file
-                string filename = dirname.toStdString() + "/"+ string(FILE_CHANNELS_GRAL) + "_" + channel->GetChannelName()  + ".mnc";
-                WriteFloatVolume(filename, channelModelVol);
+                // Save channel as volume in MINC file
+                if (keepChannelVol) {
+                    string filename = dirname.toStdString() + "/"+ string(FILE_CHANNELS_GRAL) + "_" + channel->GetChannelName()  + ".mnc";
+                    WriteFloatVolume(filename, task.channelModelVols[iContact]);
+                }
             }
         }
     }
 }
 
+void SEEGAtlasWidget::CalcAnatLocationTask(AnatLocationTask& task, seeg::FloatVolume::Pointer anatLabelsVol, const bool useCylinder, const bool usePerContactLabels, const bool keepChannelVol){
+    // One pipeline per task, the atlas is only read
+    SEEGContactsROIPipeline::Pointer pipelineContacts = SEEGContactsROIPipeline::New(anatLabelsVol, task.electrode->GetElectrodeModel()); //volume is only to have size,
+    if (usePerContactLabels) {
+        pipelineContacts->CalcElectrodeLabelHistogramsPerContact(task.electrode, anatLabelsVol, useCylinder, task.contactHistograms, task.channelHistograms);
+    } else {
+        pipelineContacts->CalcElectrodeLabelHistograms(task.electrode, anatLabelsVol, useCylinder, task.contactHistograms, task.channelHistograms);
+    }
+    if (keepChannelVol) {
+        for (int iChannel=0; iChannel<task.channelHistograms.size(); iChannel++) {
+            task.channelModelVols.push_back(pipelineContacts->CalcChannelModelVol(iChannel, iChannel + 1, task.electrode));
+        }
+    }
+}
+
 /***
     PLAN RELATED
 ***/
@@ -2452,34 +2464,12 @@ map <int,string> SEEGAtlasWidget::ReadAtlasLabels() {
     QString baseDir = ui->labelDirBase->text();
 
     QString fullFileNameAtlasLabelsXml = baseDir + QString("/") + filenameAtlasLabelsXml;
-    QFile xmlFileAtlasLabels(fullFileNameAtlasLabelsXml);
-    if (!xmlFileAtlasLabels.open (QFile::ReadOnly | QFile::Text)) {
+    if (!ReadAtlasLabelsFile(fullFileNameAtlasLabelsXml.toStdString(), atlasLabels)) {
         QMessageBox::warning(this, "Error reading Atlas Labels file ", "Cannot read file " + fullFileNameAtlasLabelsXml);
         return atlasLabels;
     }
-
-    QXmlStreamReader xmlReaderAtlasLabels(&xmlFileAtlasLabels);
-    while(!xmlReaderAtlasLabels.atEnd() && !xmlReaderAtlasLabels.hasError()) {
-        // QXmlStreamReader::TokenType tokenAtlasLabel = xmlReaderAtlasLabels.readNext();
-        while (xmlReaderAtlasLabels.readNextStartElement()) {
-            if (xmlReaderAtlasLabels.name().toUtf8().toStdString() == "Label") { // now we are inside label
-                QString qsLabelName, qsLabelNumber;
-                while (xmlReaderAtlasLabels.readNextStartElement()) {
-                    if (xmlReaderAtlasLabels.name().toUtf8().toStdString() == "Name") {
-                        qsLabelName = xmlReaderAtlasLabels.readElementText();
-                    }
-                    else if (xmlReaderAtlasLabels.name().toUtf8().toStdString() == "Number"){
-                        qsLabelNumber = xmlReaderAtlasLabels.readElementText();
-
-                    }
-                }
-                // once we have the name and number we can input in the map var
-                int labelNumber = qsLabelNumber.toInt();
-                string labelName = qsLabelName.toStdString();
-                atlasLabels[labelNumber] = labelName;
-				qDebug() << "Name: "<< labelName.c_str() << "number: " << labelNumber;
-            }
-        }
+    for (map<int,string>::iterator itLabel = atlasLabels.begin(); itLabel != atlasLabels.end(); itLabel++) {
+		qDebug() << "Name: "<< itLabel->second.c_str() << "number: " << itLabel->first;
     }
 	qDebug() << "Finished reading "<< fullFileNameAtlasLabelsXml.toStdString().c_str();
     return atlasLabels;
@@ -2519,7 +2509,7 @@ void SEEGAtlasWidget::onRunBatchAnalysis(){
     //2.2. Load electrodes
             QString electrodesDirStr = patientDir;
             //electrodesDirStr.append(QString("/") + "electrodes/prespace");
-            electrodesDirStr.append(QString("/") + "electrodes/TALspace");
+            electrodesDirStr.append(QString("/") + DIR_BATCH_ELECTRODES);
             QDir electrodesDir(electrodesDirStr.toStdString().c_str() );
 			qDebug() << "Electrodes dir: "<< electrodesDirStr;
             QStringList fileExtension;
@@ -2546,7 +2536,7 @@ void SEEGAtlasWidget::onRunBatchAnalysis(){
             QString anatomicalInfoDir = electrodesDirStr;
           //  anatomicalInfoDir.append(QString("/") + "3x3x3/CSF_GM_WM");
            // anatomicalInfoDir.append(QString("/") + "3x3x3/AnatLoc_seg_lobes");
-             anatomicalInfoDir.append(QString("/") + "3x3x3/AnatLoc_tal_seg_lobes_HCAG");
+             anatomicalInfoDir.append(QString("/") + DIR_BATCH_ANAT_LOCATION);
             onSavePlanningToDirectory(anatomicalInfoDir);
 			qDebug() << "... Saving Electrodes with Anatomical Info" << " - Dir: "<< anatomicalInfoDir;
 
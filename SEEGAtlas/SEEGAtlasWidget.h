@@ -11,6 +11,7 @@
 #include "SEEGFileHelper.h"
 #include "SEEGElectrodeModel.h"
 #include "SEEGElectrodesCohort.h"
+#include "SEEGContactsROIPipeline.h"
 #include "seegatlasplugininterface.h"
 #include <SEEGPointRepresentation.h>
 #include <QTableWidget>
@@ -216,6 +217,16 @@ private:
     seeg::FloatVolume::Pointer openAtlasVolume();
     map <int,string> ReadAtlasLabels();
 
+    // Anatomical location of contacts/channels: one task per electrode, run in parallel
+    struct AnatLocationTask {
+        seeg::ElectrodeInfo::Pointer electrode;
+        vector<seeg::LabelHistogram> contactHistograms;
+        vector<seeg::LabelHistogram> channelHistograms;      // channel's index is the first of its 2 contacts
+        vector<seeg::FloatVolume::Pointer> channelModelVols; // only kept to be saved
+    };
+    void FindAnatLocation(const vector<seeg::ElectrodeInfo::Pointer>& electrodes, const bool useChannels, const QString dirname);
+    static void CalcAnatLocationTask(AnatLocationTask& task, seeg::FloatVolume::Pointer anatLabelsVol, const bool useCylinder, const bool usePerContactLabels, const bool keepChannelVol);
+
     //various
     string timeStamp();
 
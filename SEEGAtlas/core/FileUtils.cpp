@@ -23,6 +23,14 @@ namespace seeg {
         return true;
     }
 
+    long long GetFileModificationTime(const std::string filename) {
+        struct stat fileStat;
+        if (stat(filename.c_str(), &fileStat) != 0) {
+            return -1;
+        }
+        return (long long) fileStat.st_mtime;
+    }
+
 
 
 }
@@ -9,6 +9,9 @@ namespace seeg {
 
     bool IsFileExists(const std::string filename);
     bool CreateDirectory(const std::string directoryName);
+
+    // last modification time of a file (seconds since the epoch), -1 if the file does not exist
+    long long GetFileModificationTime(const std::string filename);
 }
 
 
@@ -12,6 +12,7 @@
 // Header files to include
 #include "itkImageToImageFilter.h"
 #include "MathUtils.h"
+#include "BasicTypes.h"
 
 namespace seeg {
 
@@ -69,9 +70,31 @@ namespace seeg {
 //        void PrintSelf( std::ostream &os, Indent indent) const;
 
         /**
-         * Implementation of the sub-classe's GenerateData() function
+         * Precomputes the scaled trajectory end points shared by all threads
          */
-        void GenerateData();
+        void BeforeThreadedGenerateData();
+
+        /**
+         * Multithreaded implementation of the sub-classe's GenerateData() function
+         */
+#if ITK_VERSION_MAJOR >= 5
+        void DynamicThreadedGenerateData(const OutRegionType& outputRegionForThread);
+#else
+        void ThreadedGenerateData(const OutRegionType& outputRegionForThread, ITK_THREAD_ID threadId);
+#endif
+
+    private:
+        /** Voxel spacing */
+        float m_Scale[3];
+
+        /** Entry point in mm (index * spacing) */
+        float m_P1[3];
+
+        /** Trajectory vector (target - entry) in mm */
+        float m_Dir[3];
+
+        /** 1 / squared trajectory length (0 for a degenerate trajectory) */
+        float m_InvLengthSq;
 
     };
 }
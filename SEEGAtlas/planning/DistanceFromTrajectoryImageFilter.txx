@@ -23,56 +23,83 @@ namespace seeg {
 
     template <typename TInputImage3D, typename TOutputImage3D>
     DistanceFromTrajectoryImageFilter<TInputImage3D, TOutputImage3D>::DistanceFromTrajectoryImageFilter() {
-
+#if ITK_VERSION_MAJOR >= 5
+        this->DynamicMultiThreadingOn();
+#endif
+        for (int i=0; i<3; i++) {
+            m_Scale[i] = 1;
+            m_P1[i] = 0;
+            m_Dir[i] = 0;
+        }
+        m_InvLengthSq = 0;
     }
 
 
-    /**** IMPL OF GenerateData() ****/
+    /**** IMPL OF ThreadedGenerateData() ****/
 
     template <typename TInputImage3D, typename TOutputImage3D>
-    void DistanceFromTrajectoryImageFilter<TInputImage3D, TOutputImage3D>::GenerateData() {
+    void DistanceFromTrajectoryImageFilter<TInputImage3D, TOutputImage3D>::BeforeThreadedGenerateData() {
 
-        // this function probably needs some commenting...
-
-        this->AllocateOutputs();
-        OutImagePointerType outputImage = this->GetOutput();
-        OutRegionType outputRegion = outputImage->GetRequestedRegion();
+        // The distance of a voxel p0 to the segment [p1,p2] is computed by projecting p0 on the
+        // line (t = (p0-p1).(p2-p1) / |p2-p1|^2), clamping t to [0,1] (closest end point when the
+        // projection falls outside of the segment) and measuring |p0 - (p1 + t*(p2-p1))|.
+        // This is the same distance as the former per-voxel norm()/pow()/sqrt() formulation.
         InImagePointerType inputImage = this->GetInput();
-
         InSpacingType spacing = inputImage->GetSpacing();
 
-        Vector3D_f scale = Vector3D_f(spacing[0], spacing[1], spacing[2]);
-        Vector3D_f p1 = Vector3D_f(m_EntryPoint[0], m_EntryPoint[1], m_EntryPoint[2]);
-        Vector3D_f p2 = Vector3D_f(m_TargetPoint[0], m_TargetPoint[1], m_TargetPoint[2]);
-
-        p1 = p1.DotMult(scale);
-        p2 = p2.DotMult(scale);
-
-        float dist_p1p2 = norm(p2-p1);
-
-        typedef ImageRegionIteratorWithIndex< TOutputImage3D > ImageIterator;
-        ImageIterator outputIterator( outputImage, outputRegion );
-
-        outputIterator.GoToBegin();
-
-        while( ! outputIterator.IsAtEnd() ) {
-
-            OutIndexType voxelIndex = outputIterator.GetIndex();
-            Vector3D_f p0 (voxelIndex[0], voxelIndex[1], voxelIndex[2]);
-            p0 = p0.DotMult(scale);
-
-            float dist_p0p1 = norm(p1-p0);
-            float dist_p0p2 = norm(p2-p0);
-            float d = (norm((p2-p1)*(p1-p0)) / dist_p1p2);
+        for (int i=0; i<3; i++) {
+            m_Scale[i] = spacing[i];
+            m_P1[i] = m_EntryPoint[i] * spacing[i];
+            m_Dir[i] = m_TargetPoint[i] * spacing[i] - m_P1[i];
+        }
+        float lengthSq = m_Dir[0]*m_Dir[0] + m_Dir[1]*m_Dir[1] + m_Dir[2]*m_Dir[2];
+        // degenerate trajectory (entry == target): distance to the point
+        m_InvLengthSq = (lengthSq > 0) ? 1.0f / lengthSq : 0.0f;
+    }
 
-             // Look for special cases: intersection point is outside line segment
-             float t = sqrt(pow(max(dist_p0p1, dist_p0p2),2) - pow(d,2));
-             if (t > dist_p1p2) {
-                 d = min(dist_p0p1, dist_p0p2);
-             }
+    template <typename TInputImage3D, typename TOutputImage3D>
+#if ITK_VERSION_MAJOR >= 5
+    void DistanceFromTrajectoryImageFilter<TInputImage3D, TOutputImage3D>::DynamicThreadedGenerateData(const OutRegionType& outputRegionForThread) {
+#else
+    void DistanceFromTrajectoryImageFilter<TInputImage3D, TOutputImage3D>::ThreadedGenerateData(const OutRegionType& outputRegionForThread, ITK_THREAD_ID threadId) {
+#endif
 
-             outputIterator.Set( d );
-             ++outputIterator;
+        OutImagePointerType outputImage = this->GetOutput();
+        OutPixelType* outBuffer = outputImage->GetBufferPointer();
+
+        OutIndexType regionIndex = outputRegionForThread.GetIndex();
+        typename TOutputImage3D::SizeType regionSize = outputRegionForThread.GetSize();
+        const int lineLength = regionSize[0];
+
+        const float sx = m_Scale[0];
+        const float dx = m_Dir[0], dy = m_Dir[1], dz = m_Dir[2];
+        const float invLengthSq = m_InvLengthSq;
+
+        // process the region one scanline (contiguous x-axis) at a time; along a scanline only the
+        // x component varies, so the inner loop is a branch-free kernel the compiler can vectorize
+        for (unsigned int iz=0; iz<regionSize[2]; iz++) {
+            const float wz = (regionIndex[2] + (long) iz) * m_Scale[2] - m_P1[2];
+            for (unsigned int iy=0; iy<regionSize[1]; iy++) {
+                const float wy = (regionIndex[1] + (long) iy) * m_Scale[1] - m_P1[1];
+                const float dotYZ = wy*dy + wz*dz;
+
+                OutIndexType lineIndex;
+                lineIndex[0] = regionIndex[0];
+                lineIndex[1] = regionIndex[1] + iy;
+                lineIndex[2] = regionIndex[2] + iz;
+                OutPixelType* out = outBuffer + outputImage->ComputeOffset(lineIndex);
+                const float x0 = regionIndex[0] * sx - m_P1[0];
+
+                for (int ix=0; ix<lineLength; ix++) {
+                    const float wx = x0 + ix * sx;
+                    float t = (wx*dx + dotYZ) * invLengthSq;
+                    t = (t < 0.0f) ? 0.0f : ((t > 1.0f) ? 1.0f : t);
+                    const float ex = wx - t*dx;
+                    const float ey = wy - t*dy;
+                    const float ez = wz - t*dz;
+                    out[ix] = static_cast<OutPixelType>(sqrtf(ex*ex + ey*ey + ez*ez));
+                }
+            }
         }
     }
 };
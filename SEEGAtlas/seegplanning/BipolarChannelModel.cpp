@@ -165,11 +165,10 @@ namespace seeg {
         // Use this option ONLY the first time to get image size and spacing
 
         // First, get Image information from input template
-        FloatVolumeDuplicator::Pointer volDuplicator = FloatVolumeDuplicator::New();
-        volDuplicator->SetInputImage(templateVolume); //templateVolume could be empty! --> only to have appropriate size
-        volDuplicator->Update();
-        m_VolModel = volDuplicator->GetOutput();
-        m_VolModel->DisconnectPipeline();
+        // (only its geometry is needed: no buffer is allocated, so the template can be shared between threads)
+        m_VolModel = FloatVolume::New();
+        m_VolModel->CopyInformation(templateVolume);
+        m_VolModel->SetRegions(templateVolume->GetLargestPossibleRegion());
 
         m_VolModel->SetRequestedRegion(channelRegion);
         //m_VolSpacing = templateVolume->GetSpacing();
@@ -0,0 +1,522 @@
+/**
+ * @file SEEGBatchAnalysis.cpp
+ *
+ * Implementation of the SEEGBatchAnalysis class
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include "SEEGBatchAnalysis.h"
+#include "SEEGContactsROIPipeline.h"
+#include "itkTimeProbe.h"
+#include <math.h>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <QDir>
+#include <QFileInfo>
+
+namespace seeg {
+
+    // spacing of the cohort's trajectories, same as SEEGAtlasWidget
+    static const float COHORT_SPACING_RESOLUTION = 0.5;
+
+    // default memory of the prefetched atlases: 16 float volumes of 256^3 voxels (as the volume cache)
+    static const unsigned long long DEFAULT_PREFETCH_MEMORY_BUDGET = 1024ULL * 1024 * 1024;
+
+
+    /**** CONSTRUCTORS / DESTRUCTOR ****/
+
+    SEEGBatchAnalysis::SEEGBatchAnalysis(const string& baseDir, const vector<SEEGElectrodeModel::Pointer>& electrodeModelList) {
+        m_BaseDir = baseDir;
+        m_ElectrodeModelList = electrodeModelList;
+        m_NumberOfWorkers = std::thread::hardware_concurrency();
+        if (m_NumberOfWorkers < 1) {
+            m_NumberOfWorkers = 1;
+        }
+        m_UseCylinder = true;
+        m_UsePerContactLabels = false;
+        m_UseTemplateSpace = true;
+        m_PrefetchDepth = 2;
+        m_PrefetchMemoryBudget = DEFAULT_PREFETCH_MEMORY_BUDGET;
+        m_ElapsedTime = 0;
+        m_PrefetchStallTime = 0;
+        m_NextPatient = 0;
+        m_StopPrefetch = false;
+    }
+
+    SEEGBatchAnalysis::~SEEGBatchAnalysis() {
+        // Do nothing
+    }
+
+
+    /**** PUBLIC FUNCTIONS ****/
+
+    void SEEGBatchAnalysis::SetNumberOfWorkers(unsigned int numWorkers) {
+        m_NumberOfWorkers = (numWorkers < 1) ? 1 : numWorkers;
+    }
+
+    unsigned int SEEGBatchAnalysis::GetNumberOfWorkers() {
+        return m_NumberOfWorkers;
+    }
+
+    void SEEGBatchAnalysis::SetUseCylinder(bool useCylinder) {
+        m_UseCylinder = useCylinder;
+    }
+
+    bool SEEGBatchAnalysis::GetUseCylinder() {
+        return m_UseCylinder;
+    }
+
+    void SEEGBatchAnalysis::SetUsePerContactLabels(bool usePerContactLabels) {
+        m_UsePerContactLabels = usePerContactLabels;
+    }
+
+    bool SEEGBatchAnalysis::GetUsePerContactLabels() {
+        return m_UsePerContactLabels;
+    }
+
+    void SEEGBatchAnalysis::SetUseTemplateSpace(bool useTemplateSpace) {
+        m_UseTemplateSpace = useTemplateSpace;
+    }
+
+    bool SEEGBatchAnalysis::GetUseTemplateSpace() {
+        return m_UseTemplateSpace;
+    }
+
+    void SEEGBatchAnalysis::SetPrefetchDepth(unsigned int prefetchDepth) {
+        m_PrefetchDepth = prefetchDepth;
+    }
+
+    unsigned int SEEGBatchAnalysis::GetPrefetchDepth() {
+        return m_PrefetchDepth;
+    }
+
+    void SEEGBatchAnalysis::SetPrefetchMemoryBudget(unsigned long long numBytes) {
+        m_PrefetchMemoryBudget = numBytes;
+    }
+
+    unsigned long long SEEGBatchAnalysis::GetPrefetchMemoryBudget() {
+        return m_PrefetchMemoryBudget;
+    }
+
+    bool SEEGBatchAnalysis::ReadPatientNames() {
+        m_PatientNames.clear();
+        string fullFileNamePatients = m_BaseDir + "/" + FILE_PATIENT_NAMES;
+        ifstream filePatients(fullFileNamePatients.c_str());
+        if (!filePatients.is_open()) {
+            cerr << "File " << fullFileNamePatients << " not found." << std::endl;
+            return false;
+        }
+        string linePatientInfo;
+        while (getline(filePatients, linePatientInfo)) {
+            if (!linePatientInfo.empty() && linePatientInfo[linePatientInfo.size() - 1] == '\r') {
+                linePatientInfo.erase(linePatientInfo.size() - 1); // file written on Windows
+            }
+            if (linePatientInfo.empty()) {
+                break;
+            }
+            m_PatientNames.push_back(linePatientInfo); // each line contains the name of 1 patient subdirectory
+        }
+        return true;
+    }
+
+    const vector<string>& SEEGBatchAnalysis::GetPatientNames() {
+        return m_PatientNames;
+    }
+
+    void SEEGBatchAnalysis::Run() {
+        m_Results.assign(m_PatientNames.size(), BatchPatientResult());
+        for (unsigned int iPatient=0; iPatient<m_PatientNames.size(); iPatient++) {
+            BatchPatientResult& result = m_Results[iPatient];
+            result.m_PatientName = m_PatientNames[iPatient];
+            result.m_PatientDir = m_BaseDir + "/" + m_PatientNames[iPatient];
+            result.m_Done = false;
+            result.m_Worker = -1;
+            result.m_NumElectrodes = result.m_NumContacts = result.m_NumChannels = 0;
+            result.m_LoadTime = result.m_LabelTime = result.m_SaveTime = result.m_TotalTime = 0;
+            result.m_Prefetched = false;
+            result.m_PrefetchTime = result.m_PrefetchWaitTime = 0;
+        }
+        m_NextPatient = 0;
+        m_PrefetchStates.assign(m_Results.size(), PREFETCH_NONE);
+        m_StopPrefetch = false;
+        m_PrefetchStallTime = 0;
+
+        // during the batch the volume cache only holds the prefetched atlases
+        unsigned long long previousCacheBudget = GetVolumeCacheMemoryBudget();
+        if (m_PrefetchDepth > 0) {
+            SetVolumeCacheMemoryBudget(m_PrefetchMemoryBudget);
+        }
+        VolumeCacheStatistics startStatistics = GetVolumeCacheStatistics();
+
+        itk::TimeProbe runProbe;
+        runProbe.Start();
+        std::thread prefetch;
+        if (m_PrefetchDepth > 0) {
+            prefetch = std::thread(&SEEGBatchAnalysis::RunPrefetch, this);
+        }
+        unsigned int numWorkers = min(m_NumberOfWorkers, (unsigned int) m_Results.size());
+        if (numWorkers <= 1) {
+            RunWorker(0);
+        } else {
+            vector<std::thread> workers;
+            for (unsigned int iWorker=0; iWorker<numWorkers; iWorker++) {
+                workers.push_back(std::thread(&SEEGBatchAnalysis::RunWorker, this, iWorker));
+            }
+            for (unsigned int iWorker=0; iWorker<numWorkers; iWorker++) {
+                workers[iWorker].join();
+            }
+        }
+        if (prefetch.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(m_PrefetchMutex);
+                m_StopPrefetch = true;
+            }
+            m_PrefetchCondition.notify_all();
+            prefetch.join();
+        }
+        runProbe.Stop();
+        m_ElapsedTime = runProbe.GetTotal();
+
+        VolumeCacheStatistics endStatistics = GetVolumeCacheStatistics();
+        m_CacheStatistics = endStatistics;
+        m_CacheStatistics.numHits -= startStatistics.numHits;
+        m_CacheStatistics.numMisses -= startStatistics.numMisses;
+        m_CacheStatistics.numEvictions -= startStatistics.numEvictions;
+        m_CacheStatistics.numInvalidations -= startStatistics.numInvalidations;
+        SetVolumeCacheMemoryBudget(previousCacheBudget);
+    }
+
+    const vector<BatchPatientResult>& SEEGBatchAnalysis::GetResults() {
+        return m_Results;
+    }
+
+    double SEEGBatchAnalysis::GetElapsedTime() {
+        return m_ElapsedTime;
+    }
+
+    double SEEGBatchAnalysis::GetPrefetchStallTime() {
+        return m_PrefetchStallTime;
+    }
+
+    bool SEEGBatchAnalysis::WriteReport(const string& filename, const char delimiter) {
+        ofstream file(filename.c_str());
+        if (!file.is_open()) {
+            cerr << "Cannot write batch report " << filename << std::endl;
+            return false;
+        }
+        file << "[fileType]" << delimiter << "BatchAnalysis" << std::endl;
+        file << "[baseDir]" << delimiter << m_BaseDir << std::endl;
+        file << "[settings]" << delimiter << m_NumberOfWorkers << delimiter << (m_UseTemplateSpace ? "Template" : "T1")
+             << delimiter << m_UseCylinder << delimiter << m_UsePerContactLabels << delimiter << m_PrefetchDepth << delimiter << m_PrefetchMemoryBudget << std::endl;
+
+        int numDone = 0;
+        double sumPatientTimes = 0;
+        double sumPrefetchTimes = 0;
+        double hiddenReadTime = 0;
+        for (unsigned int iPatient=0; iPatient<m_Results.size(); iPatient++) {
+            const BatchPatientResult& result = m_Results[iPatient];
+            file << "[patient]" << delimiter;
+            file << result.m_PatientName << delimiter;
+            file << (result.m_Done ? "Done" : "Failed") << delimiter;
+            file << result.m_Worker << delimiter;
+            file << result.m_NumElectrodes << delimiter;
+            file << result.m_NumContacts << delimiter;
+            file << result.m_NumChannels << delimiter;
+            file << result.m_LoadTime << delimiter;
+            file << result.m_LabelTime << delimiter;
+            file << result.m_SaveTime << delimiter;
+            file << result.m_TotalTime << delimiter;
+            file << result.m_Prefetched << delimiter;
+            file << result.m_PrefetchTime << delimiter;
+            file << result.m_PrefetchWaitTime << delimiter;
+            file << result.m_Error << std::endl;
+            numDone += result.m_Done ? 1 : 0;
+            sumPatientTimes += result.m_TotalTime;
+            sumPrefetchTimes += result.m_PrefetchTime;
+            hiddenReadTime += GetHiddenReadTime(result);
+        }
+        file << "[summary]" << delimiter << m_Results.size() << delimiter << numDone << delimiter << m_Results.size() - numDone
+             << delimiter << m_ElapsedTime << delimiter << sumPatientTimes << delimiter << sumPrefetchTimes
+             << delimiter << hiddenReadTime << delimiter << m_PrefetchStallTime << delimiter << m_CacheStatistics.numHits
+             << delimiter << m_CacheStatistics.numMisses << delimiter << m_CacheStatistics.numEvictions << std::endl;
+        file << "[order]" << delimiter << "PatientName" << delimiter << "status" << delimiter << "worker" << delimiter << "electrodes"
+             << delimiter << "contacts" << delimiter << "channels" << delimiter << "loadTime" << delimiter << "labelTime"
+             << delimiter << "saveTime" << delimiter << "totalTime" << delimiter << "prefetched" << delimiter << "prefetchTime"
+             << delimiter << "prefetchWaitTime" << delimiter << "error" << std::endl;
+        file << "[orderSummary]" << delimiter << "patients" << delimiter << "done" << delimiter << "failed" << delimiter
+             << "elapsedTime" << delimiter << "sumPatientTimes" << delimiter << "sumPrefetchTimes" << delimiter << "hiddenReadTime"
+             << delimiter << "prefetchStallTime" << delimiter << "cacheHits" << delimiter << "cacheMisses" << delimiter << "cacheEvictions" << std::endl;
+        file.close();
+        return true;
+    }
+
+    void SEEGBatchAnalysis::PrintSummary(ostream& os) {
+        int numDone = 0;
+        double sumPatientTimes = 0;
+        double sumLoadTimes = 0, sumLabelTimes = 0, sumSaveTimes = 0;
+        int numPrefetched = 0;
+        double sumPrefetchTimes = 0;
+        double hiddenReadTime = 0;
+        for (unsigned int iPatient=0; iPatient<m_Results.size(); iPatient++) {
+            const BatchPatientResult& result = m_Results[iPatient];
+            numDone += result.m_Done ? 1 : 0;
+            sumPatientTimes += result.m_TotalTime;
+            sumLoadTimes += result.m_LoadTime;
+            sumLabelTimes += result.m_LabelTime;
+            sumSaveTimes += result.m_SaveTime;
+            numPrefetched += result.m_Prefetched ? 1 : 0;
+            sumPrefetchTimes += result.m_PrefetchTime;
+            hiddenReadTime += GetHiddenReadTime(result);
+        }
+        os << "Batch analysis: " << m_Results.size() << " patients - " << numDone << " done - " << m_Results.size() - numDone << " failed" << std::endl;
+        os << "Elapsed time: " << m_ElapsedTime << " s - sum of patient times: " << sumPatientTimes << " s";
+        if (m_ElapsedTime > 0) {
+            os << " (x" << sumPatientTimes / m_ElapsedTime << " with " << min(m_NumberOfWorkers, (unsigned int) m_Results.size()) << " workers)";
+        }
+        os << std::endl;
+        os << "Stages (sum over patients): load " << sumLoadTimes << " s - label " << sumLabelTimes << " s - save " << sumSaveTimes << " s" << std::endl;
+        if (m_PrefetchDepth > 0) {
+            os << "Prefetch (" << m_PrefetchDepth << " patients ahead, " << m_PrefetchMemoryBudget / (1024 * 1024) << " MB): "
+               << numPrefetched << " atlases read ahead in " << sumPrefetchTimes << " s, " << hiddenReadTime
+               << " s of reading overlapped with the workers - stalled " << m_PrefetchStallTime << " s" << std::endl;
+            os << "Volume cache: " << m_CacheStatistics.numHits << " hits - " << m_CacheStatistics.numMisses << " misses - "
+               << m_CacheStatistics.numEvictions << " evictions" << std::endl;
+        }
+        for (unsigned int iPatient=0; iPatient<m_Results.size(); iPatient++) {
+            if (!m_Results[iPatient].m_Done) {
+                os << "  Failed: " << m_Results[iPatient].m_PatientName << " - " << m_Results[iPatient].m_Error << std::endl;
+            }
+        }
+    }
+
+
+    /**** PRIVATE FUNCTIONS ****/
+
+    void SEEGBatchAnalysis::RunWorker(unsigned int iWorker) {
+        for (unsigned int iPatient = m_NextPatient++; iPatient < m_Results.size(); iPatient = m_NextPatient++) {
+            BatchPatientResult& result = m_Results[iPatient];
+            result.m_Worker = iWorker;
+            itk::TimeProbe totalProbe;
+            totalProbe.Start();
+            try {
+                ProcessPatient(iPatient);
+            } catch (std::exception& excep) { // one patient must not stop the batch
+                result.m_Done = false;
+                result.m_Error = string("Exception: ") + excep.what();
+            }
+            totalProbe.Stop();
+            result.m_TotalTime = totalProbe.GetTotal();
+
+            stringstream ssMessage;
+            if (result.m_Done) {
+                ssMessage << "Done in " << result.m_TotalTime << " s (" << result.m_NumElectrodes << " electrodes)";
+            } else {
+                ssMessage << "FAILED after " << result.m_TotalTime << " s - " << result.m_Error;
+            }
+            Log(result.m_PatientName, ssMessage.str());
+        }
+    }
+
+    void SEEGBatchAnalysis::RunPrefetch() {
+        unsigned long long atlasBytes = 0; // size of the last atlas read (the next one is assumed to be the same)
+        for (unsigned int iPatient=0; iPatient<m_Results.size(); iPatient++) {
+            {
+                std::unique_lock<std::mutex> lock(m_PrefetchMutex);
+                itk::TimeProbe stallProbe;
+                stallProbe.Start();
+                m_PrefetchCondition.wait(lock, [&]() {
+                    return m_StopPrefetch || m_PrefetchStates[iPatient] != PREFETCH_NONE ||
+                           (iPatient < m_NextPatient + m_PrefetchDepth &&
+                            GetVolumeCacheStatistics().memoryUsed + atlasBytes <= m_PrefetchMemoryBudget);
+                });
+                stallProbe.Stop();
+                m_PrefetchStallTime += stallProbe.GetTotal();
+                if (m_StopPrefetch) {
+                    return;
+                }
+                if (m_PrefetchStates[iPatient] != PREFETCH_NONE) {
+                    continue; // already taken by a worker
+                }
+                m_PrefetchStates[iPatient] = PREFETCH_READING;
+            }
+
+            itk::TimeProbe readProbe;
+            readProbe.Start();
+            FloatVolume::Pointer anatLabelsVol = OpenCachedFloatVolume(GetAtlasFile(m_Results[iPatient]));
+            readProbe.Stop();
+            {
+                std::lock_guard<std::mutex> lock(m_PrefetchMutex);
+                m_Results[iPatient].m_PrefetchTime = readProbe.GetTotal();
+                m_PrefetchStates[iPatient] = PREFETCH_DONE;
+                if (anatLabelsVol) {
+                    atlasBytes = anatLabelsVol->GetBufferedRegion().GetNumberOfPixels() * sizeof(FloatVolume::PixelType);
+                }
+            }
+            m_PrefetchCondition.notify_all();
+        }
+    }
+
+    void SEEGBatchAnalysis::ProcessPatient(unsigned int iPatient) {
+        BatchPatientResult& result = m_Results[iPatient];
+        Log(result.m_PatientName, "Processing " + result.m_PatientDir);
+
+        //1. Load atlas, atlas labels and electrodes
+        itk::TimeProbe loadProbe;
+        loadProbe.Start();
+        FloatVolume::Pointer anatLabelsVol = OpenAtlas(iPatient);
+        if (anatLabelsVol.IsNull()) {
+            result.m_Error = "Cannot read atlas " + GetAtlasFile(result);
+            return;
+        }
+        map<int, string> atlasLabels;
+        string atlasLabelsFile = result.m_PatientDir + "/" + FILE_ATLAS_LABELS;
+        if (!ReadAtlasLabelsFile(atlasLabelsFile, atlasLabels)) {
+            Log(result.m_PatientName, "Cannot read atlas labels " + atlasLabelsFile + " - label numbers are used instead");
+        }
+        string electrodesDir = result.m_PatientDir + "/" + DIR_BATCH_ELECTRODES;
+        SEEGElectrodesCohort::Pointer cohort = SEEGElectrodesCohort::New(SEEGElectrodeModel::New(), COHORT_SPACING_RESOLUTION);
+        LoadElectrodes(result.m_PatientName, electrodesDir, cohort);
+        loadProbe.Stop();
+        result.m_LoadTime = loadProbe.GetTotal();
+
+        const map<string, ElectrodeInfo::Pointer>& electrodes = cohort->GetBestCohort();
+        result.m_NumElectrodes = electrodes.size();
+        if (electrodes.empty()) {
+            result.m_Error = "No electrode in " + electrodesDir;
+            return;
+        }
+
+        //2. Anatomical location of channels and contacts
+        itk::TimeProbe labelProbe;
+        labelProbe.Start();
+        map<string, ElectrodeInfo::Pointer>::const_iterator elecIt;
+        for (elecIt = electrodes.begin(); elecIt != electrodes.end(); elecIt++) {
+            LabelElectrode(elecIt->second, anatLabelsVol, atlasLabels);
+            result.m_NumContacts += elecIt->second->GetNumberOfContacts();
+            result.m_NumChannels += elecIt->second->GetNumberOfChannels();
+        }
+        labelProbe.Stop();
+        result.m_LabelTime = labelProbe.GetTotal();
+
+        //3. Save all electrodes' information
+        itk::TimeProbe saveProbe;
+        saveProbe.Start();
+        string anatomicalInfoDir = electrodesDir + "/" + DIR_BATCH_ANAT_LOCATION;
+        if (!QDir().mkpath(QString::fromStdString(anatomicalInfoDir))) {
+            result.m_Error = "Cannot create directory " + anatomicalInfoDir;
+            return;
+        }
+        cohort->SaveSEEGBestCohortDataToFile(anatomicalInfoDir + "/" + FILE_RESULTS_TRAJ_BEST + FILE_POS_FIX, DELIMITER_TRAJFILE);
+        for (elecIt = electrodes.begin(); elecIt != electrodes.end(); elecIt++) {
+            string filename = anatomicalInfoDir + "/" + FILE_RESULTS_TRAJ_GRAL + elecIt->first + FILE_POS_FIX;
+            elecIt->second->SaveElectrodeDataToFile(filename, DELIMITER_TRAJFILE);
+        }
+        saveProbe.Stop();
+        result.m_SaveTime = saveProbe.GetTotal();
+        result.m_Done = true;
+    }
+
+    void SEEGBatchAnalysis::LoadElectrodes(const string& patientName, const string& electrodesDir, SEEGElectrodesCohort::Pointer cohort) {
+        QDir dir(QString::fromStdString(electrodesDir));
+        dir.setNameFilters(QStringList() << "*.csv");
+        QFileInfoList filesList = dir.entryInfoList(QDir::Files, QDir::Type);
+        for (int iElec=0; iElec<filesList.size(); iElec++) {
+            string filename = filesList[iElec].absoluteFilePath().toStdString();
+            ElectrodeInfo::Pointer electrode = ElectrodeInfo::New();
+            bool status = electrode->LoadElectrodeDataFromFile(filename, DELIMITER_TRAJFILE, m_ElectrodeModelList);
+            if (status == false) {
+                status = electrode->LoadElectrodeDataFromFile(filename, DELIMITER_TRAJFILE_2OPTION, m_ElectrodeModelList);
+            }
+            if (status == false) {
+                Log(patientName, "Cannot load electrode file " + filename + " (unknown format or electrode type)");
+                continue;
+            }
+            cohort->AddTrajectoryToBestCohort(electrode->GetElectrodeName(), electrode, iElec);
+            cohort->SetElectrodeModel(electrode->GetElectrodeModel());
+        }
+    }
+
+    void SEEGBatchAnalysis::LabelElectrode(ElectrodeInfo::Pointer electrode, FloatVolume::Pointer anatLabelsVol, map<int, string>& atlasLabels) {
+        SEEGContactsROIPipeline::Pointer pipelineContacts = SEEGContactsROIPipeline::New(anatLabelsVol, electrode->GetElectrodeModel());
+        vector<LabelHistogram> contactHistograms, channelHistograms;
+        if (m_UsePerContactLabels) {
+            pipelineContacts->CalcElectrodeLabelHistogramsPerContact(electrode, anatLabelsVol, m_UseCylinder, contactHistograms, channelHistograms);
+        } else {
+            pipelineContacts->CalcElectrodeLabelHistograms(electrode, anatLabelsVol, m_UseCylinder, contactHistograms, channelHistograms);
+        }
+
+        for (unsigned int iChannel=0; iChannel<channelHistograms.size(); iChannel++) {
+            float proba;
+            int label = SEEGContactsROIPipeline::FindMostCommonLabel(channelHistograms[iChannel], true, proba);
+            if (!isnan(proba)) {
+                electrode->GetOneChannel(iChannel)->SetChannelLocation(GetLabelName(atlasLabels, label), label, proba);
+            }
+        }
+        for (unsigned int iContact=0; iContact<contactHistograms.size(); iContact++) {
+            float proba;
+            int label = SEEGContactsROIPipeline::FindMostCommonLabel(contactHistograms[iContact], false, proba);
+            if (!isnan(proba)) {
+                electrode->GetOneContact(iContact)->SetContactLocation(GetLabelName(atlasLabels, label), label, proba);
+            }
+        }
+    }
+
+    FloatVolume::Pointer SEEGBatchAnalysis::OpenAtlas(unsigned int iPatient) {
+        BatchPatientResult& result = m_Results[iPatient];
+        bool isPrefetchDone = false;
+        if (m_PrefetchDepth > 0) {
+            std::unique_lock<std::mutex> lock(m_PrefetchMutex);
+            itk::TimeProbe waitProbe;
+            waitProbe.Start();
+            m_PrefetchCondition.wait(lock, [&]() { return m_PrefetchStates[iPatient] != PREFETCH_READING; });
+            waitProbe.Stop();
+            result.m_PrefetchWaitTime = waitProbe.GetTotal();
+            isPrefetchDone = (m_PrefetchStates[iPatient] == PREFETCH_DONE);
+            m_PrefetchStates[iPatient] = PREFETCH_TAKEN;
+        }
+        m_PrefetchCondition.notify_all(); // one patient less ahead of the prefetch
+
+        string atlasFile = GetAtlasFile(result);
+        bool isCacheHit = false;
+        FloatVolume::Pointer anatLabelsVol = OpenCachedFloatVolume(atlasFile, &isCacheHit);
+        result.m_Prefetched = isPrefetchDone && isCacheHit; // the prefetched atlas may have been evicted meanwhile
+        RemoveCachedFloatVolume(atlasFile); // not opened again: leave its memory to the next patients
+        {
+            // the prefetch waits on the memory used by the cache: changing it between the prefetch's check
+            // and its wait would lose this notification
+            std::lock_guard<std::mutex> lock(m_PrefetchMutex);
+        }
+        m_PrefetchCondition.notify_all();
+        return anatLabelsVol;
+    }
+
+    string SEEGBatchAnalysis::GetAtlasFile(const BatchPatientResult& result) {
+        return result.m_PatientDir + "/" + (m_UseTemplateSpace ? FILE_TAL_ANATOMICAL_REGIONS : FILE_PRE_ANATOMICAL_REGIONS);
+    }
+
+    double SEEGBatchAnalysis::GetHiddenReadTime(const BatchPatientResult& result) {
+        if (!result.m_Prefetched) {
+            return 0;
+        }
+        return max(0.0, result.m_PrefetchTime - result.m_PrefetchWaitTime);
+    }
+
+    string SEEGBatchAnalysis::GetLabelName(map<int, string>& atlasLabels, int label) {
+        if (atlasLabels.size() > 0) {
+            return atlasLabels[label];
+        }
+        stringstream ssLabel;
+        ssLabel << label;
+        return ssLabel.str();
+    }
+
+    void SEEGBatchAnalysis::Log(const string& patientName, const string& message) {
+        std::lock_guard<std::mutex> lock(m_LogMutex);
+        cout << "[" << patientName << "] " << message << std::endl;
+    }
+}
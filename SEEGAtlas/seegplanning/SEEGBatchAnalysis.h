@@ -0,0 +1,227 @@
+#ifndef __SEEG_BATCH_ANALYSIS_H__
+#define __SEEG_BATCH_ANALYSIS_H__
+
+/**
+ * @file SEEGBatchAnalysis.h
+ *
+ * Defines the SEEGBatchAnalysis class: anatomical location of the contacts and channels of the
+ * electrodes of many patients (same processing as SEEGAtlasWidget::onRunBatchAnalysis()), without
+ * the GUI and with several patients processed at the same time.
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <vector>
+#include <string>
+#include <map>
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "BasicTypes.h"
+#include "VolumeTypes.h"
+#include "SEEGElectrodeModel.h"
+#include "SEEGElectrodesCohort.h"
+#include "SEEGFileHelper.h"
+
+using namespace std;
+
+namespace seeg {
+
+    /**
+     * Outcome of one patient of the batch. Times are in seconds.
+     */
+    struct BatchPatientResult {
+        string m_PatientName;
+        string m_PatientDir;
+
+        /** true if the results were saved, otherwise m_Error says why */
+        bool m_Done;
+        string m_Error;
+
+        /** Worker that processed the patient */
+        int m_Worker;
+
+        int m_NumElectrodes;
+        int m_NumContacts;
+        int m_NumChannels;
+
+        double m_LoadTime;      // atlas, atlas labels and electrodes
+        double m_LabelTime;     // contacts and channels
+        double m_SaveTime;
+        double m_TotalTime;
+
+        /** true if the atlas read by the prefetch was still in the cache when the patient was started */
+        bool m_Prefetched;
+        double m_PrefetchTime;      // atlas read by the prefetch thread (not part of m_TotalTime)
+        double m_PrefetchWaitTime;  // wait for the prefetch to finish reading the atlas (part of m_LoadTime)
+    };
+
+    /**
+     * Patients are the subdirectories of the base directory listed in FILE_PATIENT_NAMES (one per line).
+     * For each patient:
+     * - the atlas (FILE_TAL_ANATOMICAL_REGIONS or FILE_PRE_ANATOMICAL_REGIONS) and its labels (FILE_ATLAS_LABELS)
+     *   are read from the patient's directory
+     * - the electrodes are read from the *.csv files of DIR_BATCH_ELECTRODES
+     * - channels and contacts get their most common label (see SEEGContactsROIPipeline::FindMostCommonLabel())
+     * - the electrodes are saved in DIR_BATCH_ANAT_LOCATION, as SEEGAtlasWidget::onSavePlanningToDirectory() does
+     *
+     * Patients are processed by a fixed number of workers, each one taking the next patient of the list
+     * when it is done with the previous one. Nothing is shared between patients except the electrode models
+     * (only read), so the results do not depend on the number of workers. Volumes are read one at a time
+     * (the MINC reader is not thread-safe).
+     *
+     * While the workers label their patients, a prefetch thread reads the atlas of the next patients into
+     * the volume cache (see OpenCachedFloatVolume()), in the order of the list. It stays at most
+     * prefetchDepth patients ahead of the workers and only reads when the cache has room for one more atlas
+     * within the prefetch memory budget: a worker removes its atlas from the cache when it takes it, which
+     * lets the prefetch go on. A patient taken before its atlas was read reads it itself.
+     */
+    class SEEGBatchAnalysis {
+
+    public:
+        /** SmartPointer type for the SEEGBatchAnalysis class */
+        typedef mrilSmartPtr<SEEGBatchAnalysis> Pointer;
+
+        /**
+         * @param baseDir directory of FILE_PATIENT_NAMES and of the patients' subdirectories
+         * @param electrodeModelList models the electrodes' files can refer to (see ElectrodeInfo::LoadElectrodeDataFromFile())
+         */
+        static Pointer New(const string& baseDir, const vector<SEEGElectrodeModel::Pointer>& electrodeModelList) {
+            return Pointer(new SEEGBatchAnalysis(baseDir, electrodeModelList));
+        }
+
+    protected:
+        SEEGBatchAnalysis(const string& baseDir, const vector<SEEGElectrodeModel::Pointer>& electrodeModelList);
+
+    public:
+        virtual ~SEEGBatchAnalysis();
+
+        /** Number of patients processed at the same time (default: number of cores) */
+        void SetNumberOfWorkers(unsigned int numWorkers);
+        unsigned int GetNumberOfWorkers();
+
+        /** Use cylinder (default) or central point as model of the contact/channel */
+        void SetUseCylinder(bool useCylinder);
+        bool GetUseCylinder();
+
+        /**
+         * Labels each contact/channel with its own volume (SEEGContactsROIPipeline::CalcElectrodeLabelHistogramsPerContact())
+         * instead of one walk over the atlas per electrode (default: false, same counts but slower)
+         */
+        void SetUsePerContactLabels(bool usePerContactLabels);
+        bool GetUsePerContactLabels();
+
+        /** Atlas of the template (default, electrodes in TAL space) or of the pre-implantation space */
+        void SetUseTemplateSpace(bool useTemplateSpace);
+        bool GetUseTemplateSpace();
+
+        /** Number of patients whose atlas is read ahead of the workers (default: 2, 0 disables the prefetch) */
+        void SetPrefetchDepth(unsigned int prefetchDepth);
+        unsigned int GetPrefetchDepth();
+
+        /**
+         * Memory of the prefetched atlases (bytes, default: 1GB), used as budget of the volume cache during Run().
+         * Must hold at least one atlas, otherwise nothing is prefetched.
+         */
+        void SetPrefetchMemoryBudget(unsigned long long numBytes);
+        unsigned long long GetPrefetchMemoryBudget();
+
+        /**
+         * Reads the list of patients from baseDir/FILE_PATIENT_NAMES (stops at the first empty line, as
+         * SEEGAtlasWidget::onRunBatchAnalysis())
+         *
+         * @return false if the file cannot be read
+         */
+        bool ReadPatientNames();
+        const vector<string>& GetPatientNames();
+
+        /** Processes all the patients, returns when all of them are done */
+        void Run();
+
+        /** Results of the last Run(), in the order of the list of patients */
+        const vector<BatchPatientResult>& GetResults();
+
+        /** Wall-clock time of the last Run() (seconds) */
+        double GetElapsedTime();
+
+        /** Time the prefetch thread waited for the workers or for room in the budget during the last Run() (seconds) */
+        double GetPrefetchStallTime();
+
+        /**
+         * Writes one line per patient (status, numbers and times) and a summary line
+         *
+         * @return false if the file cannot be written
+         */
+        bool WriteReport(const string& filename, const char delimiter);
+
+        /** Prints the summary of the last Run() */
+        void PrintSummary(ostream& os);
+
+    private:
+        /** State of the atlas of a patient for the prefetch */
+        enum PrefetchState { PREFETCH_NONE, PREFETCH_READING, PREFETCH_DONE, PREFETCH_TAKEN };
+
+        /** Processes patients until there are none left */
+        void RunWorker(unsigned int iWorker);
+
+        /** Reads the atlas of the patients into the volume cache ahead of the workers */
+        void RunPrefetch();
+
+        void ProcessPatient(unsigned int iPatient);
+
+        /** Atlas of the patient, from the prefetch or read */
+        FloatVolume::Pointer OpenAtlas(unsigned int iPatient);
+
+        string GetAtlasFile(const BatchPatientResult& result);
+
+        /** Time of the prefetch read of the atlas that the worker did not wait for */
+        static double GetHiddenReadTime(const BatchPatientResult& result);
+
+        /**
+         * Reads the electrodes' files of a directory into the cohort (index of an electrode in the cohort
+         * is the one of its file, as in SEEGAtlasWidget::onRunBatchAnalysis())
+         */
+        void LoadElectrodes(const string& patientName, const string& electrodesDir, SEEGElectrodesCohort::Pointer cohort);
+
+        /** Labels all contacts and channels of the electrode */
+        void LabelElectrode(ElectrodeInfo::Pointer electrode, FloatVolume::Pointer anatLabelsVol, map<int, string>& atlasLabels);
+
+        /** Name of a label (its number if there are no atlas labels) */
+        static string GetLabelName(map<int, string>& atlasLabels, int label);
+
+        /** Writes a line of the log (lines of different workers are not mixed) */
+        void Log(const string& patientName, const string& message);
+
+        string m_BaseDir;
+        vector<SEEGElectrodeModel::Pointer> m_ElectrodeModelList;
+        unsigned int m_NumberOfWorkers;
+        bool m_UseCylinder;
+        bool m_UsePerContactLabels;
+        bool m_UseTemplateSpace;
+        unsigned int m_PrefetchDepth;
+        unsigned long long m_PrefetchMemoryBudget;
+
+        vector<string> m_PatientNames;
+        vector<BatchPatientResult> m_Results;
+        double m_ElapsedTime;
+        double m_PrefetchStallTime;
+
+        /** Volume cache counters at the end of the last Run() minus the ones at its start */
+        VolumeCacheStatistics m_CacheStatistics;
+
+        /** Index of the next patient to process */
+        std::atomic<unsigned int> m_NextPatient;
+
+        /** Prefetch state of each patient, m_StopPrefetch: workers are done (protected by m_PrefetchMutex) */
+        vector<PrefetchState> m_PrefetchStates;
+        bool m_StopPrefetch;
+        std::mutex m_PrefetchMutex;
+        std::condition_variable m_PrefetchCondition;
+
+        std::mutex m_LogMutex;
+    };
+}
+
+#endif
@@ -0,0 +1,284 @@
+/**
+ * @file SEEGBrickOccupancy.cpp
+ *
+ * Implementation of the SEEGBrickOccupancy class
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include "SEEGBrickOccupancy.h"
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+namespace seeg {
+
+    /**** CONSTRUCTORS / DESTRUCTOR ****/
+
+    SEEGBrickOccupancy::SEEGBrickOccupancy(IntVolume::Pointer vol) {
+        Build<IntVolume>(vol);
+    }
+
+    SEEGBrickOccupancy::SEEGBrickOccupancy(FloatVolume::Pointer vol) {
+        Build<FloatVolume>(vol);
+    }
+
+    SEEGBrickOccupancy::~SEEGBrickOccupancy() {
+        // Do nothing
+    }
+
+
+    /**** PUBLIC FUNCTIONS ****/
+
+    float SEEGBrickOccupancy::GetMaxValueNearSegment(const Point3D& p1, const Point3D& p2, float maxDist) {
+        const BrickLevel& coarseLevel = m_Levels[1];
+        const BrickLevel& fineLevel = m_Levels[0];
+        unsigned int firstBrick[3], lastBrick[3];
+        GetBrickRange(coarseLevel, p1, p2, maxDist, firstBrick, lastBrick);
+
+        float maxValue = -FLT_MAX;
+        double projection;
+        for (unsigned int bz=firstBrick[2]; bz<=lastBrick[2]; bz++) {
+            for (unsigned int by=firstBrick[1]; by<=lastBrick[1]; by++) {
+                for (unsigned int bx=firstBrick[0]; bx<=lastBrick[0]; bx++) {
+                    unsigned int coarseBrick = (bz * coarseLevel.m_NumBricks[1] + by) * coarseLevel.m_NumBricks[0] + bx;
+                    if (coarseLevel.m_MaxValues[coarseBrick] <= maxValue ||
+                        CalcDistanceToSegment(GetBrickCenter(coarseLevel, bx, by, bz), p1, p2, projection) > maxDist + coarseLevel.m_BrickRadius) {
+                        continue; // cannot raise the bound / too far
+                    }
+                    // the fine bricks of the coarse brick
+                    for (unsigned int fz=2*bz; fz<2*bz+2 && fz<fineLevel.m_NumBricks[2]; fz++) {
+                        for (unsigned int fy=2*by; fy<2*by+2 && fy<fineLevel.m_NumBricks[1]; fy++) {
+                            for (unsigned int fx=2*bx; fx<2*bx+2 && fx<fineLevel.m_NumBricks[0]; fx++) {
+                                unsigned int fineBrick = (fz * fineLevel.m_NumBricks[1] + fy) * fineLevel.m_NumBricks[0] + fx;
+                                if (fineLevel.m_MaxValues[fineBrick] > maxValue &&
+                                    CalcDistanceToSegment(GetBrickCenter(fineLevel, fx, fy, fz), p1, p2, projection) <= maxDist + fineLevel.m_BrickRadius) {
+                                    maxValue = fineLevel.m_MaxValues[fineBrick];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return maxValue;
+    }
+
+    bool SEEGBrickOccupancy::IsSegmentFartherThan(const Point3D& p1, const Point3D& p2, float maxDist) {
+        return GetMaxValueNearSegment(p1, p2, maxDist) <= 0;
+    }
+
+    bool SEEGBrickOccupancy::HasValueCloserThan(const Point3D& p1, const Point3D& p2, float maxDist, float minValue) {
+        double length = sqrt((p2[0]-p1[0])*(p2[0]-p1[0]) + (p2[1]-p1[1])*(p2[1]-p1[1]) + (p2[2]-p1[2])*(p2[2]-p1[2]));
+        if (length <= 2 * m_HalfVoxelDiagonal) {
+            return false;
+        }
+
+        // a brick has a voxel center within m_HalfVoxelDiagonal of its center: if all its voxels are above
+        // minValue and its center is close enough to the segment, that voxel is closer than maxDist
+        for (int iLevel=1; iLevel>=0; iLevel--) {
+            const BrickLevel& level = m_Levels[iLevel];
+            unsigned int firstBrick[3], lastBrick[3];
+            GetBrickRange(level, p1, p2, maxDist, firstBrick, lastBrick);
+            for (unsigned int bz=firstBrick[2]; bz<=lastBrick[2]; bz++) {
+                for (unsigned int by=firstBrick[1]; by<=lastBrick[1]; by++) {
+                    for (unsigned int bx=firstBrick[0]; bx<=lastBrick[0]; bx++) {
+                        unsigned int brick = (bz * level.m_NumBricks[1] + by) * level.m_NumBricks[0] + bx;
+                        if (level.m_MinValues[brick] < minValue) {
+                            continue;
+                        }
+                        double projection;
+                        double dist = CalcDistanceToSegment(GetBrickCenter(level, bx, by, bz), p1, p2, projection);
+                        if (dist + m_HalfVoxelDiagonal < maxDist &&
+                            projection > m_HalfVoxelDiagonal && projection < length - m_HalfVoxelDiagonal) {
+                            return true;
+                        }
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    float SEEGBrickOccupancy::GetEmptyBrickFraction() {
+        const BrickLevel& fineLevel = m_Levels[0];
+        if (fineLevel.m_MaxValues.empty()) {
+            return 1;
+        }
+        unsigned int numEmpty = 0;
+        for (unsigned int i=0; i<fineLevel.m_MaxValues.size(); i++) {
+            if (fineLevel.m_MaxValues[i] <= 0) {
+                numEmpty++;
+            }
+        }
+        return (float) numEmpty / fineLevel.m_MaxValues.size();
+    }
+
+    const void* SEEGBrickOccupancy::GetVolume() {
+        return m_Volume;
+    }
+
+
+    /**** PRIVATE FUNCTIONS ****/
+
+    template <class VolumeType>
+    void SEEGBrickOccupancy::Build(typename VolumeType::Pointer vol) {
+        typedef typename VolumeType::PixelType PixelType;
+        m_Volume = vol.GetPointer();
+
+        // geometry: local index (from the start of the buffered region) -> world
+        typename VolumeType::RegionType region = vol->GetBufferedRegion();
+        typename VolumeType::SpacingType spacing = vol->GetSpacing();
+        typename VolumeType::DirectionType direction = vol->GetDirection();
+        typename VolumeType::PointType origin;
+        vol->TransformIndexToPhysicalPoint(region.GetIndex(), origin);
+        double halfDiagonal = 0;
+        for (int i=0; i<3; i++) {
+            m_Size[i] = region.GetSize()[i];
+            m_Origin[i] = origin[i];
+            for (int j=0; j<3; j++) {
+                m_IndexToWorld[i][j] = direction[i][j] * spacing[j];
+                m_WorldToIndex[j][i] = direction[i][j] / spacing[j]; // direction is orthonormal
+            }
+            halfDiagonal += spacing[i] * spacing[i];
+        }
+        m_HalfVoxelDiagonal = 0.5 * sqrt(halfDiagonal);
+
+        BrickLevel& fineLevel = m_Levels[0];
+        fineLevel.m_BrickSize = BRICK_SIZE;
+        unsigned int numBricks = 1;
+        double brickDiagonal = 0;
+        for (int i=0; i<3; i++) {
+            fineLevel.m_NumBricks[i] = (m_Size[i] + BRICK_SIZE - 1) / BRICK_SIZE;
+            numBricks *= fineLevel.m_NumBricks[i];
+            brickDiagonal += (BRICK_SIZE - 1) * spacing[i] * (BRICK_SIZE - 1) * spacing[i];
+        }
+        fineLevel.m_BrickRadius = 0.5 * sqrt(brickDiagonal);
+        fineLevel.m_MinValues.assign(numBricks, FLT_MAX);
+        fineLevel.m_MaxValues.assign(numBricks, -FLT_MAX);
+
+        // one pass over the voxels, in memory order
+        const PixelType* buffer = vol->GetBufferPointer();
+        for (unsigned int z=0; z<m_Size[2]; z++) {
+            for (unsigned int y=0; y<m_Size[1]; y++) {
+                const PixelType* row = buffer + ((unsigned long long) z * m_Size[1] + y) * m_Size[0];
+                unsigned int brickRowStart = ((z / BRICK_SIZE) * fineLevel.m_NumBricks[1] + y / BRICK_SIZE) * fineLevel.m_NumBricks[0];
+                for (unsigned int x0=0; x0<m_Size[0]; x0+=BRICK_SIZE) {
+                    unsigned int x1 = min(x0 + BRICK_SIZE, m_Size[0]);
+                    float minValue = fineLevel.m_MinValues[brickRowStart + x0 / BRICK_SIZE];
+                    float maxValue = fineLevel.m_MaxValues[brickRowStart + x0 / BRICK_SIZE];
+                    for (unsigned int x=x0; x<x1; x++) {
+                        float value = (float) row[x];
+                        minValue = min(minValue, value);
+                        maxValue = max(maxValue, value);
+                    }
+                    fineLevel.m_MinValues[brickRowStart + x0 / BRICK_SIZE] = minValue;
+                    fineLevel.m_MaxValues[brickRowStart + x0 / BRICK_SIZE] = maxValue;
+                }
+            }
+        }
+
+        BuildCoarseLevel();
+    }
+
+    void SEEGBrickOccupancy::BuildCoarseLevel() {
+        const BrickLevel& fineLevel = m_Levels[0];
+        BrickLevel& coarseLevel = m_Levels[1];
+        coarseLevel.m_BrickSize = 2 * fineLevel.m_BrickSize;
+        unsigned int numBricks = 1;
+        double brickDiagonal = 0;
+        for (int i=0; i<3; i++) {
+            coarseLevel.m_NumBricks[i] = (fineLevel.m_NumBricks[i] + 1) / 2;
+            numBricks *= coarseLevel.m_NumBricks[i];
+            double extent = 0;
+            for (int j=0; j<3; j++) {
+                extent += m_IndexToWorld[j][i] * m_IndexToWorld[j][i];
+            }
+            brickDiagonal += (coarseLevel.m_BrickSize - 1) * (coarseLevel.m_BrickSize - 1) * extent; // extent: spacing^2
+        }
+        coarseLevel.m_BrickRadius = 0.5 * sqrt(brickDiagonal);
+        coarseLevel.m_MinValues.assign(numBricks, FLT_MAX);
+        coarseLevel.m_MaxValues.assign(numBricks, -FLT_MAX);
+
+        for (unsigned int fz=0; fz<fineLevel.m_NumBricks[2]; fz++) {
+            for (unsigned int fy=0; fy<fineLevel.m_NumBricks[1]; fy++) {
+                for (unsigned int fx=0; fx<fineLevel.m_NumBricks[0]; fx++) {
+                    unsigned int fineBrick = (fz * fineLevel.m_NumBricks[1] + fy) * fineLevel.m_NumBricks[0] + fx;
+                    unsigned int coarseBrick = ((fz / 2) * coarseLevel.m_NumBricks[1] + fy / 2) * coarseLevel.m_NumBricks[0] + fx / 2;
+                    coarseLevel.m_MinValues[coarseBrick] = min(coarseLevel.m_MinValues[coarseBrick], fineLevel.m_MinValues[fineBrick]);
+                    coarseLevel.m_MaxValues[coarseBrick] = max(coarseLevel.m_MaxValues[coarseBrick], fineLevel.m_MaxValues[fineBrick]);
+                }
+            }
+        }
+    }
+
+    void SEEGBrickOccupancy::GetBrickRange(const BrickLevel& level, const Point3D& p1, const Point3D& p2, float maxDist,
+                                           unsigned int firstBrick[3], unsigned int lastBrick[3]) {
+        // index bounding box of the corners of the world bounding box of the capsule
+        double worldMin[3], worldMax[3];
+        for (int i=0; i<3; i++) {
+            worldMin[i] = min(p1[i], p2[i]) - maxDist;
+            worldMax[i] = max(p1[i], p2[i]) + maxDist;
+        }
+        double indexMin[3] = { DBL_MAX, DBL_MAX, DBL_MAX };
+        double indexMax[3] = { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+        for (int corner=0; corner<8; corner++) {
+            double offset[3];
+            for (int i=0; i<3; i++) {
+                offset[i] = ((corner >> i) & 1 ? worldMax[i] : worldMin[i]) - m_Origin[i];
+            }
+            for (int i=0; i<3; i++) {
+                double index = m_WorldToIndex[i][0] * offset[0] + m_WorldToIndex[i][1] * offset[1] + m_WorldToIndex[i][2] * offset[2];
+                indexMin[i] = min(indexMin[i], index);
+                indexMax[i] = max(indexMax[i], index);
+            }
+        }
+        for (int i=0; i<3; i++) {
+            double first = max(floor(indexMin[i]), 0.0);
+            double last = min(ceil(indexMax[i]), (double) m_Size[i] - 1);
+            if (last < first) {
+                // outside of the volume: empty range
+                firstBrick[i] = 1;
+                lastBrick[i] = 0;
+                continue;
+            }
+            firstBrick[i] = (unsigned int) first / level.m_BrickSize;
+            lastBrick[i] = (unsigned int) last / level.m_BrickSize;
+        }
+    }
+
+    Point3D SEEGBrickOccupancy::GetBrickCenter(const BrickLevel& level, unsigned int bx, unsigned int by, unsigned int bz) {
+        unsigned int brick[3] = { bx, by, bz };
+        double index[3];
+        for (int i=0; i<3; i++) {
+            unsigned int first = brick[i] * level.m_BrickSize;
+            unsigned int last = min(first + level.m_BrickSize, m_Size[i]) - 1;
+            index[i] = 0.5 * (first + last);
+        }
+        Point3D center;
+        for (int i=0; i<3; i++) {
+            center[i] = m_Origin[i] + m_IndexToWorld[i][0] * index[0] + m_IndexToWorld[i][1] * index[1] + m_IndexToWorld[i][2] * index[2];
+        }
+        return center;
+    }
+
+    double SEEGBrickOccupancy::CalcDistanceToSegment(const Point3D& point, const Point3D& p1, const Point3D& p2, double& projection) {
+        double segment[3], toPoint[3];
+        double lengthSq = 0, dot = 0;
+        for (int i=0; i<3; i++) {
+            segment[i] = p2[i] - p1[i];
+            toPoint[i] = point[i] - p1[i];
+            lengthSq += segment[i] * segment[i];
+            dot += segment[i] * toPoint[i];
+        }
+        double t = (lengthSq > 0) ? max(0.0, min(1.0, dot / lengthSq)) : 0;
+        projection = t * sqrt(lengthSq);
+        double distSq = 0;
+        for (int i=0; i<3; i++) {
+            double d = toPoint[i] - t * segment[i];
+            distSq += d * d;
+        }
+        return sqrt(distSq);
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef __SEEG_BRICK_OCCUPANCY_H__
+#define __SEEG_BRICK_OCCUPANCY_H__
+
+/**
+ * @file SEEGBrickOccupancy.h
+ *
+ * Defines the SEEGBrickOccupancy class: minimum and maximum voxel values of the bricks (8x8x8 and
+ * 16x16x16 voxels) of a volume, used to screen trajectories against sparse structures (e.g. vessels)
+ * without reading their voxels.
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <vector>
+#include "BasicTypes.h"
+#include "MathUtils.h"
+#include "VolumeTypes.h"
+
+using namespace std;
+
+namespace seeg {
+
+    /**
+     * Two-level brick hierarchy of a binary (IntVolume) or fuzzy (FloatVolume) volume. Each brick
+     * stores the minimum and maximum value of its voxels; a coarse brick covers 2x2x2 fine bricks.
+     * Queries are about the voxels whose center is within a distance of a segment (the capsule
+     * around the trajectory):
+     * - an upper bound of their values (0 or less: the dense test would not find any foreground voxel)
+     * - whether one of them surely has a value above a threshold (a brick where all voxels are above
+     *   the threshold is close enough to the segment)
+     *
+     * Once built, the hierarchy is read-only and can be queried from several threads.
+     */
+    class SEEGBrickOccupancy {
+
+    public:
+        /** SmartPointer type for the SEEGBrickOccupancy class */
+        typedef mrilSmartPtr<SEEGBrickOccupancy> Pointer;
+
+        /** Size (in voxels) of the fine bricks; coarse bricks are twice as large */
+        static const unsigned int BRICK_SIZE = 8;
+
+        static Pointer New(IntVolume::Pointer vol) { return Pointer(new SEEGBrickOccupancy(vol)); }
+        static Pointer New(FloatVolume::Pointer vol) { return Pointer(new SEEGBrickOccupancy(vol)); }
+
+    protected:
+        SEEGBrickOccupancy(IntVolume::Pointer vol);
+        SEEGBrickOccupancy(FloatVolume::Pointer vol);
+
+    public:
+        virtual ~SEEGBrickOccupancy();
+
+        /**
+         * Upper bound of the values of the voxels whose center is within maxDist of the segment [p1,p2]
+         *
+         * @return the bound, -FLT_MAX if no voxel can be within maxDist
+         */
+        float GetMaxValueNearSegment(const Point3D& p1, const Point3D& p2, float maxDist);
+
+        /** true only if no voxel with a value > 0 can be within maxDist of the segment [p1,p2] */
+        bool IsSegmentFartherThan(const Point3D& p1, const Point3D& p2, float maxDist);
+
+        /**
+         * true only if a voxel with a value >= minValue is surely closer than maxDist to the segment
+         * [p1,p2] (its projection falling inside the segment). false does not mean that there is none.
+         */
+        bool HasValueCloserThan(const Point3D& p1, const Point3D& p2, float maxDist, float minValue);
+
+        /** Fraction of the fine bricks where all voxels are <= 0 */
+        float GetEmptyBrickFraction();
+
+        /** Volume the bricks were computed from (IntVolume or FloatVolume) */
+        const void* GetVolume();
+
+    private:
+        /** Min / max values of the bricks of one level */
+        struct BrickLevel {
+            unsigned int m_BrickSize;
+            unsigned int m_NumBricks[3];
+            vector<float> m_MinValues;
+            vector<float> m_MaxValues;
+
+            /** Distance from the center of a brick to its farthest voxel center (in mm) */
+            float m_BrickRadius;
+        };
+
+        template <class VolumeType>
+        void Build(typename VolumeType::Pointer vol);
+
+        /** Computes the coarse level from the fine one (2x2x2 fine bricks per coarse brick) */
+        void BuildCoarseLevel();
+
+        /** Bricks of a level that can contain a voxel within maxDist of [p1,p2] */
+        void GetBrickRange(const BrickLevel& level, const Point3D& p1, const Point3D& p2, float maxDist,
+                           unsigned int firstBrick[3], unsigned int lastBrick[3]);
+
+        /** Center (world coordinates) of a brick */
+        Point3D GetBrickCenter(const BrickLevel& level, unsigned int bx, unsigned int by, unsigned int bz);
+
+        /** Distance from point to [p1,p2], with the position of its projection along the segment (in mm from p1) */
+        static double CalcDistanceToSegment(const Point3D& point, const Point3D& p1, const Point3D& p2, double& projection);
+
+        const void* m_Volume;
+
+        /** Size of the volume (voxels) */
+        unsigned int m_Size[3];
+
+        /** index -> world: m_Origin + m_IndexToWorld * index */
+        Point3D m_Origin;
+        double m_IndexToWorld[3][3];
+        double m_WorldToIndex[3][3];
+
+        /** Distance from a voxel center to a corner of the voxel (in mm) */
+        float m_HalfVoxelDiagonal;
+
+        /** Fine bricks (BRICK_SIZE) then coarse bricks (2*BRICK_SIZE) */
+        BrickLevel m_Levels[2];
+    };
+}
+
+#endif
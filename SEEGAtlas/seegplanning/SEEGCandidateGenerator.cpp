@@ -0,0 +1,330 @@
+/**
+ * @file SEEGCandidateGenerator.cpp
+ *
+ * Implementation of the SEEGCandidateGenerator class
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include "SEEGCandidateGenerator.h"
+#include <math.h>
+#include <iostream>
+#include <map>
+#include <algorithm>
+
+namespace seeg {
+
+    /**** CONSTRUCTORS / DESTRUCTOR ****/
+
+    SEEGCandidateGenerator::SEEGCandidateGenerator(IntVolume::Pointer entryPointMaskVol, IntVolume::Pointer targetMaskVol) {
+        m_EntryPointMaskVol = entryPointMaskVol;
+        m_TargetMaskVol = targetMaskVol;
+        m_MaxLength = 0;
+        m_MinLength = 0;
+        m_MaxAngle = 0;
+        m_CosMaxAngle = 1;
+        m_EntryPointSpacing = 0;
+        m_RandomSeed = 1;
+        m_PointsExtracted = false;
+        m_NextEntry = 0;
+        m_NextTarget = 0;
+        m_NumPairsChecked = 0;
+        m_NumPairsRejected = 0;
+    }
+
+    SEEGCandidateGenerator::~SEEGCandidateGenerator() {
+        // Do nothing
+    }
+
+
+    /**** PUBLIC FUNCTIONS ****/
+
+    void SEEGCandidateGenerator::SetMaximumLength(double maxLength) {
+        m_MaxLength = maxLength;
+    }
+
+    double SEEGCandidateGenerator::GetMaximumLength() {
+        return m_MaxLength;
+    }
+
+    void SEEGCandidateGenerator::SetMinimumLength(double minLength) {
+        m_MinLength = minLength;
+    }
+
+    double SEEGCandidateGenerator::GetMinimumLength() {
+        return m_MinLength;
+    }
+
+    void SEEGCandidateGenerator::SetElectrodeModel(SEEGElectrodeModel::Pointer electrodeModel) {
+        m_MinLength = electrodeModel->GetElectrodeHeight();
+    }
+
+    void SEEGCandidateGenerator::SetSkullNormals(vector<FloatVolume::Pointer>& normalVols, double maxAngle) {
+        m_NormalVols = normalVols;
+        m_MaxAngle = maxAngle;
+        m_CosMaxAngle = cos(maxAngle * PI / 180.0);
+        m_PointsExtracted = false; // normals are read with the entry points
+    }
+
+    void SEEGCandidateGenerator::SetEntryPointSpacing(double spacing) {
+        m_EntryPointSpacing = spacing;
+        m_PointsExtracted = false;
+    }
+
+    double SEEGCandidateGenerator::GetEntryPointSpacing() {
+        return m_EntryPointSpacing;
+    }
+
+    void SEEGCandidateGenerator::SetRandomSeed(unsigned int seed) {
+        m_RandomSeed = seed;
+        m_PointsExtracted = false;
+    }
+
+    unsigned int SEEGCandidateGenerator::GetNumberOfEntryPoints() {
+        ExtractPoints();
+        return m_EntryCoords.size() / 3;
+    }
+
+    unsigned int SEEGCandidateGenerator::GetNumberOfTargetPoints() {
+        ExtractPoints();
+        return m_TargetCoords.size() / 3;
+    }
+
+    unsigned int SEEGCandidateGenerator::GenerateBatch(SEEGTrajectoryCandidates::Pointer candidates, unsigned int maxCandidates) {
+        ExtractPoints();
+        unsigned int numEntries = m_EntryCoords.size() / 3;
+        unsigned int numTargets = m_TargetCoords.size() / 3;
+        unsigned int numAdded = 0;
+
+        while (m_NextEntry < numEntries && numAdded < maxCandidates) {
+            Point3D worldEntryPoint;
+            worldEntryPoint[0] = m_EntryCoords[3*m_NextEntry];
+            worldEntryPoint[1] = m_EntryCoords[3*m_NextEntry+1];
+            worldEntryPoint[2] = m_EntryCoords[3*m_NextEntry+2];
+            for (; m_NextTarget < numTargets && numAdded < maxCandidates; m_NextTarget++) {
+                m_NumPairsChecked++;
+                if (!IsValidPair(m_NextEntry, m_NextTarget)) {
+                    m_NumPairsRejected++;
+                    continue;
+                }
+                Point3D worldTargetPoint;
+                worldTargetPoint[0] = m_TargetCoords[3*m_NextTarget];
+                worldTargetPoint[1] = m_TargetCoords[3*m_NextTarget+1];
+                worldTargetPoint[2] = m_TargetCoords[3*m_NextTarget+2];
+                candidates->AddCandidate(worldEntryPoint, worldTargetPoint); // aggregated scores start at -1
+                numAdded++;
+            }
+            if (m_NextTarget >= numTargets) {
+                m_NextTarget = 0;
+                m_NextEntry++;
+            }
+        }
+        return numAdded;
+    }
+
+    unsigned int SEEGCandidateGenerator::GenerateAll(SEEGTrajectoryCandidates::Pointer candidates) {
+        unsigned int numAdded = 0;
+        unsigned int numBatch;
+        do {
+            numBatch = GenerateBatch(candidates, 1 << 20);
+            numAdded += numBatch;
+        } while (numBatch > 0);
+        return numAdded;
+    }
+
+    bool SEEGCandidateGenerator::IsAtEnd() {
+        ExtractPoints();
+        return m_NextEntry >= m_EntryCoords.size() / 3;
+    }
+
+    void SEEGCandidateGenerator::Rewind() {
+        m_NextEntry = 0;
+        m_NextTarget = 0;
+        m_NumPairsChecked = 0;
+        m_NumPairsRejected = 0;
+    }
+
+    unsigned long long SEEGCandidateGenerator::GetNumberOfPairsChecked() {
+        return m_NumPairsChecked;
+    }
+
+    unsigned long long SEEGCandidateGenerator::GetNumberOfPairsRejected() {
+        return m_NumPairsRejected;
+    }
+
+
+    /**** PRIVATE FUNCTIONS ****/
+
+    void SEEGCandidateGenerator::ExtractPoints() {
+        if (m_PointsExtracted) {
+            return;
+        }
+        m_EntryCoords.clear();
+        m_EntryNormals.clear();
+        m_EntryHasNormal.clear();
+        m_TargetCoords.clear();
+
+        IntVolumeRegionConstIteratorWithIndex it (m_EntryPointMaskVol, m_EntryPointMaskVol->GetLargestPossibleRegion());
+        for (it.GoToBegin(); !it.IsAtEnd(); ++it) {
+            if (it.Get()) {
+                Point3D worldEntryPoint;
+                m_EntryPointMaskVol->TransformIndexToPhysicalPoint(it.GetIndex(), worldEntryPoint);
+                m_EntryCoords.push_back(worldEntryPoint[0]);
+                m_EntryCoords.push_back(worldEntryPoint[1]);
+                m_EntryCoords.push_back(worldEntryPoint[2]);
+
+                Vector3D_lf normal;
+                FloatVolume::IndexType normalIndex;
+                bool hasNormal = m_NormalVols.size() == 3 && m_MaxAngle > 0 &&
+                                 m_NormalVols[0]->TransformPhysicalPointToIndex(worldEntryPoint, normalIndex) &&
+                                 GetSkullNormal(normalIndex, normal);
+                m_EntryNormals.push_back(hasNormal ? normal.x : 0);
+                m_EntryNormals.push_back(hasNormal ? normal.y : 0);
+                m_EntryNormals.push_back(hasNormal ? normal.z : 0);
+                m_EntryHasNormal.push_back(hasNormal ? 1 : 0);
+            }
+        }
+
+        IntVolumeRegionConstIteratorWithIndex it2 (m_TargetMaskVol, m_TargetMaskVol->GetLargestPossibleRegion());
+        for (it2.GoToBegin(); !it2.IsAtEnd(); ++it2) {
+            if (it2.Get()) {
+                Point3D worldTargetPoint;
+                m_TargetMaskVol->TransformIndexToPhysicalPoint(it2.GetIndex(), worldTargetPoint);
+                m_TargetCoords.push_back(worldTargetPoint[0]);
+                m_TargetCoords.push_back(worldTargetPoint[1]);
+                m_TargetCoords.push_back(worldTargetPoint[2]);
+            }
+        }
+
+        SubsampleEntryPoints();
+        m_PointsExtracted = true;
+        Rewind();
+
+        cout << "Candidate generator: " << m_EntryCoords.size() / 3 << " entry points, "
+             << m_TargetCoords.size() / 3 << " target points" << endl;
+    }
+
+    bool SEEGCandidateGenerator::GetSkullNormal(const FloatVolume::IndexType& voxelIndex, Vector3D_lf& normal) {
+        // as SEEGPathPlanner::TestVectorOverlap(): the voxel or the 6-neighbour with the largest magnitude
+        FloatVolume::RegionType region = m_NormalVols[0]->GetLargestPossibleRegion();
+        double maxNorm = 0;
+        for (int i=-1; i<6; i++) {
+            FloatVolume::IndexType newIndex = voxelIndex;
+            if (i >= 0) {
+                newIndex[i % 3] += (i % 2 == 0) ? 1 : -1;
+            }
+            if (!region.IsInside(newIndex)) {
+                continue;
+            }
+            Vector3D_lf v(m_NormalVols[0]->GetPixel(newIndex),
+                          m_NormalVols[1]->GetPixel(newIndex),
+                          m_NormalVols[2]->GetPixel(newIndex));
+            double vNorm = norm(v);
+            if (vNorm > maxNorm) {
+                maxNorm = vNorm;
+                normal = v / vNorm;
+            }
+        }
+        return maxNorm > 0;
+    }
+
+    void SEEGCandidateGenerator::SubsampleEntryPoints() {
+        unsigned int numEntries = m_EntryCoords.size() / 3;
+        if (m_EntryPointSpacing <= 0 || numEntries == 0) {
+            return;
+        }
+
+        // entry points in a random order (simple LCG so the sampling only depends on the seed)
+        vector<unsigned int> order(numEntries);
+        for (unsigned int i=0; i<numEntries; i++) {
+            order[i] = i;
+        }
+        unsigned int state = m_RandomSeed;
+        for (unsigned int i=numEntries-1; i>0; i--) {
+            state = state * 1664525u + 1013904223u;
+            unsigned int j = state % (i + 1);
+            swap(order[i], order[j]);
+        }
+
+        // dart throwing on a grid of cells of diagonal m_EntryPointSpacing (at most 1 point per cell):
+        // a point is kept if no kept point within 2 cells is closer than m_EntryPointSpacing
+        double cellSize = m_EntryPointSpacing / sqrt(3.0);
+        double squareSpacing = m_EntryPointSpacing * m_EntryPointSpacing;
+        map<long long, unsigned int> grid;
+        vector<unsigned char> keep(numEntries, 0);
+        for (unsigned int i=0; i<numEntries; i++) {
+            unsigned int entry = order[i];
+            long long cell[3];
+            for (int d=0; d<3; d++) {
+                cell[d] = (long long) floor(m_EntryCoords[3*entry+d] / cellSize);
+            }
+            bool isFar = true;
+            for (long long dx=-2; dx<=2 && isFar; dx++) {
+                for (long long dy=-2; dy<=2 && isFar; dy++) {
+                    for (long long dz=-2; dz<=2 && isFar; dz++) {
+                        long long key = (((cell[0]+dx) & 0x1FFFFF) << 42) | (((cell[1]+dy) & 0x1FFFFF) << 21) | ((cell[2]+dz) & 0x1FFFFF);
+                        map<long long, unsigned int>::iterator itCell = grid.find(key);
+                        if (itCell == grid.end()) {
+                            continue;
+                        }
+                        unsigned int other = itCell->second;
+                        double squareDist = 0;
+                        for (int d=0; d<3; d++) {
+                            double diff = m_EntryCoords[3*entry+d] - m_EntryCoords[3*other+d];
+                            squareDist += diff * diff;
+                        }
+                        isFar = squareDist >= squareSpacing;
+                    }
+                }
+            }
+            if (isFar) {
+                long long key = ((cell[0] & 0x1FFFFF) << 42) | ((cell[1] & 0x1FFFFF) << 21) | (cell[2] & 0x1FFFFF);
+                grid[key] = entry;
+                keep[entry] = 1;
+            }
+        }
+
+        // kept entry points stay in the order of the mask
+        unsigned int numKept = 0;
+        for (unsigned int entry=0; entry<numEntries; entry++) {
+            if (!keep[entry]) {
+                continue;
+            }
+            for (int d=0; d<3; d++) {
+                m_EntryCoords[3*numKept+d] = m_EntryCoords[3*entry+d];
+                m_EntryNormals[3*numKept+d] = m_EntryNormals[3*entry+d];
+            }
+            m_EntryHasNormal[numKept] = m_EntryHasNormal[entry];
+            numKept++;
+        }
+        m_EntryCoords.resize(3*numKept);
+        m_EntryNormals.resize(3*numKept);
+        m_EntryHasNormal.resize(numKept);
+    }
+
+    bool SEEGCandidateGenerator::IsValidPair(unsigned int entry, unsigned int target) {
+        double vx = m_EntryCoords[3*entry] - m_TargetCoords[3*target];
+        double vy = m_EntryCoords[3*entry+1] - m_TargetCoords[3*target+1];
+        double vz = m_EntryCoords[3*entry+2] - m_TargetCoords[3*target+2];
+        double squareLength = vx*vx + vy*vy + vz*vz;
+        if (squareLength == 0) {
+            return false; // no direction
+        }
+        if (m_MaxLength > 0 && squareLength > m_MaxLength * m_MaxLength) {
+            return false;
+        }
+        if (m_MinLength > 0 && squareLength < m_MinLength * m_MinLength) {
+            return false;
+        }
+        if (m_MaxAngle > 0 && m_EntryHasNormal[entry]) {
+            // angle folded to [0, 90] as in TestVectorOverlap(): reject if angle >= maxAngle
+            double dotProd = vx * m_EntryNormals[3*entry] + vy * m_EntryNormals[3*entry+1] + vz * m_EntryNormals[3*entry+2];
+            double cosAngle = fabs(dotProd) / sqrt(squareLength);
+            if (cosAngle <= m_CosMaxAngle) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,153 @@
+#ifndef __SEEG_CANDIDATE_GENERATOR_H__
+#define __SEEG_CANDIDATE_GENERATOR_H__
+
+/**
+ * @file SEEGCandidateGenerator.h
+ *
+ * Defines the SEEGCandidateGenerator class: generates the (entry point, target point) candidate
+ * trajectories of the SEEGPathPlanner from entry and target masks, in batches.
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <vector>
+#include "BasicTypes.h"
+#include "MathUtils.h"
+#include "VolumeTypes.h"
+#include "SEEGElectrodeModel.h"
+#include "SEEGTrajectoryCandidates.h"
+
+using namespace std;
+
+namespace seeg {
+
+    /**
+     * The voxels of the entry and target masks are extracted once (world coordinates in compact
+     * arrays). Candidates are all the (entry, target) pairs, entry points in the outer loop, that
+     * pass the constraints:
+     * - maximum length (entry to target)
+     * - minimum length, e.g. the height of the electrode (SetElectrodeModel()): shorter trajectories
+     *   cannot hold all the contacts
+     * - maximum angle with the normal to the skull at the entry point (as the hard constraint of
+     *   SEEGPathPlanner::DoVectorTest(), entry points without a normal are not pruned)
+     * Pairs are checked before anything is allocated for them. Entry points can also be subsampled
+     * so that they are at least SetEntryPointSpacing() mm apart (Poisson-disk sampling).
+     *
+     * GenerateBatch() appends the next candidates to a table, so the caller does not need to
+     * hold all of them at once.
+     */
+    class SEEGCandidateGenerator {
+
+    public:
+        /** SmartPointer type for the SEEGCandidateGenerator class */
+        typedef mrilSmartPtr<SEEGCandidateGenerator> Pointer;
+
+        static Pointer New(IntVolume::Pointer entryPointMaskVol, IntVolume::Pointer targetMaskVol) {
+            return Pointer(new SEEGCandidateGenerator(entryPointMaskVol, targetMaskVol));
+        }
+
+    protected:
+        SEEGCandidateGenerator(IntVolume::Pointer entryPointMaskVol, IntVolume::Pointer targetMaskVol);
+
+    public:
+        virtual ~SEEGCandidateGenerator();
+
+        /*** Constraints (must be set before the first batch) ***/
+
+        /** Maximum entry to target distance in mm (<= 0: no limit) */
+        void SetMaximumLength(double maxLength);
+        double GetMaximumLength();
+
+        /** Minimum entry to target distance in mm (<= 0: no limit) */
+        void SetMinimumLength(double minLength);
+        double GetMinimumLength();
+
+        /** Sets the minimum length to the height of the electrode (from its tip to the last contact) */
+        void SetElectrodeModel(SEEGElectrodeModel::Pointer electrodeModel);
+
+        /**
+         * Rejects trajectories whose angle with the normal to the skull at the entry point is >= maxAngle
+         *
+         * @param normalVols x, y and z components of the normals (same volumes as DoVectorTest())
+         * @param maxAngle in degrees (<= 0: no limit)
+         */
+        void SetSkullNormals(vector<FloatVolume::Pointer>& normalVols, double maxAngle);
+
+        /** Minimum distance in mm between the entry points used (<= 0: all entry points) */
+        void SetEntryPointSpacing(double spacing);
+        double GetEntryPointSpacing();
+
+        /** Seed of the random order of the Poisson-disk sampling (same seed, same entry points) */
+        void SetRandomSeed(unsigned int seed);
+
+        /*** Generation ***/
+
+        /** Number of entry points (after subsampling) */
+        unsigned int GetNumberOfEntryPoints();
+
+        unsigned int GetNumberOfTargetPoints();
+
+        /**
+         * Appends the next candidates (at most maxCandidates) to candidates
+         *
+         * @return the number of candidates added (0 once all pairs were generated)
+         */
+        unsigned int GenerateBatch(SEEGTrajectoryCandidates::Pointer candidates, unsigned int maxCandidates);
+
+        /** Appends all the (remaining) candidates to candidates */
+        unsigned int GenerateAll(SEEGTrajectoryCandidates::Pointer candidates);
+
+        bool IsAtEnd();
+
+        /** Starts the generation again from the first pair */
+        void Rewind();
+
+        /** Number of pairs checked / rejected by the constraints since the last Rewind() */
+        unsigned long long GetNumberOfPairsChecked();
+        unsigned long long GetNumberOfPairsRejected();
+
+    private:
+        /** Extracts entry and target points (and entry normals) if not done yet */
+        void ExtractPoints();
+
+        /** Unit normal at voxelIndex (voxel or 6-neighbour of largest magnitude), false if no normal */
+        bool GetSkullNormal(const FloatVolume::IndexType& voxelIndex, Vector3D_lf& normal);
+
+        /** Keeps entry points at least m_EntryPointSpacing apart */
+        void SubsampleEntryPoints();
+
+        /** true if the pair passes all the constraints */
+        bool IsValidPair(unsigned int entry, unsigned int target);
+
+        IntVolume::Pointer m_EntryPointMaskVol;
+        IntVolume::Pointer m_TargetMaskVol;
+        vector<FloatVolume::Pointer> m_NormalVols;
+
+        double m_MaxLength;
+        double m_MinLength;
+        double m_MaxAngle;
+        double m_CosMaxAngle;
+        double m_EntryPointSpacing;
+        unsigned int m_RandomSeed;
+
+        bool m_PointsExtracted;
+
+        /** World coordinates of the entry points (3 per point) and unit normals to the skull */
+        vector<double> m_EntryCoords;
+        vector<double> m_EntryNormals;
+        vector<unsigned char> m_EntryHasNormal;
+
+        /** World coordinates of the target points (3 per point) */
+        vector<double> m_TargetCoords;
+
+        /** Next pair to check */
+        unsigned int m_NextEntry;
+        unsigned int m_NextTarget;
+
+        unsigned long long m_NumPairsChecked;
+        unsigned long long m_NumPairsRejected;
+    };
+}
+
+#endif
@@ -14,6 +14,7 @@
 #include "itkImageRegionIterator.h"
 #include "itkBinaryImageToShapeLabelMapFilter.h"
 #include <qglobal.h>
+#include <math.h>
 
 
 
@@ -255,33 +256,17 @@ SEEGContactsROIPipeline::~SEEGContactsROIPipeline() {
         return outputVol;
     }
 
-    FloatVolume::Pointer SEEGContactsROIPipeline::GetRecordedVolPerElectrode(ElectrodeInfo::Pointer electrode){
-
-        bool onlyInsdeBrain = false; // RIZ20151227 since entry point could be specified inside the brain, compute contact position also "outside"
-
-        // duplicate volume to have same size -instead get from original volume
-      /*  FloatVolume::Pointer vol = FloatVolume::New(); //volDuplicator->GetOutput();
-        vol->CopyInformation(m_TemplateVolume);
-        vol->SetRegions(vol->GetLargestPossibleRegion());
-        vol->Allocate();
-        */
-        FloatVolumeDuplicator::Pointer volDuplicator = FloatVolumeDuplicator::New();
-        volDuplicator->SetInputImage(m_TemplateVolume); //m_TemplateVolume should be clean! --> only to have appropriate size
-        volDuplicator->Update();
-        FloatVolume::Pointer vol = volDuplicator->GetOutput();
-        vol->DisconnectPipeline();
-
+    FloatVolume::RegionType SEEGContactsROIPipeline::CalcElectrodeRegion(ElectrodeInfo::Pointer electrode) {
 
         // create empty electrode to assign entry-target
-        //SEEGElectrodeModel::Pointer electrode = SEEGElectrodeModel::New(SEEGElectrodeModel::MNI);
         double recRadius = m_ElectrodeModel->GetRecordingRadius();
 
         // define region of interest
         FloatVolume::RegionType electrodeRegion;
         FloatVolume::IndexType entryPointIndex, targetPointIndex;
-        vol->TransformPhysicalPointToIndex(electrode->m_EntryPointWorld, entryPointIndex);
-        vol->TransformPhysicalPointToIndex(electrode->m_TargetPointWorld, targetPointIndex);
-        FloatVolume::SpacingType spacing = vol->GetSpacing();
+        m_TemplateVolume->TransformPhysicalPointToIndex(electrode->m_EntryPointWorld, entryPointIndex);
+        m_TemplateVolume->TransformPhysicalPointToIndex(electrode->m_TargetPointWorld, targetPointIndex);
+        FloatVolume::SpacingType spacing = m_TemplateVolume->GetSpacing();
 
         Point3D radiousPtIndex;
         radiousPtIndex[0] =recRadius * spacing[0];
@@ -291,7 +276,7 @@ SEEGContactsROIPipeline::~SEEGContactsROIPipeline() {
         CalcTrajBoundingBox(entryPointIndex, targetPointIndex, radiousPtIndex, electrodeRegion);
         FloatVolume::SizeType regionSize = electrodeRegion.GetSize();
         FloatVolume::IndexType elecRegionStart = electrodeRegion.GetIndex();
-        FloatVolume::RegionType volRegion = vol->GetRequestedRegion();
+        FloatVolume::RegionType volRegion = m_TemplateVolume->GetLargestPossibleRegion();
         FloatVolume::SizeType volRegionSize = volRegion.GetSize();
         FloatVolume::IndexType volRegionStart = volRegion.GetIndex();
         if (abs((int)regionSize[0]+elecRegionStart[0]) < abs((int)volRegionSize[0]+volRegionStart[0]) && abs((int)regionSize[1]+elecRegionStart[1]) < abs((int)volRegionSize[1]+volRegionStart[1]) && abs((int)regionSize[2]+elecRegionStart[2]) < abs((int)volRegionSize[2]+volRegionStart[2])) {
@@ -305,128 +290,396 @@ SEEGContactsROIPipeline::~SEEGContactsROIPipeline() {
         } else {
             cout << "No Padding possible EP:"<< electrode->m_EntryPointWorld<<" TP: "<<electrode->m_TargetPointWorld<<endl;
         }
+        return electrodeRegion;
+    }
 
-        // get small volume
-       // cout << "Electrode Region: " << electrodeRegion.GetSize();
-        RegionOfInterestFilterType::Pointer regionOfInterestFilter = RegionOfInterestFilterType::New();
-        regionOfInterestFilter->SetInput(vol); //vol
-        regionOfInterestFilter->SetRegionOfInterest(electrodeRegion);
-        FloatVolume::Pointer smallVol = regionOfInterestFilter->GetOutput();
-        regionOfInterestFilter->Update();
-      //  Q_ASSERT( smallVol );
-        FloatVolume::RegionType region = smallVol->GetRequestedRegion();
-        //create contour - it should be a sphere -- RIZ: for now computes recording in whole bounding box
+    FloatVolume::Pointer SEEGContactsROIPipeline::CopyVolumeRegion(FloatVolume::Pointer vol, const FloatVolume::RegionType& region) {
+        // same image as RegionOfInterestImageFilter (origin at the start of region, indices from 0),
+        // but vol is only read: updating a filter would change the requested region of its input
+        FloatVolume::RegionType roiRegion;
+        roiRegion.SetSize(region.GetSize());
+        FloatVolume::PointType roiOrigin;
+        vol->TransformIndexToPhysicalPoint(region.GetIndex(), roiOrigin);
+
+        FloatVolume::Pointer roiVol = FloatVolume::New();
+        roiVol->SetRegions(roiRegion);
+        roiVol->SetOrigin(roiOrigin);
+        roiVol->SetSpacing(vol->GetSpacing());
+        roiVol->SetDirection(vol->GetDirection());
+        roiVol->Allocate();
+
+        FloatVolumeRegionConstIterator itIn(vol, region);
+        FloatVolumeRegionIterator itOut(roiVol, roiRegion);
+        for (itIn.GoToBegin(), itOut.GoToBegin(); !itIn.IsAtEnd(); ++itIn, ++itOut) {
+            itOut.Set(itIn.Get());
+        }
+        return roiVol;
+    }
 
-        // locate each contact in vol and set the corresponding central pixel in smallVol
+    void SEEGContactsROIPipeline::AllocateROIVolume(FloatVolume::Pointer& roiVol, const FloatVolume::RegionType& region) {
+        // same origin/spacing/direction as the template -> indices and world coordinates are the ones of the full volume
+        if (roiVol.IsNull()) {
+            roiVol = FloatVolume::New();
+        }
+        roiVol->CopyInformation(m_TemplateVolume);
+        roiVol->SetRegions(region);
+        roiVol->Allocate(); // the pixel container keeps its capacity, so smaller regions do not reallocate
+    }
+
+    int SEEGContactsROIPipeline::CalcContactSeeds(ElectrodeInfo::Pointer electrode, const FloatVolume::RegionType& electrodeRegion,
+                                                  vector<float>& seedX, vector<float>& seedY, vector<float>& seedZ) {
+
+        bool onlyInsdeBrain = false; // RIZ20151227 since entry point could be specified inside the brain, compute contact position also "outside"
+
+        // locate each contact in vol -> the voxel of each contact is a seed (as for the former Danielsson distance map)
         vector<Point3D> allContactsWorld;
         m_ElectrodeModel->CalcAllContactPositions(electrode->m_TargetPointWorld, electrode->m_EntryPointWorld, allContactsWorld, onlyInsdeBrain); //RIZ20151227 - corrected! started from entry point!!!
 
+        FloatVolume::SpacingType spacing = m_TemplateVolume->GetSpacing();
+        seedX.clear();
+        seedY.clear();
+        seedZ.clear();
         for (int iCont=0; iCont<m_ElectrodeModel->GetNumContacts(); iCont++){
             FloatVolume::IndexType index;
-            smallVol->TransformPhysicalPointToIndex(allContactsWorld[iCont], index);
-            if (region.IsInside(index)){
-                smallVol->SetPixel(index, 1);
+            m_TemplateVolume->TransformPhysicalPointToIndex(allContactsWorld[iCont], index);
+            if (electrodeRegion.IsInside(index)){
+                seedX.push_back(index[0] * spacing[0]);
+                seedY.push_back(index[1] * spacing[1]);
+                seedZ.push_back(index[2] * spacing[2]);
             } else {
                 //cout << "No Region for this contact "<< iCont <<"- EP:"<< electrode->m_EntryPointWorld<<" TP: "<<electrode->m_TargetPointWorld<<endl;
                 break;
             }
         }
-    //    WriteFloatVolume("/Users/rzelmann/test/smallVol.mnc", smallVol);
-    //    WriteFloatVolume("/Users/rzelmann/test/origVol.mnc", m_TemplateVolume);
+        return seedX.size();
+    }
 
+    float SEEGContactsROIPipeline::CalcContactsSquareDistances(ElectrodeInfo::Pointer electrode) {
 
-  /*      for (int iCont=0; iCont<electrode->GetNumContacts(); iCont++){
-            FloatVolume::IndexType index;
-            vol->TransformPhysicalPointToIndex(allContactsWorld[iCont], index);
-            if (region.IsInside(index)){
-                vol->SetPixel(index, 1);
-            } else {
-                break;
+        // only the electrode's bounding region is allocated (buffer reused between calls)
+        FloatVolume::RegionType electrodeRegion = CalcElectrodeRegion(electrode);
+        AllocateROIVolume(m_ContactsVol, electrodeRegion);
+
+        FloatVolume::SpacingType spacing = m_TemplateVolume->GetSpacing();
+        vector<float> seedX, seedY, seedZ; // seed voxel centres in mm (index * spacing)
+        int nSeeds = CalcContactSeeds(electrode, electrodeRegion, seedX, seedY, seedZ);
+        if (nSeeds == 0) {
+            return -1;
+        }
+
+        // squared distance of each voxel to its nearest contact - per scanline only x varies,
+        // so the y/z part of each contact's distance is computed once per line
+        FloatVolume::IndexType regionIndex = electrodeRegion.GetIndex();
+        FloatVolume::SizeType regionSize = electrodeRegion.GetSize();
+        float* buffer = m_ContactsVol->GetBufferPointer();
+        vector<float> seedYZ(nSeeds);
+        float maxSquareDist = 0;
+        for (unsigned int iz=0; iz<regionSize[2]; iz++) {
+            float z = (regionIndex[2] + (long) iz) * spacing[2];
+            for (unsigned int iy=0; iy<regionSize[1]; iy++) {
+                float y = (regionIndex[1] + (long) iy) * spacing[1];
+                for (int j=0; j<nSeeds; j++) {
+                    seedYZ[j] = (y - seedY[j]) * (y - seedY[j]) + (z - seedZ[j]) * (z - seedZ[j]);
+                }
+                for (unsigned int ix=0; ix<regionSize[0]; ix++) {
+                    float x = (regionIndex[0] + (long) ix) * spacing[0];
+                    float minSquareDist = (x - seedX[0]) * (x - seedX[0]) + seedYZ[0];
+                    for (int j=1; j<nSeeds; j++) {
+                        float d = (x - seedX[j]) * (x - seedX[j]) + seedYZ[j];
+                        minSquareDist = (d < minSquareDist) ? d : minSquareDist;
+                    }
+                    *buffer++ = minSquareDist;
+                    maxSquareDist = (minSquareDist > maxSquareDist) ? minSquareDist : maxSquareDist;
+                }
             }
         }
-*/
-        // Compute Distance Map for each contact
-        FloatVolume::Pointer distMapAllContacts = CompSquareDistMapFromPoint(smallVol);  //Danielsson Distance map
-   //     FloatVolume::Pointer distMapAllContacts1 = CompSquareDistMapFromPoints(smallVol); //Maurer Distance map
-       //DELETE!! FloatVolume::Pointer distMapAllContacts = CompSquareDistMapFromPoint(vol, electrodeRegion);
-        // only to test if distMap is ok
-   //     WriteFloatVolume("/Users/rzelmann/test/distMapAllContactsMaurer.mnc", distMapAllContacts1);
-        //WriteFloatVolume("/Users/rzelmann/test/distMapAllContactsDanielsson.mnc", distMapAllContacts);
-
-
-        // bring back to orignal size
-        FloatVolume::IndexType destinationIndex =  electrodeRegion.GetIndex();
-        //     cout << "Electrode Region: " << destinationIndex <<" - "<< electrodeRegion.GetSize() << std::endl;
-        PasteImageFilterType::Pointer pasteFilter = PasteImageFilterType::New ();
-        pasteFilter->SetSourceImage(distMapAllContacts);
-        pasteFilter->SetDestinationImage(vol);
-        pasteFilter->SetSourceRegion(distMapAllContacts->GetLargestPossibleRegion());
-        pasteFilter->SetDestinationIndex(destinationIndex);
-        FloatVolume::Pointer outputVol =  pasteFilter->GetOutput(); // RIZ20160322: changed before the update as in all other filters
-        pasteFilter->Update();
-        // output
-//        FloatVolume::Pointer outputVol =  pasteFilter->GetOutput();
-        outputVol->SetRequestedRegion(electrodeRegion);
-       // Q_ASSERT( outputVol );
-        // only to test if distMap is ok
-  //      WriteFloatVolume("/home/rina/test/pasteDistMapAllContacts.mnc", outputVol);
+        return sqrt(maxSquareDist);
+    }
 
-        return outputVol;
+    FloatVolume::Pointer SEEGContactsROIPipeline::GetRecordedVolPerElectrode(ElectrodeInfo::Pointer electrode){
+        // copy: m_ContactsVol is overwritten by the next electrode
+        CalcRecordingWeights(electrode);
+        return CopyFloatVolume(m_ContactsVol);
     }
 
-    void SEEGContactsROIPipeline::CalcRecordingMap(FloatVolume::Pointer targetDistMap, FloatVolume::Pointer &recordingMap, ElectrodeInfo::Pointer electrode){
+    void SEEGContactsROIPipeline::CalcRecordingWeights(ElectrodeInfo::Pointer electrode){
 
-        MultiplyImageFilterType::Pointer multiplyFilter = MultiplyImageFilterType::New ();
+        // weight = (1 - dist/maxDist)^2 : same as inverting, normalizing and squaring the distance map
+        // of the contacts (CompSquareDistMapFromPoint) but computed in place in the ROI buffer
+        float maxDist = CalcContactsSquareDistances(electrode);
+        float* buffer = m_ContactsVol->GetBufferPointer();
+        size_t nVoxels = m_ContactsVol->GetBufferedRegion().GetNumberOfPixels();
+        if (maxDist < 0) {
+            m_ContactsVol->FillBuffer(0); // no contact within the region
+        } else {
+            float invMaxDist = (maxDist > 0) ? 1.0f / maxDist : 0.0f;
+            for (size_t i=0; i<nVoxels; i++) {
+                float w = 1.0f - sqrtf(buffer[i]) * invMaxDist;
+                buffer[i] = w * w;
+            }
+        }
+    }
 
-        // get volume recorded for this electrode
-        FloatVolume::Pointer recVolume = GetRecordedVolPerElectrode(electrode);
-        FloatVolume::RegionType region = recVolume->GetRequestedRegion();
-        //cout << "CalcRecordingMap Region: " << region.GetIndex() <<" - "<< region.GetSize() << std::endl;
-        //cout << "targetDistMap Region: " << targetDistMap->GetRequestedRegion().GetSize() << std::endl;
+    void SEEGContactsROIPipeline::CalcRecordingMap(FloatVolume::Pointer targetDistMap, FloatVolume::Pointer &recordingMap, ElectrodeInfo::Pointer electrode){
 
-        // multiply by distance map of volume of interest
-        multiplyFilter->SetInput1(targetDistMap);
-        multiplyFilter->SetInput2(recVolume);
-        multiplyFilter->Update();
-        recordingMap = multiplyFilter->GetOutput();
-        recordingMap->SetRequestedRegion(region);
-    //    Q_ASSERT( recordingMap );
-       // cout << "recordingMap Region: " << recordingMap->GetRequestedRegion().GetSize() << std::endl;
+        // squared distances to the contacts (only the electrode's region)
+        float maxDist = CalcContactsSquareDistances(electrode);
+        FloatVolume::RegionType region = m_ContactsVol->GetBufferedRegion();
+        AllocateROIVolume(recordingMap, region);
+        m_LastRecordingSums.assign(1, 0);
+        if (maxDist < 0) {
+            recordingMap->FillBuffer(0); // no contact within the region
+            return;
+        }
 
-        // only to test if distMap is ok
- //       WriteFloatVolume("/home/rina/test/targetDistMap.mnc", targetDistMap);
- //      WriteFloatVolume("/home/rina/test/recordingMap.mnc", recordingMap);
-        //   FloatVolume::Pointer recordingMap = multiplyFilter->GetOutput();
-        //  return outputVol;
+        // single pass: recording weight, multiplication by the map of the volume of interest and sum
+        float invMaxDist = (maxDist > 0) ? 1.0f / maxDist : 0.0f;
+        FloatVolume::IndexType regionIndex = region.GetIndex();
+        FloatVolume::SizeType regionSize = region.GetSize();
+        const float* distBuffer = m_ContactsVol->GetBufferPointer();
+        float* outBuffer = recordingMap->GetBufferPointer();
+        const float* targetBuffer = targetDistMap->GetBufferPointer();
+        double sum = 0;
+        for (unsigned int iz=0; iz<regionSize[2]; iz++) {
+            for (unsigned int iy=0; iy<regionSize[1]; iy++) {
+                FloatVolume::IndexType lineIndex;
+                lineIndex[0] = regionIndex[0];
+                lineIndex[1] = regionIndex[1] + iy;
+                lineIndex[2] = regionIndex[2] + iz;
+                const float* target = targetBuffer + targetDistMap->ComputeOffset(lineIndex);
+                for (unsigned int ix=0; ix<regionSize[0]; ix++) {
+                    float w = 1.0f - sqrtf(*distBuffer++) * invMaxDist;
+                    float value = w * w * target[ix];
+                    *outBuffer++ = value;
+                    sum += value;
+                }
+            }
+        }
+        m_LastRecordingSums[0] = sum;
     }
 
     void SEEGContactsROIPipeline::CalcRecordingMap(vector<FloatVolume::Pointer> targetDistMaps, vector<FloatVolume::Pointer> &recordingMaps, ElectrodeInfo::Pointer electrode){
-        // get volume recorded for this electrode
-        FloatVolume::Pointer recVolume = GetRecordedVolPerElectrode(electrode);
-        FloatVolume::RegionType region = recVolume->GetRequestedRegion();
-      //  cout << "CalcRecordingMap Region: " << region.GetIndex() <<" - "<< region.GetSize() << std::endl;
-   //     cout << "targetDistMap Region: " << targetDistMap->GetRequestedRegion().GetSize() << std::endl;
+        // recording weights of this electrode in m_ContactsVol (only the electrode's region, no copy)
+        CalcRecordingWeights(electrode);
+        FloatVolume::Pointer recVolume = m_ContactsVol;
+        FloatVolume::RegionType region = recVolume->GetBufferedRegion();
+        FloatVolume::IndexType regionIndex = region.GetIndex();
+        FloatVolume::SizeType regionSize = region.GetSize();
 
-        // multiply by distance map of volume of interest for each target
+        // multiply by distance map of volume of interest for each target (maps of a previous call are reused)
+        recordingMaps.resize(targetDistMaps.size());
+        m_LastRecordingSums.assign(targetDistMaps.size(), 0);
         for (int iTarget=0; iTarget<targetDistMaps.size(); iTarget++){
             FloatVolume::Pointer targetDistMap = targetDistMaps[iTarget];
-            //targetDistMap->SetRequestedRegion(region);
-            MultiplyImageFilterType::Pointer multiplyFilter = MultiplyImageFilterType::New();
-            multiplyFilter->SetInput2(recVolume);
-            multiplyFilter->Modified(); //RIZ:: this should come back --works with this! maybe a bug in ITK
-            //cout<<"Target" << iTarget<< multiplyFilter->GetMTime()<<endl;
-            multiplyFilter->SetInput1(targetDistMap);
-            FloatVolume::Pointer recordingMap = multiplyFilter->GetOutput();
-            multiplyFilter->Update();
-            recordingMap->SetRequestedRegion(region); //multiply FULL image --> there will be garbage if only consider requested region
-      //      WriteFloatVolume("/home/rina/test/recMap.mnc", recordingMap);
-            recordingMaps.push_back(recordingMap);
-           // Q_ASSERT( recordingMap );
+            AllocateROIVolume(recordingMaps[iTarget], region);
+            const float* recBuffer = recVolume->GetBufferPointer();
+            float* outBuffer = recordingMaps[iTarget]->GetBufferPointer();
+            double sum = 0;
+            for (unsigned int iz=0; iz<regionSize[2]; iz++) {
+                for (unsigned int iy=0; iy<regionSize[1]; iy++) {
+                    FloatVolume::IndexType lineIndex;
+                    lineIndex[0] = regionIndex[0];
+                    lineIndex[1] = regionIndex[1] + iy;
+                    lineIndex[2] = regionIndex[2] + iz;
+                    const float* target = targetDistMap->GetBufferPointer() + targetDistMap->ComputeOffset(lineIndex);
+                    for (unsigned int ix=0; ix<regionSize[0]; ix++) {
+                        float value = (*recBuffer++) * target[ix];
+                        *outBuffer++ = value;
+                        sum += value;
+                    }
+                }
+            }
+            m_LastRecordingSums[iTarget] = sum;
+        }
+    }
+
+    void SEEGContactsROIPipeline::ExtractSparseTargetVoxels(FloatVolume::Pointer targetDistMap, const FloatVolume::RegionType& region, SparseTargetVoxels& targetVoxels) {
+        targetVoxels.m_TargetMap = targetDistMap;
+        targetVoxels.m_Indices.clear();
+        targetVoxels.m_Values.clear();
+        targetVoxels.m_X.clear();
+        targetVoxels.m_Y.clear();
+        targetVoxels.m_Z.clear();
+        FloatVolume::SpacingType spacing = m_TemplateVolume->GetSpacing();
+        FloatVolumeRegionConstIteratorWithIndex it(targetDistMap, region);
+        for (it.GoToBegin(); !it.IsAtEnd(); ++it) {
+            if (it.Get() != 0) { // voxels with 0 do not contribute to the recording map
+                FloatVolume::IndexType index = it.GetIndex();
+                targetVoxels.m_Indices.push_back(index);
+                targetVoxels.m_Values.push_back(it.Get());
+                targetVoxels.m_X.push_back(index[0] * spacing[0]);
+                targetVoxels.m_Y.push_back(index[1] * spacing[1]);
+                targetVoxels.m_Z.push_back(index[2] * spacing[2]);
+            }
+        }
+    }
+
+    float SEEGContactsROIPipeline::CalcMaxSquareDistanceToSeeds(const FloatVolume::RegionType& region,
+                                                               const vector<float>& seedX, const vector<float>& seedY, const vector<float>& seedZ,
+                                                               FloatVolume::IndexType& farthestVoxel, const FloatVolume::IndexType* startVoxel) {
+        // Exact maximum over the voxels of the region of the squared distance to the nearest seed,
+        // found by branch and bound on sub-boxes: the distance to one seed is convex, so its maximum
+        // over a box is at one of the box corners, and min over seeds of those maxima bounds the box.
+        FloatVolume::SpacingType spacing = m_TemplateVolume->GetSpacing();
+        int nSeeds = seedX.size();
+
+        struct VoxelBox { long lo[3]; long hi[3]; };
+        vector<VoxelBox> boxes;
+        VoxelBox fullBox;
+        for (int i=0; i<3; i++) {
+            fullBox.lo[i] = region.GetIndex()[i];
+            fullBox.hi[i] = region.GetIndex()[i] + (long) region.GetSize()[i] - 1;
+        }
+        boxes.push_back(fullBox);
+
+        float best = -1;
+        farthestVoxel = region.GetIndex();
+
+        // a voxel of the region is a lower bound of the maximum: boxes that cannot beat it are pruned at once
+        if (startVoxel != NULL && region.IsInside(*startVoxel)) {
+            float x = (*startVoxel)[0] * spacing[0];
+            float y = (*startVoxel)[1] * spacing[1];
+            float z = (*startVoxel)[2] * spacing[2];
+            float minSquareDist = -1;
+            for (int j=0; j<nSeeds; j++) {
+                float d = (x - seedX[j]) * (x - seedX[j]) + ((y - seedY[j]) * (y - seedY[j]) + (z - seedZ[j]) * (z - seedZ[j]));
+                minSquareDist = (minSquareDist < 0 || d < minSquareDist) ? d : minSquareDist;
+            }
+            best = minSquareDist;
+            farthestVoxel = *startVoxel;
+        }
+
+        while (!boxes.empty()) {
+            VoxelBox box = boxes.back();
+            boxes.pop_back();
+
+            // upper bound for the box
+            float upperBound = -1;
+            for (int j=0; j<nSeeds; j++) {
+                float maxSeed = 0;
+                for (int corner=0; corner<8; corner++) {
+                    float x = ((corner & 1) ? box.hi[0] : box.lo[0]) * spacing[0];
+                    float y = ((corner & 2) ? box.hi[1] : box.lo[1]) * spacing[1];
+                    float z = ((corner & 4) ? box.hi[2] : box.lo[2]) * spacing[2];
+                    float d = (x - seedX[j]) * (x - seedX[j]) + ((y - seedY[j]) * (y - seedY[j]) + (z - seedZ[j]) * (z - seedZ[j]));
+                    maxSeed = (d > maxSeed) ? d : maxSeed;
+                }
+                upperBound = (upperBound < 0 || maxSeed < upperBound) ? maxSeed : upperBound;
+            }
+            if (upperBound * (1 + 1e-5f) < best) {
+                continue; // no voxel of this box can beat the current maximum
+            }
+
+            // value at the box centre voxel (same arithmetic as CalcContactsSquareDistances)
+            long c[3];
+            for (int i=0; i<3; i++) {
+                c[i] = (box.lo[i] + box.hi[i]) / 2;
+            }
+            float x = c[0] * spacing[0];
+            float y = c[1] * spacing[1];
+            float z = c[2] * spacing[2];
+            float minSquareDist = -1;
+            for (int j=0; j<nSeeds; j++) {
+                float d = (x - seedX[j]) * (x - seedX[j]) + ((y - seedY[j]) * (y - seedY[j]) + (z - seedZ[j]) * (z - seedZ[j]));
+                minSquareDist = (minSquareDist < 0 || d < minSquareDist) ? d : minSquareDist;
+            }
+            if (minSquareDist > best) {
+                best = minSquareDist;
+                for (int i=0; i<3; i++) {
+                    farthestVoxel[i] = c[i];
+                }
+            }
+
+            // split along the longest axis
+            int axis = 0;
+            for (int i=1; i<3; i++) {
+                if (box.hi[i] - box.lo[i] > box.hi[axis] - box.lo[axis]) {
+                    axis = i;
+                }
+            }
+            if (box.hi[axis] == box.lo[axis]) {
+                continue; // single voxel
+            }
+            long mid = (box.lo[axis] + box.hi[axis]) / 2;
+            VoxelBox half1 = box;
+            VoxelBox half2 = box;
+            half1.hi[axis] = mid;
+            half2.lo[axis] = mid + 1;
+            boxes.push_back(half1);
+            boxes.push_back(half2);
+        }
+        return best;
+    }
+
+    void SEEGContactsROIPipeline::CalcSparseRecording(const SparseTargetVoxels& targetVoxels, ElectrodeInfo::Pointer electrode, const vector<Point3D>& contactPoints,
+                                                      double& recordingSum, int& nContactsInside, SparseRecordingHint* hint) {
+        recordingSum = 0;
+        nContactsInside = 0;
 
-        //    cout << "recordingMap Region: " << recordingMap->GetRequestedRegion().GetSize() << std::endl;
+        FloatVolume::RegionType electrodeRegion = CalcElectrodeRegion(electrode);
+        vector<float> seedX, seedY, seedZ;
+        int nSeeds = CalcContactSeeds(electrode, electrodeRegion, seedX, seedY, seedZ);
+        if (nSeeds == 0) {
+            return; // recording map is 0 everywhere
         }
+        FloatVolume::IndexType farthestVoxel;
+        const FloatVolume::IndexType* startVoxel = (hint != NULL && hint->m_HasFarthestVoxel) ? &hint->m_FarthestVoxel : NULL;
+        float maxDist = sqrt(CalcMaxSquareDistanceToSeeds(electrodeRegion, seedX, seedY, seedZ, farthestVoxel, startVoxel));
+        if (hint != NULL) {
+            hint->m_HasFarthestVoxel = true;
+            hint->m_FarthestVoxel = farthestVoxel;
+        }
+        float invMaxDist = (maxDist > 0) ? 1.0f / maxDist : 0.0f;
+        FloatVolume::SpacingType spacing = m_TemplateVolume->GetSpacing();
+
+        // sum over the voxels of the target within this electrode's region (raster order -> same sum as CalcRecordingMap)
+        double sum = 0;
+        for (int iVoxel=0; iVoxel<targetVoxels.m_Indices.size(); iVoxel++) {
+            const FloatVolume::IndexType& index = targetVoxels.m_Indices[iVoxel];
+            if (!electrodeRegion.IsInside(index)) {
+                continue;
+            }
+            float x = targetVoxels.m_X[iVoxel];
+            float y = targetVoxels.m_Y[iVoxel];
+            float z = targetVoxels.m_Z[iVoxel];
+            float minSquareDist = -1;
+            for (int j=0; j<nSeeds; j++) {
+                float d = (x - seedX[j]) * (x - seedX[j]) + ((y - seedY[j]) * (y - seedY[j]) + (z - seedZ[j]) * (z - seedZ[j]));
+                minSquareDist = (minSquareDist < 0 || d < minSquareDist) ? d : minSquareDist;
+            }
+            float w = 1.0f - sqrtf(minSquareDist) * invMaxDist;
+            float value = w * w * targetVoxels.m_Values[iVoxel];
+            sum += value;
+        }
+        recordingSum = sum;
 
+        // contacts where the recording map is > 0
+        for (int iCont=0; iCont<contactPoints.size(); iCont++) {
+            FloatVolume::IndexType index;
+            targetVoxels.m_TargetMap->TransformPhysicalPointToIndex(contactPoints[iCont], index);
+            if (!electrodeRegion.IsInside(index)) {
+                continue;
+            }
+            float x = index[0] * spacing[0];
+            float y = index[1] * spacing[1];
+            float z = index[2] * spacing[2];
+            float minSquareDist = -1;
+            for (int j=0; j<nSeeds; j++) {
+                float d = (x - seedX[j]) * (x - seedX[j]) + ((y - seedY[j]) * (y - seedY[j]) + (z - seedZ[j]) * (z - seedZ[j]));
+                minSquareDist = (minSquareDist < 0 || d < minSquareDist) ? d : minSquareDist;
+            }
+            float w = 1.0f - sqrtf(minSquareDist) * invMaxDist;
+            if (w * w * targetVoxels.m_TargetMap->GetPixel(index) > 0) {
+                nContactsInside++;
+            }
+        }
+    }
 
+    double SEEGContactsROIPipeline::GetLastRecordingSum(int iTarget) {
+        if (iTarget < 0 || iTarget >= m_LastRecordingSums.size()) {
+            return 0;
+        }
+        return m_LastRecordingSums[iTarget];
     }
 
     void SEEGContactsROIPipeline::CalcTrajBoundingBox(FloatVolume::IndexType entryPointIndex, FloatVolume::IndexType targetPointIndex,  Point3D maxRadius, FloatVolume::RegionType& region) {
@@ -518,87 +771,67 @@ SEEGContactsROIPipeline::~SEEGContactsROIPipeline() {
 
     FloatVolume::Pointer SEEGContactsROIPipeline::CalcVolOfContact(int contactIndex, ElectrodeInfo::Pointer electrode, FloatVolume::Pointer anatLabelsMap){
         //Find All labels within the volume of the contact and return a volume with the labels
+        FloatVolume::RegionType contactRegion = CalcContactRegion(contactIndex, electrode, true);
 
-        //Empty vol to have access to transforms
-        FloatVolumeDuplicator::Pointer volDuplicator = FloatVolumeDuplicator::New();
-        volDuplicator->SetInputImage(m_TemplateVolume); //m_TemplateVolume should be clean! --> only to have appropriate size
-        volDuplicator->Update();
-        FloatVolume::Pointer vol = volDuplicator->GetOutput();
-        vol->DisconnectPipeline();
-        
-        double extraRadious; // to include partial voxels it should be 1 - computed as extraRadious * volSpacing
-        extraRadious = m_ElectrodeModel->GetRecordingRadius(); // to consider recording radious as specified by model (defined following vonEllenrieder2014)
-        FloatVolume::SpacingType spacing = vol->GetSpacing();
-        Point3D extraRadiousIndex;
-        extraRadiousIndex[0] =extraRadious * spacing[0];
-        extraRadiousIndex[1] =extraRadious * spacing[1];
-        extraRadiousIndex[2] = extraRadious * spacing[2];
-
-        //1. Find start and end of electrode
-        Point3D contactStartPt, contactEndPt;
-        m_ElectrodeModel->CalcContactStartEnds(contactIndex, electrode->GetTargetPoint(), electrode->GetEntryPoint(), contactStartPt, contactEndPt);
-
-        //2. convert to indexes
-        FloatVolume::RegionType contactRegion;
-        FloatVolume::IndexType contactStartPtIndex, contactEndPtIndex;
-        vol->TransformPhysicalPointToIndex(contactStartPt, contactStartPtIndex);
-        vol->TransformPhysicalPointToIndex(contactEndPt, contactEndPtIndex);
-
-        //3. Calculate Bounding box (contact's region of interest)
-        CalcTrajBoundingBox(contactEndPtIndex, contactStartPtIndex, extraRadiousIndex, contactRegion);
-
-        //4. Get region of interest in anatLabelsMap
-        RegionOfInterestFilterType::Pointer regionOfInterestFilter = RegionOfInterestFilterType::New();
-        regionOfInterestFilter->SetInput(anatLabelsMap); //volume to reduce size
-        regionOfInterestFilter->SetRegionOfInterest(contactRegion);
-        FloatVolume::Pointer smallVol = regionOfInterestFilter->GetOutput();
-        regionOfInterestFilter->Update();
+        //Get region of interest in anatLabelsMap
+        FloatVolume::Pointer smallVol = CopyVolumeRegion(anatLabelsMap, contactRegion);
 
         return smallVol;
 }
 
     FloatVolume::Pointer SEEGContactsROIPipeline::CalcVolOfCenterOfContact(int contactIndex, ElectrodeInfo::Pointer electrode, FloatVolume::Pointer anatLabelsMap){
         //Find All labels within the volume of the contact and return a volume with the labels
+        FloatVolume::RegionType contactRegion = CalcContactRegion(contactIndex, electrode, false);
 
-        //Empty vol to have access to transforms
-        FloatVolumeDuplicator::Pointer volDuplicator = FloatVolumeDuplicator::New();
-        volDuplicator->SetInputImage(m_TemplateVolume); //m_TemplateVolume should be clean! --> only to have appropriate size
-        volDuplicator->Update();
-        FloatVolume::Pointer vol = volDuplicator->GetOutput();
-        vol->DisconnectPipeline();
+        //Get region of interest in anatLabelsMap
+        FloatVolume::Pointer smallVol = CopyVolumeRegion(anatLabelsMap, contactRegion);
 
-        double extraRadious = 1; // to include partial voxels it should be 1  (that gives 27 voxels) / to ONLY consider central point use zero - RIZ should be CHANGED to config value - computed as extraRadious * volSpacing
-        FloatVolume::SpacingType spacing = vol->GetSpacing();
-        Point3D extraRadiousIndex;
-        extraRadiousIndex[0] =extraRadious * spacing[0];
-        extraRadiousIndex[1] =extraRadious * spacing[1];
-        extraRadiousIndex[2] = extraRadious * spacing[2];
-
-        //1. Find start and end of electrode
-        Point3D contactStartPt, contactEndPt;
-        m_ElectrodeModel->CalcContactStartEnds(contactIndex, electrode->GetTargetPoint(), electrode->GetEntryPoint(), contactStartPt, contactEndPt);
-
-        ContactInfo::Pointer contact = electrode->GetOneContact(contactIndex);
-        Point3D contactCentralPt = contact->GetCentralPoint();
+        return smallVol;
+}
 
-        //2. convert to indexes
+    FloatVolume::RegionType SEEGContactsROIPipeline::CalcContactRegion(int contactIndex, ElectrodeInfo::Pointer electrode, bool useCylinder){
+        //Template only gives access to transforms (it is not modified)
+        FloatVolume::Pointer vol = m_TemplateVolume;
+        FloatVolume::SpacingType spacing = vol->GetSpacing();
         FloatVolume::RegionType contactRegion;
-        FloatVolume::IndexType contactCentralPtIndex, contactStartPtIndex;
-        vol->TransformPhysicalPointToIndex(contactStartPt, contactStartPtIndex);
-        vol->TransformPhysicalPointToIndex(contactCentralPt, contactCentralPtIndex);
-
-        //3. Calculate Bounding box (contact's region of interest)
-        CalcTrajBoundingBox(contactCentralPtIndex, contactCentralPtIndex, extraRadiousIndex, contactRegion);
-
-        //4. Get region of interest in anatLabelsMap
-        RegionOfInterestFilterType::Pointer regionOfInterestFilter = RegionOfInterestFilterType::New();
-        regionOfInterestFilter->SetInput(anatLabelsMap); //volume to reduce size
-        regionOfInterestFilter->SetRegionOfInterest(contactRegion);
-        FloatVolume::Pointer smallVol = regionOfInterestFilter->GetOutput();
-        regionOfInterestFilter->Update();
 
-        return smallVol;
-}
+        if (useCylinder == true) { // bounding box of the contact's cylinder
+            double extraRadious; // to include partial voxels it should be 1 - computed as extraRadious * volSpacing
+            extraRadious = m_ElectrodeModel->GetRecordingRadius(); // to consider recording radious as specified by model (defined following vonEllenrieder2014)
+            Point3D extraRadiousIndex;
+            extraRadiousIndex[0] =extraRadious * spacing[0];
+            extraRadiousIndex[1] =extraRadious * spacing[1];
+            extraRadiousIndex[2] = extraRadious * spacing[2];
+
+            //1. Find start and end of electrode
+            Point3D contactStartPt, contactEndPt;
+            m_ElectrodeModel->CalcContactStartEnds(contactIndex, electrode->GetTargetPoint(), electrode->GetEntryPoint(), contactStartPt, contactEndPt);
+
+            //2. convert to indexes
+            FloatVolume::IndexType contactStartPtIndex, contactEndPtIndex;
+            vol->TransformPhysicalPointToIndex(contactStartPt, contactStartPtIndex);
+            vol->TransformPhysicalPointToIndex(contactEndPt, contactEndPtIndex);
+
+            //3. Calculate Bounding box (contact's region of interest)
+            CalcTrajBoundingBox(contactEndPtIndex, contactStartPtIndex, extraRadiousIndex, contactRegion);
+        } else { // central point and 1 voxel around it
+            double extraRadious = 1; // to include partial voxels it should be 1  (that gives 27 voxels) / to ONLY consider central point use zero - RIZ should be CHANGED to config value - computed as extraRadious * volSpacing
+            Point3D extraRadiousIndex;
+            extraRadiousIndex[0] =extraRadious * spacing[0];
+            extraRadiousIndex[1] =extraRadious * spacing[1];
+            extraRadiousIndex[2] = extraRadious * spacing[2];
+
+            //1. convert central point to index
+            ContactInfo::Pointer contact = electrode->GetOneContact(contactIndex);
+            Point3D contactCentralPt = contact->GetCentralPoint();
+            FloatVolume::IndexType contactCentralPtIndex;
+            vol->TransformPhysicalPointToIndex(contactCentralPt, contactCentralPtIndex);
+
+            //2. Calculate Bounding box (contact's region of interest)
+            CalcTrajBoundingBox(contactCentralPtIndex, contactCentralPtIndex, extraRadiousIndex, contactRegion);
+        }
+        return contactRegion;
+    }
 
 // Channel based analysis of labels
     FloatVolume::Pointer SEEGContactsROIPipeline::CalcChannelRecordingArea(Point3D contact1Center, Point3D contact2Center,  double maxRadius){
@@ -631,9 +864,8 @@ SEEGContactsROIPipeline::~SEEGContactsROIPipeline() {
         //1. Find volume that corresponds to bipolar channel's recordings
         FloatVolume::Pointer anatLabelsOfChannel;
         anatLabelsOfChannel = CalcVolOfChannel(contact1Index, contact2Index, electrode, anatLabelsMap);  //considers volume that could record EEG - looks for area with largest presence in recording volume
-        if (useCylinder == true){ // if true use the whole contact's cylinder to estimate location /
-            anatLabelsOfChannel = CalcVolOfChannel(contact1Index, contact2Index, electrode, anatLabelsMap);  //considers volume that could record EEG - looks for area with largest presence in recording volume
-        } else { // if false use only central point and 1 voxel around it
+        // the channel model is always computed (GetNumberVoxelsInChannelModel / GetChannelModelVol)
+        if (useCylinder == false){ // if false use only central point and 1 voxel around it
             anatLabelsOfChannel = CalcVolOfCenterOfContact((contact2Index - contact1Index), electrode, anatLabelsMap); //only considers central point of contact
         }
 
@@ -670,12 +902,8 @@ SEEGContactsROIPipeline::~SEEGContactsROIPipeline() {
     FloatVolume::Pointer SEEGContactsROIPipeline::CalcVolOfChannel(int contact1Index, int contact2Index, ElectrodeInfo::Pointer electrode, FloatVolume::Pointer anatLabelsMap){
         //Find All labels within the volume of the contact and return a volume with the labels
 
-        //Empty vol to have access to transforms
-        FloatVolumeDuplicator::Pointer volDuplicator = FloatVolumeDuplicator::New();
-        volDuplicator->SetInputImage(m_TemplateVolume); //m_TemplateVolume should be clean! --> only to have appropriate size
-        volDuplicator->Update();
-        FloatVolume::Pointer vol = volDuplicator->GetOutput();
-        vol->DisconnectPipeline();
+        //Template only gives access to transforms (it is not modified)
+        FloatVolume::Pointer vol = m_TemplateVolume;
 
         double maxRadius;
         maxRadius = m_ElectrodeModel->GetRecordingRadius(); // to consider recording radious as specified by model (defined following vonEllenrieder2014) - Default 5mm
@@ -711,11 +939,7 @@ SEEGContactsROIPipeline::~SEEGContactsROIPipeline() {
 //        cout << "anatLabelsMap Origin: " << anatLabelsMap->GetOrigin() <<  "- Spacing: " << anatLabelsMap->GetSpacing() << " - Size: " << anatLabelsMap->GetRequestedRegion()<<endl;
 
         //5. Get bounding box - region of interest in anatLabelsMap
-        RegionOfInterestFilterType::Pointer regionOfInterestFilter = RegionOfInterestFilterType::New();
-        regionOfInterestFilter->SetInput(anatLabelsMap); //volume to reduce size
-        regionOfInterestFilter->SetRegionOfInterest(channelRegion);
-        FloatVolume::Pointer smallVolLabels = regionOfInterestFilter->GetOutput();
-        regionOfInterestFilter->Update();
+        FloatVolume::Pointer smallVolLabels = CopyVolumeRegion(anatLabelsMap, channelRegion);
 //        cout << "smallVolLabels Origin: " << smallVolLabels->GetOrigin() << "- Spacing: " << smallVolLabels->GetSpacing() << " - Size: " << smallVolLabels->GetRequestedRegion()<<endl;
 
         //6. Multiply model of recording by anatLabelsMap to obtain labels within the recording volume
@@ -735,6 +959,183 @@ SEEGContactsROIPipeline::~SEEGContactsROIPipeline() {
     }
 
 
+    void SEEGContactsROIPipeline::CalcElectrodeLabelHistograms(ElectrodeInfo::Pointer electrode, FloatVolume::Pointer anatLabelsMap, bool useCylinder,
+                                                               vector<LabelHistogram>& contactHistograms, vector<LabelHistogram>& channelHistograms){
+        // Labels of all the contacts and channels of the electrode in one walk over the atlas:
+        // each voxel is added to the contact regions and channel models it falls in
+        int nContacts = electrode->GetNumberOfContacts();
+        int nChannels = (nContacts > 1) ? nContacts - 1 : 0;
+        contactHistograms.assign(nContacts, LabelHistogram());
+        channelHistograms.assign(nChannels, LabelHistogram());
+
+        //1. Regions of the contacts (as CalcVolOfContact / CalcVolOfCenterOfContact) and models of the channels (as CalcVolOfChannel)
+        vector<FloatVolume::RegionType> regions;
+        for (int iContact=0; iContact<nContacts; iContact++) {
+            contactHistograms[iContact].m_NumVoxels = 0;
+            regions.push_back(CalcContactRegion(iContact, electrode, useCylinder));
+        }
+        vector<ChannelCapsule> capsules(nChannels);
+        for (int iChannel=0; iChannel<nChannels; iChannel++) { // channel's index is the first of its 2 contacts
+            channelHistograms[iChannel].m_NumVoxels = 0;
+            CalcChannelCapsule(iChannel, iChannel + 1, electrode, capsules[iChannel]);
+            regions.push_back(capsules[iChannel].m_Region);
+        }
+
+        //2. Region to walk: bounding box of all the regions (regions[iRegion] is contact iRegion, then channel iRegion - nContacts)
+        vector<long> firstIndex(3 * regions.size()), lastIndex(3 * regions.size());
+        long walkFirst[3] = { 0, 0, 0 };
+        long walkLast[3] = { -1, -1, -1 };
+        bool isWalkEmpty = true;
+        for (unsigned int iRegion=0; iRegion<regions.size(); iRegion++) {
+            bool isEmpty = false;
+            for (int i=0; i<3; i++) {
+                firstIndex[3 * iRegion + i] = regions[iRegion].GetIndex()[i];
+                lastIndex[3 * iRegion + i] = regions[iRegion].GetIndex()[i] + (long) regions[iRegion].GetSize()[i] - 1;
+                isEmpty = isEmpty || (lastIndex[3 * iRegion + i] < firstIndex[3 * iRegion + i]);
+            }
+            if (isEmpty) {
+                continue;
+            }
+            for (int i=0; i<3; i++) {
+                walkFirst[i] = isWalkEmpty ? firstIndex[3 * iRegion + i] : min(walkFirst[i], firstIndex[3 * iRegion + i]);
+                walkLast[i] = isWalkEmpty ? lastIndex[3 * iRegion + i] : max(walkLast[i], lastIndex[3 * iRegion + i]);
+            }
+            isWalkEmpty = false;
+        }
+
+        //3. Walk the region row by row, with the regions that contain the row
+        FloatVolume::SpacingType spacing = m_TemplateVolume->GetSpacing();
+        const float* buffer = anatLabelsMap->GetBufferPointer();
+        vector<unsigned int> rowRegions;
+        for (long z=walkFirst[2]; z<=walkLast[2]; z++) {
+            for (long y=walkFirst[1]; y<=walkLast[1]; y++) {
+                rowRegions.clear();
+                for (unsigned int iRegion=0; iRegion<regions.size(); iRegion++) {
+                    if (y >= firstIndex[3 * iRegion + 1] && y <= lastIndex[3 * iRegion + 1] &&
+                        z >= firstIndex[3 * iRegion + 2] && z <= lastIndex[3 * iRegion + 2] &&
+                        firstIndex[3 * iRegion] <= lastIndex[3 * iRegion]) {
+                        rowRegions.push_back(iRegion);
+                    }
+                }
+                if (rowRegions.empty()) {
+                    continue;
+                }
+                FloatVolume::IndexType rowIndex;
+                rowIndex[0] = walkFirst[0];
+                rowIndex[1] = y;
+                rowIndex[2] = z;
+                const float* row = buffer + anatLabelsMap->ComputeOffset(rowIndex) - walkFirst[0];
+
+                for (unsigned int iRow=0; iRow<rowRegions.size(); iRow++) {
+                    unsigned int iRegion = rowRegions[iRow];
+                    if (iRegion < (unsigned int) nContacts) {
+                        // contacts: all the voxels of the region
+                        LabelHistogram& histogram = contactHistograms[iRegion];
+                        for (long x=firstIndex[3 * iRegion]; x<=lastIndex[3 * iRegion]; x++) {
+                            histogram.m_NumVoxels++;
+                            if (row[x] > 0) {
+                                histogram.m_LabelCounts[(int) row[x]]++;
+                            }
+                        }
+                    } else {
+                        // channels: voxels of the region inside the model (labels are only counted here when using the cylinder)
+                        const ChannelCapsule& capsule = capsules[iRegion - nContacts];
+                        LabelHistogram& histogram = channelHistograms[iRegion - nContacts];
+                        double point[3];
+                        point[1] = capsule.m_RegionOrigin[1] + spacing[1] * (y - firstIndex[3 * iRegion + 1]);
+                        point[2] = capsule.m_RegionOrigin[2] + spacing[2] * (z - firstIndex[3 * iRegion + 2]);
+                        for (long x=firstIndex[3 * iRegion]; x<=lastIndex[3 * iRegion]; x++) {
+                            point[0] = capsule.m_RegionOrigin[0] + spacing[0] * (x - firstIndex[3 * iRegion]);
+                            if (!IsInsideChannelCapsule(capsule, point)) {
+                                continue;
+                            }
+                            histogram.m_NumVoxels++;
+                            if (useCylinder == true && row[x] > 0) {
+                                histogram.m_LabelCounts[(int) row[x]]++;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        //4. Without the cylinder, GetLabelsInChannel() uses the central region of contact (contact2Index - contact1Index)
+        if (useCylinder == false) {
+            for (int iChannel=0; iChannel<nChannels; iChannel++) {
+                channelHistograms[iChannel].m_LabelCounts = contactHistograms[1].m_LabelCounts;
+            }
+        }
+    }
+
+    void SEEGContactsROIPipeline::CalcElectrodeLabelHistogramsPerContact(ElectrodeInfo::Pointer electrode, FloatVolume::Pointer anatLabelsMap, bool useCylinder,
+                                                                         vector<LabelHistogram>& contactHistograms, vector<LabelHistogram>& channelHistograms){
+        // Labels of each contact and channel with their own volume (ITK filters and channel model image)
+        int nContacts = electrode->GetNumberOfContacts();
+        int nChannels = (nContacts > 1) ? nContacts - 1 : 0;
+        contactHistograms.assign(nContacts, LabelHistogram());
+        channelHistograms.assign(nChannels, LabelHistogram());
+
+        for (int iContact=0; iContact<nContacts; iContact++) {
+            vector<int> labelsCount = GetLabelsInContact(iContact, electrode, anatLabelsMap, contactHistograms[iContact].m_NumVoxels, useCylinder);
+            for (int iLabel=1; iLabel<labelsCount.size(); iLabel++) { // label 0 is never counted
+                if (labelsCount[iLabel] > 0) {
+                    contactHistograms[iContact].m_LabelCounts[iLabel] = labelsCount[iLabel];
+                }
+            }
+        }
+        for (int iChannel=0; iChannel<nChannels; iChannel++) { // channel's index is the first of its 2 contacts
+            vector<int> labelsCount = GetLabelsInChannel(iChannel, iChannel + 1, electrode, anatLabelsMap, useCylinder);
+            channelHistograms[iChannel].m_NumVoxels = GetNumberVoxelsInChannelModel();
+            for (int iLabel=1; iLabel<labelsCount.size(); iLabel++) {
+                if (labelsCount[iLabel] > 0) {
+                    channelHistograms[iChannel].m_LabelCounts[iLabel] = labelsCount[iLabel];
+                }
+            }
+        }
+    }
+
+    FloatVolume::Pointer SEEGContactsROIPipeline::CalcChannelModelVol(int contact1Index, int contact2Index, ElectrodeInfo::Pointer electrode){
+        // Same image as GetChannelModelVol() after GetLabelsInChannel(): 1 inside the model, 0 outside, over the channel's region
+        ChannelCapsule capsule;
+        CalcChannelCapsule(contact1Index, contact2Index, electrode, capsule);
+
+        FloatVolume::RegionType modelRegion;
+        modelRegion.SetSize(capsule.m_Region.GetSize());
+        FloatVolume::PointType modelOrigin;
+        for (int i=0; i<3; i++) {
+            modelOrigin[i] = capsule.m_RegionOrigin[i];
+        }
+        FloatVolume::Pointer channelModelVol = FloatVolume::New();
+        channelModelVol->SetRegions(modelRegion);
+        channelModelVol->SetOrigin(modelOrigin);
+        channelModelVol->SetSpacing(m_TemplateVolume->GetSpacing());
+        channelModelVol->Allocate();
+
+        FloatVolume::SpacingType spacing = channelModelVol->GetSpacing();
+        FloatVolumeRegionIteratorWithIndex it(channelModelVol, modelRegion);
+        for (it.GoToBegin(); !it.IsAtEnd(); ++it) {
+            double point[3];
+            for (int i=0; i<3; i++) {
+                point[i] = capsule.m_RegionOrigin[i] + spacing[i] * it.GetIndex()[i];
+            }
+            it.Set(IsInsideChannelCapsule(capsule, point) ? 1 : 0);
+        }
+        return channelModelVol;
+    }
+
+    int SEEGContactsROIPipeline::FindMostCommonLabel(const LabelHistogram& histogram, bool isChannel, float& proba){
+        int indexMaxLabel = isChannel ? 0 : -1;
+        int sumMaxLabel = isChannel ? 0 : -1;
+        for (map<int,int>::const_iterator itLabel = histogram.m_LabelCounts.begin(); itLabel != histogram.m_LabelCounts.end(); itLabel++) {
+            if ((isChannel && itLabel->second > sumMaxLabel) || (!isChannel && itLabel->second >= sumMaxLabel)) {  // using > or >= changes the results when 0.5 proba
+                sumMaxLabel = itLabel->second;
+                indexMaxLabel = itLabel->first;
+            }
+        }
+        proba = float(sumMaxLabel) / float(histogram.m_NumVoxels);
+        return indexMaxLabel;
+    }
+
     FloatVolume::Pointer SEEGContactsROIPipeline::GetChannelModelVol(){
         FloatVolume::Pointer channelRecVol = m_ChannelModel->GetBipolarChannelVolume();
         return channelRecVol;
@@ -752,4 +1153,84 @@ SEEGContactsROIPipeline::~SEEGContactsROIPipeline() {
     // do nothing
     }
 
+    void SEEGContactsROIPipeline::CalcChannelCapsule(int contact1Index, int contact2Index, ElectrodeInfo::Pointer electrode, ChannelCapsule& capsule) {
+        // Same region as CalcVolOfChannel() and same model as BipolarChannelModel
+        FloatVolume::Pointer vol = m_TemplateVolume;
+        double maxRadius = m_ElectrodeModel->GetRecordingRadius(); // to consider recording radious as specified by model (defined following vonEllenrieder2014) - Default 5mm
+        FloatVolume::SpacingType spacing = vol->GetSpacing();
+        Point3D extraRadiousIndex;
+        extraRadiousIndex[0] =maxRadius * spacing[0];
+        extraRadiousIndex[1] =maxRadius * spacing[1];
+        extraRadiousIndex[2] = maxRadius * spacing[2];
+
+        //1. Channel's region: from beginning of contact1 to end of contact2
+        Point3D contact1StartPt, contact1EndPt;
+        Point3D contact2StartPt, contact2EndPt;
+        m_ElectrodeModel->CalcContactStartEnds(contact1Index, electrode->GetTargetPoint(), electrode->GetEntryPoint(), contact1StartPt, contact1EndPt);
+        m_ElectrodeModel->CalcContactStartEnds(contact2Index, electrode->GetTargetPoint(), electrode->GetEntryPoint(), contact2StartPt, contact2EndPt);
+        FloatVolume::IndexType contact1StartPtIndex, contact2EndPtIndex;
+        vol->TransformPhysicalPointToIndex(contact1StartPt, contact1StartPtIndex);
+        vol->TransformPhysicalPointToIndex(contact2EndPt, contact2EndPtIndex);
+        CalcTrajBoundingBox(contact1StartPtIndex, contact2EndPtIndex, extraRadiousIndex, capsule.m_Region);
+
+        // origin of the model image (BipolarChannelModel::GenerateImage)
+        Point3D regionOriginPt;
+        vol->TransformIndexToPhysicalPoint(capsule.m_Region.GetIndex(), regionOriginPt);
+
+        //2. Model: spheres at the contacts' centers and a tube of the same length, starting at contact1
+        Point3D contact1Center = m_ElectrodeModel->SEEGCalcContactPosition(contact1Index, electrode->GetTargetPoint(), electrode->GetEntryPoint(), 0);
+        Point3D contact2Center = m_ElectrodeModel->SEEGCalcContactPosition(contact2Index, electrode->GetTargetPoint(), electrode->GetEntryPoint(), 0);
+        Vector3D_lf pt1(contact1Center[0], contact1Center[1], contact1Center[2]);
+        Vector3D_lf pt2(contact2Center[0], contact2Center[1], contact2Center[2]);
+        capsule.m_TubeHeight = norm(pt2 - pt1);
+        capsule.m_Radius = (int) maxRadius; // BipolarChannelModel::New() takes integer radii
+        for (int i=0; i<3; i++) {
+            capsule.m_RegionOrigin[i] = regionOriginPt[i];
+            capsule.m_Sphere1[i] = contact1Center[i];
+            capsule.m_Sphere2[i] = contact2Center[i];
+            // the tube's transform gets its center after its offset: itk recomputes the offset as (offset + center) - center
+            double centralPtContacts = (contact1Center[i] + contact2Center[i]) / 2;
+            capsule.m_TubeOffset[i] = (contact1Center[i] + centralPtContacts) - centralPtContacts;
+        }
+    }
+
+    bool SEEGContactsROIPipeline::IsInsideChannelCapsule(const ChannelCapsule& capsule, const double point[3]) {
+        // Tests of the spatial objects of BipolarChannelModel (sphere1, tube, sphere2), with the same
+        // operations so that voxels on the border of the model are classified the same way
+        double radius = capsule.m_Radius;
+        const double* sphereCenters[2] = { capsule.m_Sphere1, capsule.m_Sphere2 };
+        for (int iSphere=0; iSphere<2; iSphere++) {
+            // EllipseSpatialObject: sum of (x - center)^2 / radius^2 <= 1 (a radius of 0 only contains the center)
+            double r = 0;
+            for (int i=0; i<3; i++) {
+                double x = point[i] - sphereCenters[iSphere][i];
+                if (radius > 0) {
+                    r += (x * x) / (radius * radius);
+                } else if (x != 0) {
+                    r = 2;
+                    break;
+                }
+            }
+            if (r <= 1) {
+                return true;
+            }
+        }
+
+        // TubeSpatialObject with points (0,0,0) and (0,0,height) and flat ends: projection within the segment
+        // and distance to the axis <= radius (the model is not rotated along the electrode)
+        double x[3];
+        for (int i=0; i<3; i++) {
+            x[i] = point[i] - capsule.m_TubeOffset[i];
+        }
+        double lambda = (capsule.m_TubeHeight * x[2]) / (capsule.m_TubeHeight * capsule.m_TubeHeight);
+        if (lambda >= 0.0 && lambda <= 1.0) {
+            double dz = lambda * capsule.m_TubeHeight - x[2];
+            double squaredDist = x[0] * x[0] + x[1] * x[1] + dz * dz;
+            if (squaredDist <= radius * radius) {
+                return true;
+            }
+        }
+        return false;
+    }
+
 }
@@ -13,6 +13,7 @@
 
 // Header files to include
 #include <string>
+#include <map>
 #include "BasicTypes.h"
 #include "MathUtils.h"
 #include "VolumeTypes.h"
@@ -39,6 +40,40 @@ using namespace itk;
 
 namespace seeg {
 
+  /**
+   * Voxels of a target map with a non-zero value within a region, in raster order.
+   * Extracted once per trajectory line and shared by all the depths evaluated on it.
+   * m_X, m_Y, m_Z are the coordinates of the voxels (index * spacing, as in CalcContactsSquareDistances).
+   */
+  struct SparseTargetVoxels {
+      FloatVolume::Pointer m_TargetMap;
+      vector<FloatVolume::IndexType> m_Indices;
+      vector<float> m_Values;
+      vector<float> m_X;
+      vector<float> m_Y;
+      vector<float> m_Z;
+  };
+
+  /**
+   * State of CalcSparseRecording() kept between the depths of a line: the voxel farthest from the contacts
+   * at the previous depth, which starts the search of the next one (consecutive depths differ by one step).
+   */
+  struct SparseRecordingHint {
+      bool m_HasFarthestVoxel;
+      FloatVolume::IndexType m_FarthestVoxel;
+
+      SparseRecordingHint() : m_HasFarthestVoxel(false) {}
+  };
+
+  /**
+   * Labels of a contact or bipolar channel: number of voxels per label (labels > 0 only)
+   * and number of voxels of the contact's region / channel's model.
+   */
+  struct LabelHistogram {
+      map<int, int> m_LabelCounts;
+      int m_NumVoxels;
+  };
+
 
   class SEEGContactsROIPipeline {
 
@@ -82,14 +117,51 @@ namespace seeg {
 
         FloatVolume::Pointer CompSquareDistMapFromPoint(FloatVolume::Pointer inputVol, FloatVolume::RegionType region);
 
+        /**
+         * Recording weight of the electrode's contacts. The returned image only covers the
+         * electrode's bounding region (its largest possible region is that ROI) but has the
+         * template's origin and spacing, so indices are the ones of the full volume.
+         * The image is a copy owned by the caller.
+         */
         FloatVolume::Pointer GetRecordedVolPerElectrode(ElectrodeInfo::Pointer electrode);
 
+        /**
+         * Recording weight multiplied by targetDistMap, computed only within the electrode's region.
+         * recordingMap is an ROI image (see GetRecordedVolPerElectrode); if it already points to a map
+         * from a previous call, its buffer is reused.
+         */
         void CalcRecordingMap(FloatVolume::Pointer targetDistMap, FloatVolume::Pointer& recordingMap, ElectrodeInfo::Pointer electrode);
 
         void CalcRecordingMap(vector<FloatVolume::Pointer> targetDistMaps, vector<FloatVolume::Pointer> &recordingMaps, ElectrodeInfo::Pointer electrode);
 
+        /**
+         * Sum of the recording map computed by the last call to CalcRecordingMap()
+         * (iTarget is the index of the target for the vector version)
+         */
+        double GetLastRecordingSum(int iTarget = 0);
+
+        /** Bounding region of the electrode (trajectory + recording radius, padded by 1 voxel) */
+        FloatVolume::RegionType CalcElectrodeRegion(ElectrodeInfo::Pointer electrode);
+
+        /** Stores the non-zero voxels of targetDistMap within region (see SparseTargetVoxels) */
+        void ExtractSparseTargetVoxels(FloatVolume::Pointer targetDistMap, const FloatVolume::RegionType& region, SparseTargetVoxels& targetVoxels);
+
+        /**
+         * Same sum and number of contacts with a recording > 0 as CalcRecordingMap() + TestMaximizationOverlap,
+         * but only visiting the target voxels: the recording map itself is not computed.
+         * targetVoxels must have been extracted from a region that contains the electrode's region.
+         *
+         * @param hint previous depth of the same line (may be NULL), updated with this depth
+         */
+        void CalcSparseRecording(const SparseTargetVoxels& targetVoxels, ElectrodeInfo::Pointer electrode, const vector<Point3D>& contactPoints,
+                                 double& recordingSum, int& nContactsInside, SparseRecordingHint* hint = NULL);
+
         void CalcTrajBoundingBox(FloatVolume::IndexType entryPointIndex, FloatVolume::IndexType targetPointIndex, Point3D maxRadius, FloatVolume::RegionType& region);
 
+        /**
+         * Label counts of a contact / channel. anatLabelsMap and the template are only read, so
+         * several pipelines (one per thread) can label contacts of the same atlas in parallel.
+         */
         vector<int> GetLabelsInContact(int contactIndex, ElectrodeInfo::Pointer electrode, FloatVolume::Pointer anatLabelsMap, int &voxelsInContactVol, bool useCylinder);
 
         FloatVolume::Pointer CalcVolOfContact(int contactIndex, ElectrodeInfo::Pointer electrode, FloatVolume::Pointer anatLabelsMap);
@@ -105,6 +177,32 @@ namespace seeg {
 
         FloatVolume::Pointer CalcVolOfChannel(int contact1Index, int contact2Index, ElectrodeInfo::Pointer electrode, FloatVolume::Pointer anatLabelsMap);
 
+        /**
+         * Label histograms of all the contacts and bipolar channels (contact i to i+1) of the electrode, in one walk
+         * over the atlas and without creating any volume. Counts are the ones of GetLabelsInContact() and
+         * GetLabelsInChannel() (+ GetNumberVoxelsInChannelModel()) with the same useCylinder.
+         */
+        void CalcElectrodeLabelHistograms(ElectrodeInfo::Pointer electrode, FloatVolume::Pointer anatLabelsMap, bool useCylinder,
+                                          vector<LabelHistogram>& contactHistograms, vector<LabelHistogram>& channelHistograms);
+
+        /**
+         * Same histograms as CalcElectrodeLabelHistograms(), computed contact by contact and channel by channel
+         * with GetLabelsInContact() and GetLabelsInChannel() (+ GetNumberVoxelsInChannelModel()). Slower, kept
+         * as reference for the one-walk counts.
+         */
+        void CalcElectrodeLabelHistogramsPerContact(ElectrodeInfo::Pointer electrode, FloatVolume::Pointer anatLabelsMap, bool useCylinder,
+                                                    vector<LabelHistogram>& contactHistograms, vector<LabelHistogram>& channelHistograms);
+
+        /** Channel model volume (1 inside, 0 outside), same as GetChannelModelVol() after GetLabelsInChannel() */
+        FloatVolume::Pointer CalcChannelModelVol(int contact1Index, int contact2Index, ElectrodeInfo::Pointer electrode);
+
+        /**
+         * Most common label of a histogram, proba being its count divided by m_NumVoxels (NaN when
+         * both are 0). Channels keep the first label with the highest count (label 0 and count 0 if
+         * there is none), contacts the last one (label -1 and count -1 if there is none).
+         */
+        static int FindMostCommonLabel(const LabelHistogram& histogram, bool isChannel, float& proba);
+
 //Getters and Setters
         FloatVolume::Pointer GetTemplateVol();
 
@@ -132,10 +230,75 @@ namespace seeg {
   private:
         void InitPipeline();
 
+        /**
+         * Analytic version of BipolarChannelModel over the channel's region: spheres at the contacts' centers and
+         * a tube along +z from contact1 (the spatial objects are only translated). Model image voxel k has its
+         * center at m_RegionOrigin + spacing * k.
+         */
+        struct ChannelCapsule {
+            FloatVolume::RegionType m_Region;
+            double m_RegionOrigin[3];
+            double m_Sphere1[3];
+            double m_Sphere2[3];
+            double m_TubeOffset[3];
+            double m_TubeHeight;
+            double m_Radius;
+        };
+
+        void CalcChannelCapsule(int contact1Index, int contact2Index, ElectrodeInfo::Pointer electrode, ChannelCapsule& capsule);
+
+        static bool IsInsideChannelCapsule(const ChannelCapsule& capsule, const double point[3]);
+
+        /** Region of a contact: bounding box of its cylinder, or its central voxel and 1 voxel around it */
+        FloatVolume::RegionType CalcContactRegion(int contactIndex, ElectrodeInfo::Pointer electrode, bool useCylinder);
+
+        /**
+         * Voxel centres (index * spacing, in mm) of the contacts, stopping at the first contact outside
+         * the electrode's region. These are the seeds of the distance of each voxel to its nearest contact.
+         *
+         * @return number of seeds
+         */
+        int CalcContactSeeds(ElectrodeInfo::Pointer electrode, const FloatVolume::RegionType& electrodeRegion,
+                             vector<float>& seedX, vector<float>& seedY, vector<float>& seedZ);
+
+        /**
+         * Maximum over the voxels of region of the squared distance to the nearest seed (same value as the
+         * maximum found by CalcContactsSquareDistances) without visiting every voxel
+         *
+         * @param farthestVoxel where to store the voxel of the maximum
+         * @param startVoxel voxel whose distance bounds the maximum from below before the search (may be NULL
+         *        or outside region); only prunes more boxes, the maximum is the same
+         */
+        float CalcMaxSquareDistanceToSeeds(const FloatVolume::RegionType& region,
+                                           const vector<float>& seedX, const vector<float>& seedY, const vector<float>& seedZ,
+                                           FloatVolume::IndexType& farthestVoxel, const FloatVolume::IndexType* startVoxel = NULL);
+
+        /**
+         * Fills m_ContactsVol (electrode's region) with the squared distance (mm) of each voxel to the
+         * nearest contact voxel. Replaces the Danielsson/max/invert/multiply chain of CompSquareDistMapFromPoint().
+         *
+         * @return the maximum distance within the region (-1 if no contact is inside the region)
+         */
+        float CalcContactsSquareDistances(ElectrodeInfo::Pointer electrode);
+
+        /** Replaces the squared distances of m_ContactsVol by the recording weights of the electrode's contacts */
+        void CalcRecordingWeights(ElectrodeInfo::Pointer electrode);
+
+        /**
+         * Copy of the voxels of vol within region, as the output of RegionOfInterestImageFilter.
+         * region must be inside vol (CalcTrajBoundingBox crops it to the template).
+         */
+        FloatVolume::Pointer CopyVolumeRegion(FloatVolume::Pointer vol, const FloatVolume::RegionType& region);
+
+        /** (Re)allocates roiVol with the template's geometry but only over region */
+        void AllocateROIVolume(FloatVolume::Pointer& roiVol, const FloatVolume::RegionType& region);
+
         /** Pointer to the template volume */
         FloatVolume::Pointer m_TemplateVolume; // for volume dimension, spacing, etc
         SEEGElectrodeModel::Pointer m_ElectrodeModel;
         BipolarChannelModel::Pointer m_ChannelModel; // Bipolar channel model
+        FloatVolume::Pointer m_ContactsVol; // ROI buffer with the contacts' distances/weights (reused between calls)
+        vector<double> m_LastRecordingSums; // sums of the last recording maps
     };
 }
 #endif // SEEGCONTACTSROIPIPELINE_H
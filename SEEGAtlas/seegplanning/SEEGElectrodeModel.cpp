@@ -2,7 +2,9 @@
 
 namespace seeg {
 
+#ifndef SEEGATLAS_NO_SERIALIZER
     ObjectSerializationMacro(seeg::SEEGElectrodeModel);
+#endif
 
     SEEGElectrodeModel::SEEGElectrodeModel() 
     {
@@ -221,6 +223,7 @@ namespace seeg {
 
     }
 
+#ifndef SEEGATLAS_NO_SERIALIZER
     void SEEGElectrodeModel::Serialize(Serializer * ser)
     {
         ::Serialize(ser, "ElectrodeId", m_ElectrodeId);
@@ -235,4 +238,5 @@ namespace seeg {
         ::Serialize(ser, "NumContacts", m_NumContacts);
         ::Serialize(ser, "TipOffset", m_TipOffset);
     }
+#endif
 }
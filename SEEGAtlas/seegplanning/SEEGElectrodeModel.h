@@ -5,7 +5,9 @@
 #include "BasicTypes.h"
 #include "FileUtils.h"
 #include "MathUtils.h"
+#ifndef SEEGATLAS_NO_SERIALIZER // IBIS's serializer (not available without IbisLib, see ReadElectrodeModelFile())
 #include "serializer.h"
+#endif
 
 namespace seeg {
 
@@ -16,7 +18,9 @@ class SEEGElectrodeModel
 {
 public:
     
+#ifndef SEEGATLAS_NO_SERIALIZER
     virtual void Serialize(Serializer * ser);
+#endif
 
 private:
     std::string m_ElectrodeId;
@@ -37,6 +41,9 @@ public:
 
     SEEGElectrodeModel();
     static SEEGElectrodeModel::Pointer New();
+    static SEEGElectrodeModel::Pointer New(std::string id, std::string name, double contactDiameter, double contactHeight, double spacing, int numContacts, double tipOffset, double tipHeight, double recRadious, double pegHeight, double pegDiameter) {
+        return SEEGElectrodeModel::Pointer(new SEEGElectrodeModel(id, name, contactDiameter, contactHeight, spacing, numContacts, tipOffset, tipHeight, recRadious, pegHeight, pegDiameter));
+    }
 
 protected:
     SEEGElectrodeModel(std::string id, std::string name, double contactDiameter, double contactHeight, double spacing, int numContacts, double tipOffset, double tipHeight, double recRadious,double pegHeight, double pegDiameter){
@@ -142,7 +149,9 @@ public:
 
 };
 
+#ifndef SEEGATLAS_NO_SERIALIZER
 ObjectSerializationHeaderMacro(SEEGElectrodeModel);
+#endif
 
 }
 
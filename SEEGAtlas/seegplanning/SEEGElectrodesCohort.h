@@ -6,7 +6,6 @@
 //#include "SEEGTrajectoryROIPipeline.h"
 #include "SEEGElectrodeModel.h"
 #include "ElectrodeInfo.h"
-#include <SEEGPointRepresentation.h>
 
 using namespace std;
 namespace seeg {
@@ -28,8 +27,6 @@ class SEEGElectrodesCohort
 
         float m_SpacingResolution; // spacing to consider when looking at all the points in a trajectory
 
-        SEEGPointRepresentation::Pointer m_Points;
-
     public:
         // smart pointer
         typedef mrilSmartPtr<SEEGElectrodesCohort> Pointer;
@@ -6,8 +6,13 @@
 //#include "itkStatisticsImageFilter.h"
 
 #include <vector>
+#include <list>
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <sys/stat.h>
+#include <QFile>
+#include <QXmlStreamReader>
 
 
 using namespace std;
@@ -281,11 +286,55 @@ namespace seeg {
 
     GroupInfoMapType m_GroupInfoMap;
 
+    // default budget of the volume cache: 16 float volumes of 256^3 voxels
+    static const unsigned long long DEFAULT_VOLUME_CACHE_BUDGET = 1024ULL * 1024 * 1024;
+
+    // freshness of a cached volume: size and modification time with nanoseconds (files rewritten within
+    // the same second, e.g. by the batch, are not taken for the cached ones)
+    struct CachedFileStamp {
+        long long size;
+        long long seconds;
+        long long nanoseconds;
+
+        bool operator==(const CachedFileStamp& other) const {
+            return size == other.size && seconds == other.seconds && nanoseconds == other.nanoseconds;
+        }
+    };
+
+    struct CachedVolume {
+        std::string filename;
+        CachedFileStamp fileStamp;
+        itk::DataObject::Pointer volume;
+        unsigned long long numBytes;
+        std::list<std::string>::iterator lruPosition;
+    };
+
+    static std::map<std::string, CachedVolume> m_VolumeCache;
+    static std::list<std::string> m_VolumeCacheLru; // keys of m_VolumeCache, most recently used first
+    static unsigned long long m_VolumeCacheBudget = DEFAULT_VOLUME_CACHE_BUDGET;
+    static VolumeCacheStatistics m_VolumeCacheStatistics;
+    static std::mutex m_VolumeCacheMutex;
+    static std::mutex m_VolumeReadMutex; // the MINC reader (HDF5) is not thread-safe: one read at a time
+
 
 /***************** PRIVATE FUNCTIONS PROTOTYPE *******************/
 
     static void CreateMRIGroup (const std::string& groupName);
 
+    template <class VolumeType>
+    static typename VolumeType::Pointer OpenCachedVolume(const std::string& groupName, const std::string& name, const char* pixelTypeName,
+                                                         typename VolumeType::Pointer (*readVolume)(const std::string&));
+
+    template <class VolumeType>
+    static typename VolumeType::Pointer OpenCachedVolumeFile(const std::string& cacheKey, const std::string& filename,
+                                                             typename VolumeType::Pointer (*readVolume)(const std::string&), bool* isCacheHit);
+
+    static std::string GetFileCacheKey(const std::string& filename, const char* pixelTypeName);
+
+    static bool GetCachedFileStamp(const std::string& filename, CachedFileStamp& fileStamp);
+
+    static void RemoveCachedVolume(std::map<std::string, CachedVolume>::iterator itCache);
+
 
 /***************** PUBLIC FUNCTIONS IMPL *************************/
 
@@ -375,21 +424,20 @@ namespace seeg {
         if (!VolumeExists(groupName, gralName+DIM0)) {
             cout << "Volume Not Found in OpenFloatVectorVolume. group: " << groupName << " name: " << gralName+DIM0 << std::endl;
         }
-        DataSetInfo* ds;
         FloatVolume::Pointer vol;
         string str[3];
         str[0].append(DIM0);
         str[1].append(DIM1);
         str[2].append(DIM2);
         for (int i=0; i<3; i++){
-            ds = GetDatasetInfo(groupName, gralName + str[i]);
-            vol = ReadFloatVolume(ds->filename);
+            vol = OpenCachedVolume<FloatVolume>(groupName, gralName + str[i], "float", ReadFloatVolume);
             vecVol.push_back(vol);
         }
     }
 
     // reset UI
     void ClearAll() {
+        std::lock_guard<std::mutex> lock(m_VolumeCacheMutex); // m_GroupInfoMap is read by OpenCachedVolume()
         m_GroupInfoMap.clear();
     }
 
@@ -405,6 +453,7 @@ namespace seeg {
             return;
         }
 
+        std::lock_guard<std::mutex> lock(m_VolumeCacheMutex); // m_GroupInfoMap is read by OpenCachedVolume()
         if (m_GroupInfoMap.find(groupName) == m_GroupInfoMap.end()) {
             CreateMRIGroup(groupName);
         }
@@ -433,7 +482,7 @@ namespace seeg {
             cout << "Volume Not Found in OpenFloatVolume. group: " << groupName << " name: " << name << std::endl;
             return FloatVolume::Pointer();
         }
-        return ReadFloatVolume(m_GroupInfoMap[groupName].datasetMap[name].filename);
+        return OpenCachedVolume<FloatVolume>(groupName, name, "float", ReadFloatVolume);
     }
 
     IntVolume::Pointer OpenIntVolume (const std::string& groupName, const std::string& name) {
@@ -441,7 +490,7 @@ namespace seeg {
             cout << "Volume Not Found in OpenIntVolume. group: " << groupName << " name: " << name << std::endl;
             return IntVolume::Pointer();
         }
-        return ReadIntVolume(m_GroupInfoMap[groupName].datasetMap[name].filename);
+        return OpenCachedVolume<IntVolume>(groupName, name, "int", ReadIntVolume);
     }
 
     ByteVolume::Pointer OpenByteVolume (const std::string& groupName, const std::string& name) {
@@ -450,7 +499,46 @@ namespace seeg {
             return ByteVolume::Pointer();
         }
 
-        return ReadByteVolume(m_GroupInfoMap[groupName].datasetMap[name].filename);
+        return OpenCachedVolume<ByteVolume>(groupName, name, "byte", ReadByteVolume);
+    }
+
+    void SetVolumeCacheMemoryBudget(unsigned long long numBytes) {
+        std::lock_guard<std::mutex> lock(m_VolumeCacheMutex);
+        m_VolumeCacheBudget = numBytes;
+        while (!m_VolumeCacheLru.empty() && m_VolumeCacheStatistics.memoryUsed > m_VolumeCacheBudget) {
+            RemoveCachedVolume(m_VolumeCache.find(m_VolumeCacheLru.back()));
+            m_VolumeCacheStatistics.numEvictions++;
+        }
+    }
+
+    FloatVolume::Pointer OpenCachedFloatVolume(const std::string& filename, bool* isCacheHit) {
+        return OpenCachedVolumeFile<FloatVolume>(GetFileCacheKey(filename, "float"), filename, ReadFloatVolume, isCacheHit);
+    }
+
+    void RemoveCachedFloatVolume(const std::string& filename) {
+        std::lock_guard<std::mutex> lock(m_VolumeCacheMutex);
+        std::map<std::string, CachedVolume>::iterator itCache = m_VolumeCache.find(GetFileCacheKey(filename, "float"));
+        if (itCache != m_VolumeCache.end()) {
+            RemoveCachedVolume(itCache);
+        }
+    }
+
+    unsigned long long GetVolumeCacheMemoryBudget() {
+        std::lock_guard<std::mutex> lock(m_VolumeCacheMutex);
+        return m_VolumeCacheBudget;
+    }
+
+    void ClearVolumeCache() {
+        std::lock_guard<std::mutex> lock(m_VolumeCacheMutex);
+        m_VolumeCache.clear();
+        m_VolumeCacheLru.clear();
+        m_VolumeCacheStatistics.numVolumes = 0;
+        m_VolumeCacheStatistics.memoryUsed = 0;
+    }
+
+    VolumeCacheStatistics GetVolumeCacheStatistics() {
+        std::lock_guard<std::mutex> lock(m_VolumeCacheMutex);
+        return m_VolumeCacheStatistics;
     }
 
     GeneralTransform::Pointer OpenTransform(const std::string& groupName, bool invert) {
@@ -491,11 +579,16 @@ namespace seeg {
     }
 
     DataSetInfo * GetDatasetInfo(const std::string& groupName, const std::string& name) {
-        if (!VolumeExists(groupName, name)) {
+        std::lock_guard<std::mutex> lock(m_VolumeCacheMutex); // volumes are opened from several threads
+        GroupInfoMapType::iterator itGroup = m_GroupInfoMap.find(groupName);
+        if (itGroup == m_GroupInfoMap.end()) {
+            return 0;
+        }
+        DataSetInfoMapType::iterator itDataset = itGroup->second.datasetMap.find(name);
+        if (itDataset == itGroup->second.datasetMap.end()) {
             return 0;
-        } else {
-            return &(m_GroupInfoMap[groupName].datasetMap[name]);
         }
+        return &(itDataset->second);
     }
 
     bool VolumeExists(const std::string& groupName, const std::string& name) {
@@ -506,6 +599,92 @@ namespace seeg {
         return false;
     }
 
+    bool ReadAtlasLabelsFile(const std::string& filename, std::map<int, std::string>& atlasLabels) {
+        QFile xmlFileAtlasLabels(QString::fromStdString(filename));
+        if (!xmlFileAtlasLabels.open(QFile::ReadOnly | QFile::Text)) {
+            return false;
+        }
+
+        // <Label><Name>...</Name><Number>...</Number></Label>
+        QXmlStreamReader xmlReaderAtlasLabels(&xmlFileAtlasLabels);
+        while (!xmlReaderAtlasLabels.atEnd() && !xmlReaderAtlasLabels.hasError()) {
+            while (xmlReaderAtlasLabels.readNextStartElement()) {
+                if (xmlReaderAtlasLabels.name() == QLatin1String("Label")) { // now we are inside label
+                    QString qsLabelName, qsLabelNumber;
+                    while (xmlReaderAtlasLabels.readNextStartElement()) {
+                        if (xmlReaderAtlasLabels.name() == QLatin1String("Name")) {
+                            qsLabelName = xmlReaderAtlasLabels.readElementText();
+                        } else if (xmlReaderAtlasLabels.name() == QLatin1String("Number")) {
+                            qsLabelNumber = xmlReaderAtlasLabels.readElementText();
+                        }
+                    }
+                    // once we have the name and number we can input in the map var
+                    atlasLabels[qsLabelNumber.toInt()] = qsLabelName.toStdString();
+                }
+            }
+        }
+        return true;
+    }
+
+    bool ReadElectrodeModelFile(const std::string& filename, SEEGElectrodeModel::Pointer& electrodeModel) {
+        QFile xmlFileElectrodeModel(QString::fromStdString(filename));
+        if (!xmlFileElectrodeModel.open(QFile::ReadOnly | QFile::Text)) {
+            return false;
+        }
+
+        // <configuration><ElectrodeId>...</ElectrodeId><ElectrodeName>...</ElectrodeName>...</configuration>
+        SEEGElectrodeModel::Pointer defaultModel = SEEGElectrodeModel::New();
+        std::string id = defaultModel->GetElectrodeId();
+        std::string name = defaultModel->GetElectrodeName();
+        double tipContactHeight = defaultModel->GetTipContactHeight();
+        double recordingRadius = defaultModel->GetRecordingRadius();
+        double pegHeight = defaultModel->GetPegHeight();
+        double pegDiameter = defaultModel->GetPegDiameter();
+        double contactDiameter = defaultModel->GetContactDiameter();
+        double contactHeight = defaultModel->GetContactHeight();
+        double contactSpacing = defaultModel->GetInterContactDistance();
+        int numContacts = defaultModel->GetNumContacts();
+        double tipOffset = defaultModel->GetTipOffset();
+
+        QXmlStreamReader xmlReaderElectrodeModel(&xmlFileElectrodeModel);
+        if (xmlReaderElectrodeModel.readNextStartElement()) { // root element
+            while (xmlReaderElectrodeModel.readNextStartElement()) {
+                QString elementName = xmlReaderElectrodeModel.name().toString();
+                QString value = xmlReaderElectrodeModel.readElementText();
+                if (elementName == QLatin1String("ElectrodeId")) {
+                    id = value.toStdString();
+                } else if (elementName == QLatin1String("ElectrodeName")) {
+                    name = value.toStdString();
+                } else if (elementName == QLatin1String("TipContactHeight")) {
+                    tipContactHeight = value.toDouble();
+                } else if (elementName == QLatin1String("RecordingRadius")) {
+                    recordingRadius = value.toDouble();
+                } else if (elementName == QLatin1String("PegHeight")) {
+                    pegHeight = value.toDouble();
+                } else if (elementName == QLatin1String("PegDiameter")) {
+                    pegDiameter = value.toDouble();
+                } else if (elementName == QLatin1String("ContactDiameter")) {
+                    contactDiameter = value.toDouble();
+                } else if (elementName == QLatin1String("ContactHeight")) {
+                    contactHeight = value.toDouble();
+                } else if (elementName == QLatin1String("ContactSpacing")) {
+                    contactSpacing = value.toDouble();
+                } else if (elementName == QLatin1String("NumContacts")) {
+                    numContacts = value.toInt();
+                } else if (elementName == QLatin1String("TipOffset")) {
+                    tipOffset = value.toDouble();
+                }
+            }
+        }
+        if (xmlReaderElectrodeModel.hasError()) {
+            return false;
+        }
+
+        electrodeModel = SEEGElectrodeModel::New(id, name, contactDiameter, contactHeight, contactSpacing, numContacts, tipOffset,
+                                                 tipContactHeight, recordingRadius, pegHeight, pegDiameter);
+        return true;
+    }
+
 
 // RIZ July2013: Some of these functions are likely to be moved to PathCohort!!!!
 /*    SEEGPathPlanner::Pointer GetSEEGPathPlanners(int indTarget) {
@@ -541,6 +720,106 @@ namespace seeg {
 
         }
 
+        template <class VolumeType>
+        static typename VolumeType::Pointer OpenCachedVolume(const std::string& groupName, const std::string& name, const char* pixelTypeName,
+                                                             typename VolumeType::Pointer (*readVolume)(const std::string&)) {
+            DataSetInfo* ds = GetDatasetInfo(groupName, name);
+            if (ds == NULL) {
+                return typename VolumeType::Pointer();
+            }
+            std::string filename;
+            {
+                std::lock_guard<std::mutex> lock(m_VolumeCacheMutex); // LoadVolume() may replace the entry meanwhile
+                filename = ds->filename;
+            }
+            return OpenCachedVolumeFile<VolumeType>(groupName + "/" + name + "/" + pixelTypeName, filename, readVolume, NULL);
+        }
+
+        template <class VolumeType>
+        static typename VolumeType::Pointer OpenCachedVolumeFile(const std::string& cacheKey, const std::string& filename,
+                                                                 typename VolumeType::Pointer (*readVolume)(const std::string&), bool* isCacheHit) {
+            CachedFileStamp fileStamp;
+            const bool hasFileStamp = GetCachedFileStamp(filename, fileStamp);
+            if (isCacheHit != NULL) {
+                *isCacheHit = false;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_VolumeCacheMutex);
+                std::map<std::string, CachedVolume>::iterator itCache = m_VolumeCache.find(cacheKey);
+                if (itCache != m_VolumeCache.end()) {
+                    if (itCache->second.filename == filename && hasFileStamp && itCache->second.fileStamp == fileStamp) {
+                        m_VolumeCacheLru.splice(m_VolumeCacheLru.begin(), m_VolumeCacheLru, itCache->second.lruPosition);
+                        m_VolumeCacheStatistics.numHits++;
+                        if (isCacheHit != NULL) {
+                            *isCacheHit = true;
+                        }
+                        return static_cast<VolumeType*>(itCache->second.volume.GetPointer());
+                    }
+                    RemoveCachedVolume(itCache); // file replaced or modified since it was read
+                    m_VolumeCacheStatistics.numInvalidations++;
+                }
+                m_VolumeCacheStatistics.numMisses++;
+            }
+
+            // read without holding the lock (other volumes can be served meanwhile)
+            typename VolumeType::Pointer vol;
+            {
+                std::lock_guard<std::mutex> readLock(m_VolumeReadMutex);
+                vol = readVolume(filename);
+            }
+            if (vol.IsNull() || !hasFileStamp) {
+                return vol;
+            }
+            unsigned long long numBytes = vol->GetBufferedRegion().GetNumberOfPixels() * sizeof(typename VolumeType::PixelType);
+
+            std::lock_guard<std::mutex> lock(m_VolumeCacheMutex);
+            if (numBytes > m_VolumeCacheBudget) {
+                return vol; // would not fit (or cache disabled)
+            }
+            std::map<std::string, CachedVolume>::iterator itCache = m_VolumeCache.find(cacheKey);
+            if (itCache != m_VolumeCache.end()) {
+                RemoveCachedVolume(itCache); // read by another thread meanwhile
+            }
+            while (!m_VolumeCacheLru.empty() && m_VolumeCacheStatistics.memoryUsed + numBytes > m_VolumeCacheBudget) {
+                RemoveCachedVolume(m_VolumeCache.find(m_VolumeCacheLru.back()));
+                m_VolumeCacheStatistics.numEvictions++;
+            }
+            CachedVolume& cached = m_VolumeCache[cacheKey];
+            cached.filename = filename;
+            cached.fileStamp = fileStamp;
+            cached.volume = vol.GetPointer();
+            cached.numBytes = numBytes;
+            m_VolumeCacheLru.push_front(cacheKey);
+            cached.lruPosition = m_VolumeCacheLru.begin();
+            m_VolumeCacheStatistics.memoryUsed += numBytes;
+            m_VolumeCacheStatistics.numVolumes++;
+            return vol;
+        }
+
+        static std::string GetFileCacheKey(const std::string& filename, const char* pixelTypeName) {
+            return std::string("file:") + filename + "/" + pixelTypeName; // volumes of a group use group/name/pixel type
+        }
+
+        static bool GetCachedFileStamp(const std::string& filename, CachedFileStamp& fileStamp) {
+            struct stat fileStat;
+            if (stat(filename.c_str(), &fileStat) != 0) {
+                return false;
+            }
+            fileStamp.size = (long long) fileStat.st_size;
+            fileStamp.seconds = (long long) fileStat.st_mtim.tv_sec;
+            fileStamp.nanoseconds = (long long) fileStat.st_mtim.tv_nsec;
+            return true;
+        }
+
+        // call with m_VolumeCacheMutex locked
+        static void RemoveCachedVolume(std::map<std::string, CachedVolume>::iterator itCache) {
+            m_VolumeCacheStatistics.memoryUsed -= itCache->second.numBytes;
+            m_VolumeCacheStatistics.numVolumes--;
+            m_VolumeCacheLru.erase(itCache->second.lruPosition);
+            m_VolumeCache.erase(itCache);
+        }
+
 
 
 }
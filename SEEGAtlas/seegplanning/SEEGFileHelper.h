@@ -190,6 +190,9 @@ namespace seeg {
 #define FILE_RESULTS_TRAJ_GRAL "electrode_"
 #define FILE_POS_FIX ".csv"
 #define FILE_PATIENT_NAMES "patients_tobatchrun.txt"
+#define DIR_BATCH_ELECTRODES "electrodes/TALspace" // electrodes of each patient in batch analysis (relative to patient dir)
+#define DIR_BATCH_ANAT_LOCATION "3x3x3/AnatLoc_tal_seg_lobes_HCAG" // results of batch analysis (relative to electrodes dir)
+#define FILE_BATCH_REPORT "batchAnalysis_report.csv" // status and times of each patient of a batch analysis (in base dir)
 
 //CHANNELS
 #define FILE_CHANNELS_GRAL "channels_"
@@ -235,6 +238,20 @@ namespace seeg {
 
     typedef std::map<std::string, GroupInfo> GroupInfoMapType;
 
+    // counters of the volume cache (see SetVolumeCacheMemoryBudget())
+    struct VolumeCacheStatistics {
+        unsigned long long numHits;
+        unsigned long long numMisses;
+        unsigned long long numEvictions;        // volumes removed to stay under the memory budget
+        unsigned long long numInvalidations;    // volumes read again because their file changed
+        unsigned long long numVolumes;
+        unsigned long long memoryUsed;          // bytes of voxel data held by the cache
+
+        VolumeCacheStatistics() {
+            numHits = numMisses = numEvictions = numInvalidations = numVolumes = memoryUsed = 0;
+        }
+    };
+
 /*************** PUBLIC FUNCTIONS *********************************/
 
     // reset UI
@@ -246,6 +263,9 @@ namespace seeg {
     void GetTransformFile(const std::string& groupName, std::string& transformFile);
 
     // Open volume/transform
+    // Volumes are kept in a process-wide cache (key: group, name and pixel type) and the same image is
+    // returned until its file changes: callers must not modify it (copy it first, e.g. CopyFloatVolume()).
+    // Volumes that are not in the cache are read one at a time (the MINC reader is not thread-safe)
     FloatVolume::Pointer OpenFloatVolume (const std::string& groupName, const std::string& name);
     IntVolume::Pointer OpenIntVolume (const std::string& groupName, const std::string& name);
     ByteVolume::Pointer OpenByteVolume (const std::string& groupName, const std::string& name);
@@ -264,6 +284,25 @@ namespace seeg {
     // Load data
     void OpenFloatVectorVolume (const std::string& groupName, const std::string& gralName, vector<FloatVolume::Pointer> &vecVol);
 
+    // Atlas labels (FILE_ATLAS_LABELS): label number -> name. Returns false if the file cannot be read
+    bool ReadAtlasLabelsFile(const std::string& filename, std::map<int, std::string>& atlasLabels);
+
+    // Electrode model (xml file of SEEGElectrodeModel::Serialize()): values missing in the file keep the default of
+    // SEEGElectrodeModel::New(). Returns false if the file cannot be read
+    bool ReadElectrodeModelFile(const std::string& filename, SEEGElectrodeModel::Pointer& electrodeModel);
+
+    // Volume cache: least recently used volumes are released when the voxel data exceeds the budget (0 disables the cache)
+    void SetVolumeCacheMemoryBudget(unsigned long long numBytes);
+    unsigned long long GetVolumeCacheMemoryBudget();
+    void ClearVolumeCache();
+    VolumeCacheStatistics GetVolumeCacheStatistics();
+
+    // Volumes given by their file only (not registered in a group, e.g. batch analysis), through the same cache.
+    // Remove a volume that will not be opened again to leave its memory to the next ones.
+    // isCacheHit (if given) tells whether the volume was in the cache or had to be read
+    FloatVolume::Pointer OpenCachedFloatVolume(const std::string& filename, bool* isCacheHit = NULL);
+    void RemoveCachedFloatVolume(const std::string& filename);
+
     // Accessor for the path planner instance and other planning data
 //    SEEGPathPlanner::Pointer GetSEEGPathPlanners(int indTarget);
 
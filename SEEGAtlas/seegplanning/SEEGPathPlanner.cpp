@@ -9,12 +9,19 @@
 // header files to include
 #include "itkCastImageFilter.h"
 #include "itkLineIterator.h"
+#include "itkTimeProbe.h"
+#if ITK_VERSION_MAJOR >= 5
+#include "itkMultiThreaderBase.h"
+#endif
 
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <sstream>
 #include <cstdlib>
+#include <algorithm>
+#include <set>
+#include <limits>
 
 #include "SEEGPathPlanner.h"
 #include "VolumeTypes.h"
@@ -35,30 +42,127 @@ namespace seeg {
         return first->m_AggregatedScore < second->m_AggregatedScore;
     }
 
-    static string m_TestToCompare;
-
-    // compare two ElectrodeInfo instance based on the sum criteria of a specific test (m_TestToCompare)
-    static bool compareSEEGSum (ElectrodeInfo::Pointer first, ElectrodeInfo::Pointer second) {
-        return first->m_TrajectoryTestScores[m_TestToCompare].scoreSum <
-                    second->m_TrajectoryTestScores[m_TestToCompare].scoreSum;
+    // compare two trajectory indices based on their aggregated score (ties keep the order of the
+    // indices, as std::list::sort() would). Passed to std::partial_sort() by CalcBestFirstOrder()
+    struct CompareAggregatedScoreIndices {
+        const vector<float>& m_Scores;
+        CompareAggregatedScoreIndices(const vector<float>& scores) : m_Scores(scores) {}
+        bool operator() (unsigned int first, unsigned int second) const {
+            if (m_Scores[first] != m_Scores[second]) {
+                return m_Scores[first] < m_Scores[second];
+            }
+            return first < second;
+        }
+    };
+
+    // below this number of trajectories min/max are not worth splitting among threads
+    static const unsigned int MIN_SCORES_PER_THREAD = 65536;
+
+    // min/max of the scores of the trajectories indices[firstIndex, lastIndex) (see SEEGPathPlanner::CalcMinMaxScores())
+    static void ReduceMinMaxScores(const vector<float>& scores, const vector<unsigned int>& indices,
+                                   const vector<unsigned int>* firstScores, const vector<unsigned int>* numberOfScores,
+                                   unsigned int firstIndex, unsigned int lastIndex, float& minVal, float& maxVal) {
+        float minScore = minVal;
+        float maxScore = maxVal;
+        for (unsigned int i = firstIndex; i < lastIndex; i++) {
+            unsigned int index = indices[i];
+            if (numberOfScores == NULL) {
+                minScore = min(minScore, scores[index]);
+                maxScore = max(maxScore, scores[index]);
+                continue;
+            }
+            unsigned int lastScore = (*firstScores)[index] + (*numberOfScores)[index];
+            for (unsigned int iScore = (*firstScores)[index]; iScore < lastScore; iScore++) {
+                minScore = min(minScore, scores[iScore]);
+                maxScore = max(maxScore, scores[iScore]);
+            }
+        }
+        minVal = minScore;
+        maxVal = maxScore;
     }
 
-    // compare two ElectrodeInfo instance based on the max criteria of a specific test (m_TestToCompare)
-    static bool compareSEEGMax (ElectrodeInfo::Pointer first, ElectrodeInfo::Pointer second) {
-        return first->m_TrajectoryTestScores[m_TestToCompare].scoreMax <
-                    second->m_TrajectoryTestScores[m_TestToCompare].scoreMax;
+    // filters of the SEEGTrajectoryIndex of the candidates table
+    struct CandidateNotMaterializedFilter {
+        SEEGTrajectoryCandidates::Pointer m_Candidates;
+        CandidateNotMaterializedFilter(SEEGTrajectoryCandidates::Pointer candidates) : m_Candidates(candidates) {}
+        bool operator() (unsigned int index) const { return !m_Candidates->IsMaterialized(index); }
+    };
+
+    struct CandidateActiveFilter {
+        SEEGTrajectoryCandidates::Pointer m_Candidates;
+        CandidateActiveFilter(SEEGTrajectoryCandidates::Pointer candidates) : m_Candidates(candidates) {}
+        bool operator() (unsigned int index) const { return m_Candidates->IsActive(index); }
+    };
+
+    // active candidates that no test rejected (the scores of the rejected ones may be missing)
+    struct CandidateValidActiveFilter {
+        SEEGTrajectoryCandidates::Pointer m_Candidates;
+        CandidateValidActiveFilter(SEEGTrajectoryCandidates::Pointer candidates) : m_Candidates(candidates) {}
+        bool operator() (unsigned int index) const { return m_Candidates->IsActive(index) && m_Candidates->IsValid(index); }
+    };
+
+    // number of candidates on which the binary tests are measured to choose their order
+    static const unsigned int BINARY_TEST_ORDER_SAMPLE_SIZE = 64;
+
+    // below this number of candidates the sample would cost too much of the evaluation: the order is not changed
+    static const unsigned int BINARY_TEST_ORDER_MIN_CANDIDATES = 8 * BINARY_TEST_ORDER_SAMPLE_SIZE;
+
+    // name of the rejection bit of the candidates pruned by the coarse levels (the test has no score column)
+    static const char* COARSE_TO_FINE_PRUNED_TEST_NAME = "CoarseToFinePruned";
+
+    // step (in mm) of the table of the risk as a function of the distance used by the ray sweeps
+    static const float RAY_SWEEP_RISK_TABLE_STEP = 0.01f;
+
+    // compare two candidates based on their target point (passed to std::sort() by DoSEEGRaySweepTest())
+    struct CompareCandidateTargets {
+        SEEGTrajectoryCandidates::Pointer m_Candidates;
+        CompareCandidateTargets(SEEGTrajectoryCandidates::Pointer candidates) : m_Candidates(candidates) {}
+        bool operator() (unsigned int first, unsigned int second) const {
+            Point3D firstTarget = m_Candidates->GetTargetPoint(first);
+            Point3D secondTarget = m_Candidates->GetTargetPoint(second);
+            for (int i=0; i<3; i++) {
+                if (firstTarget[i] != secondTarget[i]) {
+                    return firstTarget[i] < secondTarget[i];
+                }
+            }
+            return first < second;
+        }
+    };
+
+    static bool HaveSameTargetPoint(SEEGTrajectoryCandidates::Pointer candidates, unsigned int first, unsigned int second) {
+        Point3D firstTarget = candidates->GetTargetPoint(first);
+        Point3D secondTarget = candidates->GetTargetPoint(second);
+        return firstTarget[0] == secondTarget[0] && firstTarget[1] == secondTarget[1] && firstTarget[2] == secondTarget[2];
     }
 
-    // compare two ElectrodeInfo instance based on agreggated Reward rankings
-    static bool compareAgreggatedReward (ElectrodeInfo::Pointer first, ElectrodeInfo::Pointer second) {
-        return first->m_AggregatedRewardScore >
-                    second->m_AggregatedRewardScore;
+    // values[i] = values[order[i]]
+    template <class T>
+    static void ApplyTestOrder(const vector<unsigned int>& order, vector<T>& values) {
+        vector<T> orderedValues(order.size());
+        for (unsigned int i=0; i<order.size(); i++) {
+            orderedValues[i] = values[order[i]];
+        }
+        values.swap(orderedValues);
     }
 
     /**** CONSTRUCTOR/DESTRUCTOR ****/
 
     SEEGPathPlanner::SEEGPathPlanner() {
-        // nothing to do
+        m_NumberOfThreads = 0;
+        m_UseRiskDistanceMaps = false;
+        m_UseRiskBrickOccupancies = false;
+        m_AdaptiveBinaryTestOrder = true;
+        m_CoarseToFineLevels = 0;
+        m_CoarseToFineKeepFraction = 0.25;
+        m_CoarseToFineHardLimitMargin = 0.25;
+        m_VolumePyramid = SEEGVolumePyramid::New();
+        m_TestRegistry = SEEGTrajectoryTestRegistry::New();
+        m_Candidates = SEEGTrajectoryCandidates::New(m_TestRegistry);
+        m_HasCandidatesElectrodeType = false;
+        m_CandidatesIndex = SEEGTrajectoryIndex::New();
+        m_AllTrajectoriesIndex = SEEGTrajectoryIndex::New();
+        m_ActiveTrajectoriesIndex = SEEGTrajectoryIndex::New();
+        m_TrajectoryIndicesModified = true;
     }
 
     SEEGPathPlanner::~SEEGPathPlanner() {
@@ -77,6 +181,7 @@ namespace seeg {
         ElectrodeInfo::Pointer ep = ElectrodeInfo::New(entryPoint, targetPoint, electrodeType);
         m_AllTrajectories.push_back(ep);
         m_ActiveTrajectories.push_back(ep);
+        AddToTrajectoryIndices(ep, true);
     }
 
     void SEEGPathPlanner::SetTrajectoryRiskTestWeights(const string& testName,
@@ -93,6 +198,7 @@ namespace seeg {
         this->m_TrajectoryRiskTestWeights[testName].m_WeightUsingMax = weightUsingMax;
         this->m_TrajectoryRiskTestWeights[testName].m_WeightUsingSum = weightUsingSum;
         this->m_TrajectoryRiskTestWeights[testName].m_HardLimit = hardLimitValue;
+        m_TestRegistry->RegisterTest(testName);
     }
 
     void SEEGPathPlanner::SetTrajectoryRewardTestWeights(const string& testName,
@@ -100,6 +206,19 @@ namespace seeg {
                                                float weightUsingSum) {
         this->m_TrajectoryRewardTestWeights[testName].m_WeightUsingMax = weightUsingMax;
         this->m_TrajectoryRewardTestWeights[testName].m_WeightUsingSum = weightUsingSum;
+        m_TestRegistry->RegisterTest(testName);
+    }
+
+    int SEEGPathPlanner::RegisterTrajectoryTest(const string& testName) {
+        return m_TestRegistry->RegisterTest(testName);
+    }
+
+    int SEEGPathPlanner::GetTrajectoryTestId(const string& testName) {
+        return m_TestRegistry->GetTestId(testName);
+    }
+
+    SEEGTrajectoryTestRegistry::Pointer SEEGPathPlanner::GetTestRegistry() {
+        return m_TestRegistry;
     }
 
     map<string, TrajectoryRiskTestWeights>& SEEGPathPlanner::GetTrajectoryRiskTestWeights() {
@@ -118,6 +237,7 @@ namespace seeg {
             ElectrodeInfo::Pointer electrodePoints = *it;
             electrodePoints->m_TrajectoryTestScores.erase(testName);
         }
+        m_Candidates->RemoveTestColumn(testName);
     }
 
     void SEEGPathPlanner::SetTrajectoryGlobalWeights(float weightRisk, float weightReward) {
@@ -141,8 +261,167 @@ namespace seeg {
         m_ElectrodeName = electrodeName;
     }
 
+    SEEGTrajectoryCandidates::Pointer SEEGPathPlanner::GetCandidates() {
+        return m_Candidates;
+    }
+
+    ElectrodeInfo::Pointer SEEGPathPlanner::MaterializeCandidate(unsigned int index) {
+        bool wasActive = m_Candidates->IsActive(index);
+        ElectrodeInfo::Pointer info = m_Candidates->MaterializeElectrode(index);
+        if (m_HasCandidatesElectrodeType) {
+            info->m_ElectrodeType = m_CandidatesElectrodeType;
+        }
+        CopyCandidateScoresToElectrode(m_Candidates, index, info);
+        m_AllTrajectories.push_back(info);
+        if (wasActive) {
+            m_ActiveTrajectories.push_back(info);
+        }
+        AddToTrajectoryIndices(info, wasActive);
+        return info;
+    }
+
+    void SEEGPathPlanner::MaterializeActiveCandidates() {
+        // copy of the indices: materializing removes them from the active set
+        vector<unsigned int> activeIndices = m_Candidates->GetActiveIndices();
+        for (unsigned int i=0; i<activeIndices.size(); i++) {
+            MaterializeCandidate(activeIndices[i]);
+        }
+    }
+
+    ElectrodeInfo::Pointer SEEGPathPlanner::CreateCandidateElectrode(unsigned int index) {
+        ElectrodeInfo::Pointer info = m_Candidates->CreateElectrode(index);
+        if (m_HasCandidatesElectrodeType) {
+            info->m_ElectrodeType = m_CandidatesElectrodeType;
+        }
+        CopyCandidateScoresToElectrode(m_Candidates, index, info);
+        return info;
+    }
+
+    SEEGElectrodeModel::SEEG_ELECTRODE_MODEL_TYPE SEEGPathPlanner::GetCandidatesElectrodeType() {
+        if (m_HasCandidatesElectrodeType) {
+            return m_CandidatesElectrodeType;
+        }
+        return ElectrodeInfo::New(Point3D(), Point3D())->GetElectrodeModelType(); // type of the electrodes created by the table
+    }
+
     int SEEGPathPlanner::GetNumberOfActiveTrajectories(){
-        return this->GetActiveTrajectories().size();
+        return this->GetActiveTrajectories().size() + m_Candidates->GetNumberOfActiveCandidates(); // candidates not materialized yet are still in the table
+    }
+
+    void SEEGPathPlanner::SetNumberOfThreads(unsigned int numThreads) {
+        m_NumberOfThreads = numThreads;
+    }
+
+    unsigned int SEEGPathPlanner::GetNumberOfThreads() {
+        return m_NumberOfThreads;
+    }
+
+    void SEEGPathPlanner::SetUseRiskDistanceMaps(bool useDistanceMaps) {
+        m_UseRiskDistanceMaps = useDistanceMaps;
+    }
+
+    bool SEEGPathPlanner::GetUseRiskDistanceMaps() {
+        return m_UseRiskDistanceMaps;
+    }
+
+    void SEEGPathPlanner::SetUseRiskBrickOccupancies(bool useBrickOccupancies) {
+        m_UseRiskBrickOccupancies = useBrickOccupancies;
+    }
+
+    bool SEEGPathPlanner::GetUseRiskBrickOccupancies() {
+        return m_UseRiskBrickOccupancies;
+    }
+
+    void SEEGPathPlanner::SetScoreCacheDirectory(const string& directory) {
+        if (directory.empty()) {
+            m_ScoreCache = SEEGScoreCache::Pointer();
+        } else if (!m_ScoreCache || m_ScoreCache->GetDirectory() != directory) {
+            m_ScoreCache = SEEGScoreCache::New(directory);
+        }
+    }
+
+    SEEGScoreCache::Pointer SEEGPathPlanner::GetScoreCache() {
+        return m_ScoreCache;
+    }
+
+    void SEEGPathPlanner::SetAdaptiveBinaryTestOrder(bool adaptiveOrder) {
+        m_AdaptiveBinaryTestOrder = adaptiveOrder;
+    }
+
+    bool SEEGPathPlanner::GetAdaptiveBinaryTestOrder() {
+        return m_AdaptiveBinaryTestOrder;
+    }
+
+    void SEEGPathPlanner::SetCoarseToFineLevels(unsigned int levels) {
+        m_CoarseToFineLevels = levels;
+    }
+
+    unsigned int SEEGPathPlanner::GetCoarseToFineLevels() {
+        return m_CoarseToFineLevels;
+    }
+
+    void SEEGPathPlanner::SetCoarseToFineKeepFraction(float keepFraction) {
+        m_CoarseToFineKeepFraction = min(max(keepFraction, 0.0f), 1.0f);
+    }
+
+    float SEEGPathPlanner::GetCoarseToFineKeepFraction() {
+        return m_CoarseToFineKeepFraction;
+    }
+
+    void SEEGPathPlanner::SetCoarseToFineHardLimitMargin(float margin) {
+        m_CoarseToFineHardLimitMargin = max(margin, 0.0f);
+    }
+
+    float SEEGPathPlanner::GetCoarseToFineHardLimitMargin() {
+        return m_CoarseToFineHardLimitMargin;
+    }
+
+    const vector<CoarseToFineLevelReport>& SEEGPathPlanner::GetMultiTestCoarseToFineReport() {
+        return m_MultiTestCoarseToFineReport;
+    }
+
+    const vector<CoarseToFineLevelReport>& SEEGPathPlanner::GetMaximizationTestCoarseToFineReport() {
+        return m_MaximizationTestCoarseToFineReport;
+    }
+
+    void SEEGPathPlanner::ClearCoarseToFineReport() {
+        m_MultiTestCoarseToFineReport.clear();
+        m_MaximizationTestCoarseToFineReport.clear();
+    }
+
+    void SEEGPathPlanner::ClearVolumePyramids() {
+        m_VolumePyramid->Clear();
+    }
+
+    void SEEGPathPlanner::PrecomputeRiskDistanceMaps(vector<string>& binTestNames, vector<IntVolume::Pointer>& binVols) {
+        for (int i=0; i<binTestNames.size() && i<binVols.size(); i++) {
+            map<string, SEEGStructureDistanceMap::Pointer>::iterator itMap = m_RiskDistanceMaps.find(binTestNames[i]);
+            if (itMap != m_RiskDistanceMaps.end() && itMap->second->GetStructureVolume() == binVols[i]) {
+                continue; // already computed for this volume
+            }
+            cout << "Computing distance map for " << binTestNames[i] << endl;
+            m_RiskDistanceMaps[binTestNames[i]] = SEEGStructureDistanceMap::New(binVols[i]);
+        }
+    }
+
+    void SEEGPathPlanner::ClearRiskDistanceMaps() {
+        m_RiskDistanceMaps.clear();
+    }
+
+    void SEEGPathPlanner::PrecomputeRiskBrickOccupancies(vector<string>& binTestNames, vector<IntVolume::Pointer>& binVols) {
+        for (int i=0; i<binTestNames.size() && i<binVols.size(); i++) {
+            map<string, SEEGBrickOccupancy::Pointer>::iterator itBricks = m_RiskBrickOccupancies.find(binTestNames[i]);
+            if (itBricks != m_RiskBrickOccupancies.end() && itBricks->second->GetVolume() == binVols[i].GetPointer()) {
+                continue; // already computed for this volume
+            }
+            m_RiskBrickOccupancies[binTestNames[i]] = SEEGBrickOccupancy::New(binVols[i]);
+            cout << "Computed brick occupancy for " << binTestNames[i] << " ("
+                 << 100 * m_RiskBrickOccupancies[binTestNames[i]]->GetEmptyBrickFraction() << "% empty bricks)" << endl;
+        }
+    }
+
+    void SEEGPathPlanner::ClearRiskBrickOccupancies() {
+        m_RiskBrickOccupancies.clear();
     }
 
 
@@ -151,9 +430,17 @@ namespace seeg {
     void SEEGPathPlanner::Reset() {
         m_AllTrajectories.clear();
         m_ActiveTrajectories.clear();
+        m_TrajectoryIndicesModified = true;
+        m_Candidates->Clear();
+        m_CandidatesIndex->Clear();
+        m_TestRegistry->Clear();
+        m_HasCandidatesElectrodeType = false;
         m_TrajectoryRiskTestWeights.clear();
         m_TrajectoryRewardTestWeights.clear();
         m_ElectrodeName.clear();
+        m_RiskDistanceMaps.clear();
+        m_RiskBrickOccupancies.clear();
+        m_SkullPointIndex = SEEGSkullPointIndex::Pointer();
     }
 
 
@@ -180,19 +467,20 @@ namespace seeg {
                                      entryPoint[1] - targetPoint[1],
                                      entryPoint[2] - targetPoint[2]);
 
+        // distance between trajectories is the distance between electrode vectors (see CalcDistanceBetweenPointsInTrajectories())
+        UpdateTrajectoryIndices();
+        double distance;
+        int closest = m_AllTrajectoriesIndex->FindNearest(electrodePoints, minDistance, TrajectoryIndexAcceptAll(), distance);
+        if (closest >= 0) {
+            minDistance = distance;
+            closest_match_point = m_AllTrajectoriesIndexed[closest];
+        }
 
-        list<ElectrodeInfo::Pointer>::iterator it;
-
-        it = m_AllTrajectories.begin();
-        while( it != m_AllTrajectories.end() ) {
-            ElectrodeInfo::Pointer electrode = *it;
-         //   float angle = this->CalcAngleBetweenTrajectories(electrodePoints, electrode->m_ElectrodeVectorWorld);
-               float sumDistance = this->CalcDistanceBetweenPointsInTrajectories(electrodePoints, electrode->m_ElectrodeVectorWorld);
-            if (abs(sumDistance) < abs(minDistance) ) {
-                minDistance = sumDistance;
-                closest_match_point = electrode;
-            }
-            it++;
+        // candidates still in the table - the closest one is returned as a copy (it stays in the table)
+        int closestCandidate = m_CandidatesIndex->FindNearest(electrodePoints, minDistance, CandidateNotMaterializedFilter(m_Candidates), distance);
+        if (closestCandidate >= 0) {
+            minDistance = distance;
+            closest_match_point = CreateCandidateElectrode(closestCandidate);
         }
 
         sumDistBetweenTraj = minDistance;
@@ -216,19 +504,19 @@ namespace seeg {
                                      entryPoint[1] - targetPoint[1],
                                      entryPoint[2] - targetPoint[2]);
 
+        UpdateTrajectoryIndices();
+        double distance;
+        int closest = m_ActiveTrajectoriesIndex->FindNearest(electrodePoints, min_SumDistance, TrajectoryIndexAcceptAll(), distance);
+        if (closest >= 0) {
+            min_SumDistance = distance;
+            closest_match_point = m_ActiveTrajectoriesIndexed[closest];
+        }
 
-        list<ElectrodeInfo::Pointer>::iterator it;
-
-        it = m_ActiveTrajectories.begin();
-        while( it != m_ActiveTrajectories.end() ) {
-            ElectrodeInfo::Pointer electrode = *it;
-         //   float angle = this->CalcAngleBetweenTrajectories(electrodePoints, electrode->m_ElectrodeVectorWorld);
-               float sumDistance = this->CalcDistanceBetweenPointsInTrajectories(electrodePoints, electrode->m_ElectrodeVectorWorld);
-            if (abs(sumDistance) < abs(min_SumDistance) ) {
-                min_SumDistance = sumDistance;
-                closest_match_point = electrode;
-            }
-            it++;
+        // active candidates still in the table - the closest one is returned as a copy (it stays in the table)
+        int closestCandidate = m_CandidatesIndex->FindNearest(electrodePoints, min_SumDistance, CandidateActiveFilter(m_Candidates), distance);
+        if (closestCandidate >= 0) {
+            min_SumDistance = distance;
+            closest_match_point = CreateCandidateElectrode(closestCandidate);
         }
 
         sumDistBetweenTraj = min_SumDistance;
@@ -237,79 +525,92 @@ namespace seeg {
 
 
     void SEEGPathPlanner::InitializeTrajectoriesFromVols(IntVolume::Pointer entryPointMaskVol, IntVolume::Pointer targetMaskVol) {
+        // all pairs of entry and target voxels (the voxels of each mask are extracted once)
+        InitializeTrajectoriesFromGenerator(SEEGCandidateGenerator::New(entryPointMaskVol, targetMaskVol));
+    }
+
+    void SEEGPathPlanner::InitializeTrajectoriesFromGenerator(SEEGCandidateGenerator::Pointer generator) {
 
         // clear current list of entry points
         this->m_AllTrajectories.clear();
         this->m_ActiveTrajectories.clear();
+        m_TrajectoryIndicesModified = true;
+        m_Candidates->Clear();
+        m_HasCandidatesElectrodeType = false;
+
+        generator->Rewind();
+        generator->GenerateAll(m_Candidates);
+        cout << "Candidates: " << m_Candidates->GetNumberOfCandidates() << " (" << generator->GetNumberOfPairsRejected() << " pairs rejected by the constraints)" << endl;
+        BuildCandidatesIndex();
+    }
 
-        // iterate through entryPoints and Target Volumes to build a list of possible Trajectory points
-
-        IntVolumeRegionIteratorWithIndex it (entryPointMaskVol, entryPointMaskVol->GetLargestPossibleRegion());
-        IntVolumeRegionIteratorWithIndex it2 (targetMaskVol, targetMaskVol->GetLargestPossibleRegion());
-        for (it.GoToBegin(); !it.IsAtEnd(); ++it) {
-            IntVolume::IndexType voxelIndex = it.GetIndex();
-            if (it.Get()) {
-                Point3D worldEntryPoint;
-                entryPointMaskVol->TransformIndexToPhysicalPoint(voxelIndex, worldEntryPoint);
-                for (it2.GoToBegin(); !it2.IsAtEnd(); ++it2) {
-                    IntVolume::IndexType voxelIndex = it.GetIndex();
-                    if (it2.Get()) {
-                        Point3D worldTargetPoint;
-                        entryPointMaskVol->TransformIndexToPhysicalPoint(voxelIndex, worldTargetPoint);
-
-                        ElectrodeInfo::Pointer info = ElectrodeInfo::New(worldEntryPoint, worldTargetPoint);
-                        info->m_AggregatedRiskScore = -1;
-                        info->m_AggregatedRewardScore = -1;
-                        info->m_AggregatedScore = -1;
-                        m_AllTrajectories.push_back(info);
-                        m_ActiveTrajectories.push_back(info);
-                    }
+    void SEEGPathPlanner::InitializeValidTrajectoriesFromGenerator( SEEGCandidateGenerator::Pointer generator,
+                                                                    unsigned int batchSize,
+                                                                    vector<string>& binTestNames,
+                                                                    vector<IntVolume::Pointer>& binVols,
+                                                                    vector<BinaryTestCfg>& binTestCfgs,
+                                                                    vector<string>& fuzzyTestNames,
+                                                                    vector<FloatVolume::Pointer>& fuzzyVols,
+                                                                    vector<FuzzyTestCfg>& fuzzyTestCfgs,
+                                                                    map<string, float>& extraLengthCfgs,
+                                                                    GeneralTransform::Pointer nativeToRef) {
+        this->m_AllTrajectories.clear();
+        this->m_ActiveTrajectories.clear();
+        m_TrajectoryIndicesModified = true;
+        m_Candidates->Clear();
+        m_HasCandidatesElectrodeType = false;
+        for (int i=0; i<binTestNames.size(); i++) {
+            m_Candidates->AddTestColumn(binTestNames[i]);
+        }
+        for (int i=0; i<fuzzyTestNames.size(); i++) {
+            m_Candidates->AddTestColumn(fuzzyTestNames[i]);
+        }
+
+        // only one batch of candidates is held besides the valid ones
+        SEEGTrajectoryCandidates::Pointer batch = SEEGTrajectoryCandidates::New(m_TestRegistry);
+        batch->Reserve(batchSize);
+        unsigned long long numEvaluated = 0;
+        generator->Rewind();
+        while (generator->GenerateBatch(batch, batchSize) > 0) {
+            vector<unsigned int> indices = batch->GetActiveIndices();
+            EvaluateCandidates( batch,
+                                indices,
+                                binTestNames,
+                                binVols,
+                                binTestCfgs,
+                                fuzzyTestNames,
+                                fuzzyVols,
+                                fuzzyTestCfgs,
+                                extraLengthCfgs,
+                                nativeToRef);
+            for (unsigned int i=0; i<indices.size(); i++) {
+                if (batch->IsValid(indices[i])) {
+                    m_Candidates->AppendCandidate(batch, indices[i]);
                 }
             }
+            numEvaluated += indices.size();
+            batch->Clear();
         }
+        cout << "Candidates: " << m_Candidates->GetNumberOfCandidates() << " valid of " << numEvaluated << " evaluated ("
+             << generator->GetNumberOfPairsRejected() << " pairs rejected by the constraints)" << endl;
+        BuildCandidatesIndex();
     }
 
     void SEEGPathPlanner::InitializeTrajectoriesFromFile (const string& filename,  const SEEGElectrodeModel::SEEG_ELECTRODE_MODEL_TYPE electrodeType) {
         // clear current list of entry points
         this->m_AllTrajectories.clear();
         this->m_ActiveTrajectories.clear();
-
-        // read file with all points
-        ifstream fileAllTraj (filename.c_str(), ios::in|ios::binary); //RIZ: check!
-        string line, token;
-
-        if (fileAllTraj.is_open())  {
-            while ( fileAllTraj.good() ) {
-                getline (fileAllTraj,line);
-                if (line.length()>0){
-                    stringstream ss (line);
-
-                    Point3D targetPoints;
-                    getline(ss, token, ',');
-                    targetPoints[0] = atof(token.c_str()); //first 3 points are the target
-                    getline(ss, token, ',');
-                    targetPoints[1] = atof(token.c_str()); //first 3 points are the target
-                    getline(ss, token, ',');
-                    targetPoints[2] = atof(token.c_str()); //first 3 points are the target
-                    Point3D entryPoints;
-                    getline(ss, token, ',');
-                    entryPoints[0] = atof(token.c_str()); // last 3 points are the entry points
-                    getline(ss, token, ',');
-                    entryPoints[1] = atof(token.c_str()); // last 3 points are the entry points
-                    getline(ss, token, ',');
-                    entryPoints[2] = atof(token.c_str()); // last 3 points are the entry points
-                    ElectrodeInfo::Pointer info = ElectrodeInfo::New(entryPoints, targetPoints);
-                    info->m_AggregatedRiskScore = -1;
-                    info->m_AggregatedRewardScore = -1;
-                    info->m_AggregatedScore = -1;
-                    info->m_ElectrodeType = electrodeType;
-                    m_AllTrajectories.push_back(info);
-                    m_ActiveTrajectories.push_back(info);
-                }
-            }
-            fileAllTraj.close();
-        }
-        else cout << "Unable to open file "<<filename.c_str()<<endl;
+        m_TrajectoryIndicesModified = true;
+        m_Candidates->Clear();
+        m_Candidates->SetElectrodeModel(SEEGElectrodeModel::New(electrodeType));
+        m_CandidatesElectrodeType = electrodeType;
+        m_HasCandidatesElectrodeType = true;
+
+        // read file with all points (text or binary, see SEEGTrajectoryFileReader)
+        SEEGTrajectoryFileReader::Pointer reader = SEEGTrajectoryFileReader::New();
+        reader->SetNumberOfThreads(m_NumberOfThreads);
+        reader->Read(filename, m_Candidates);
+        BuildCandidatesIndex();
     }
 
     void SEEGPathPlanner::DoSEEGMultiTest ( vector<string>& binTestNames,
@@ -324,6 +625,20 @@ namespace seeg {
 
                                     GeneralTransform::Pointer nativeToRef) {
 
+        // candidates of the table (scores stay in the table)
+        vector<unsigned int> activeIndices = m_Candidates->GetActiveIndices();
+        EvaluateCandidates( m_Candidates,
+                            activeIndices,
+                            binTestNames,
+                            binVols,
+                            binTestCfgs,
+                            fuzzyTestNames,
+                            fuzzyVols,
+                            fuzzyTestCfgs,
+                            extraLengthCfgs,
+                            nativeToRef);
+
+        // trajectories that already are ElectrodeInfo (manual plans, materialized candidates)
         DoSEEGMultiTest(    binTestNames,
                         binVols,
                         binTestCfgs,
@@ -350,56 +665,567 @@ namespace seeg {
                                      list<ElectrodeInfo::Pointer>::iterator last,
                                      GeneralTransform::Pointer nativeToRef) {
 
-        bool reject;
-       // cout<<"inside DoMultiTest"<<endl;
-    /*    Point3D targetDestination_native(m_TargetDestination);
-        if (nativeToRef) {
-            nativeToRef->TransformPointInv(m_TargetDestination, targetDestination_native); // go from ref to native space
+        // the trajectories are copied to a temporary table, evaluated there and their scores copied back
+        vector<ElectrodeInfo::Pointer> electrodes(first, last);
+        if (electrodes.empty()) {
+            return;
         }
-*/
-        SEEGTrajectoryROIPipeline::Pointer pipeline;
-        // one of the 2 vectors must contain a volume
-        if (binVols.size()>0) {
-            pipeline = SEEGTrajectoryROIPipeline::New(binVols[0]);
+        SEEGTrajectoryCandidates::Pointer candidates = SEEGTrajectoryCandidates::New(m_TestRegistry);
+        candidates->Reserve(electrodes.size());
+        for (int i=0; i<binTestNames.size(); i++) {
+            candidates->AddTestColumn(binTestNames[i]);
+        }
+        for (int i=0; i<fuzzyTestNames.size(); i++) {
+            candidates->AddTestColumn(fuzzyTestNames[i]);
+        }
+        for (unsigned int iElec=0; iElec<electrodes.size(); iElec++) {
+            unsigned int index = candidates->AddCandidate(electrodes[iElec]->m_EntryPointWorld, electrodes[iElec]->m_TargetPointWorld);
+            CopyElectrodeScoresToCandidate(electrodes[iElec], candidates, index);
+        }
+
+        vector<unsigned int> indices = candidates->GetActiveIndices();
+        EvaluateCandidates( candidates,
+                            indices,
+                            binTestNames,
+                            binVols,
+                            binTestCfgs,
+                            fuzzyTestNames,
+                            fuzzyVols,
+                            fuzzyTestCfgs,
+                            extraLengthCfgs,
+                            nativeToRef);
+
+        for (unsigned int iElec=0; iElec<electrodes.size(); iElec++) {
+            CopyCandidateScoresToElectrode(candidates, iElec, electrodes[iElec]);
+        }
+    }
+
+    void SEEGPathPlanner::DoSEEGRaySweepTest(vector<string>& binTestNames,
+                                             vector<IntVolume::Pointer>& binVols,
+                                             vector<BinaryTestCfg>& binTestCfgs,
+                                             map<string, float>& extraLengthCfgs,
+                                             GeneralTransform::Pointer nativeToRef) {
+        if (m_Candidates->GetNumberOfActiveCandidates() == 0) {
+            return;
+        }
+
+        // score columns are added before any thread writes to the table
+        vector<int> binColumns(binTestNames.size());
+        vector<float> binExtraLengths(binTestNames.size());
+        for (int i=0; i<binTestNames.size(); i++) {
+            binColumns[i] = m_Candidates->AddTestColumn(binTestNames[i]);
+            if (binColumns[i] < 0) {
+                return;
+            }
+            binExtraLengths[i] = extraLengthCfgs[binTestNames[i]];
+        }
+
+        // rejections of a previous sweep of these tests are cleared, then only the valid active candidates are swept
+        const vector<unsigned int>& activeIndices = m_Candidates->GetActiveIndices();
+        for (unsigned int iElec=0; iElec<activeIndices.size(); iElec++) {
+            for (int i=0; i<binColumns.size(); i++) {
+                m_Candidates->SetRejected(activeIndices[iElec], binColumns[i], false);
+            }
+        }
+        vector<unsigned int> indices;
+        m_Candidates->GetValidActiveIndices(indices);
+        if (indices.empty()) {
+            return;
+        }
+
+        // one sweep per structure, on its distance map (computed once per patient)
+        PrecomputeRiskDistanceMaps(binTestNames, binVols);
+        vector<SEEGTargetRaySweep::Pointer> sweeps(binTestNames.size());
+        for (int i=0; i<binTestNames.size(); i++) {
+            sweeps[i] = SEEGTargetRaySweep::New(m_RiskDistanceMaps[binTestNames[i]]->GetDistanceMap());
+            sweeps[i]->SetMaxDistance(binTestCfgs[i].m_MaxDistToEvaluate);
+            vector<float> riskTable((unsigned int) ceil(binTestCfgs[i].m_MaxDistToEvaluate / RAY_SWEEP_RISK_TABLE_STEP) + 1);
+            for (unsigned int k=0; k<riskTable.size(); k++) {
+                riskTable[k] = CalcDistFromTrajFactor(k * RAY_SWEEP_RISK_TABLE_STEP, binTestCfgs[i].m_k1, binTestCfgs[i].m_k2);
+            }
+            sweeps[i]->SetRiskTable(riskTable, RAY_SWEEP_RISK_TABLE_STEP);
+            // once closer than m_k1 the trajectory is rejected, the rest of the ray does not matter
+            sweeps[i]->SetStopDistance(binTestCfgs[i].m_HardConstraint ? binTestCfgs[i].m_k1 : -1);
+        }
+        vector<TrajectoryTestScore> binNoOverlapScores;
+        CalcNoOverlapScores(binVols, binTestCfgs, nativeToRef, binNoOverlapScores);
+
+        // groups of candidates with the same target
+        sort(indices.begin(), indices.end(), CompareCandidateTargets(m_Candidates));
+        vector<unsigned int> groupStarts;
+        for (unsigned int iElec=0; iElec<indices.size(); iElec++) {
+            if (iElec == 0 || !HaveSameTargetPoint(m_Candidates, indices[iElec - 1], indices[iElec])) {
+                groupStarts.push_back(iElec);
+            }
+        }
+        groupStarts.push_back(indices.size());
+        unsigned int numGroups = groupStarts.size() - 1;
+        cout << "Ray sweep test: " << indices.size() << " candidates, " << numGroups << " targets" << endl;
+
+        unsigned int numThreads = m_NumberOfThreads;
+#if ITK_VERSION_MAJOR >= 5
+        if (numThreads == 0) {
+            numThreads = itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads();
+        }
+#else
+        numThreads = 1;
+#endif
+        if (numThreads <= 1 || numGroups <= 1) {
+            for (unsigned int iGroup=0; iGroup<numGroups; iGroup++) {
+                SweepTargetCandidates(indices, groupStarts[iGroup], groupStarts[iGroup + 1], sweeps,
+                                      binTestCfgs, binNoOverlapScores, binExtraLengths, binColumns, nativeToRef);
+            }
         } else {
-            pipeline = SEEGTrajectoryROIPipeline::New(fuzzyVols[0]);
+#if ITK_VERSION_MAJOR >= 5
+            // each candidate belongs to a single target group: results do not depend on scheduling
+            itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+            threader->SetMaximumNumberOfThreads(numThreads);
+            threader->SetNumberOfWorkUnits(numThreads);
+            threader->ParallelizeArray(0, numGroups,
+                [&](itk::SizeValueType iGroup) {
+                    SweepTargetCandidates(indices, groupStarts[iGroup], groupStarts[iGroup + 1], sweeps,
+                                          binTestCfgs, binNoOverlapScores, binExtraLengths, binColumns, nativeToRef);
+                },
+                nullptr);
+#endif
         }
+    }
 
+    void SEEGPathPlanner::EvaluateCandidates(  SEEGTrajectoryCandidates::Pointer candidates,
+                                               const vector<unsigned int>& indices,
+                                               vector<string>& binTestNames,
+                                               vector<IntVolume::Pointer>& binVols,
+                                               vector<BinaryTestCfg>& binTestCfgs,
+                                               vector<string>& fuzzyTestNames,
+                                               vector<FloatVolume::Pointer>& fuzzyVols,
+                                               vector<FuzzyTestCfg>& fuzzyTestCfgs,
+                                               map<string, float>& extraLengthCfgs,
+                                               GeneralTransform::Pointer nativeToRef) {
+        if (m_CoarseToFineLevels == 0 || indices.empty()) {
+            EvaluateCandidateTests(candidates, indices, binTestNames, binVols, binTestCfgs,
+                                   fuzzyTestNames, fuzzyVols, fuzzyTestCfgs, extraLengthCfgs, nativeToRef);
+            return;
+        }
 
-        list<ElectrodeInfo::Pointer>::iterator it;
+        vector<unsigned int> fineIndices;
+        SelectCandidatesCoarseToFine(candidates, indices, binTestNames, binVols, binTestCfgs,
+                                     fuzzyTestNames, fuzzyVols, fuzzyTestCfgs, extraLengthCfgs, nativeToRef, fineIndices);
+        EvaluateCandidateTests(candidates, fineIndices, binTestNames, binVols, binTestCfgs,
+                               fuzzyTestNames, fuzzyVols, fuzzyTestCfgs, extraLengthCfgs, nativeToRef);
+    }
 
-        it = first;
-        do {
-            reject = false;
-            ElectrodeInfo::Pointer electrode = *it;
-            Point3D entryPoint_native(electrode->m_EntryPointWorld);
-            Point3D targetDestination_native(electrode->m_TargetPointWorld);
+    void SEEGPathPlanner::SelectCandidatesCoarseToFine(SEEGTrajectoryCandidates::Pointer candidates,
+                                                       const vector<unsigned int>& indices,
+                                                       vector<string>& binTestNames,
+                                                       vector<IntVolume::Pointer>& binVols,
+                                                       vector<BinaryTestCfg>& binTestCfgs,
+                                                       vector<string>& fuzzyTestNames,
+                                                       vector<FloatVolume::Pointer>& fuzzyVols,
+                                                       vector<FuzzyTestCfg>& fuzzyTestCfgs,
+                                                       map<string, float>& extraLengthCfgs,
+                                                       GeneralTransform::Pointer nativeToRef,
+                                                       vector<unsigned int>& fineIndices) {
+        fineIndices = indices;
+
+        // pruned candidates are rejected by a test of their own
+        int prunedTestId = candidates->GetTestRegistry()->RegisterTest(COARSE_TO_FINE_PRUNED_TEST_NAME);
+        if (prunedTestId < 0 || prunedTestId >= SEEGTrajectoryCandidates::MAX_TEST_COLUMNS) {
+            cout << "Coarse-to-fine: too many tests, all candidates are evaluated at full resolution" << endl;
+            return;
+        }
+        SEEGTrajectoryCandidates::RejectionMaskType prunedMask = ((SEEGTrajectoryCandidates::RejectionMaskType) 1) << prunedTestId;
+
+        // tests that rank the candidates (weights) or keep them (hard limits), in the order of the columns of the coarse table
+        vector<string> testNames(binTestNames.begin(), binTestNames.end());
+        testNames.insert(testNames.end(), fuzzyTestNames.begin(), fuzzyTestNames.end());
+        unsigned int numTests = testNames.size();
+        vector<float> weightsUsingMax(numTests, 0);
+        vector<float> weightsUsingSum(numTests, 0);
+        vector<float> hardLimits(numTests, -1);
+        bool hasWeights = false;
+        for (unsigned int iTest=0; iTest<numTests; iTest++) {
+            map<string, TrajectoryRiskTestWeights>::iterator itRisk = m_TrajectoryRiskTestWeights.find(testNames[iTest]);
+            map<string, TrajectoryTestWeights>::iterator itReward = m_TrajectoryRewardTestWeights.find(testNames[iTest]);
+            if (itRisk != m_TrajectoryRiskTestWeights.end()) {
+                weightsUsingMax[iTest] = itRisk->second.m_WeightUsingMax;
+                weightsUsingSum[iTest] = itRisk->second.m_WeightUsingSum;
+                hardLimits[iTest] = itRisk->second.m_HardLimit;
+            } else if (itReward != m_TrajectoryRewardTestWeights.end()) {
+                weightsUsingMax[iTest] = -itReward->second.m_WeightUsingMax; // lower scores are better
+                weightsUsingSum[iTest] = -itReward->second.m_WeightUsingSum;
+            }
+            hasWeights = hasWeights || weightsUsingMax[iTest] != 0 || weightsUsingSum[iTest] != 0;
+        }
 
-            /*if (nativeToRef) {
-                nativeToRef->TransformPointInv(electrode->m_EntryPointWorld, entryPoint_native); // go from ref to native space
-                nativeToRef->TransformPointInv(electrode->m_TargetPointWorld, targetDestination_native); // go from ref to native space
-            }*/
-            Point3D entryPoint_extrapolated;
+        if (m_MultiTestCoarseToFineReport.size() < m_CoarseToFineLevels) {
+            m_MultiTestCoarseToFineReport.resize(m_CoarseToFineLevels);
+        }
+
+        for (unsigned int level=m_CoarseToFineLevels; level>=1 && !fineIndices.empty(); level--) {
+            vector<IntVolume::Pointer> coarseBinVols(binVols.size());
+            for (int i=0; i<binVols.size(); i++) {
+                coarseBinVols[i] = m_VolumePyramid->GetLevel(binVols[i], level);
+            }
+            vector<FloatVolume::Pointer> coarseFuzzyVols(fuzzyVols.size());
+            for (int i=0; i<fuzzyVols.size(); i++) {
+                coarseFuzzyVols[i] = m_VolumePyramid->GetLevel(fuzzyVols[i], level);
+            }
+
+            // coarse scores are written to a temporary table
+            SEEGTrajectoryCandidates::Pointer coarseCandidates = SEEGTrajectoryCandidates::New(candidates->GetTestRegistry());
+            coarseCandidates->Reserve(fineIndices.size());
+            for (unsigned int iElec=0; iElec<fineIndices.size(); iElec++) {
+                coarseCandidates->AddCandidate(candidates->GetEntryPoint(fineIndices[iElec]), candidates->GetTargetPoint(fineIndices[iElec]));
+            }
+            vector<unsigned int> coarseIndices = coarseCandidates->GetActiveIndices();
+            EvaluateCandidateTests(coarseCandidates, coarseIndices, binTestNames, coarseBinVols, binTestCfgs,
+                                   fuzzyTestNames, coarseFuzzyVols, fuzzyTestCfgs, extraLengthCfgs, nativeToRef);
+
+            // scores are normalized per test over the candidates that were not rejected
+            unsigned int numCandidates = fineIndices.size();
+            vector<unsigned int> validIndices;
+            for (unsigned int iElec=0; iElec<numCandidates; iElec++) {
+                if (coarseCandidates->IsValid(iElec)) {
+                    validIndices.push_back(iElec);
+                }
+            }
+            vector<float> coarseScores(validIndices.size(), 0);
+            vector<unsigned char> keep(numCandidates, 0);
+            vector<unsigned char> nearHardLimit(numCandidates, 0);
+            for (unsigned int iTest=0; iTest<numTests; iTest++) {
+                int column = coarseCandidates->GetTestColumnIndex(testNames[iTest]);
+                if (column < 0) {
+                    continue;
+                }
+                TrajectoryTestColumn& testColumn = coarseCandidates->GetTestColumn(column);
+                if (hardLimits[iTest] > 0) {
+                    float margin = m_CoarseToFineHardLimitMargin * hardLimits[iTest];
+                    for (unsigned int iElec=0; iElec<numCandidates; iElec++) {
+                        if (testColumn.m_Evaluated[iElec] && fabs(testColumn.m_ScoreMax[iElec] - hardLimits[iTest]) <= margin) {
+                            nearHardLimit[iElec] = 1;
+                        }
+                    }
+                }
+                if (validIndices.empty() || (weightsUsingMax[iTest] == 0 && weightsUsingSum[iTest] == 0)) {
+                    continue;
+                }
+                float minMax, maxMax, minSum, maxSum;
+                CalcMinMaxScores(testColumn.m_ScoreMax, validIndices, NULL, NULL, minMax, maxMax);
+                CalcMinMaxScores(testColumn.m_ScoreSum, validIndices, NULL, NULL, minSum, maxSum);
+                for (unsigned int i=0; i<validIndices.size(); i++) {
+                    if (maxMax - minMax > 0.001) {
+                        coarseScores[i] += weightsUsingMax[iTest] * (testColumn.m_ScoreMax[validIndices[i]] - minMax) / (maxMax - minMax);
+                    }
+                    if (maxSum - minSum > 0.001) {
+                        coarseScores[i] += weightsUsingSum[iTest] * (testColumn.m_ScoreSum[validIndices[i]] - minSum) / (maxSum - minSum);
+                    }
+                }
+            }
+
+            // best fraction of the valid candidates (all of them if there is no weight to rank them)
+            unsigned int numBest = validIndices.size();
+            if (hasWeights) {
+                numBest = min(numBest, (unsigned int) ceil(m_CoarseToFineKeepFraction * validIndices.size()));
+            }
+            vector<unsigned int> order(validIndices.size());
+            for (unsigned int i=0; i<order.size(); i++) {
+                order[i] = i;
+            }
+            if (numBest < order.size()) {
+                nth_element(order.begin(), order.begin() + numBest, order.end(), CompareAggregatedScoreIndices(coarseScores));
+            }
+            for (unsigned int i=0; i<numBest; i++) {
+                keep[validIndices[order[i]]] = 1;
+            }
 
-            for (int i=0; i<binTestNames.size() && !reject; i++) {
-                this->ExtrapolateEntryPoint(targetDestination_native, entryPoint_native, entryPoint_extrapolated, extraLengthCfgs[binTestNames[i]]); //extrapolate by 50mm to consider ears
-                pipeline->CalcDistanceMap(entryPoint_extrapolated,targetDestination_native, binTestCfgs[i].m_MaxDistToEvaluate);
+            CoarseToFineLevelReport& report = m_MultiTestCoarseToFineReport[level - 1];
+            report.m_Level = level;
+            unsigned int numRejected = numCandidates - validIndices.size();
+            unsigned int numNearHardLimit = 0;
+            vector<unsigned int> keptIndices;
+            for (unsigned int iElec=0; iElec<numCandidates; iElec++) {
+                // rejections on the max-pooled volumes may not hold at full resolution: only the ranking prunes
+                if (keep[iElec] || nearHardLimit[iElec] || !coarseCandidates->IsValid(iElec)) {
+                    keptIndices.push_back(fineIndices[iElec]);
+                    if (!keep[iElec] && nearHardLimit[iElec] && coarseCandidates->IsValid(iElec)) {
+                        numNearHardLimit++;
+                    }
+                } else {
+                    candidates->SetRejectionMask(fineIndices[iElec], prunedMask);
+                    candidates->SetAggregatedScores(fineIndices[iElec], -1, -1, -1);
+                }
+            }
+            report.m_NumberOfCandidates += numCandidates;
+            report.m_NumberOfRejected += numRejected;
+            report.m_NumberOfKeptBest += numBest;
+            report.m_NumberOfKeptNearHardLimit += numNearHardLimit;
+            report.m_NumberOfPruned += numCandidates - keptIndices.size();
+            cout << "Coarse-to-fine level " << level << ": " << numCandidates << " candidates, " << numRejected << " rejected (kept), "
+                 << numBest << " kept for their score, " << numNearHardLimit << " near a hard limit, "
+                 << numCandidates - keptIndices.size() << " pruned" << endl;
+            fineIndices.swap(keptIndices);
+        }
+    }
 
-                TrajectoryTestScore& testScore = electrode->m_TrajectoryTestScores[binTestNames[i]];
+    void SEEGPathPlanner::EvaluateCandidateTests(  SEEGTrajectoryCandidates::Pointer candidates,
+                                                   const vector<unsigned int>& indices,
+                                                   vector<string>& binTestNames,
+                                                   vector<IntVolume::Pointer>& binVols,
+                                                   vector<BinaryTestCfg>& binTestCfgs,
+                                                   vector<string>& fuzzyTestNames,
+                                                   vector<FloatVolume::Pointer>& fuzzyVols,
+                                                   vector<FuzzyTestCfg>& fuzzyTestCfgs,
+                                                   map<string, float>& extraLengthCfgs,
+                                                   GeneralTransform::Pointer nativeToRef) {
+        if (indices.empty()) {
+            return;
+        }
 
-                reject = TestBinaryOverlap (
-                                   pipeline->GetLastDistanceMap(),
-                                   binVols[i],
-                                   binTestCfgs[i],
-                                   testScore,
-                                   nativeToRef);
+        // score columns are added before any thread writes to the table
+        vector<int> binColumns(binTestNames.size());
+        for (int i=0; i<binTestNames.size(); i++) {
+            binColumns[i] = candidates->AddTestColumn(binTestNames[i]);
+            if (binColumns[i] < 0) {
+                return;
+            }
+        }
+        vector<int> fuzzyColumns(fuzzyTestNames.size());
+        for (int i=0; i<fuzzyTestNames.size(); i++) {
+            fuzzyColumns[i] = candidates->AddTestColumn(fuzzyTestNames[i]);
+            if (fuzzyColumns[i] < 0) {
+                return;
             }
+        }
 
-            for (int i=0; i<fuzzyTestNames.size() && !reject; i++) {
-                this->ExtrapolateEntryPoint(targetDestination_native, entryPoint_native, entryPoint_extrapolated, extraLengthCfgs[fuzzyTestNames[i]]); //extrapolate by 50mm to consider ears
-                pipeline->CalcDistanceMap(entryPoint_extrapolated,targetDestination_native, fuzzyTestCfgs[i].m_MaxDistToEvaluate);
+        // resolve the extra lengths once (map::operator[] must not be called from several threads)
+        vector<float> binExtraLengths(binTestNames.size());
+        for (int i=0; i<binTestNames.size(); i++) {
+            binExtraLengths[i] = extraLengthCfgs[binTestNames[i]];
+        }
+        // distance maps of the structures (only if computed from the same volume)
+        vector<SEEGStructureDistanceMap::Pointer> binDistanceMaps;
+        GetRiskDistanceMaps(binTestNames, binVols, binDistanceMaps);
+        vector<SEEGBrickOccupancy::Pointer> binBrickOccupancies;
+        GetRiskBrickOccupancies(binTestNames, binVols, binBrickOccupancies);
+        vector<float> fuzzyExtraLengths(fuzzyTestNames.size());
+        for (int i=0; i<fuzzyTestNames.size(); i++) {
+            fuzzyExtraLengths[i] = extraLengthCfgs[fuzzyTestNames[i]];
+        }
 
-                TrajectoryTestScore& testScore = electrode->m_TrajectoryTestScores[fuzzyTestNames[i]];
+        // binary tests are evaluated in the order that rejects candidates the soonest (the columns do not move)
+        FloatVolume::Pointer templateVol;
+        vector<IntVolume::Pointer> orderedBinVols(binVols.begin(), binVols.begin() + binColumns.size());
+        vector<BinaryTestCfg> orderedBinTestCfgs(binTestCfgs.begin(), binTestCfgs.begin() + binColumns.size());
+        if (m_AdaptiveBinaryTestOrder && binColumns.size() > 1 && indices.size() >= BINARY_TEST_ORDER_MIN_CANDIDATES) {
+            vector<unsigned int> binOrder;
+            CalcBinaryTestOrder(candidates, indices, templateVol, orderedBinVols, fuzzyVols, orderedBinTestCfgs,
+                                binExtraLengths, binDistanceMaps, binBrickOccupancies, nativeToRef, binOrder);
+            ApplyTestOrder(binOrder, binColumns);
+            ApplyTestOrder(binOrder, orderedBinVols);
+            ApplyTestOrder(binOrder, orderedBinTestCfgs);
+            ApplyTestOrder(binOrder, binExtraLengths);
+            ApplyTestOrder(binOrder, binDistanceMaps);
+            ApplyTestOrder(binOrder, binBrickOccupancies);
+        }
+
+        // tests already evaluated with the same volumes, configuration and candidates are restored from the score cache
+        vector<ScoreCacheKey> testKeys;
+        unsigned int numCachedTests = 0;
+        if (m_ScoreCache && !nativeToRef) {
+            CalcMultiTestCacheKeys(candidates, indices, orderedBinVols, orderedBinTestCfgs, binExtraLengths, binDistanceMaps,
+                                   binBrickOccupancies, fuzzyVols, fuzzyTestCfgs, fuzzyExtraLengths, testKeys);
+            numCachedTests = RestoreMultiTestScores(candidates, indices, testKeys, binColumns, fuzzyColumns);
+        }
+        unsigned int numCachedBinTests = min(numCachedTests, (unsigned int) binColumns.size());
+        unsigned int numCachedFuzzyTests = numCachedTests - numCachedBinTests;
+        if (numCachedTests > 0 && numCachedTests == binColumns.size() + fuzzyColumns.size()) {
+            SEEGTrajectoryCandidates::RejectionMaskType cachedRejectionMask = 0;
+            for (int i=0; i<binColumns.size(); i++) {
+                cachedRejectionMask |= ((SEEGTrajectoryCandidates::RejectionMaskType) 1) << binColumns[i];
+            }
+            for (unsigned int iElec=0; iElec<indices.size(); iElec++) {
+                unsigned int iCand = indices[iElec];
+                candidates->SetRejectionMask(iCand, candidates->GetRejectionMask(iCand) & cachedRejectionMask);
+                if (!candidates->IsValid(iCand)) {
+                    candidates->SetAggregatedScores(iCand, -1, -1, -1);
+                }
+            }
+            return;
+        }
+
+        // cast only once, each chunk grafts it
+        if (!templateVol) {
+            templateVol = CreateTemplateVolume(binVols, fuzzyVols);
+        }
+
+        unsigned int numElectrodes = indices.size();
+        unsigned int numThreads = m_NumberOfThreads;
+#if ITK_VERSION_MAJOR >= 5
+        if (numThreads == 0) {
+            numThreads = itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads();
+        }
+#else
+        numThreads = 1;
+#endif
+        if (numThreads > numElectrodes) {
+            numThreads = numElectrodes;
+        }
+
+        if (numThreads <= 1) {
+            EvaluateSEEGMultiTest(candidates, indices, 0, numElectrodes, templateVol,
+                                  orderedBinVols, orderedBinTestCfgs, binExtraLengths, binDistanceMaps, binBrickOccupancies, binColumns,
+                                  fuzzyVols, fuzzyTestCfgs, fuzzyExtraLengths, fuzzyColumns,
+                                  numCachedBinTests, numCachedFuzzyTests, false, nativeToRef);
+        } else {
+#if ITK_VERSION_MAJOR >= 5
+            // a few chunks per thread to balance trajectories of different lengths.
+            // Each candidate is written by a single chunk, so results do not depend on scheduling.
+            unsigned int numChunks = numThreads * 4;
+            if (numChunks > numElectrodes) {
+                numChunks = numElectrodes;
+            }
+            itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+            threader->SetMaximumNumberOfThreads(numThreads);
+            threader->SetNumberOfWorkUnits(numThreads);
+            threader->ParallelizeArray(0, numChunks,
+                [&](itk::SizeValueType chunk) {
+                    unsigned int firstIndex = (unsigned int)(((unsigned long long)chunk * numElectrodes) / numChunks);
+                    unsigned int lastIndex = (unsigned int)(((unsigned long long)(chunk + 1) * numElectrodes) / numChunks);
+                    EvaluateSEEGMultiTest(candidates, indices, firstIndex, lastIndex, templateVol,
+                                          orderedBinVols, orderedBinTestCfgs, binExtraLengths, binDistanceMaps, binBrickOccupancies, binColumns,
+                                          fuzzyVols, fuzzyTestCfgs, fuzzyExtraLengths, fuzzyColumns,
+                                          numCachedBinTests, numCachedFuzzyTests, true, nativeToRef);
+                },
+                nullptr);
+#endif
+        }
+
+        if (!testKeys.empty()) {
+            StoreMultiTestScores(candidates, indices, testKeys, numCachedTests, binColumns, fuzzyColumns);
+        }
+    }
+
+    void SEEGPathPlanner::EvaluateSEEGMultiTest( SEEGTrajectoryCandidates::Pointer candidates,
+                                                 const vector<unsigned int>& indices,
+                                                 unsigned int firstIndex,
+                                                 unsigned int lastIndex,
+                                                 FloatVolume::Pointer templateVol,
+                                                 const vector<IntVolume::Pointer>& binVols,
+                                                 const vector<BinaryTestCfg>& binTestCfgs,
+                                                 const vector<float>& binExtraLengths,
+                                                 const vector<SEEGStructureDistanceMap::Pointer>& binDistanceMaps,
+                                                 const vector<SEEGBrickOccupancy::Pointer>& binBrickOccupancies,
+                                                 const vector<int>& binColumns,
+                                                 const vector<FloatVolume::Pointer>& fuzzyVols,
+                                                 const vector<FuzzyTestCfg>& fuzzyTestCfgs,
+                                                 const vector<float>& fuzzyExtraLengths,
+                                                 const vector<int>& fuzzyColumns,
+                                                 unsigned int numCachedBinTests,
+                                                 unsigned int numCachedFuzzyTests,
+                                                 bool singleThreadedPipeline,
+                                                 GeneralTransform::Pointer nativeToRef) {
+
+        // the graft shares the pixel buffer but has its own regions, so the requested region
+        // set by this chunk's pipeline does not interfere with the other chunks
+        FloatVolume::Pointer chunkTemplateVol = FloatVolume::New();
+        chunkTemplateVol->Graft(templateVol);
+        SEEGTrajectoryROIPipeline::Pointer pipeline = SEEGTrajectoryROIPipeline::New(chunkTemplateVol);
+        if (singleThreadedPipeline) {
+            pipeline->SetNumberOfWorkUnits(1);
+        }
+
+        // binary tests on volumes of the template's grid are scored from sparse distance maps
+        vector<unsigned char> binSparse(binColumns.size());
+        for (int i=0; i<binColumns.size(); i++) {
+            binSparse[i] = (binVols[i]->GetBufferedRegion() == templateVol->GetBufferedRegion()) ? 1 : 0;
+        }
+
+        // score of the tests skipped by the screening, as given by TestBinaryOverlap()
+        vector<TrajectoryTestScore> binNoOverlapScores;
+        CalcNoOverlapScores(binVols, binTestCfgs, nativeToRef, binNoOverlapScores);
+
+        // tests restored from the score cache are not evaluated again, only their rejections are kept
+        SEEGTrajectoryCandidates::RejectionMaskType cachedRejectionMask = 0;
+        for (unsigned int i=0; i<numCachedBinTests; i++) {
+            cachedRejectionMask |= ((SEEGTrajectoryCandidates::RejectionMaskType) 1) << binColumns[i];
+        }
+
+        bool reject;
+        for (unsigned int iElec=firstIndex; iElec<lastIndex; iElec++) {
+            unsigned int iCand = indices[iElec];
+            Point3D entryPoint_native = candidates->GetEntryPoint(iCand);
+            Point3D targetDestination_native = candidates->GetTargetPoint(iCand);
+            Point3D entryPoint_extrapolated;
+            candidates->SetRejectionMask(iCand, candidates->GetRejectionMask(iCand) & cachedRejectionMask);
+            reject = !candidates->IsValid(iCand);
+
+            // consecutive tests with the same extra length and radius share the distance map of the pipeline
+            bool hasDistanceMap = false;
+            float distanceMapExtraLength = 0;
+            float distanceMapRadius = 0;
+            bool hasSparseDistanceMap = false;
+            float sparseDistanceMapExtraLength = 0;
+            float sparseDistanceMapRadius = 0;
+
+            for (int i=numCachedBinTests; i<binColumns.size() && !reject; i++) {
+                this->ExtrapolateEntryPoint(targetDestination_native, entryPoint_native, entryPoint_extrapolated, binExtraLengths[i]); //extrapolate by 50mm to consider ears
+                TrajectoryTestScore testScore;
+                GetCandidateTestScore(candidates, iCand, binColumns[i], testScore);
+
+                // far from the structure: the dense test would not find any voxel within m_MaxDistToEvaluate
+                int screening = ScreenBinaryTest(binBrickOccupancies[i], binTestCfgs[i], entryPoint_extrapolated, targetDestination_native);
+                if (screening > 0 || (binDistanceMaps[i] &&
+                    binDistanceMaps[i]->IsSegmentFartherThan(entryPoint_extrapolated, targetDestination_native, binTestCfgs[i].m_MaxDistToEvaluate))) {
+                    testScore = binNoOverlapScores[i]; // what TestBinaryOverlap() gives without any voxel
+                    SetCandidateTestScore(candidates, iCand, binColumns[i], testScore);
+                    continue;
+                }
+                // a structure voxel is surely within the hard constraint distance: rejected without the dense test.
+                // The column keeps no score for this candidate (m_Evaluated stays 0): the readers of the columns
+                // skip the rejected candidates (see SEEGTrajectoryCandidates::GetValidActiveIndices())
+                if (screening < 0) {
+                    reject = true;
+                    candidates->SetRejected(iCand, binColumns[i], reject);
+                    continue;
+                }
+
+                if (binSparse[i]) {
+                    if (!hasSparseDistanceMap || sparseDistanceMapExtraLength != binExtraLengths[i] || sparseDistanceMapRadius != binTestCfgs[i].m_MaxDistToEvaluate) {
+                        pipeline->CalcSparseDistanceMap(entryPoint_extrapolated,targetDestination_native, binTestCfgs[i].m_MaxDistToEvaluate);
+                        hasSparseDistanceMap = true;
+                        sparseDistanceMapExtraLength = binExtraLengths[i];
+                        sparseDistanceMapRadius = binTestCfgs[i].m_MaxDistToEvaluate;
+                    }
+                    reject = TestBinaryOverlapSparse(pipeline, binVols[i], binTestCfgs[i], binNoOverlapScores[i], testScore, nativeToRef);
+                } else {
+                    if (!hasDistanceMap || distanceMapExtraLength != binExtraLengths[i] || distanceMapRadius != binTestCfgs[i].m_MaxDistToEvaluate) {
+                        pipeline->CalcDistanceMap(entryPoint_extrapolated,targetDestination_native, binTestCfgs[i].m_MaxDistToEvaluate);
+                        hasDistanceMap = true;
+                        distanceMapExtraLength = binExtraLengths[i];
+                        distanceMapRadius = binTestCfgs[i].m_MaxDistToEvaluate;
+                    }
+                    reject = TestBinaryOverlap (
+                                       pipeline->GetLastDistanceMap(),
+                                       binVols[i],
+                                       binTestCfgs[i],
+                                       testScore,
+                                       nativeToRef);
+                }
+                SetCandidateTestScore(candidates, iCand, binColumns[i], testScore);
+                candidates->SetRejected(iCand, binColumns[i], reject);
+            }
+
+            for (int i=numCachedFuzzyTests; i<fuzzyColumns.size() && !reject; i++) {
+                this->ExtrapolateEntryPoint(targetDestination_native, entryPoint_native, entryPoint_extrapolated, fuzzyExtraLengths[i]); //extrapolate by 50mm to consider ears
+                if (!hasDistanceMap || distanceMapExtraLength != fuzzyExtraLengths[i] || distanceMapRadius != fuzzyTestCfgs[i].m_MaxDistToEvaluate) {
+                    pipeline->CalcDistanceMap(entryPoint_extrapolated,targetDestination_native, fuzzyTestCfgs[i].m_MaxDistToEvaluate);
+                    hasDistanceMap = true;
+                    distanceMapExtraLength = fuzzyExtraLengths[i];
+                    distanceMapRadius = fuzzyTestCfgs[i].m_MaxDistToEvaluate;
+                }
+
+                TrajectoryTestScore testScore;
+                GetCandidateTestScore(candidates, iCand, fuzzyColumns[i], testScore);
 
                 TestFuzzyOverlap (
                                    pipeline->GetLastDistanceMap(),
@@ -407,19 +1233,503 @@ namespace seeg {
                                    fuzzyTestCfgs[i],
                                    testScore,
                                    nativeToRef);
+                SetCandidateTestScore(candidates, iCand, fuzzyColumns[i], testScore);
             }
 
-
             if (reject) {
-                electrode->m_Valid = false;
-                electrode->m_AggregatedRiskScore = -1;
-                electrode->m_AggregatedRewardScore = -1;
-                electrode->m_AggregatedScore = -1;
-            } else {
-                electrode->m_Valid = true;
+                candidates->SetAggregatedScores(iCand, -1, -1, -1);
             }
-            it++;
-        } while (it != last);
+        }
+    }
+
+    void SEEGPathPlanner::SweepTargetCandidates( const vector<unsigned int>& indices,
+                                                 unsigned int firstIndex,
+                                                 unsigned int lastIndex,
+                                                 const vector<SEEGTargetRaySweep::Pointer>& sweeps,
+                                                 const vector<BinaryTestCfg>& binTestCfgs,
+                                                 const vector<TrajectoryTestScore>& binNoOverlapScores,
+                                                 const vector<float>& binExtraLengths,
+                                                 const vector<int>& binColumns,
+                                                 GeneralTransform::Pointer nativeToRef) {
+        Point3D targetPoint = m_Candidates->GetTargetPoint(indices[firstIndex]);
+        vector<unsigned int> rayCandidates;
+        vector<Point3D> rayEndPoints;
+        vector<RaySweepScore> rayScores;
+        for (int i=0; i<binColumns.size(); i++) {
+            // the candidates rejected by a previous test are not evaluated (as in DoSEEGMultiTest())
+            rayCandidates.clear();
+            rayEndPoints.clear();
+            for (unsigned int iElec=firstIndex; iElec<lastIndex; iElec++) {
+                unsigned int iCand = indices[iElec];
+                if (!m_Candidates->IsValid(iCand)) {
+                    continue;
+                }
+                Point3D entryPoint_native = m_Candidates->GetEntryPoint(iCand);
+                Point3D entryPoint_extrapolated;
+                this->ExtrapolateEntryPoint(targetPoint, entryPoint_native, entryPoint_extrapolated, binExtraLengths[i]);
+                rayCandidates.push_back(iCand);
+                rayEndPoints.push_back(entryPoint_extrapolated);
+            }
+            if (rayCandidates.empty()) {
+                return;
+            }
+
+            sweeps[i]->Sweep(targetPoint, rayEndPoints, rayScores);
+
+            for (unsigned int iRay=0; iRay<rayCandidates.size(); iRay++) {
+                unsigned int iCand = rayCandidates[iRay];
+                const RaySweepScore& rayScore = rayScores[iRay];
+                TrajectoryTestScore testScore;
+                GetCandidateTestScore(m_Candidates, iCand, binColumns[i], testScore);
+                if (rayScore.m_MinDist > binTestCfgs[i].m_MaxDistToEvaluate) {
+                    testScore = binNoOverlapScores[i];
+                } else {
+                    float dist = max(rayScore.m_MinDist, 0.0f);
+                    testScore.scoreMax = CalcDistFromTrajFactor(dist, binTestCfgs[i].m_k1, binTestCfgs[i].m_k2);
+                    testScore.scoreSum = rayScore.m_RiskSum; // ray sum, not the cylinder sum of TestBinaryOverlap()
+                    testScore.distAtMaxScore = dist;
+                    if (nativeToRef) {
+                        nativeToRef->TransformPoint(rayScore.m_PointAtMinDist, testScore.pointAtMaxScore);
+                    } else {
+                        testScore.pointAtMaxScore = rayScore.m_PointAtMinDist;
+                    }
+                }
+                SetCandidateTestScore(m_Candidates, iCand, binColumns[i], testScore);
+
+                bool reject = binTestCfgs[i].m_HardConstraint && rayScore.m_MinDist < binTestCfgs[i].m_k1;
+                m_Candidates->SetRejected(iCand, binColumns[i], reject);
+                if (reject) {
+                    m_Candidates->SetAggregatedScores(iCand, -1, -1, -1);
+                }
+            }
+        }
+    }
+
+    FloatVolume::Pointer SEEGPathPlanner::CreateTemplateVolume(const vector<IntVolume::Pointer>& binVols,
+                                                               const vector<FloatVolume::Pointer>& fuzzyVols) {
+        // one of the 2 vectors must contain a volume
+        if (binVols.size()>0) {
+            typedef itk::CastImageFilter<IntVolume, FloatVolume> CastFilterType;
+            CastFilterType::Pointer castFilter = CastFilterType::New();
+            castFilter->SetInput(binVols[0]);
+            castFilter->Update();
+            return castFilter->GetOutput();
+        }
+        return fuzzyVols[0];
+    }
+
+    void SEEGPathPlanner::CalcBinaryTestOrder(  SEEGTrajectoryCandidates::Pointer candidates,
+                                                const vector<unsigned int>& indices,
+                                                FloatVolume::Pointer& templateVol,
+                                                const vector<IntVolume::Pointer>& binVols,
+                                                const vector<FloatVolume::Pointer>& fuzzyVols,
+                                                const vector<BinaryTestCfg>& binTestCfgs,
+                                                const vector<float>& binExtraLengths,
+                                                const vector<SEEGStructureDistanceMap::Pointer>& binDistanceMaps,
+                                                const vector<SEEGBrickOccupancy::Pointer>& binBrickOccupancies,
+                                                GeneralTransform::Pointer nativeToRef,
+                                                vector<unsigned int>& binOrder) {
+        unsigned int numTests = binVols.size();
+        binOrder.resize(numTests);
+        for (unsigned int i=0; i<numTests; i++) {
+            binOrder[i] = i;
+        }
+
+        // the order depends on timings: it is kept in the score cache so that the keys of the tests do not change
+        ScoreCacheKey cacheKey;
+        bool useScoreCache = m_ScoreCache && !nativeToRef;
+        if (useScoreCache) {
+            SEEGScoreCacheKeyBuilder keyBuilder;
+            keyBuilder.AddString("binary test order");
+            keyBuilder.Add<int>(m_HasCandidatesElectrodeType ? (int) m_CandidatesElectrodeType : -1); // electrode type of the candidates
+            for (unsigned int i=0; i<numTests; i++) {
+                keyBuilder.AddKey(m_ScoreCache->GetVolumeKey(binVols[i]));
+                AddBinaryTestCfgToKey(keyBuilder, binTestCfgs[i]);
+                keyBuilder.Add<float>(binExtraLengths[i]);
+                keyBuilder.Add<int>(binDistanceMaps[i] ? 1 : 0);
+                keyBuilder.Add<int>(binBrickOccupancies[i] ? 1 : 0);
+            }
+            for (unsigned int iElec=0; iElec<indices.size(); iElec++) {
+                keyBuilder.AddPoint(candidates->GetEntryPoint(indices[iElec]));
+                keyBuilder.AddPoint(candidates->GetTargetPoint(indices[iElec]));
+            }
+            cacheKey = keyBuilder.GetKey();
+
+            ScoreCacheEntry::Pointer entry = m_ScoreCache->Find(cacheKey);
+            if (entry && entry->GetSize() == numTests * sizeof(unsigned int)) {
+                const unsigned char* data = entry->GetData();
+                unsigned long long position = 0;
+                vector<bool> used(numTests, false);
+                bool valid = true;
+                for (unsigned int i=0; i<numTests && valid; i++) {
+                    binOrder[i] = SEEGScoreCache::ReadValue<unsigned int>(data, position);
+                    valid = binOrder[i] < numTests && !used[binOrder[i]];
+                    if (valid) {
+                        used[binOrder[i]] = true;
+                    }
+                }
+                if (valid) {
+                    return;
+                }
+                for (unsigned int i=0; i<numTests; i++) {
+                    binOrder[i] = i;
+                }
+            }
+        }
+
+        // Evaluate every test (without early rejection) on candidates spread over the list
+        if (!templateVol) {
+            templateVol = CreateTemplateVolume(binVols, fuzzyVols);
+        }
+        FloatVolume::Pointer sampleTemplateVol = FloatVolume::New();
+        sampleTemplateVol->Graft(templateVol);
+        SEEGTrajectoryROIPipeline::Pointer pipeline = SEEGTrajectoryROIPipeline::New(sampleTemplateVol);
+        vector<TrajectoryTestScore> binNoOverlapScores;
+        CalcNoOverlapScores(binVols, binTestCfgs, nativeToRef, binNoOverlapScores);
+
+        unsigned int numSamples = min(BINARY_TEST_ORDER_SAMPLE_SIZE, (unsigned int) indices.size());
+        vector<itk::TimeProbe> distanceMapProbes(numTests);
+        vector<itk::TimeProbe> overlapProbes(numTests);
+        vector<unsigned int> numRejected(numTests, 0);
+        for (unsigned int iSample=0; iSample<numSamples; iSample++) {
+            unsigned int iCand = indices[(unsigned int)(((unsigned long long) iSample * indices.size()) / numSamples)];
+            Point3D entryPoint_native = candidates->GetEntryPoint(iCand);
+            Point3D targetDestination_native = candidates->GetTargetPoint(iCand);
+            Point3D entryPoint_extrapolated;
+            for (unsigned int i=0; i<numTests; i++) {
+                this->ExtrapolateEntryPoint(targetDestination_native, entryPoint_native, entryPoint_extrapolated, binExtraLengths[i]);
+                int screening = ScreenBinaryTest(binBrickOccupancies[i], binTestCfgs[i], entryPoint_extrapolated, targetDestination_native);
+                if (screening > 0 || (binDistanceMaps[i] &&
+                    binDistanceMaps[i]->IsSegmentFartherThan(entryPoint_extrapolated, targetDestination_native, binTestCfgs[i].m_MaxDistToEvaluate))) {
+                    continue; // neither cost nor rejection
+                }
+                if (screening < 0) {
+                    numRejected[i]++; // rejection without cost
+                    continue;
+                }
+                // same distance maps as EvaluateSEEGMultiTest() (sparse on the template's grid)
+                bool sparse = (binVols[i]->GetBufferedRegion() == templateVol->GetBufferedRegion());
+                distanceMapProbes[i].Start();
+                if (sparse) {
+                    pipeline->CalcSparseDistanceMap(entryPoint_extrapolated,targetDestination_native, binTestCfgs[i].m_MaxDistToEvaluate);
+                } else {
+                    pipeline->CalcDistanceMap(entryPoint_extrapolated,targetDestination_native, binTestCfgs[i].m_MaxDistToEvaluate);
+                }
+                distanceMapProbes[i].Stop();
+
+                TrajectoryTestScore testScore;
+                bool reject;
+                overlapProbes[i].Start();
+                if (sparse) {
+                    reject = TestBinaryOverlapSparse(pipeline, binVols[i], binTestCfgs[i], binNoOverlapScores[i], testScore, nativeToRef);
+                } else {
+                    reject = TestBinaryOverlap (
+                                       pipeline->GetLastDistanceMap(),
+                                       binVols[i],
+                                       binTestCfgs[i],
+                                       testScore,
+                                       nativeToRef);
+                }
+                overlapProbes[i].Stop();
+                if (reject) {
+                    numRejected[i]++;
+                }
+            }
+        }
+
+        // a test that never rejected in the sample is given half a rejection, so that those tests are ordered by cost
+        vector<double> rejectionRates(numTests);
+        vector<double> distanceMapCosts(numTests);
+        vector<double> overlapCosts(numTests);
+        for (unsigned int i=0; i<numTests; i++) {
+            rejectionRates[i] = max((double) numRejected[i], 0.5) / numSamples;
+            distanceMapCosts[i] = distanceMapProbes[i].GetTotal() / numSamples;
+            overlapCosts[i] = overlapProbes[i].GetTotal() / numSamples;
+        }
+
+        // greedy order: lowest expected cost per rejection first
+        vector<bool> ordered(numTests, false);
+        int previousTest = -1;
+        for (unsigned int iOrder=0; iOrder<numTests; iOrder++) {
+            int bestTest = -1;
+            double bestCostPerRejection = 0;
+            for (unsigned int i=0; i<numTests; i++) {
+                if (ordered[i]) {
+                    continue;
+                }
+                double cost = overlapCosts[i];
+                if (previousTest < 0 ||
+                    binExtraLengths[i] != binExtraLengths[previousTest] ||
+                    binTestCfgs[i].m_MaxDistToEvaluate != binTestCfgs[previousTest].m_MaxDistToEvaluate) {
+                    cost += distanceMapCosts[i];
+                }
+                double costPerRejection = cost / rejectionRates[i];
+                if (bestTest < 0 || costPerRejection < bestCostPerRejection) {
+                    bestTest = i;
+                    bestCostPerRejection = costPerRejection;
+                }
+            }
+            ordered[bestTest] = true;
+            binOrder[iOrder] = bestTest;
+            previousTest = bestTest;
+        }
+
+        cout << "Binary tests order:";
+        for (unsigned int i=0; i<numTests; i++) {
+            cout << " " << binOrder[i] << " (rejected " << numRejected[binOrder[i]] << "/" << numSamples << ")";
+        }
+        cout << endl;
+
+        if (useScoreCache) {
+            vector<unsigned char> data;
+            for (unsigned int i=0; i<numTests; i++) {
+                SEEGScoreCache::AppendValue<unsigned int>(data, binOrder[i]);
+            }
+            m_ScoreCache->Store(cacheKey, data);
+        }
+    }
+
+    void SEEGPathPlanner::GetCandidateTestScore(SEEGTrajectoryCandidates::Pointer candidates, unsigned int index, int column, TrajectoryTestScore& score) {
+        TrajectoryTestColumn& testColumn = candidates->GetTestColumn(column);
+        if (!testColumn.m_Evaluated[index]) {
+            score = TrajectoryTestScore(); // as a new entry of ElectrodeInfo::m_TrajectoryTestScores
+            return;
+        }
+        score.scoreMax = testColumn.m_ScoreMax[index];
+        score.scoreSum = testColumn.m_ScoreSum[index];
+        score.rankingUsingMax = testColumn.m_RankingUsingMax[index];
+        score.rankingUsingSum = testColumn.m_RankingUsingSum[index];
+        score.distAtMaxScore = testColumn.m_DistAtMaxScore[index];
+        score.pointAtMaxScore[0] = testColumn.m_PointAtMaxScoreX[index];
+        score.pointAtMaxScore[1] = testColumn.m_PointAtMaxScoreY[index];
+        score.pointAtMaxScore[2] = testColumn.m_PointAtMaxScoreZ[index];
+    }
+
+    void SEEGPathPlanner::SetCandidateTestScore(SEEGTrajectoryCandidates::Pointer candidates, unsigned int index, int column, const TrajectoryTestScore& score) {
+        TrajectoryTestColumn& testColumn = candidates->GetTestColumn(column);
+        testColumn.m_ScoreMax[index] = score.scoreMax;
+        testColumn.m_ScoreSum[index] = score.scoreSum;
+        testColumn.m_RankingUsingMax[index] = score.rankingUsingMax;
+        testColumn.m_RankingUsingSum[index] = score.rankingUsingSum;
+        testColumn.m_DistAtMaxScore[index] = score.distAtMaxScore;
+        testColumn.m_PointAtMaxScoreX[index] = score.pointAtMaxScore[0];
+        testColumn.m_PointAtMaxScoreY[index] = score.pointAtMaxScore[1];
+        testColumn.m_PointAtMaxScoreZ[index] = score.pointAtMaxScore[2];
+        testColumn.m_Evaluated[index] = 1;
+    }
+
+    void SEEGPathPlanner::GetCandidateDepthScore(SEEGTrajectoryCandidates::Pointer candidates, unsigned int index, int column,
+                                                 unsigned int iDepth, TrajectoryTestScore& score) {
+        TrajectoryTestColumn& testColumn = candidates->GetTestColumn(column);
+        unsigned int depth = testColumn.m_FirstDepth[index] + iDepth;
+        score.scoreMax = testColumn.m_DepthScoreMax[depth];
+        score.scoreSum = testColumn.m_DepthScoreSum[depth];
+        score.rankingUsingMax = testColumn.m_DepthRankingUsingMax[depth];
+        score.rankingUsingSum = testColumn.m_DepthRankingUsingSum[depth];
+        score.distAtMaxScore = testColumn.m_DepthDistAtMaxScore[depth];
+        score.pointAtMaxScore[0] = testColumn.m_DepthPointAtMaxScoreX[depth];
+        score.pointAtMaxScore[1] = testColumn.m_DepthPointAtMaxScoreY[depth];
+        score.pointAtMaxScore[2] = testColumn.m_DepthPointAtMaxScoreZ[depth];
+    }
+
+    void SEEGPathPlanner::AddCandidateDepthScore(SEEGTrajectoryCandidates::Pointer candidates, unsigned int index, int column,
+                                                 const TrajectoryTestScore& score) {
+        unsigned int depth = candidates->AddDepth(index, column);
+        TrajectoryTestColumn& testColumn = candidates->GetTestColumn(column);
+        testColumn.m_DepthScoreMax[depth] = score.scoreMax;
+        testColumn.m_DepthScoreSum[depth] = score.scoreSum;
+        testColumn.m_DepthRankingUsingMax[depth] = score.rankingUsingMax;
+        testColumn.m_DepthRankingUsingSum[depth] = score.rankingUsingSum;
+        testColumn.m_DepthDistAtMaxScore[depth] = score.distAtMaxScore;
+        testColumn.m_DepthPointAtMaxScoreX[depth] = score.pointAtMaxScore[0];
+        testColumn.m_DepthPointAtMaxScoreY[depth] = score.pointAtMaxScore[1];
+        testColumn.m_DepthPointAtMaxScoreZ[depth] = score.pointAtMaxScore[2];
+    }
+
+    void SEEGPathPlanner::CalcMultiTestCacheKeys(SEEGTrajectoryCandidates::Pointer candidates,
+                                                 const vector<unsigned int>& indices,
+                                                 const vector<IntVolume::Pointer>& binVols,
+                                                 const vector<BinaryTestCfg>& binTestCfgs,
+                                                 const vector<float>& binExtraLengths,
+                                                 const vector<SEEGStructureDistanceMap::Pointer>& binDistanceMaps,
+                                                 const vector<SEEGBrickOccupancy::Pointer>& binBrickOccupancies,
+                                                 const vector<FloatVolume::Pointer>& fuzzyVols,
+                                                 const vector<FuzzyTestCfg>& fuzzyTestCfgs,
+                                                 const vector<float>& fuzzyExtraLengths,
+                                                 vector<ScoreCacheKey>& testKeys) {
+        SEEGScoreCacheKeyBuilder candidatesKey;
+        candidatesKey.AddString("candidates");
+        candidatesKey.Add<int>(m_HasCandidatesElectrodeType ? (int) m_CandidatesElectrodeType : -1); // electrode type of the candidates
+        for (unsigned int iElec=0; iElec<indices.size(); iElec++) {
+            candidatesKey.AddPoint(candidates->GetEntryPoint(indices[iElec]));
+            candidatesKey.AddPoint(candidates->GetTargetPoint(indices[iElec]));
+        }
+
+        // test names are not part of the keys: scores do not depend on them
+        testKeys.clear();
+        ScoreCacheKey previousKey = candidatesKey.GetKey();
+        for (int i=0; i<binVols.size(); i++) {
+            SEEGScoreCacheKeyBuilder testKey;
+            testKey.AddString("binary test");
+            testKey.AddKey(previousKey);
+            testKey.AddKey(m_ScoreCache->GetVolumeKey(binVols[i]));
+            AddBinaryTestCfgToKey(testKey, binTestCfgs[i]);
+            testKey.Add<float>(binExtraLengths[i]);
+            testKey.Add<int>(binDistanceMaps[i] ? 1 : 0);
+            testKey.Add<int>(binBrickOccupancies[i] ? 1 : 0);
+            previousKey = testKey.GetKey();
+            testKeys.push_back(previousKey);
+        }
+        for (int i=0; i<fuzzyVols.size(); i++) {
+            SEEGScoreCacheKeyBuilder testKey;
+            testKey.AddString("fuzzy test");
+            testKey.AddKey(previousKey);
+            testKey.AddKey(m_ScoreCache->GetVolumeKey(fuzzyVols[i]));
+            AddFuzzyTestCfgToKey(testKey, fuzzyTestCfgs[i]);
+            testKey.Add<float>(fuzzyExtraLengths[i]);
+            previousKey = testKey.GetKey();
+            testKeys.push_back(previousKey);
+        }
+    }
+
+    unsigned int SEEGPathPlanner::RestoreMultiTestScores(SEEGTrajectoryCandidates::Pointer candidates,
+                                                         const vector<unsigned int>& indices,
+                                                         const vector<ScoreCacheKey>& testKeys,
+                                                         const vector<int>& binColumns,
+                                                         const vector<int>& fuzzyColumns) {
+        // one record per candidate: evaluated, rejected, score
+        const unsigned long long recordSize = 2 + 5 * sizeof(float) + 3 * sizeof(double);
+        unsigned int numTests = 0;
+        for (; numTests<testKeys.size(); numTests++) {
+            ScoreCacheEntry::Pointer entry = m_ScoreCache->Find(testKeys[numTests]);
+            if (!entry || entry->GetSize() != indices.size() * recordSize) {
+                break;
+            }
+            bool binaryTest = numTests < binColumns.size();
+            int column = binaryTest ? binColumns[numTests] : fuzzyColumns[numTests - binColumns.size()];
+            const unsigned char* data = entry->GetData();
+            unsigned long long position = 0;
+            for (unsigned int iElec=0; iElec<indices.size(); iElec++) {
+                unsigned int iCand = indices[iElec];
+                bool evaluated = SEEGScoreCache::ReadValue<unsigned char>(data, position) != 0;
+                bool rejected = SEEGScoreCache::ReadValue<unsigned char>(data, position) != 0;
+                TrajectoryTestScore score;
+                ReadCachedTestScore(data, position, score);
+                if (evaluated) {
+                    SetCandidateTestScore(candidates, iCand, column, score);
+                } else {
+                    candidates->GetTestColumn(column).m_Evaluated[iCand] = 0;
+                }
+                if (binaryTest) {
+                    candidates->SetRejected(iCand, column, rejected);
+                }
+            }
+        }
+        return numTests;
+    }
+
+    void SEEGPathPlanner::StoreMultiTestScores(SEEGTrajectoryCandidates::Pointer candidates,
+                                               const vector<unsigned int>& indices,
+                                               const vector<ScoreCacheKey>& testKeys,
+                                               unsigned int firstTest,
+                                               const vector<int>& binColumns,
+                                               const vector<int>& fuzzyColumns) {
+        for (unsigned int iTest=firstTest; iTest<testKeys.size(); iTest++) {
+            bool binaryTest = iTest < binColumns.size();
+            int column = binaryTest ? binColumns[iTest] : fuzzyColumns[iTest - binColumns.size()];
+            SEEGTrajectoryCandidates::RejectionMaskType bit = ((SEEGTrajectoryCandidates::RejectionMaskType) 1) << column;
+            vector<unsigned char> data;
+            data.reserve(indices.size() * (2 + 5 * sizeof(float) + 3 * sizeof(double)));
+            for (unsigned int iElec=0; iElec<indices.size(); iElec++) {
+                unsigned int iCand = indices[iElec];
+                TrajectoryTestScore score;
+                GetCandidateTestScore(candidates, iCand, column, score);
+                SEEGScoreCache::AppendValue<unsigned char>(data, candidates->GetTestColumn(column).m_Evaluated[iCand]);
+                SEEGScoreCache::AppendValue<unsigned char>(data, (binaryTest && (candidates->GetRejectionMask(iCand) & bit)) ? 1 : 0);
+                AppendCachedTestScore(data, score);
+            }
+            m_ScoreCache->Store(testKeys[iTest], data);
+        }
+    }
+
+    void SEEGPathPlanner::AddBinaryTestCfgToKey(SEEGScoreCacheKeyBuilder& keyBuilder, const BinaryTestCfg& cfg) {
+        keyBuilder.Add<float>(cfg.m_MaxDistToEvaluate);
+        keyBuilder.Add<float>(cfg.m_k1);
+        keyBuilder.Add<float>(cfg.m_k2);
+        keyBuilder.Add<int>(cfg.m_HardConstraint ? 1 : 0);
+    }
+
+    void SEEGPathPlanner::AddFuzzyTestCfgToKey(SEEGScoreCacheKeyBuilder& keyBuilder, const FuzzyTestCfg& cfg) {
+        keyBuilder.Add<float>(cfg.m_MaxDistToEvaluate);
+        keyBuilder.Add<float>(cfg.m_k1);
+        keyBuilder.Add<float>(cfg.m_k2);
+    }
+
+    void SEEGPathPlanner::AppendCachedTestScore(vector<unsigned char>& data, const TrajectoryTestScore& score) {
+        SEEGScoreCache::AppendValue<float>(data, score.scoreMax);
+        SEEGScoreCache::AppendValue<float>(data, score.scoreSum);
+        SEEGScoreCache::AppendValue<float>(data, score.rankingUsingMax);
+        SEEGScoreCache::AppendValue<float>(data, score.rankingUsingSum);
+        SEEGScoreCache::AppendValue<float>(data, score.distAtMaxScore);
+        for (int i=0; i<3; i++) {
+            SEEGScoreCache::AppendValue<double>(data, score.pointAtMaxScore[i]);
+        }
+    }
+
+    void SEEGPathPlanner::ReadCachedTestScore(const unsigned char* data, unsigned long long& position, TrajectoryTestScore& score) {
+        score.scoreMax = SEEGScoreCache::ReadValue<float>(data, position);
+        score.scoreSum = SEEGScoreCache::ReadValue<float>(data, position);
+        score.rankingUsingMax = SEEGScoreCache::ReadValue<float>(data, position);
+        score.rankingUsingSum = SEEGScoreCache::ReadValue<float>(data, position);
+        score.distAtMaxScore = SEEGScoreCache::ReadValue<float>(data, position);
+        for (int i=0; i<3; i++) {
+            score.pointAtMaxScore[i] = SEEGScoreCache::ReadValue<double>(data, position);
+        }
+    }
+
+    void SEEGPathPlanner::CopyCandidateScoresToElectrode(SEEGTrajectoryCandidates::Pointer candidates, unsigned int index, ElectrodeInfo::Pointer electrode) {
+        for (int iCol=0; iCol<candidates->GetNumberOfTestColumns(); iCol++) {
+            if (!candidates->HasTestColumn(iCol)) {
+                continue;
+            }
+            const string& testName = m_TestRegistry->GetTestName(iCol);
+            if (candidates->GetTestColumn(iCol).m_Evaluated[index]) {
+                GetCandidateTestScore(candidates, index, iCol, electrode->m_TrajectoryTestScores[testName]);
+            }
+            unsigned int numDepths = candidates->GetTestColumn(iCol).m_NumberOfDepths[index];
+            if (numDepths > 0) {
+                ElectrodeInfo::VecTrajectoryTestScore& vecScores = electrode->m_VecTrajectoryTestScores[testName];
+                vecScores.resize(numDepths);
+                for (unsigned int iDepth=0; iDepth<numDepths; iDepth++) {
+                    GetCandidateDepthScore(candidates, index, iCol, iDepth, vecScores[iDepth]);
+                }
+            }
+        }
+        electrode->m_AggregatedRiskScore = candidates->GetAggregatedRiskScore(index);
+        electrode->m_AggregatedRewardScore = candidates->GetAggregatedRewardScore(index);
+        electrode->m_AggregatedScore = candidates->GetAggregatedScore(index);
+        electrode->m_Valid = candidates->IsValid(index);
+    }
+
+    void SEEGPathPlanner::CopyElectrodeScoresToCandidate(ElectrodeInfo::Pointer electrode, SEEGTrajectoryCandidates::Pointer candidates, unsigned int index) {
+        for (int iCol=0; iCol<candidates->GetNumberOfTestColumns(); iCol++) {
+            if (!candidates->HasTestColumn(iCol)) {
+                continue;
+            }
+            const string& testName = m_TestRegistry->GetTestName(iCol);
+            map<string, TrajectoryTestScore>::iterator itScore = electrode->m_TrajectoryTestScores.find(testName);
+            if (itScore != electrode->m_TrajectoryTestScores.end()) {
+                SetCandidateTestScore(candidates, index, iCol, itScore->second);
+            }
+            map<string, ElectrodeInfo::VecTrajectoryTestScore>::iterator itDepths = electrode->m_VecTrajectoryTestScores.find(testName);
+            if (itDepths != electrode->m_VecTrajectoryTestScores.end()) {
+                candidates->RemoveDepths(index, iCol);
+                for (unsigned int iDepth=0; iDepth<itDepths->second.size(); iDepth++) {
+                    AddCandidateDepthScore(candidates, index, iCol, itDepths->second[iDepth]);
+                }
+            }
+        }
+        candidates->SetAggregatedScores(index, electrode->m_AggregatedRiskScore, electrode->m_AggregatedRewardScore, electrode->m_AggregatedScore);
     }
 
     void SEEGPathPlanner::RemoveInvalidPaths() {
@@ -428,10 +1738,15 @@ namespace seeg {
             ElectrodeInfo::Pointer electrode = *it;
             if (!electrode->m_Valid) {
                 it = m_ActiveTrajectories.erase(it);
+                m_TrajectoryIndicesModified = true;
             } else {
                 it++;
             }
         }
+
+        // Rejected candidates stay in the table. The survivors stay active rows: the maximization tests and the
+        // aggregation run on the table, only the best trajectories are materialized (see AggregateAll())
+        m_Candidates->RemoveInvalidCandidates();
     }
 
 
@@ -575,14 +1890,16 @@ namespace seeg {
                                    list<ElectrodeInfo::Pointer>::iterator last,
                                    GeneralTransform::Pointer nativeToRef) { //RIZ: OBSOLETE! - only considers 1 distMap
 
-       FloatVolumeDuplicator::Pointer volDuplicator = FloatVolumeDuplicator::New();
-       volDuplicator->SetInputImage(targetDistMap);
-       volDuplicator->Update();
-       FloatVolume::Pointer vol = volDuplicator->GetOutput();
-       vol->DisconnectPipeline();
+       // works on ElectrodeInfo only: the active candidates of the table are materialized first
+       if (first == m_ActiveTrajectories.begin() && last == m_ActiveTrajectories.end()) {
+           MaterializeActiveCandidates();
+           first = m_ActiveTrajectories.begin();
+       }
+
+       // the recording maps are computed only within each electrode's region -> the target map is only used for its geometry
+       FloatVolume::Pointer vol = targetDistMap;
        ElectrodeInfo::Pointer electrode = *first;
        SEEGContactsROIPipeline::Pointer pipelineContacts = SEEGContactsROIPipeline::New(vol, electrode->GetElectrodeModelType()); //volume is only to have size,
-       pipelineContacts->EmptyTemplateVol();
        FloatVolume::SpacingType spacing = vol->GetSpacing();
        float maxSpacing = max(spacing[0], max(spacing[1], spacing[2]));
        FloatVolume::RegionType region = targetDistMap->GetRequestedRegion();
@@ -635,6 +1952,7 @@ namespace seeg {
 
                    TestMaximizationOverlap(
                                recordedDistMap,
+                               pipelineContacts->GetLastRecordingSum(),
                                allContactPoints,
                                cfgs,
                                testVolScore,
@@ -654,6 +1972,25 @@ namespace seeg {
        }
    }
 
+   void SEEGPathPlanner::DoMaximizationTest(vector<string> &testNames,
+                                   const vector<FloatVolume::Pointer> &targetDistMaps,
+                                   const MaximizationTestCfg& cfgs,
+                                   vector<string>& binTestNames,
+                                   vector<IntVolume::Pointer>& binVols,
+                                   vector<BinaryTestCfg>& binTestCfgs,
+                                   GeneralTransform::Pointer nativeToRef) {
+
+       // valid candidates of the table (scores stay in the table)
+       vector<unsigned int> activeIndices;
+       m_Candidates->GetValidActiveIndices(activeIndices);
+       EvaluateMaximizationCandidates(testNames, targetDistMaps, cfgs, binTestNames, binVols, binTestCfgs,
+                                      m_Candidates, activeIndices, GetCandidatesElectrodeType(), nativeToRef);
+
+       // trajectories that already are ElectrodeInfo (manual plans, materialized candidates)
+       DoMaximizationTest(testNames, targetDistMaps, cfgs, binTestNames, binVols, binTestCfgs,
+                          m_ActiveTrajectories.begin(), m_ActiveTrajectories.end(), nativeToRef);
+   }
+
    void SEEGPathPlanner::DoMaximizationTest(vector<string> &testNames,
                                    const vector<FloatVolume::Pointer> &targetDistMaps,
                                    const MaximizationTestCfg& cfgs,
@@ -664,15 +2001,210 @@ namespace seeg {
                                    list<ElectrodeInfo::Pointer>::iterator last,
                                    GeneralTransform::Pointer nativeToRef) {
 
-       // Creates empty contacts pipeline -> useful to compute dist map around line
-       FloatVolumeDuplicator::Pointer volDuplicator = FloatVolumeDuplicator::New();
-       volDuplicator->SetInputImage(targetDistMaps[0]);
-       volDuplicator->Update();
-       FloatVolume::Pointer vol = volDuplicator->GetOutput();
-       vol->DisconnectPipeline();
-       ElectrodeInfo::Pointer electrode = *first;
-       SEEGContactsROIPipeline::Pointer pipelineContacts = SEEGContactsROIPipeline::New(vol, electrode->GetElectrodeModelType()); //volume is only to have size
-       pipelineContacts->EmptyTemplateVol();
+       // the electrodes are copied to a temporary table, evaluated there and their scores copied back
+       vector<ElectrodeInfo::Pointer> electrodes(first, last);
+       if (electrodes.empty()) {
+           return;
+       }
+       SEEGTrajectoryCandidates::Pointer candidates = SEEGTrajectoryCandidates::New(m_TestRegistry);
+       candidates->Reserve(electrodes.size());
+       for (int iTarget=0; iTarget<testNames.size(); iTarget++) {
+           candidates->AddTestColumn(testNames[iTarget]);
+       }
+       for (unsigned int iElec=0; iElec<electrodes.size(); iElec++) {
+           unsigned int index = candidates->AddCandidate(electrodes[iElec]->m_EntryPointWorld, electrodes[iElec]->m_TargetPointWorld);
+           CopyElectrodeScoresToCandidate(electrodes[iElec], candidates, index);
+       }
+
+       // all electrodes are assumed to be of the same type
+       vector<unsigned int> indices = candidates->GetActiveIndices();
+       EvaluateMaximizationCandidates(testNames, targetDistMaps, cfgs, binTestNames, binVols, binTestCfgs,
+                                      candidates, indices, electrodes[0]->GetElectrodeModelType(), nativeToRef);
+
+       // pruned electrodes get no score (see SelectElectrodesCoarseToFine()), depths are the ones of the table
+       for (unsigned int iElec=0; iElec<electrodes.size(); iElec++) {
+           for (int iTarget=0; iTarget<testNames.size(); iTarget++) {
+               electrodes[iElec]->m_VecTrajectoryTestScores[testNames[iTarget]].clear();
+               if (!candidates->GetTestColumn(candidates->GetTestColumnIndex(testNames[iTarget])).m_Evaluated[iElec]) {
+                   electrodes[iElec]->m_TrajectoryTestScores.erase(testNames[iTarget]);
+               }
+           }
+           CopyCandidateScoresToElectrode(candidates, iElec, electrodes[iElec]);
+       }
+   }
+
+   void SEEGPathPlanner::EvaluateMaximizationCandidates(vector<string> &testNames,
+                                   const vector<FloatVolume::Pointer> &targetDistMaps,
+                                   const MaximizationTestCfg& cfgs,
+                                   vector<string>& binTestNames,
+                                   vector<IntVolume::Pointer>& binVols,
+                                   vector<BinaryTestCfg>& binTestCfgs,
+                                   SEEGTrajectoryCandidates::Pointer candidates,
+                                   const vector<unsigned int>& indices,
+                                   SEEGElectrodeModel::SEEG_ELECTRODE_MODEL_TYPE electrodeType,
+                                   GeneralTransform::Pointer nativeToRef) {
+       if (indices.empty() || testNames.empty()) {
+           return;
+       }
+       if (m_CoarseToFineLevels == 0) {
+           EvaluateMaximizationTest(testNames, targetDistMaps, cfgs, binTestNames, binVols, binTestCfgs,
+                                    candidates, indices, electrodeType, nativeToRef);
+           return;
+       }
+
+       vector<unsigned int> fineIndices;
+       SelectElectrodesCoarseToFine(testNames, targetDistMaps, cfgs, candidates, indices, electrodeType, nativeToRef, fineIndices);
+       if (!fineIndices.empty()) {
+           EvaluateMaximizationTest(testNames, targetDistMaps, cfgs, binTestNames, binVols, binTestCfgs,
+                                    candidates, fineIndices, electrodeType, nativeToRef);
+       }
+   }
+
+   void SEEGPathPlanner::SelectElectrodesCoarseToFine(vector<string> &testNames,
+                                   const vector<FloatVolume::Pointer> &targetDistMaps,
+                                   const MaximizationTestCfg& cfgs,
+                                   SEEGTrajectoryCandidates::Pointer candidates,
+                                   const vector<unsigned int>& indices,
+                                   SEEGElectrodeModel::SEEG_ELECTRODE_MODEL_TYPE electrodeType,
+                                   GeneralTransform::Pointer nativeToRef,
+                                   vector<unsigned int>& fineIndices) {
+       vector<unsigned int> selected(indices);
+       vector<int> targetColumns(testNames.size());
+       for (int iTarget=0; iTarget<testNames.size(); iTarget++) {
+           targetColumns[iTarget] = candidates->AddTestColumn(testNames[iTarget]);
+       }
+
+       // weights of the targets (the score sum if the test has no weights)
+       vector<float> weightsUsingMax(testNames.size(), 0);
+       vector<float> weightsUsingSum(testNames.size(), 1);
+       for (int iTarget=0; iTarget<testNames.size(); iTarget++) {
+           map<string, TrajectoryTestWeights>::iterator itReward = m_TrajectoryRewardTestWeights.find(testNames[iTarget]);
+           if (itReward != m_TrajectoryRewardTestWeights.end()) {
+               weightsUsingMax[iTarget] = itReward->second.m_WeightUsingMax;
+               weightsUsingSum[iTarget] = itReward->second.m_WeightUsingSum;
+           }
+       }
+
+       if (m_MaximizationTestCoarseToFineReport.size() < m_CoarseToFineLevels) {
+           m_MaximizationTestCoarseToFineReport.resize(m_CoarseToFineLevels);
+       }
+
+       for (unsigned int level=m_CoarseToFineLevels; level>=1 && !selected.empty(); level--) {
+           vector<FloatVolume::Pointer> coarseTargetDistMaps(targetDistMaps.size());
+           for (int i=0; i<targetDistMaps.size(); i++) {
+               coarseTargetDistMaps[i] = m_VolumePyramid->GetLevel(targetDistMaps[i], level);
+           }
+
+           // coarse scores are computed in a temporary table, without the binary tests: the depths that
+           // the max-pooled structures would reject may be safe at full resolution (only the ranking prunes)
+           SEEGTrajectoryCandidates::Pointer coarseCandidates = SEEGTrajectoryCandidates::New(m_TestRegistry);
+           coarseCandidates->Reserve(selected.size());
+           for (unsigned int i=0; i<selected.size(); i++) {
+               coarseCandidates->AddCandidate(candidates->GetEntryPoint(selected[i]), candidates->GetTargetPoint(selected[i]));
+           }
+           vector<unsigned int> coarseIndices = coarseCandidates->GetActiveIndices();
+           vector<string> noBinTestNames;
+           vector<IntVolume::Pointer> noBinVols;
+           vector<BinaryTestCfg> noBinTestCfgs;
+           EvaluateMaximizationTest(testNames, coarseTargetDistMaps, cfgs, noBinTestNames, noBinVols, noBinTestCfgs,
+                                    coarseCandidates, coarseIndices, electrodeType, nativeToRef);
+
+           // coarse score: best depth of the weighted scores of all targets (negated: lower is better)
+           vector<float> coarseScores(selected.size(), 0);
+           unsigned int numWithoutDepth = 0;
+           for (unsigned int iElec=0; iElec<selected.size(); iElec++) {
+               unsigned int nTP = coarseCandidates->GetTestColumn(targetColumns.back()).m_NumberOfDepths[iElec];
+               for (int iTarget=0; iTarget<testNames.size(); iTarget++) {
+                   nTP = min(nTP, coarseCandidates->GetTestColumn(targetColumns[iTarget]).m_NumberOfDepths[iElec]);
+               }
+               if (nTP == 0) {
+                   numWithoutDepth++;
+               }
+               float bestScore = 0;
+               for (unsigned int iTP=0; iTP<nTP; iTP++) {
+                   float score = 0;
+                   for (int iTarget=0; iTarget<testNames.size(); iTarget++) {
+                       TrajectoryTestColumn& testColumn = coarseCandidates->GetTestColumn(targetColumns[iTarget]);
+                       unsigned int depth = testColumn.m_FirstDepth[iElec] + iTP;
+                       score += weightsUsingMax[iTarget] * testColumn.m_DepthScoreMax[depth] + weightsUsingSum[iTarget] * testColumn.m_DepthScoreSum[depth];
+                   }
+                   bestScore = max(bestScore, score);
+               }
+               coarseScores[iElec] = -bestScore;
+           }
+
+           unsigned int numKept = min((unsigned int) selected.size(), (unsigned int) ceil(m_CoarseToFineKeepFraction * selected.size()));
+           vector<unsigned int> order(selected.size());
+           for (unsigned int i=0; i<order.size(); i++) {
+               order[i] = i;
+           }
+           if (numKept < order.size()) {
+               nth_element(order.begin(), order.begin() + numKept, order.end(), CompareAggregatedScoreIndices(coarseScores));
+           }
+           vector<unsigned char> keep(selected.size(), 0);
+           for (unsigned int i=0; i<numKept; i++) {
+               keep[order[i]] = 1;
+           }
+
+           // pruned candidates get no score (as candidates without any depth in the targets)
+           vector<unsigned int> keptSelected;
+           for (unsigned int i=0; i<selected.size(); i++) {
+               if (keep[i]) {
+                   keptSelected.push_back(selected[i]);
+                   continue;
+               }
+               for (int iTarget=0; iTarget<testNames.size(); iTarget++) {
+                   candidates->RemoveDepths(selected[i], targetColumns[iTarget]);
+                   candidates->GetTestColumn(targetColumns[iTarget]).m_Evaluated[selected[i]] = 0;
+               }
+           }
+
+           CoarseToFineLevelReport& report = m_MaximizationTestCoarseToFineReport[level - 1];
+           report.m_Level = level;
+           report.m_NumberOfCandidates += selected.size();
+           report.m_NumberOfRejected += numWithoutDepth;
+           report.m_NumberOfKeptBest += numKept;
+           report.m_NumberOfPruned += selected.size() - numKept;
+           cout << "Coarse-to-fine level " << level << " (maximization): " << selected.size() << " electrodes, "
+                << numWithoutDepth << " without any depth in the targets, " << numKept << " kept, "
+                << selected.size() - numKept << " pruned" << endl;
+           selected.swap(keptSelected);
+       }
+
+       fineIndices.swap(selected);
+   }
+
+   void SEEGPathPlanner::EvaluateMaximizationTest(vector<string> &testNames,
+                                   const vector<FloatVolume::Pointer> &targetDistMaps,
+                                   const MaximizationTestCfg& cfgs,
+                                   vector<string>& binTestNames,
+                                   vector<IntVolume::Pointer>& binVols,
+                                   vector<BinaryTestCfg>& binTestCfgs,
+                                   SEEGTrajectoryCandidates::Pointer candidates,
+                                   const vector<unsigned int>& indices,
+                                   SEEGElectrodeModel::SEEG_ELECTRODE_MODEL_TYPE electrodeType,
+                                   GeneralTransform::Pointer nativeToRef) {
+
+       vector<int> targetColumns(testNames.size());
+       for (int iTarget=0; iTarget<testNames.size(); iTarget++) {
+           targetColumns[iTarget] = candidates->AddTestColumn(testNames[iTarget]);
+       }
+
+       // score cache: per candidate and target volume, the score and the scores of all depths
+       ScoreCacheKey cacheKey;
+       bool useScoreCache = m_ScoreCache && !nativeToRef && !indices.empty();
+       if (useScoreCache) {
+           cacheKey = CalcMaximizationTestCacheKey(targetDistMaps, cfgs, binTestNames, binVols, binTestCfgs, candidates, indices, electrodeType);
+           if (RestoreMaximizationTestScores(cacheKey, candidates, indices, targetColumns)) {
+               return;
+           }
+       }
+
+       // Creates contacts pipeline -> useful to compute dist map around line
+       // (recording maps are ROI images of each electrode's region: the template is only used for its geometry)
+       FloatVolume::Pointer vol = targetDistMaps[0];
+       SEEGContactsROIPipeline::Pointer pipelineContacts = SEEGContactsROIPipeline::New(vol, electrodeType); //volume is only to have size
+       vector<FloatVolume::Pointer> recordingBuffers(targetDistMaps.size()); // reused for every depth of every electrode
 
        // Create pipeline to check if new target points ought to be rejected or not
        vector<SEEGTrajectoryROIPipeline::Pointer> pipelineTrajectories;
@@ -688,24 +2220,43 @@ namespace seeg {
        FloatVolume::SpacingType spacing = vol->GetSpacing();
        float maxSpacing = max(spacing[0], max(spacing[1], spacing[2]));
        FloatVolume::RegionType region = targetDistMaps[0]->GetRequestedRegion(); //assuming that all have same region
-       electrode = *first;
-       SEEGElectrodeModel::Pointer electrodeModel = SEEGElectrodeModel::New(electrode->GetElectrodeModelType()); // all electrodes are assumed to be of the same type! if not -> bring this line inside loop
+       SEEGElectrodeModel::Pointer electrodeModel = SEEGElectrodeModel::New(electrodeType); // all electrodes are assumed to be of the same type!
+
+       // When analysing multiple depths, the depths of one line share their target voxels and the
+       // distance of the line to each risk structure: both are computed once per line
+       vector<SparseTargetVoxels> lineTargetVoxels(targetDistMaps.size());
+       vector<SparseRecordingHint> lineRecordingHints(targetDistMaps.size()); // farthest voxel of the previous depth
+       vector<SEEGStructureDistanceMap::Pointer> binDistanceMaps;
+       GetRiskDistanceMaps(binTestNames, binVols, binDistanceMaps);
+       vector<TrajectoryTestScore> binNoOverlapScores;
+       CalcNoOverlapScores(binVols, binTestCfgs, nativeToRef, binNoOverlapScores);
+       vector<vector<float> > binPrefixMinDists(binTestNames.size());
+       vector<float> binSampleSteps(binTestNames.size());
+
+       // the recording only uses the entry and target points of an electrode: the same ElectrodeInfo
+       // are modified for every depth of every candidate
+       ElectrodeInfo::Pointer currElectInfo = ElectrodeInfo::New(Point3D(), Point3D(), electrodeType);
+       ElectrodeInfo::Pointer deepestElectrode = ElectrodeInfo::New(Point3D(), Point3D(), electrodeType);
+       ElectrodeInfo::Pointer shallowestElectrode = ElectrodeInfo::New(Point3D(), Point3D(), electrodeType);
+       vector<TrajectoryTestScore> binScores(binTestNames.size());
 
        // Integrates recording within target and GM
-       list<ElectrodeInfo::Pointer>::iterator it;
-       for (it = first; it != last; it++) {  // Analyse each electrode
-           electrode = *it;
+       for (unsigned int iElec=0; iElec<indices.size(); iElec++) {  // Analyse each electrode
+           unsigned int iCand = indices[iElec];
            for (int iTarget=0; iTarget<targetDistMaps.size();iTarget++){ //initialize vector of tesValues
-               electrode->m_VecTrajectoryTestScores[testNames[iTarget]].clear();
+               candidates->RemoveDepths(iCand, targetColumns[iTarget]);
            }
-           ElectrodeInfo::Pointer currElectInfo = ElectrodeInfo::New(electrode->m_EntryPointWorld, electrode->m_TargetPointWorld,  electrode->GetElectrodeModelType()); //the one I will modify
-           Point3D entryPoint(electrode->m_EntryPointWorld);
-           Point3D targetPoint(electrode->m_TargetPointWorld);
+           Point3D entryPoint(candidates->GetEntryPoint(iCand));
+           Point3D targetPoint(candidates->GetTargetPoint(iCand));
+           currElectInfo->m_EntryPointWorld = entryPoint; //the one I will modify
+           currElectInfo->m_TargetPointWorld = targetPoint;
+           fill(binScores.begin(), binScores.end(), TrajectoryTestScore());
            float currLength = CalcLineLength(targetPoint, entryPoint);                  // for the first point
             //cout << "Analysing electrode: " << "TP="<<targetPoint<< " - EP="<<entryPoint<<endl;
 
            //Consider all target points within volume  if m_AnalizeMultipleDepths is true
            vector<Point3D> targetPtsInTarget, allPointsPerElectrode;
+           Point3D deepestPoint(targetPoint);
            if (cfgs.m_AnalizeMultipleDepths == true){
                Point3D targetPointExtrapolated;
                float lenExtra = cfgs.m_MaxDistToEvaluate - currLength;
@@ -713,13 +2264,44 @@ namespace seeg {
                // find all points in electrode
                electrodeModel->CalcAllLinePositions(maxSpacing, targetPointExtrapolated, entryPoint, allPointsPerElectrode);
 
+               if (!allPointsPerElectrode.empty()) {
+                   deepestPoint = allPointsPerElectrode.front();
+
+                   // region covering the electrode at every depth (depths are between the first and last point of the line)
+                   deepestElectrode->m_EntryPointWorld = entryPoint;
+                   deepestElectrode->m_TargetPointWorld = deepestPoint;
+                   shallowestElectrode->m_EntryPointWorld = entryPoint;
+                   shallowestElectrode->m_TargetPointWorld = allPointsPerElectrode.back();
+                   FloatVolume::RegionType deepRegion = pipelineContacts->CalcElectrodeRegion(deepestElectrode);
+                   FloatVolume::RegionType shallowRegion = pipelineContacts->CalcElectrodeRegion(shallowestElectrode);
+                   FloatVolume::IndexType lineStart;
+                   FloatVolume::SizeType lineSize;
+                   for (int i=0; i<3; i++) {
+                       long start = min(deepRegion.GetIndex()[i], shallowRegion.GetIndex()[i]);
+                       long end = max(deepRegion.GetIndex()[i] + (long) deepRegion.GetSize()[i], shallowRegion.GetIndex()[i] + (long) shallowRegion.GetSize()[i]);
+                       lineStart[i] = start;
+                       lineSize[i] = end - start;
+                   }
+                   FloatVolume::RegionType lineRegion(lineStart, lineSize);
+                   lineRegion.PadByRadius(1);
+                   lineRegion.Crop(targetDistMaps[0]->GetLargestPossibleRegion());
+                   for (int iTarget=0; iTarget<targetDistMaps.size(); iTarget++) {
+                       pipelineContacts->ExtractSparseTargetVoxels(targetDistMaps[iTarget], lineRegion, lineTargetVoxels[iTarget]);
+                       lineRecordingHints[iTarget] = SparseRecordingHint();
+                   }
+
+                   // distance to each risk structure along the line, from the entry point to the deepest point
+                   for (int i=0; i<binTestNames.size(); i++) {
+                       if (binDistanceMaps[i]) {
+                           binSampleSteps[i] = binDistanceMaps[i]->CalcPrefixMinDistances(entryPoint, deepestPoint, binPrefixMinDists[i]);
+                       }
+                   }
+               }
+
            } else {
                allPointsPerElectrode.push_back(targetPoint); // to only do it once!
            }
 
-//           WriteFloatVolume("/Users/rzelmann/test/distMap1.mnc", targetDistMaps[0]); //RIZ to test!!
-
-           //while (maxLength-currLength >= 0 && region.IsInside(targetPointIndex)==true){
            int nPtsInTarget=0;
            while (allPointsPerElectrode.size()>0) {
                FloatVolume::IndexType targetPointIndex;
@@ -732,8 +2314,19 @@ namespace seeg {
                    bool reject=false;
                    if (cfgs.m_AnalizeMultipleDepths==true) {  //only for multiple trajectories - for single it was discarded before
                        for (int i=0; i<binTestNames.size() && !reject; i++) {
+                           TrajectoryTestScore& testScore = binScores[i];
+                           // skip the dense test if the segment entry->current target is far from the structure
+                           // (only for points between the entry point and the deepest point, covered by the samples)
+                           if (binDistanceMaps[i] && binSampleSteps[i] > 0 &&
+                               CalcLineLength(currTargetPoint, deepestPoint) <= CalcLineLength(entryPoint, deepestPoint)) {
+                               int lastSample = (int) ceil(CalcLineLength(currTargetPoint, entryPoint) / binSampleSteps[i]);
+                               lastSample = min(lastSample, (int) binPrefixMinDists[i].size() - 1);
+                               if (binPrefixMinDists[i][lastSample] > binTestCfgs[i].m_MaxDistToEvaluate + binDistanceMaps[i]->GetScreeningMargin()) {
+                                   testScore = binNoOverlapScores[i];
+                                   continue;
+                               }
+                           }
                            pipelineTrajectories[i]->CalcDistanceMap(entryPoint, currTargetPoint, binTestCfgs[i].m_MaxDistToEvaluate);
-                           TrajectoryTestScore& testScore = currElectInfo->m_TrajectoryTestScores[binTestNames[i]];
                            reject = TestBinaryOverlap (
                                        pipelineTrajectories[i]->GetLastDistanceMap(),
                                        binVols[i],
@@ -747,6 +2340,8 @@ namespace seeg {
                        vector<Point3D> allContactPoints;
                        electrodeModel->CalcAllContactPositions(currTargetPoint, entryPoint, allContactPoints);
                        vector<FloatVolume::Pointer> recordedDistMaps;
+                       vector<double> recordedSums;
+                       vector<int> recordedNContacts; // only for multiple depths (sparse recording)
                        for (int iTarget=0;iTarget<targetDistMaps.size(); iTarget++) {
                            FloatVolume::Pointer recordedDistMap;
                            int nContactsToAnalyse =0;
@@ -776,63 +2371,192 @@ namespace seeg {
                                currElectInfo->m_EntryPointWorld = newEntryPoint;   // last contact inside target
                            } else {
                                currElectInfo->m_TargetPointWorld = currTargetPoint;  //reset to full electrode
-                               currElectInfo->m_EntryPointWorld = electrode->m_EntryPointWorld;
+                               currElectInfo->m_EntryPointWorld = entryPoint;
                                nContactsToAnalyse = allContactPoints.size();
                            }
                            // Compute Distance map for each target (beacuse the electrode might be different for each target)
-                           if (nContactsToAnalyse >0){
-                               pipelineContacts->CalcRecordingMap(targetDistMaps[iTarget], recordedDistMap, currElectInfo);
+                           if (nContactsToAnalyse >0 && cfgs.m_AnalizeMultipleDepths) {
+                               // only the target voxels of this line are visited - no recording map
+                               double recordedSum;
+                               int nContactsInside;
+                               pipelineContacts->CalcSparseRecording(lineTargetVoxels[iTarget], currElectInfo, allContactPoints, recordedSum, nContactsInside,
+                                                                     &lineRecordingHints[iTarget]);
+                               recordedDistMap = FloatVolume::Pointer();
+                               recordedSums.push_back(recordedSum);
+                               recordedNContacts.push_back(nContactsInside);
+                           } else if (nContactsToAnalyse >0){
+                               pipelineContacts->CalcRecordingMap(targetDistMaps[iTarget], recordingBuffers[iTarget], currElectInfo);
+                               recordedDistMap = recordingBuffers[iTarget];
+                               recordedSums.push_back(pipelineContacts->GetLastRecordingSum());
+                               recordedNContacts.push_back(0);
                            }
                            else {
                                recordedDistMap = FloatVolume::Pointer();
+                               recordedSums.push_back(0);
+                               recordedNContacts.push_back(0);
                            }
                            recordedDistMaps.push_back(recordedDistMap);
                        }
 
                        //targetDistMaps[0] MUST be the target - all other volumes are secondary (e.g. temporal GM)
-                     //  vector<FloatVolume::Pointer> recordedDistMaps;
-                     //  pipelineContacts->CalcRecordingMap(targetDistMaps, recordedDistMaps, currElectInfo);
-                       //cout << "rec dis map " <<recordedDistMap->GetPixel(targetPointIndex) << "target dist map" << targetDistMap->GetPixel(targetPointIndex)<<endl;
-
                        for (int iTarget=0; iTarget<targetDistMaps.size();iTarget++){
-                           TrajectoryTestScore& testVolScore = electrode->m_TrajectoryTestScores[testNames[iTarget]];
+                           // the score of the candidate is the one of its last depth
+                           TrajectoryTestScore testVolScore;
+                           GetCandidateTestScore(candidates, iCand, targetColumns[iTarget], testVolScore);
                            FloatVolume::Pointer recordedDistMap = recordedDistMaps[iTarget];
-                           // WriteFloatVolume("/home/rina/test/recMap.mnc", recordedDistMap);
 
-                           TestMaximizationOverlap(
+                           if (cfgs.m_AnalizeMultipleDepths) {
+                               SetMaximizationScore(recordedNContacts[iTarget], recordedSums[iTarget], allContactPoints[0], testVolScore, nativeToRef);
+                           } else {
+                               TestMaximizationOverlap(
                                        recordedDistMap,
+                                       recordedSums[iTarget],
                                        allContactPoints,
                                        cfgs,
                                        testVolScore,
                                        nativeToRef);
+                           }
 
-                           // vecScores.push_back(testVolScore);
-                           electrode->m_VecTrajectoryTestScores[testNames[iTarget]].push_back(testVolScore);
+                           SetCandidateTestScore(candidates, iCand, targetColumns[iTarget], testVolScore);
+                           AddCandidateDepthScore(candidates, iCand, targetColumns[iTarget], testVolScore);
                        }
                        ++nPtsInTarget;
                    }
                }
            }
-           // Point3D newTargetPt;
-             //  this->ExtrapolateTargetPoint(currTargetPoint, entryPoint, newTargetPt, maxSpacing); //extrapolate target by 50mm
-             //  currTargetPoint = newTargetPt;
-             //  currLength = CalcLineLength(currTargetPoint, entryPoint);
-             //  targetDistMaps[0]->TransformPhysicalPointToIndex(currTargetPoint, targetPointIndex);
-           //}
-          // if (region.IsInside(targetPointIndex)==false){
-          //     cout << "Electrode: " << "TP="<<targetPoint<< " - current TP="<<currTargetPoint<<" Target outside of region "<<endl;
-          // }
-         //  electrode->m_VecTrajectoryTestScores[testName] = vecScores;
        //    cout << "Electrode: " << " with TP="<<targetPoint<< " - #points in target="<<nPtsInTarget<<endl;
        }
+
+       if (useScoreCache) {
+           StoreMaximizationTestScores(cacheKey, candidates, indices, targetColumns);
+       }
+   }
+
+   ScoreCacheKey SEEGPathPlanner::CalcMaximizationTestCacheKey(const vector<FloatVolume::Pointer> &targetDistMaps,
+                                                               const MaximizationTestCfg& cfgs,
+                                                               vector<string>& binTestNames,
+                                                               vector<IntVolume::Pointer>& binVols,
+                                                               vector<BinaryTestCfg>& binTestCfgs,
+                                                               SEEGTrajectoryCandidates::Pointer candidates,
+                                                               const vector<unsigned int>& indices,
+                                                               SEEGElectrodeModel::SEEG_ELECTRODE_MODEL_TYPE electrodeType) {
+       SEEGScoreCacheKeyBuilder keyBuilder;
+       keyBuilder.AddString("maximization test");
+       for (int iTarget=0; iTarget<targetDistMaps.size(); iTarget++) {
+           keyBuilder.AddKey(m_ScoreCache->GetVolumeKey(targetDistMaps[iTarget]));
+       }
+       keyBuilder.Add<float>(cfgs.m_MaxDistToEvaluate);
+       keyBuilder.Add<float>(cfgs.m_k1);
+       keyBuilder.Add<float>(cfgs.m_k2);
+       keyBuilder.Add<int>(cfgs.m_AnalizeMultipleDepths ? 1 : 0);
+       keyBuilder.Add<unsigned int>(cfgs.m_OnlyInsideContacts.size());
+       for (int i=0; i<cfgs.m_OnlyInsideContacts.size(); i++) {
+           keyBuilder.Add<int>(cfgs.m_OnlyInsideContacts[i] ? 1 : 0);
+       }
+       vector<SEEGStructureDistanceMap::Pointer> binDistanceMaps;
+       GetRiskDistanceMaps(binTestNames, binVols, binDistanceMaps);
+       for (int i=0; i<binVols.size(); i++) {
+           keyBuilder.AddKey(m_ScoreCache->GetVolumeKey(binVols[i]));
+           AddBinaryTestCfgToKey(keyBuilder, binTestCfgs[i]);
+           keyBuilder.Add<int>((i < binDistanceMaps.size() && binDistanceMaps[i]) ? 1 : 0);
+       }
+       for (unsigned int iElec=0; iElec<indices.size(); iElec++) {
+           keyBuilder.AddPoint(candidates->GetEntryPoint(indices[iElec]));
+           keyBuilder.AddPoint(candidates->GetTargetPoint(indices[iElec]));
+           keyBuilder.Add<int>(electrodeType);
+       }
+       return keyBuilder.GetKey();
+   }
+
+   bool SEEGPathPlanner::RestoreMaximizationTestScores(const ScoreCacheKey& cacheKey,
+                                                       SEEGTrajectoryCandidates::Pointer candidates,
+                                                       const vector<unsigned int>& indices,
+                                                       const vector<int>& targetColumns) {
+       ScoreCacheEntry::Pointer entry = m_ScoreCache->Find(cacheKey);
+       if (!entry) {
+           return false;
+       }
+
+       // records have a variable size: check the whole entry before modifying any candidate
+       const unsigned long long scoreSize = 5 * sizeof(float) + 3 * sizeof(double);
+       const unsigned char* data = entry->GetData();
+       unsigned long long size = entry->GetSize();
+       unsigned long long position = 0;
+       for (unsigned int iElec=0; iElec<indices.size(); iElec++) {
+           for (int iTarget=0; iTarget<targetColumns.size(); iTarget++) {
+               if (position + 1 + scoreSize + sizeof(unsigned int) > size) {
+                   return false;
+               }
+               position += 1 + scoreSize;
+               unsigned int numScores = SEEGScoreCache::ReadValue<unsigned int>(data, position);
+               if (numScores > (size - position) / scoreSize) {
+                   return false;
+               }
+               position += numScores * scoreSize;
+           }
+       }
+       if (position != size) {
+           return false;
+       }
+
+       position = 0;
+       for (unsigned int iElec=0; iElec<indices.size(); iElec++) {
+           unsigned int iCand = indices[iElec];
+           for (int iTarget=0; iTarget<targetColumns.size(); iTarget++) {
+               bool hasScore = SEEGScoreCache::ReadValue<unsigned char>(data, position) != 0;
+               TrajectoryTestScore score;
+               ReadCachedTestScore(data, position, score);
+               if (hasScore) {
+                   SetCandidateTestScore(candidates, iCand, targetColumns[iTarget], score);
+               }
+               unsigned int numScores = SEEGScoreCache::ReadValue<unsigned int>(data, position);
+               candidates->RemoveDepths(iCand, targetColumns[iTarget]);
+               for (unsigned int iScore=0; iScore<numScores; iScore++) {
+                   ReadCachedTestScore(data, position, score);
+                   AddCandidateDepthScore(candidates, iCand, targetColumns[iTarget], score);
+               }
+           }
+       }
+       return true;
    }
 
+   void SEEGPathPlanner::StoreMaximizationTestScores(const ScoreCacheKey& cacheKey,
+                                                     SEEGTrajectoryCandidates::Pointer candidates,
+                                                     const vector<unsigned int>& indices,
+                                                     const vector<int>& targetColumns) {
+       vector<unsigned char> data;
+       for (unsigned int iElec=0; iElec<indices.size(); iElec++) {
+           unsigned int iCand = indices[iElec];
+           for (int iTarget=0; iTarget<targetColumns.size(); iTarget++) {
+               TrajectoryTestColumn& testColumn = candidates->GetTestColumn(targetColumns[iTarget]);
+               TrajectoryTestScore score;
+               GetCandidateTestScore(candidates, iCand, targetColumns[iTarget], score);
+               SEEGScoreCache::AppendValue<unsigned char>(data, testColumn.m_Evaluated[iCand]);
+               AppendCachedTestScore(data, score);
+               SEEGScoreCache::AppendValue<unsigned int>(data, testColumn.m_NumberOfDepths[iCand]);
+               for (unsigned int iDepth=0; iDepth<testColumn.m_NumberOfDepths[iCand]; iDepth++) {
+                   GetCandidateDepthScore(candidates, iCand, targetColumns[iTarget], iDepth, score);
+                   AppendCachedTestScore(data, score);
+               }
+           }
+       }
+       m_ScoreCache->Store(cacheKey, data);
+   }
 
    void SEEGPathPlanner::DoVectorTest(  const string& testName,
                                    vector<FloatVolume::Pointer> &vectorVol,
                                    const BinaryTestCfg &cfgs,
                                    GeneralTransform::Pointer nativeToRef) {
 
+       // valid candidates of the table (scores and rejections stay in the table)
+       int column = m_Candidates->AddTestColumn(testName);
+       if (column >= 0) {
+           vector<unsigned int> activeIndices;
+           m_Candidates->GetValidActiveIndices(activeIndices);
+           EvaluateVectorTest(column, vectorVol, cfgs, m_Candidates, activeIndices, nativeToRef);
+       }
+
+       // trajectories that already are ElectrodeInfo (manual plans, materialized candidates)
        DoVectorTest(   testName,
                        vectorVol,
                        cfgs,
@@ -848,213 +2572,378 @@ namespace seeg {
                                    list<ElectrodeInfo::Pointer>::iterator last,
                                    GeneralTransform::Pointer nativeToRef) {
 
-      bool reject=false;
-       /*Point3D targetDestination_native(m_TargetDestination);
-       if (nativeToRef) {
-           nativeToRef->TransformPointInv(m_TargetDestination, targetDestination_native); // go from ref to native
-       }*/
+       // the electrodes are copied to a temporary table, evaluated there and their scores copied back
+       vector<ElectrodeInfo::Pointer> electrodes(first, last);
+       if (electrodes.empty()) {
+           return;
+       }
+       SEEGTrajectoryCandidates::Pointer candidates = SEEGTrajectoryCandidates::New(m_TestRegistry);
+       candidates->Reserve(electrodes.size());
+       int column = candidates->AddTestColumn(testName);
+       if (column < 0) {
+           return;
+       }
+       for (unsigned int iElec=0; iElec<electrodes.size(); iElec++) {
+           unsigned int index = candidates->AddCandidate(electrodes[iElec]->m_EntryPointWorld, electrodes[iElec]->m_TargetPointWorld);
+           CopyElectrodeScoresToCandidate(electrodes[iElec], candidates, index);
+       }
 
-       //FloatVolume::Pointer vol = vectorVol[0];
-       //SEEGTrajectoryROIPipeline::Pointer pipeline = SEEGTrajectoryROIPipeline::New(vol);
+       vector<unsigned int> indices = candidates->GetActiveIndices();
+       EvaluateVectorTest(column, vectorVol, cfgs, candidates, indices, nativeToRef);
 
-       list<ElectrodeInfo::Pointer>::iterator it;
+       // validity of the electrodes is the result of this test (the table has no other rejection)
+       for (unsigned int iElec=0; iElec<electrodes.size(); iElec++) {
+           CopyCandidateScoresToElectrode(candidates, iElec, electrodes[iElec]);
+       }
+   }
 
-       for (it = first; it != last; it++) {
+   void SEEGPathPlanner::EvaluateVectorTest(int column,
+                                   vector<FloatVolume::Pointer> &vectorVol,
+                                   const BinaryTestCfg& cfgs,
+                                   SEEGTrajectoryCandidates::Pointer candidates,
+                                   const vector<unsigned int>& indices,
+                                   GeneralTransform::Pointer nativeToRef) {
 
-           ElectrodeInfo::Pointer electrode = *it;
-           Point3D entryPoint_native(electrode->m_EntryPointWorld);
-           Point3D targetDestination_native(electrode->m_TargetPointWorld);
-           if (nativeToRef) {
-               nativeToRef->TransformPointInv(electrode->m_EntryPointWorld, entryPoint_native); // go from ref_to_native
-               nativeToRef->TransformPointInv(electrode->m_TargetPointWorld, targetDestination_native); // go from ref_to_native
-           }
+      bool reject=false;
 
-        //   Point3D entryPoint_extrapolated;
-        //   this->ExtrapolateEntryPoint(targetDestination_native, entryPoint_native, entryPoint_extrapolated, 10.0); //extrapolate by 10mm for vector test (is done on the skull)
+       // score cache: one record per candidate (rejected, score)
+       ScoreCacheKey cacheKey;
+       vector<unsigned char> cacheData;
+       bool useScoreCache = m_ScoreCache && !nativeToRef && !indices.empty();
+       if (useScoreCache) {
+           SEEGScoreCacheKeyBuilder keyBuilder;
+           keyBuilder.AddString("vector test");
+           for (int i=0; i<vectorVol.size(); i++) {
+               keyBuilder.AddKey(m_ScoreCache->GetVolumeKey(vectorVol[i]));
+           }
+           AddBinaryTestCfgToKey(keyBuilder, cfgs);
+           for (unsigned int iElec=0; iElec<indices.size(); iElec++) {
+               Vector3D_lf electrodeVector = candidates->GetElectrodeVector(indices[iElec]);
+               keyBuilder.AddPoint(candidates->GetEntryPoint(indices[iElec]));
+               keyBuilder.AddPoint(candidates->GetTargetPoint(indices[iElec]));
+               keyBuilder.Add<double>(electrodeVector.x);
+               keyBuilder.Add<double>(electrodeVector.y);
+               keyBuilder.Add<double>(electrodeVector.z);
+           }
+           cacheKey = keyBuilder.GetKey();
+
+           ScoreCacheEntry::Pointer entry = m_ScoreCache->Find(cacheKey);
+           if (entry && entry->GetSize() == indices.size() * (1 + 5 * sizeof(float) + 3 * sizeof(double))) {
+               const unsigned char* data = entry->GetData();
+               unsigned long long position = 0;
+               for (unsigned int iElec=0; iElec<indices.size(); iElec++) {
+                   unsigned int iCand = indices[iElec];
+                   reject = SEEGScoreCache::ReadValue<unsigned char>(data, position) != 0;
+                   TrajectoryTestScore testScore;
+                   ReadCachedTestScore(data, position, testScore);
+                   SetCandidateTestScore(candidates, iCand, column, testScore);
+                   candidates->SetRejected(iCand, column, reject);
+                   if (reject) {
+                       candidates->SetAggregatedScores(iCand, -1, -1, -1);
+                   }
+               }
+               return;
+           }
+       }
 
-           TrajectoryTestScore& testScore = electrode->m_TrajectoryTestScores[testName];
+       for (unsigned int iElec=0; iElec<indices.size(); iElec++) {
 
+           unsigned int iCand = indices[iElec];
+           Point3D entryPoint(candidates->GetEntryPoint(iCand));
+           Point3D targetPoint(candidates->GetTargetPoint(iCand));
+           Point3D entryPoint_native(entryPoint);
+           Point3D targetDestination_native(targetPoint);
+           if (nativeToRef) {
+               nativeToRef->TransformPointInv(entryPoint, entryPoint_native); // go from ref_to_native
+               nativeToRef->TransformPointInv(targetPoint, targetDestination_native); // go from ref_to_native
+           }
 
-          // pipeline->CalcDistanceMap(entryPoint_extrapolated, targetDestination_native, cfgs.m_MaxDistToEvaluate);
+           TrajectoryTestScore testScore;
+           GetCandidateTestScore(candidates, iCand, column, testScore);
 
            reject = TestVectorOverlap(
-                               electrode->m_ElectrodeVectorWorld,
+                               candidates->GetElectrodeVector(iCand),
                                entryPoint_native,
                                vectorVol,
                                cfgs,
                                testScore,
                                nativeToRef);
+           SetCandidateTestScore(candidates, iCand, column, testScore);
 
            //Check whether to keep or reject trajectory
+           candidates->SetRejected(iCand, column, reject);
            if (reject) {
-               electrode->m_Valid = false;
-               electrode->m_AggregatedRiskScore = -1;
-               electrode->m_AggregatedRewardScore = -1;
-               electrode->m_AggregatedScore = -1;
-           } else {
-               electrode->m_Valid = true;
+               candidates->SetAggregatedScores(iCand, -1, -1, -1);
            }
 
+           if (useScoreCache) {
+               SEEGScoreCache::AppendValue<unsigned char>(cacheData, reject ? 1 : 0);
+               AppendCachedTestScore(cacheData, testScore);
+           }
+       }
+
+       if (useScoreCache) {
+           m_ScoreCache->Store(cacheKey, cacheData);
        }
    }
 
    // Functions that aggregate scores
-       void SEEGPathPlanner::AggregateRisks(int numBins) {
-           map<string, TrajectoryRiskTestWeights>::iterator it;
-           list<ElectrodeInfo::Pointer>::iterator it2;
-           float minVal, maxVal, stepSize;
-           float score;
-           float rank;
-           ElectrodeInfo::Pointer e;
+       void SEEGPathPlanner::CalcMinMaxScores(const vector<float>& scores, const vector<unsigned int>& indices,
+                                              const vector<unsigned int>* firstScores, const vector<unsigned int>* numberOfScores,
+                                              float& minVal, float& maxVal) {
+           minVal = numeric_limits<float>::max();
+           maxVal = -numeric_limits<float>::max();
+           unsigned int nIndices = indices.size();
+
+           unsigned int numThreads = m_NumberOfThreads;
+#if ITK_VERSION_MAJOR >= 5
+           if (numThreads == 0) {
+               numThreads = itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads();
+           }
+#else
+           numThreads = 1;
+#endif
+           if (numThreads > nIndices / MIN_SCORES_PER_THREAD) {
+               numThreads = nIndices / MIN_SCORES_PER_THREAD;
+           }
 
-           if (m_ActiveTrajectories.size() == 0) {
+           if (numThreads <= 1) {
+               ReduceMinMaxScores(scores, indices, firstScores, numberOfScores, 0, nIndices, minVal, maxVal);
                return;
            }
 
-           // initialization
-           for (it2 = m_ActiveTrajectories.begin(); it2 != m_ActiveTrajectories.end(); it2++) {
-               e = *it2;
-               e->m_AggregatedRiskScore = 0;
+#if ITK_VERSION_MAJOR >= 5
+           // each chunk reduces its own range, chunk results are combined afterwards
+           vector<float> chunkMin(numThreads, minVal);
+           vector<float> chunkMax(numThreads, maxVal);
+           itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+           threader->SetMaximumNumberOfThreads(numThreads);
+           threader->SetNumberOfWorkUnits(numThreads);
+           threader->ParallelizeArray(0, numThreads,
+               [&](itk::SizeValueType chunk) {
+                   unsigned int firstIndex = (unsigned int)(((unsigned long long)chunk * nIndices) / numThreads);
+                   unsigned int lastIndex = (unsigned int)(((unsigned long long)(chunk + 1) * nIndices) / numThreads);
+                   ReduceMinMaxScores(scores, indices, firstScores, numberOfScores, firstIndex, lastIndex, chunkMin[chunk], chunkMax[chunk]);
+               },
+               nullptr);
+           for (unsigned int chunk = 0; chunk < numThreads; chunk++) {
+               minVal = min(minVal, chunkMin[chunk]);
+               maxVal = max(maxVal, chunkMax[chunk]);
+           }
+#endif
+       }
+
+       void SEEGPathPlanner::CalcMinMaxColumnScores(const vector<SEEGTrajectoryCandidates::Pointer>& tables,
+                                                    const vector<vector<unsigned int> >& tableIndices,
+                                                    int testId, bool scoreSum, bool depthScores,
+                                                    float& minVal, float& maxVal) {
+           minVal = numeric_limits<float>::max();
+           maxVal = -numeric_limits<float>::max();
+           for (unsigned int iTable = 0; iTable < tables.size(); iTable++) {
+               const TrajectoryTestColumn& testColumn = tables[iTable]->GetTestColumn(testId);
+               float tableMin, tableMax;
+               if (depthScores) {
+                   CalcMinMaxScores(scoreSum ? testColumn.m_DepthScoreSum : testColumn.m_DepthScoreMax, tableIndices[iTable],
+                                    &testColumn.m_FirstDepth, &testColumn.m_NumberOfDepths, tableMin, tableMax);
+               } else {
+                   CalcMinMaxScores(scoreSum ? testColumn.m_ScoreSum : testColumn.m_ScoreMax, tableIndices[iTable],
+                                    NULL, NULL, tableMin, tableMax);
+               }
+               minVal = min(minVal, tableMin);
+               maxVal = max(maxVal, tableMax);
+           }
+       }
+
+       bool SEEGPathPlanner::CreateActiveScoreTables(vector<SEEGTrajectoryCandidates::Pointer>& tables,
+                                                     vector<vector<unsigned int> >& tableIndices,
+                                                     vector<ElectrodeInfo::Pointer>& electrodes) {
+           // the active candidates of m_Candidates, then a temporary table with the active ElectrodeInfo
+           electrodes.assign(m_ActiveTrajectories.begin(), m_ActiveTrajectories.end());
+           SEEGTrajectoryCandidates::Pointer electrodesTable = SEEGTrajectoryCandidates::New(m_TestRegistry);
+           electrodesTable->Reserve(electrodes.size());
+           tables.clear();
+           tables.push_back(m_Candidates);
+           tables.push_back(electrodesTable);
+
+           // both tables share the registry: the column of a test is its ID in both
+           for (map<string, TrajectoryRiskTestWeights>::iterator it = m_TrajectoryRiskTestWeights.begin(); it != m_TrajectoryRiskTestWeights.end(); it++) {
+               m_Candidates->AddTestColumn((*it).first);
+               electrodesTable->AddTestColumn((*it).first);
+           }
+           for (map<string, TrajectoryTestWeights>::iterator it = m_TrajectoryRewardTestWeights.begin(); it != m_TrajectoryRewardTestWeights.end(); it++) {
+               m_Candidates->AddTestColumn((*it).first);
+               electrodesTable->AddTestColumn((*it).first);
+           }
+           for (unsigned int iElec=0; iElec<electrodes.size(); iElec++) {
+               unsigned int index = electrodesTable->AddCandidate(electrodes[iElec]->m_EntryPointWorld, electrodes[iElec]->m_TargetPointWorld);
+               CopyElectrodeScoresToCandidate(electrodes[iElec], electrodesTable, index);
            }
 
+           // rejected trajectories are not ranked (their scores may be missing, see ScreenBinaryTest())
+           tableIndices.resize(tables.size());
+           m_Candidates->GetValidActiveIndices(tableIndices[0]);
+           tableIndices[1].clear();
+           for (unsigned int iElec=0; iElec<electrodes.size(); iElec++) {
+               if (electrodes[iElec]->m_Valid) {
+                   tableIndices[1].push_back(iElec);
+               }
+           }
+           return !tableIndices[0].empty() || !tableIndices[1].empty();
+       }
 
-           for (it = m_TrajectoryRiskTestWeights.begin(); it != m_TrajectoryRiskTestWeights.end(); it++) {
-               m_TestToCompare = (*it).first;
-               TrajectoryRiskTestWeights weights = (*it).second;
+       void SEEGPathPlanner::CopyActiveScoreTablesToElectrodes(const vector<SEEGTrajectoryCandidates::Pointer>& tables,
+                                                               const vector<ElectrodeInfo::Pointer>& electrodes) {
+           for (unsigned int iElec=0; iElec<electrodes.size(); iElec++) {
+               bool valid = electrodes[iElec]->m_Valid; // the temporary table does not know the validity
+               CopyCandidateScoresToElectrode(tables[1], iElec, electrodes[iElec]);
+               electrodes[iElec]->m_Valid = valid;
+           }
+       }
 
-               // TODO: this is stupid and slow (should instead find min and max values using a single loop)!
-               m_ActiveTrajectories.sort(compareSEEGMax);
-               minVal = m_ActiveTrajectories.front()->m_TrajectoryTestScores[m_TestToCompare].scoreMax;
-               maxVal = m_ActiveTrajectories.back()->m_TrajectoryTestScores[m_TestToCompare].scoreMax;
+       void SEEGPathPlanner::AggregateTestRankings(int testId, float weightUsingMax, float weightUsingSum, int numBins,
+                                                   const vector<SEEGTrajectoryCandidates::Pointer>& tables,
+                                                   const vector<vector<unsigned int> >& tableIndices,
+                                                   vector<vector<float> >& aggregatedScores) {
+           float minVal, maxVal, stepSize;
+           float rank;
 
-               cout << "Test: " << m_TestToCompare << endl;
-               cout << "ScoreMax min " << minVal << " max: " << maxVal << endl;
-               stepSize = (maxVal - minVal) / numBins;
+           // trajectories without a score get the default one (as a new entry of ElectrodeInfo::m_TrajectoryTestScores);
+           // scores are then ranked in place in the columns of the tables
+           for (unsigned int iTable = 0; iTable < tables.size(); iTable++) {
+               TrajectoryTestColumn& testColumn = tables[iTable]->GetTestColumn(testId);
+               const vector<unsigned int>& indices = tableIndices[iTable];
+               for (unsigned int i = 0; i < indices.size(); i++) {
+                   if (!testColumn.m_Evaluated[indices[i]]) {
+                       SetCandidateTestScore(tables[iTable], indices[i], testId, TrajectoryTestScore());
+                   }
+               }
+           }
 
+           CalcMinMaxColumnScores(tables, tableIndices, testId, false, false, minVal, maxVal);
 
-               for (it2 = m_ActiveTrajectories.begin(); it2 != m_ActiveTrajectories.end(); it2++) {
-                   e = *it2;
+           cout << "Test: " << m_TestRegistry->GetTestName(testId) << endl;
+           cout << "ScoreMax min " << minVal << " max: " << maxVal << endl;
+           stepSize = (maxVal - minVal) / numBins;
 
+           for (unsigned int iTable = 0; iTable < tables.size(); iTable++) {
+               TrajectoryTestColumn& testColumn = tables[iTable]->GetTestColumn(testId);
+               const vector<unsigned int>& indices = tableIndices[iTable];
+               for (unsigned int i = 0; i < indices.size(); i++) {
                    if (maxVal-minVal < 0.001) {
                        rank = 1;
                    } else {
-                       score = e->m_TrajectoryTestScores[m_TestToCompare].scoreMax;
-                       rank = (int)((score - minVal) / stepSize) + 1;
+                       rank = (int)((testColumn.m_ScoreMax[indices[i]] - minVal) / stepSize) + 1;
                    }
-                   e->m_TrajectoryTestScores[m_TestToCompare].rankingUsingMax = rank;
-                   e->m_AggregatedRiskScore += weights.m_WeightUsingMax * rank;
+                   testColumn.m_RankingUsingMax[indices[i]] = rank;
+                   aggregatedScores[iTable][i] += weightUsingMax * rank;
                }
+           }
 
+           CalcMinMaxColumnScores(tables, tableIndices, testId, true, false, minVal, maxVal);
 
-               m_ActiveTrajectories.sort(compareSEEGSum);
-               minVal = m_ActiveTrajectories.front()->m_TrajectoryTestScores[m_TestToCompare].scoreSum;
-               maxVal = m_ActiveTrajectories.back()->m_TrajectoryTestScores[m_TestToCompare].scoreSum;
-
-               cout << "ScoreSum min " << minVal << " max: " << maxVal << endl;
-               stepSize = (maxVal-minVal + 1) / numBins;
-
-               for (it2 = m_ActiveTrajectories.begin(); it2 != m_ActiveTrajectories.end(); it2++) {
-                   e = *it2;
+           cout << "ScoreSum min " << minVal << " max: " << maxVal << endl;
+           stepSize = (maxVal-minVal + 1) / numBins;
 
+           for (unsigned int iTable = 0; iTable < tables.size(); iTable++) {
+               TrajectoryTestColumn& testColumn = tables[iTable]->GetTestColumn(testId);
+               const vector<unsigned int>& indices = tableIndices[iTable];
+               for (unsigned int i = 0; i < indices.size(); i++) {
                    if (maxVal - minVal < 0.001) {
                        rank = 1;
                    } else {
-                       score = e->m_TrajectoryTestScores[m_TestToCompare].scoreSum;
-                       rank = (int)((score - minVal) / stepSize) + 1;
+                       rank = (int)((testColumn.m_ScoreSum[indices[i]] - minVal) / stepSize) + 1;
                    }
-                   e->m_TrajectoryTestScores[m_TestToCompare].rankingUsingSum = rank;
-                   e->m_AggregatedRiskScore += weights.m_WeightUsingSum * rank;
+                   testColumn.m_RankingUsingSum[indices[i]] = rank;
+                   aggregatedScores[iTable][i] += weightUsingSum * rank;
                }
            }
+       }
 
-           // sorting aggregated list
-    //       m_ActiveTrajectories.sort(compareSEEGtraj);
+       void SEEGPathPlanner::AggregateRisks(int numBins) {
+           map<string, TrajectoryRiskTestWeights>::iterator it;
+
+           vector<SEEGTrajectoryCandidates::Pointer> tables;
+           vector<vector<unsigned int> > tableIndices;
+           vector<ElectrodeInfo::Pointer> electrodes;
+           if (!CreateActiveScoreTables(tables, tableIndices, electrodes)) {
+               return;
+           }
+           vector<vector<float> > aggregatedScores(tables.size());
+           for (unsigned int iTable = 0; iTable < tables.size(); iTable++) {
+               aggregatedScores[iTable].assign(tableIndices[iTable].size(), 0);
+           }
+
+           for (it = m_TrajectoryRiskTestWeights.begin(); it != m_TrajectoryRiskTestWeights.end(); it++) {
+               TrajectoryRiskTestWeights weights = (*it).second;
+               int testId = tables[0]->GetTestColumnIndex((*it).first);
+               if (testId >= 0) {
+                   AggregateTestRankings(testId, weights.m_WeightUsingMax, weights.m_WeightUsingSum, numBins,
+                                         tables, tableIndices, aggregatedScores);
+               }
+           }
+
+           // the order of the active trajectories is left unchanged (see AggregateAll())
+           for (unsigned int iTable = 0; iTable < tables.size(); iTable++) {
+               for (unsigned int i = 0; i < tableIndices[iTable].size(); i++) {
+                   unsigned int index = tableIndices[iTable][i];
+                   tables[iTable]->SetAggregatedScores(index, aggregatedScores[iTable][i], tables[iTable]->GetAggregatedRewardScore(index),
+                                                       tables[iTable]->GetAggregatedScore(index));
+               }
+           }
+           CopyActiveScoreTablesToElectrodes(tables, electrodes);
        }
 
        void SEEGPathPlanner::AggregateRewards(int numBins) {
            map<string, TrajectoryTestWeights>::iterator it;
-           list<ElectrodeInfo::Pointer>::iterator it2;
-           float minVal, maxVal, stepSize;
-           float score;
-           float rank;
-           ElectrodeInfo::Pointer e;
 
-           if (m_ActiveTrajectories.size() == 0) {
+           vector<SEEGTrajectoryCandidates::Pointer> tables;
+           vector<vector<unsigned int> > tableIndices;
+           vector<ElectrodeInfo::Pointer> electrodes;
+           if (!CreateActiveScoreTables(tables, tableIndices, electrodes)) {
                return;
            }
-
-           // initialization
-           for (it2 = m_ActiveTrajectories.begin(); it2 != m_ActiveTrajectories.end(); it2++) {
-               e = *it2;
-               e->m_AggregatedRewardScore = 0;
+           vector<vector<float> > aggregatedScores(tables.size());
+           for (unsigned int iTable = 0; iTable < tables.size(); iTable++) {
+               aggregatedScores[iTable].assign(tableIndices[iTable].size(), 0);
            }
 
            for (it = m_TrajectoryRewardTestWeights.begin(); it != m_TrajectoryRewardTestWeights.end(); it++) {
-               m_TestToCompare = (*it).first;
                TrajectoryTestWeights weights = (*it).second;
-
-               // TODO: this is stupid and slow (should instead find min and max values using a single loop)!
-               m_ActiveTrajectories.sort(compareSEEGMax);
-               minVal = m_ActiveTrajectories.front()->m_TrajectoryTestScores[m_TestToCompare].scoreMax;
-               maxVal = m_ActiveTrajectories.back()->m_TrajectoryTestScores[m_TestToCompare].scoreMax;
-
-               cout << "Test: " << m_TestToCompare << endl;
-               cout << "ScoreMax min " << minVal << " max: " << maxVal << endl;
-               stepSize = (maxVal - minVal) / numBins;
-
-
-
-               for (it2 = m_ActiveTrajectories.begin(); it2 != m_ActiveTrajectories.end(); it2++) {
-                   e = *it2;
-
-                   if (maxVal-minVal < 0.001) {
-                       rank = 1;
-                   } else {
-                       score = e->m_TrajectoryTestScores[m_TestToCompare].scoreMax;
-                       rank = (int)((score - minVal) / stepSize) + 1;
-                   }
-                   e->m_TrajectoryTestScores[m_TestToCompare].rankingUsingMax = rank;
-                   e->m_AggregatedRewardScore += weights.m_WeightUsingMax * rank;
+               int testId = tables[0]->GetTestColumnIndex((*it).first);
+               if (testId >= 0) {
+                   AggregateTestRankings(testId, weights.m_WeightUsingMax, weights.m_WeightUsingSum, numBins,
+                                         tables, tableIndices, aggregatedScores);
                }
+           }
 
-
-               m_ActiveTrajectories.sort(compareSEEGSum);
-               minVal = m_ActiveTrajectories.front()->m_TrajectoryTestScores[m_TestToCompare].scoreSum;
-               maxVal = m_ActiveTrajectories.back()->m_TrajectoryTestScores[m_TestToCompare].scoreSum;
-
-               cout << "ScoreSum min " << minVal << " max: " << maxVal << endl;
-               stepSize = (maxVal-minVal + 1) / numBins;
-
-               for (it2 = m_ActiveTrajectories.begin(); it2 != m_ActiveTrajectories.end(); it2++) {
-                   e = *it2;
-
-                   if (maxVal - minVal < 0.001) {
-                       rank = 1;
-                   } else {
-                       score = e->m_TrajectoryTestScores[m_TestToCompare].scoreSum;
-                       rank = (int)((score - minVal) / stepSize) + 1;
-                   }
-                   e->m_TrajectoryTestScores[m_TestToCompare].rankingUsingSum = rank;
-                   e->m_AggregatedRewardScore += weights.m_WeightUsingSum * rank;
+           // the order of the active trajectories is left unchanged (see AggregateAll())
+           for (unsigned int iTable = 0; iTable < tables.size(); iTable++) {
+               for (unsigned int i = 0; i < tableIndices[iTable].size(); i++) {
+                   unsigned int index = tableIndices[iTable][i];
+                   tables[iTable]->SetAggregatedScores(index, tables[iTable]->GetAggregatedRiskScore(index), aggregatedScores[iTable][i],
+                                                       tables[iTable]->GetAggregatedScore(index));
                }
            }
-
+           CopyActiveScoreTablesToElectrodes(tables, electrodes);
        }
 
-       void SEEGPathPlanner::AggregateRewardsAllDepths(int numBins) {
+       void SEEGPathPlanner::AggregateRewardsAllDepths(int numBins, int numBestTrajectories) {
            map<string, TrajectoryTestWeights>::iterator it;
-           list<ElectrodeInfo::Pointer>::iterator it2;
            float minScoreMax,maxScoreMax;
            float minScoreSum,maxScoreSum;
-           float stepSizeSum, stepSizeMax;
            vector<float> minMaxVec, maxMaxVec;
            vector<float> minSumVec,maxSumVec;
+           vector<float> stepSizeMaxVec, stepSizeSumVec;
            float score;
            float rankMax, rankSum;
-           ElectrodeInfo::Pointer e;
-           cout << "AggregateRewardsAllDepths: " << m_ActiveTrajectories.size() << endl;
-           if (m_ActiveTrajectories.size() == 0) {
-               cout << "AggregateRewardsAllDepths: No Active trajectories" << m_ActiveTrajectories.size() << endl;
+
+           vector<SEEGTrajectoryCandidates::Pointer> tables;
+           vector<vector<unsigned int> > tableIndices;
+           vector<ElectrodeInfo::Pointer> electrodes;
+           bool hasActive = CreateActiveScoreTables(tables, tableIndices, electrodes);
+           cout << "AggregateRewardsAllDepths: " << tableIndices[0].size() + tableIndices[1].size() << endl;
+           if (!hasActive) {
+               cout << "AggregateRewardsAllDepths: No Active trajectories" << endl;
                return;
            }
            // Check that there is test to aggregate
@@ -1063,15 +2952,29 @@ namespace seeg {
                return;
            }
 
+           // columns and weights of the tests are resolved once (tests are then addressed by their position)
+           vector<int> testIds;
+           vector<TrajectoryTestWeights> testWeights;
+           for (it = m_TrajectoryRewardTestWeights.begin(); it != m_TrajectoryRewardTestWeights.end(); it++) {
+               int testId = tables[0]->GetTestColumnIndex((*it).first);
+               if (testId >= 0) {
+                   testIds.push_back(testId);
+                   testWeights.push_back((*it).second);
+               }
+           }
+           int nTests = testIds.size();
+           if (nTests == 0) {
+               cout << "AggregateRewardsAllDepths: No Reward tests"<< endl;
+               return;
+           }
+
            //Check that there is a vector of trajectories
-           it = m_TrajectoryRewardTestWeights.begin();
-           m_TestToCompare = (*it).first;
            int isVector=0;
-           it2 = m_ActiveTrajectories.begin();
-           while ( it2 != m_ActiveTrajectories.end() && isVector<1) {
-               e = *it2;
-               isVector = e->m_VecTrajectoryTestScores[m_TestToCompare].size();
-               it2++;
+           for (unsigned int iTable = 0; iTable < tables.size() && isVector<1; iTable++) {
+               const TrajectoryTestColumn& testColumn = tables[iTable]->GetTestColumn(testIds[0]);
+               for (unsigned int i = 0; i < tableIndices[iTable].size() && isVector<1; i++) {
+                   isVector = testColumn.m_NumberOfDepths[tableIndices[iTable][i]];
+               }
            }
            cout << "AggregateRewardsAllDepths: #Vectors >= "<<isVector << endl;
            if (isVector < 1){
@@ -1080,124 +2983,219 @@ namespace seeg {
                return;
            }
 
-           // initialization
-           for (it = m_TrajectoryRewardTestWeights.begin(); it != m_TrajectoryRewardTestWeights.end(); it++) {
-               m_TestToCompare = (*it).first;
-               minScoreMax=numeric_limits<float>::max();
-               minScoreSum= numeric_limits<float>::max();
-               maxScoreMax=0;
-               maxScoreSum= 0;
-               for (it2 = m_ActiveTrajectories.begin(); it2 != m_ActiveTrajectories.end(); it2++) {
-                   e = *it2;
-                   e->m_AggregatedRewardScore = 0;
-                   ElectrodeInfo::VecTrajectoryTestScore vecTraj = e->m_VecTrajectoryTestScores[m_TestToCompare];
-                   for (int iTP=0; iTP<vecTraj.size(); iTP++){
-                       minScoreMax = min(minScoreMax, vecTraj[iTP].scoreMax);
-                       maxScoreMax = max(maxScoreMax, vecTraj[iTP].scoreMax);
-                       minScoreSum = min(minScoreSum, vecTraj[iTP].scoreSum);
-                       maxScoreSum = max(maxScoreSum, vecTraj[iTP].scoreSum);
-                   }
-                  // cout << m_TestToCompare << minScoreSum << minScoreMax << " max: "<<maxScoreMax << maxScoreMax << endl;
-
+           for (unsigned int iTable = 0; iTable < tables.size(); iTable++) {
+               for (unsigned int i = 0; i < tableIndices[iTable].size(); i++) {
+                   unsigned int index = tableIndices[iTable][i];
+                   tables[iTable]->SetAggregatedScores(index, tables[iTable]->GetAggregatedRiskScore(index), 0, tables[iTable]->GetAggregatedScore(index));
                }
+           }
+
+           // initialization: scores of all depths are reduced in place in the columns
+           for (int iTest=0; iTest<nTests; iTest++) {
+               CalcMinMaxColumnScores(tables, tableIndices, testIds[iTest], false, true, minScoreMax, maxScoreMax);
+               CalcMinMaxColumnScores(tables, tableIndices, testIds[iTest], true, true, minScoreSum, maxScoreSum);
+               maxScoreMax = max(maxScoreMax, 0.0f); // max values start at 0
+               maxScoreSum = max(maxScoreSum, 0.0f);
 
                minMaxVec.push_back(minScoreMax);
                maxMaxVec.push_back(maxScoreMax);
                minSumVec.push_back(minScoreSum);
                maxSumVec.push_back(maxScoreSum);
-               cout << "Test: " << m_TestToCompare << endl;
+               stepSizeMaxVec.push_back((maxScoreMax - minScoreMax) / numBins);
+               stepSizeSumVec.push_back((maxScoreSum-minScoreSum + 1) / numBins);
+               cout << "Test: " << m_TestRegistry->GetTestName(testIds[iTest]) << endl;
                cout << "ScoreMax min " << minScoreMax << " max: " << maxScoreMax << endl;
                cout << "ScoreSum min " << minScoreSum << " max: " << maxScoreSum << endl;
            }
 
            // since all electrodes are of same type compute center of first center with respect to tip only once
-           e =  m_ActiveTrajectories.front();
-           SEEGElectrodeModel::Pointer electrodeModel = SEEGElectrodeModel::New(e->GetElectrodeModelType()); // all electrodes are assumed to be of the same type! if not -> bring this line inside loop
+           SEEGElectrodeModel::Pointer electrodeModel = SEEGElectrodeModel::New(electrodes.empty() ? GetCandidatesElectrodeType() : electrodes.front()->GetElectrodeModelType()); // all electrodes are assumed to be of the same type! if not -> bring this line inside loop
+
+           //Compute best score combined for each trajectory
+           vector<TrajectoryTestColumn*> testColumns(nTests);
+           vector<unsigned char> electrodeMoved(electrodes.size(), 0);
+           bool candidatesMoved = false;
+           for (unsigned int iTable = 0; iTable < tables.size(); iTable++) {
+               SEEGTrajectoryCandidates::Pointer candidates = tables[iTable];
+               for (int iTest=0; iTest<nTests; iTest++) {
+                   testColumns[iTest] = &(candidates->GetTestColumn(testIds[iTest]));
+               }
 
-           //Compute best score combined for each electrode
-           for (it2 = m_ActiveTrajectories.begin(); it2 != m_ActiveTrajectories.end(); it2++) {
-               e = *it2;
-              //cout<<" Electrode - target orig: "<< e->m_TargetPointWorld;
-
-               float nTP = e->m_VecTrajectoryTestScores[m_TestToCompare].size(); //both must have same number of elements
-               if (nTP>0){ // RIZ: not sure why sometimes there is NO vecTraj -> maybe completely outside??
-                   float bestRankScoreMax=0;
-                   float bestRankScoreSum=0;
-                   int bestIndexTPSum=0;
-                   for (int iTP=0; iTP<nTP; iTP++){
-                       int iTest=0;
-                       float combinedRankMax=0;
-                       float combinedRankSum=0;
-                       for (it = m_TrajectoryRewardTestWeights.begin(); it != m_TrajectoryRewardTestWeights.end(); it++) {
-                           m_TestToCompare = (*it).first;
-                           TrajectoryTestWeights weights = (*it).second;
-                           ElectrodeInfo::VecTrajectoryTestScore vecTraj = e->m_VecTrajectoryTestScores[m_TestToCompare];
-
-                           minScoreMax=minMaxVec[iTest];
-                           maxScoreMax=maxMaxVec[iTest];
-                           minScoreSum=minSumVec[iTest];
-                           maxScoreSum=maxSumVec[iTest];
-
-                           stepSizeMax = (maxScoreMax - minScoreMax) / numBins;
-                           stepSizeSum = (maxScoreSum-minScoreSum + 1) / numBins;
-
-                           rankMax =rankSum= 1;
-
-                           if (maxScoreMax-minScoreMax > 0.001){
-                               score = vecTraj[iTP].scoreMax;
-                               rankMax = (int)((score - minScoreMax) / stepSizeMax) + 1;
-                           }
-                           e->m_VecTrajectoryTestScores[m_TestToCompare][iTP].rankingUsingMax = rankMax;
+               for (unsigned int i = 0; i < tableIndices[iTable].size(); i++) {
+                   unsigned int index = tableIndices[iTable][i];
+                   unsigned int nTP = testColumns[nTests-1]->m_NumberOfDepths[index]; //all must have same number of elements
+                   if (nTP>0){ // RIZ: not sure why sometimes there is NO vecTraj -> maybe completely outside??
+                       float bestRankScoreMax=0;
+                       float bestRankScoreSum=0;
+                       int bestIndexTPSum=0;
+                       for (int iTP=0; iTP<nTP; iTP++){
+                           float combinedRankMax=0;
+                           float combinedRankSum=0;
+                           for (int iTest=0; iTest<nTests; iTest++) {
+                               TrajectoryTestColumn& testColumn = *testColumns[iTest];
+                               unsigned int depth = testColumn.m_FirstDepth[index] + iTP;
+
+                               rankMax =rankSum= 1;
+
+                               if (maxMaxVec[iTest]-minMaxVec[iTest] > 0.001){
+                                   score = testColumn.m_DepthScoreMax[depth];
+                                   rankMax = (int)((score - minMaxVec[iTest]) / stepSizeMaxVec[iTest]) + 1;
+                               }
+                               testColumn.m_DepthRankingUsingMax[depth] = rankMax;
 
-                           if (maxScoreSum-minScoreSum > 0.001) {
-                               score = vecTraj[iTP].scoreSum;
-                               rankSum = (int)((score - minScoreSum) / stepSizeSum) + 1;
+                               if (maxSumVec[iTest]-minSumVec[iTest] > 0.001) {
+                                   score = testColumn.m_DepthScoreSum[depth];
+                                   rankSum = (int)((score - minSumVec[iTest]) / stepSizeSumVec[iTest]) + 1;
+                               }
+                               testColumn.m_DepthRankingUsingSum[depth] = rankSum;
+                               combinedRankMax += testWeights[iTest].m_WeightUsingMax * rankMax;
+                               combinedRankSum += testWeights[iTest].m_WeightUsingSum * rankSum;
                            }
-                           e->m_VecTrajectoryTestScores[m_TestToCompare][iTP].rankingUsingSum = rankSum;
-                           combinedRankMax += weights.m_WeightUsingMax * rankMax;
-                           combinedRankSum += weights.m_WeightUsingSum * rankSum;
-                           iTest++;
+                           //Keep only max score for each trajectory
+                           if (bestRankScoreMax < combinedRankMax) bestRankScoreMax = combinedRankMax;
+                           if (bestRankScoreSum < combinedRankSum) {
+                               bestRankScoreSum = combinedRankSum;
+                               bestIndexTPSum = iTP; // the only important one is sum!
+                           }
+                       }
+
+                       Point3D firstContactPoint;
+                       for (int iTest=0; iTest<nTests; iTest++) {
+                           TrajectoryTestColumn& testColumn = *testColumns[iTest];
+                           unsigned int bestDepth = testColumn.m_FirstDepth[index] + bestIndexTPSum;
+                           TrajectoryTestScore testScore;
+                           GetCandidateTestScore(candidates, index, testIds[iTest], testScore);
+                           testScore.scoreMax = testColumn.m_DepthScoreMax[bestDepth]; // before: bestScoreMax; //assign same score to all tests
+                           testScore.scoreSum = testColumn.m_DepthScoreSum[bestDepth]; // before: bestScoreSum;
+                           testScore.rankingUsingMax = testColumn.m_DepthRankingUsingMax[bestDepth];
+                           testScore.rankingUsingSum = testColumn.m_DepthRankingUsingSum[bestDepth];
+                           testScore.pointAtMaxScore[0] = testColumn.m_DepthPointAtMaxScoreX[bestDepth]; //center of first contact
+                           testScore.pointAtMaxScore[1] = testColumn.m_DepthPointAtMaxScoreY[bestDepth];
+                           testScore.pointAtMaxScore[2] = testColumn.m_DepthPointAtMaxScoreZ[bestDepth];
+                           SetCandidateTestScore(candidates, index, testIds[iTest], testScore);
+                           firstContactPoint = testScore.pointAtMaxScore;
                        }
-                       //Keep only max score for each trajectory
-                       if (bestRankScoreMax < combinedRankMax) bestRankScoreMax = combinedRankMax;
-                       if (bestRankScoreSum < combinedRankSum) {
-                           bestRankScoreSum = combinedRankSum;
-                           bestIndexTPSum = iTP; // the only important one is sum!
+                       // tip of electrode (center of 1st contact - contactSize/2 - distance from tip) - distFromTip
+                       Point3D entryPoint = candidates->GetEntryPoint(index);
+                       candidates->SetTargetPoint(index, electrodeModel->getElectrodeTipFromContactPosition(0, firstContactPoint, entryPoint));
+                       candidates->SetAggregatedScores(index, candidates->GetAggregatedRiskScore(index), bestRankScoreMax + bestRankScoreSum,
+                                                       candidates->GetAggregatedScore(index));
+                       if (iTable == 0) {
+                           candidatesMoved = true;
+                       } else {
+                           electrodeMoved[index] = 1;
                        }
                    }
+               }
+           }
 
-                   for (it = m_TrajectoryRewardTestWeights.begin(); it != m_TrajectoryRewardTestWeights.end(); it++) {
-                       m_TestToCompare = (*it).first;
-                       ElectrodeInfo::VecTrajectoryTestScore vecTraj = e->m_VecTrajectoryTestScores[m_TestToCompare];
-                       e->m_TrajectoryTestScores[m_TestToCompare].scoreMax = vecTraj[bestIndexTPSum].scoreMax; // before: bestScoreMax; //assign same score to all tests
-                       e->m_TrajectoryTestScores[m_TestToCompare].scoreSum = vecTraj[bestIndexTPSum].scoreSum; // before: bestScoreSum;
-                       e->m_TrajectoryTestScores[m_TestToCompare].rankingUsingMax = vecTraj[bestIndexTPSum].rankingUsingMax;
-                       e->m_TrajectoryTestScores[m_TestToCompare].rankingUsingSum = vecTraj[bestIndexTPSum].rankingUsingSum;
-                       e->m_TrajectoryTestScores[m_TestToCompare].pointAtMaxScore = vecTraj[bestIndexTPSum].pointAtMaxScore; //center of first contact
-                       Point3D newTargetPoint = electrodeModel->getElectrodeTipFromContactPosition(0, vecTraj[bestIndexTPSum].pointAtMaxScore, e->m_EntryPointWorld);
-                       e->m_TargetPointWorld = newTargetPoint; // tip of electrode (center of 1st contact - contactSize/2 - distance from tip) - distFromTip
-                       e->m_AggregatedRewardScore = bestRankScoreMax + bestRankScoreSum;
-                   }
-                  // cout<<" - New target: "<< e->m_TargetPointWorld << " - index: "<< bestIndexTPSum<<" - score: "<<bestScoreSum<<endl;
+           CopyActiveScoreTablesToElectrodes(tables, electrodes);
+           for (unsigned int iElec = 0; iElec < electrodes.size(); iElec++) {
+               if (electrodeMoved[iElec]) {
+                   electrodes[iElec]->m_TargetPointWorld = tables[1]->GetTargetPoint(iElec);
                }
            }
-           // sort trajectories according to the best combined score for each
-          // m_ActiveTrajectories.sort(compareSEEGSum);
-            m_ActiveTrajectories.sort(compareAgreggatedReward);
+           if (candidatesMoved) {
+               BuildCandidatesIndex(); // the index holds the electrode vectors of the candidates
+           }
+
+           // sort trajectories according to the best combined score for each (candidates and ElectrodeInfo separately):
+           // only the best numBestTrajectories of each are sorted (see AggregateAll()), the rejected candidates follow
+           vector<unsigned int> activeIndices, rejectedIndices;
+           m_Candidates->GetValidActiveIndices(activeIndices, &rejectedIndices);
+           vector<float> rewardScores(activeIndices.size());
+           for (unsigned int i = 0; i < activeIndices.size(); i++) {
+               rewardScores[i] = -m_Candidates->GetAggregatedRewardScore(activeIndices[i]); // best reward first
+           }
+           vector<unsigned int> order;
+           CalcBestFirstOrder(rewardScores, numBestTrajectories, order);
+           for (unsigned int i = 0; i < order.size(); i++) {
+               order[i] = activeIndices[order[i]];
+           }
+           order.insert(order.end(), rejectedIndices.begin(), rejectedIndices.end());
+           m_Candidates->SetActiveIndices(order);
+
+           // m_ActiveTrajectories.sort(compareSEEGSum);
+           rewardScores.resize(electrodes.size());
+           for (unsigned int i = 0; i < electrodes.size(); i++) {
+               rewardScores[i] = -electrodes[i]->m_AggregatedRewardScore;
+           }
+           CalcBestFirstOrder(rewardScores, numBestTrajectories, order);
+           m_ActiveTrajectories.clear();
+           for (unsigned int i = 0; i < order.size(); i++) {
+               m_ActiveTrajectories.push_back(electrodes[order[i]]);
+           }
+           m_TrajectoryIndicesModified = true; // the indices follow the order of the lists
+       }
+
+       void SEEGPathPlanner::CalcBestFirstOrder(const vector<float>& scores, int numBest, vector<unsigned int>& order) {
+           order.resize(scores.size());
+           for (unsigned int i = 0; i < order.size(); i++) {
+               order[i] = i;
+           }
+           if (numBest < 0 || numBest >= order.size()) {
+               sort(order.begin(), order.end(), CompareAggregatedScoreIndices(scores));
+               return;
+           }
+           partial_sort(order.begin(), order.begin() + numBest, order.end(), CompareAggregatedScoreIndices(scores));
+           sort(order.begin() + numBest, order.end()); // the others follow in their current order
        }
 
-       void SEEGPathPlanner::AggregateAll(int numBins) {
+       void SEEGPathPlanner::AggregateAll(int numBins, int numBestTrajectories) {
            list<ElectrodeInfo::Pointer>::iterator it2;
            ElectrodeInfo::Pointer e;
+           vector<unsigned int> activeIndices, rejectedIndices; // rejected candidates are not ranked, they stay in the table
+           m_Candidates->GetValidActiveIndices(activeIndices, &rejectedIndices);
+           for (unsigned int i = 0; i < activeIndices.size(); i++) {
+               unsigned int index = activeIndices[i];
+               float riskScore = m_Candidates->GetAggregatedRiskScore(index);
+               float rewardScore = m_Candidates->GetAggregatedRewardScore(index);
+               m_Candidates->SetAggregatedScores(index, riskScore, rewardScore, (m_WeightRisk * riskScore) + (m_WeightReward * (numBins - rewardScore)));
+           }
            for (it2 = m_ActiveTrajectories.begin(); it2 != m_ActiveTrajectories.end(); it2++) {
                e = *it2;
                e->m_AggregatedScore = (m_WeightRisk * e->m_AggregatedRiskScore) + (m_WeightReward * (numBins - e->m_AggregatedRewardScore));
            }
            cout << "Aggregating All " << endl;
-
-           // sorting aggregated list
-          m_ActiveTrajectories.sort(compareSEEGtraj);
-
+           m_TrajectoryIndicesModified = true; // the indices follow the order of the lists
+
+           // candidates and ElectrodeInfo are ranked together (scores of the candidates first); only the best
+           // numBestTrajectories are sorted (same order as a full sort), the others follow in their current order
+           vector<ElectrodeInfo::Pointer> electrodes(m_ActiveTrajectories.begin(), m_ActiveTrajectories.end());
+           unsigned int numCandidates = activeIndices.size();
+           vector<float> scores(numCandidates + electrodes.size());
+           for (unsigned int i = 0; i < numCandidates; i++) {
+               scores[i] = m_Candidates->GetAggregatedScore(activeIndices[i]);
+           }
+           for (unsigned int i = 0; i < electrodes.size(); i++) {
+               scores[numCandidates + i] = electrodes[i]->m_AggregatedScore;
+           }
+           vector<unsigned int> order;
+           CalcBestFirstOrder(scores, numBestTrajectories, order);
+
+           // only the best candidates are materialized (all of them if numBestTrajectories < 0): the active list
+           // starts with the best trajectories, then the other ElectrodeInfo; the other candidates stay in the table
+           unsigned int numBest = order.size();
+           if (numBestTrajectories >= 0 && numBestTrajectories < order.size()) {
+               numBest = numBestTrajectories;
+           }
+           vector<unsigned int> remainingIndices;
+           for (unsigned int i = numBest; i < order.size(); i++) {
+               if (order[i] < numCandidates) {
+                   remainingIndices.push_back(activeIndices[order[i]]);
+               }
+           }
+           remainingIndices.insert(remainingIndices.end(), rejectedIndices.begin(), rejectedIndices.end());
+           m_Candidates->SetActiveIndices(remainingIndices); // the materialized candidates leave the active set at once
+
+           m_ActiveTrajectories.clear();
+           for (unsigned int i = 0; i < order.size(); i++) {
+               if (order[i] >= numCandidates) {
+                   m_ActiveTrajectories.push_back(electrodes[order[i] - numCandidates]);
+               } else if (i < numBest) {
+                   m_ActiveTrajectories.push_back(MaterializeCandidate(activeIndices[order[i]]));
+               }
+           }
        }
 
   /*     void SEEGPathPlanner::AggregateGlobal(int numBins,  vector<list<ElectrodeInfo::Pointer>> otherActivePlans) {
@@ -1215,7 +3213,11 @@ namespace seeg {
 */
 
    // read/write functions
-      void SEEGPathPlanner::SaveSEEGPlanningDataToFile (const string& filename) {
+      void SEEGPathPlanner::SaveSEEGPlanningDataToFile (const string& filename, bool textFormat) {
+          if (!textFormat) {
+              WritePlanningResultsFile(filename, PLANNING_RESULTS_ALL);
+              return;
+          }
           ofstream file;
           file.open(filename.c_str());
     /*      file << "[target] ";
@@ -1274,6 +3276,15 @@ namespace seeg {
               file << endl;
           }
 
+          // candidates that were not materialized
+          vector<int> columnsByName;
+          GetCandidateColumnsByName(columnsByName);
+          for (unsigned int iCand=0; iCand<m_Candidates->GetNumberOfCandidates(); iCand++) {
+              if (!m_Candidates->IsMaterialized(iCand)) {
+                  WriteCandidateToFile(file, iCand, columnsByName);
+              }
+          }
+
           file << "[order] "<< "targetx targety targetz entryx entryy entryz agregatted aggregRisk aggregReward ";
           file << "testType scoreMax scoreSum rankingMax rankingSum distAtMax xAtMax yAtMax zAtMax" << endl;
 
@@ -1281,9 +3292,13 @@ namespace seeg {
           file.close();
       }
 
-      void SEEGPathPlanner::SaveActiveSEEGPlanningDataToFile (const string& filename) {
+      void SEEGPathPlanner::SaveActiveSEEGPlanningDataToFile (const string& filename, bool textFormat) {
           // similar to  SavePlanningDataToFile but saves only Active (not rejected) trajectories
           cout<<"Saving trajectory to "<<filename.c_str() << endl;
+          if (!textFormat) {
+              WritePlanningResultsFile(filename, PLANNING_RESULTS_ACTIVE);
+              return;
+          }
           ofstream file;
           file.open(filename.c_str());
           file << "[fileType] "<< "Active" << endl;
@@ -1337,12 +3352,212 @@ namespace seeg {
               }
               file << endl;
           }
+
+          // active candidates that were not materialized
+          vector<int> columnsByName;
+          GetCandidateColumnsByName(columnsByName);
+          const vector<unsigned int>& activeIndices = m_Candidates->GetActiveIndices();
+          for (unsigned int i=0; i<activeIndices.size(); i++) {
+              WriteCandidateToFile(file, activeIndices[i], columnsByName);
+          }
           file << "[order] "<< "targetx targety targetz entryx entryy entryz agregatted aggregRisk aggregReward ";
           file << "testType scoreMax scoreSum rankingMax rankingSum distAtMax xAtMax yAtMax zAtMax" << endl;
 
           file.close();
       }
 
+      void SEEGPathPlanner::GetCandidateColumnsByName(vector<int>& columnsByName) {
+          // same order as the map of test scores of ElectrodeInfo
+          map<string, int> columnsMap;
+          for (int iCol=0; iCol<m_Candidates->GetNumberOfTestColumns(); iCol++) {
+              if (m_Candidates->HasTestColumn(iCol)) {
+                  columnsMap[m_TestRegistry->GetTestName(iCol)] = iCol;
+              }
+          }
+          columnsByName.clear();
+          map<string, int>::iterator it;
+          for (it=columnsMap.begin(); it!=columnsMap.end(); it++) {
+              columnsByName.push_back((*it).second);
+          }
+      }
+
+      void SEEGPathPlanner::WriteCandidateToFile(ofstream& file, unsigned int index, const vector<int>& columnsByName) {
+          // same line as for an ElectrodeInfo (see SaveSEEGPlanningDataToFile)
+          Point3D targetPoint = m_Candidates->GetTargetPoint(index);
+          Point3D entryPoint = m_Candidates->GetEntryPoint(index);
+          file << "[trajectory] ";
+          file << targetPoint[0] << " ";
+          file << targetPoint[1] << " ";
+          file << targetPoint[2] << " ";
+          file << entryPoint[0] << " ";
+          file << entryPoint[1] << " ";
+          file << entryPoint[2] << " ";
+          file << m_Candidates->GetAggregatedScore(index) << " ";
+          file << m_Candidates->GetAggregatedRiskScore(index) << " ";
+          file << m_Candidates->GetAggregatedRewardScore(index) << " ";
+
+          for (int i=0; i<columnsByName.size(); i++) {
+              TrajectoryTestColumn& testColumn = m_Candidates->GetTestColumn(columnsByName[i]);
+              if (!testColumn.m_Evaluated[index]) {
+                  continue;
+              }
+              file << m_TestRegistry->GetTestName(columnsByName[i]) << " ";
+              file << testColumn.m_ScoreMax[index] << " ";
+              file << testColumn.m_ScoreSum[index] << " ";
+              file << testColumn.m_RankingUsingMax[index] << " ";
+              file << testColumn.m_RankingUsingSum[index] << " ";
+              file << testColumn.m_DistAtMaxScore[index] << " ";
+              file << testColumn.m_PointAtMaxScoreX[index] << " ";
+              file << testColumn.m_PointAtMaxScoreY[index] << " ";
+              file << testColumn.m_PointAtMaxScoreZ[index] << " ";
+          }
+          file << endl;
+      }
+
+      void SEEGPathPlanner::WritePlanningResultsFile(const string& filename, PLANNING_RESULTS_FILE_TYPE fileType) {
+          SEEGPlanningResultsWriter::Pointer writer = SEEGPlanningResultsWriter::New();
+          writer->SetFileType(fileType);
+          writer->SetElectrodeType(m_HasCandidatesElectrodeType ? (int) m_CandidatesElectrodeType : -1);
+          writer->SetGlobalWeights(m_WeightRisk, m_WeightReward);
+          map<string, TrajectoryRiskTestWeights>::iterator it;
+          for (it=m_TrajectoryRiskTestWeights.begin(); it != m_TrajectoryRiskTestWeights.end(); it++) {
+              writer->SetRiskTestWeights((*it).first, (*it).second.m_WeightUsingMax, (*it).second.m_WeightUsingSum, (*it).second.m_HardLimit);
+          }
+          map<string, TrajectoryTestWeights>::iterator it2;
+          for (it2=m_TrajectoryRewardTestWeights.begin(); it2 != m_TrajectoryRewardTestWeights.end(); it2++) {
+              writer->SetRewardTestWeights((*it2).first, (*it2).second.m_WeightUsingMax, (*it2).second.m_WeightUsingSum);
+          }
+
+          // materialized trajectories
+          set<ElectrodeInfo*> activeElectrodes;
+          list<ElectrodeInfo::Pointer>::iterator elecIt;
+          for (elecIt = m_ActiveTrajectories.begin(); elecIt != m_ActiveTrajectories.end(); elecIt++) {
+              activeElectrodes.insert((*elecIt).get());
+          }
+          const list<ElectrodeInfo::Pointer>& electrodes = (fileType == PLANNING_RESULTS_ACTIVE) ? m_ActiveTrajectories : m_AllTrajectories;
+          list<ElectrodeInfo::Pointer>::const_iterator constElecIt;
+          for (constElecIt = electrodes.begin(); constElecIt != electrodes.end(); constElecIt++) {
+              ElectrodeInfo::Pointer el = *constElecIt;
+              unsigned int row = writer->AddTrajectory(el->m_EntryPointWorld, el->m_TargetPointWorld, el->m_AggregatedScore,
+                                                       el->m_AggregatedRiskScore, el->m_AggregatedRewardScore,
+                                                       activeElectrodes.find(el.get()) != activeElectrodes.end());
+              map<string, TrajectoryTestScore>::iterator itScores;
+              for (itScores=el->m_TrajectoryTestScores.begin(); itScores !=el->m_TrajectoryTestScores.end(); itScores++) {
+                  TrajectoryTestColumn& column = writer->GetTestColumn(writer->AddTest((*itScores).first));
+                  column.m_ScoreMax[row] = (*itScores).second.scoreMax;
+                  column.m_ScoreSum[row] = (*itScores).second.scoreSum;
+                  column.m_RankingUsingMax[row] = (*itScores).second.rankingUsingMax;
+                  column.m_RankingUsingSum[row] = (*itScores).second.rankingUsingSum;
+                  column.m_DistAtMaxScore[row] = (*itScores).second.distAtMaxScore;
+                  column.m_PointAtMaxScoreX[row] = (*itScores).second.pointAtMaxScore[0];
+                  column.m_PointAtMaxScoreY[row] = (*itScores).second.pointAtMaxScore[1];
+                  column.m_PointAtMaxScoreZ[row] = (*itScores).second.pointAtMaxScore[2];
+                  column.m_Evaluated[row] = 1;
+              }
+          }
+
+          // candidates that were not materialized (only the active ones for an active file)
+          vector<int> candidateColumns;
+          vector<int> writerTests;
+          for (int iCol=0; iCol<m_Candidates->GetNumberOfTestColumns(); iCol++) {
+              if (m_Candidates->HasTestColumn(iCol)) {
+                  candidateColumns.push_back(iCol);
+                  writerTests.push_back(writer->AddTest(m_TestRegistry->GetTestName(iCol)));
+              }
+          }
+          for (unsigned int iCand=0; iCand<m_Candidates->GetNumberOfCandidates(); iCand++) {
+              bool active = m_Candidates->IsActive(iCand);
+              if (m_Candidates->IsMaterialized(iCand) || (fileType == PLANNING_RESULTS_ACTIVE && !active)) {
+                  continue;
+              }
+              unsigned int row = writer->AddTrajectory(m_Candidates->GetEntryPoint(iCand), m_Candidates->GetTargetPoint(iCand),
+                                                       m_Candidates->GetAggregatedScore(iCand), m_Candidates->GetAggregatedRiskScore(iCand),
+                                                       m_Candidates->GetAggregatedRewardScore(iCand), active);
+              for (int i=0; i<candidateColumns.size(); i++) {
+                  TrajectoryTestColumn& testColumn = m_Candidates->GetTestColumn(candidateColumns[i]);
+                  if (!testColumn.m_Evaluated[iCand]) {
+                      continue;
+                  }
+                  TrajectoryTestColumn& column = writer->GetTestColumn(writerTests[i]);
+                  column.m_ScoreMax[row] = testColumn.m_ScoreMax[iCand];
+                  column.m_ScoreSum[row] = testColumn.m_ScoreSum[iCand];
+                  column.m_RankingUsingMax[row] = testColumn.m_RankingUsingMax[iCand];
+                  column.m_RankingUsingSum[row] = testColumn.m_RankingUsingSum[iCand];
+                  column.m_DistAtMaxScore[row] = testColumn.m_DistAtMaxScore[iCand];
+                  column.m_PointAtMaxScoreX[row] = testColumn.m_PointAtMaxScoreX[iCand];
+                  column.m_PointAtMaxScoreY[row] = testColumn.m_PointAtMaxScoreY[iCand];
+                  column.m_PointAtMaxScoreZ[row] = testColumn.m_PointAtMaxScoreZ[iCand];
+                  column.m_Evaluated[row] = 1;
+              }
+          }
+
+          writer->Write(filename);
+      }
+
+      bool SEEGPathPlanner::LoadPlanningResultsFile(const string& filename) {
+          SEEGPlanningResultsReader::Pointer reader = SEEGPlanningResultsReader::New();
+          if (!reader->Open(filename)) {
+              return false;
+          }
+
+          this->SetTrajectoryGlobalWeights(reader->GetGlobalRiskWeight(), reader->GetGlobalRewardWeight());
+          for (int iTest=0; iTest<reader->GetNumberOfTests(); iTest++) {
+              float weightMax, weightSum, hardLimitValue;
+              if (reader->IsRiskTest(iTest)) {
+                  reader->GetRiskTestWeights(iTest, weightMax, weightSum, hardLimitValue);
+                  this->SetTrajectoryRiskTestWeights(reader->GetTestName(iTest), weightMax, weightSum, hardLimitValue);
+              }
+              if (reader->IsRewardTest(iTest)) {
+                  reader->GetRewardTestWeights(iTest, weightMax, weightSum);
+                  this->SetTrajectoryRewardTestWeights(reader->GetTestName(iTest), weightMax, weightSum);
+              }
+          }
+          if (reader->GetElectrodeType() >= 0) {
+              m_CandidatesElectrodeType = (SEEGElectrodeModel::SEEG_ELECTRODE_MODEL_TYPE) reader->GetElectrodeType();
+              m_HasCandidatesElectrodeType = true;
+              m_Candidates->SetElectrodeModel(SEEGElectrodeModel::New(m_CandidatesElectrodeType));
+          }
+
+          // trajectories are loaded as candidates: only the selected ones are materialized
+          unsigned int numTrajectories = reader->GetNumberOfTrajectories();
+          m_Candidates->Reserve(numTrajectories);
+          vector<unsigned int> activeIndices;
+          for (unsigned int iTraj=0; iTraj<numTrajectories; iTraj++) {
+              unsigned int index = m_Candidates->AddCandidate(reader->GetEntryPoint(iTraj), reader->GetTargetPoint(iTraj));
+              m_Candidates->SetAggregatedScores(index, reader->GetAggregatedRiskScore(iTraj), reader->GetAggregatedRewardScore(iTraj), reader->GetAggregatedScore(iTraj));
+              if (reader->IsActive(iTraj)) {
+                  activeIndices.push_back(index);
+              }
+          }
+          m_Candidates->SetActiveIndices(activeIndices);
+          for (int iTest=0; iTest<reader->GetNumberOfTests(); iTest++) {
+              int column = m_Candidates->AddTestColumn(reader->GetTestName(iTest));
+              if (column < 0) {
+                  cout << "Too many tests, scores of " << reader->GetTestName(iTest) << " not loaded" << endl;
+                  continue;
+              }
+              reader->ReadTestColumn(iTest, 0, numTrajectories, m_Candidates->GetTestColumn(column), 0);
+          }
+          reader->Close();
+          BuildCandidatesIndex();
+
+          // best active trajectory (first one of the active list once sorted, see LoadSEEGPlanningDataFromFile())
+          int best = -1;
+          for (unsigned int i=0; i<activeIndices.size(); i++) {
+              if (best < 0 || m_Candidates->GetAggregatedScore(activeIndices[i]) < m_Candidates->GetAggregatedScore(best)) {
+                  best = activeIndices[i];
+              }
+          }
+          if (best < 0) {
+              cout << "No Active Trajectories Found in " << filename.c_str()<<endl;
+              return false;
+          }
+          ElectrodeInfo::Pointer ep = MaterializeCandidate(best);
+          this->m_EntryPoint = ep->m_EntryPointWorld;
+          this->m_TargetDestination = ep->m_TargetPointWorld;
+          return true;
+      }
+
       bool SEEGPathPlanner::LoadSEEGPlanningDataFromFile (const string& filename) {
           ifstream file;
           string line;
@@ -1352,16 +3567,26 @@ namespace seeg {
           bool status=false;
           Reset();
 
+          if (SEEGPlanningResultsReader::IsPlanningResultsFile(filename)) {
+              return LoadPlanningResultsFile(filename);
+          }
+
           file.open(filename.c_str());
+          if (!file.is_open()) {
+              cout << "Unable to open file " << filename.c_str() << endl;
+              return false;
+          }
 
-          while(~file.eof()) {
-              getline(file, line);
+          while (getline(file, line)) {
               stringstream ss (line);
 
               token="";
               getline(ss, token, ' ');
 
-              if (token == "[fileType]") {
+              if (token.empty() || token == "[order]") {
+                  continue; // column names of the [trajectory] lines
+
+              } else if (token == "[fileType]") {
 
                   getline(ss, token, ' ');
                   testName = token;
@@ -1541,67 +3766,244 @@ namespace seeg {
               vol->TransformPhysicalPointToIndex(electrode->m_EntryPointWorld, index);
               vol->SetPixel(index, electrode->m_AggregatedScore);
           }
+
+          // valid active candidates still in the table
+          vector<unsigned int> activeIndices;
+          m_Candidates->GetValidActiveIndices(activeIndices);
+          for (unsigned int i = 0; i < activeIndices.size(); i++) {
+              FloatVolume::IndexType index;
+              vol->TransformPhysicalPointToIndex(m_Candidates->GetEntryPoint(activeIndices[i]), index);
+              vol->SetPixel(index, m_Candidates->GetAggregatedScore(activeIndices[i]));
+          }
           return vol;
       }
 
       //comparative functions
       ElectrodeInfo::Pointer SEEGPathPlanner::FindNearestDistOptimalTrajectory (ElectrodeInfo::Pointer electrode, float distThreshold) {
 
-          list<ElectrodeInfo::Pointer>::iterator it;
           ElectrodeInfo::Pointer best = electrode;
           float scoreBest = electrode->m_AggregatedScore;
-          int pntCnt = 0;
-
-          float maxDist = 0;
-          float minDist = numeric_limits<float>::max(); // sum dist in mm
-
-
-          for (it = m_ActiveTrajectories.begin(); it != m_ActiveTrajectories.end(); it++) {
 
-              ElectrodeInfo::Pointer otherElectrode = *it;
-
-              float sumDist = this->CalcDistanceBetweenPointsInTrajectories(electrode->m_ElectrodeVectorWorld, otherElectrode->m_ElectrodeVectorWorld);
-
-              if (abs(sumDist) < abs(minDist)) minDist = sumDist;
-              if (abs(sumDist) > abs(maxDist)) maxDist = sumDist;
-
-              if (abs(sumDist) > abs(distThreshold)) {
-                  continue;
-              }
+          // active trajectories within distThreshold (sum dist in mm), in the order of m_ActiveTrajectories
+          UpdateTrajectoryIndices();
+          vector<unsigned int> closeIds;
+          m_ActiveTrajectoriesIndex->FindInRadius(electrode->m_ElectrodeVectorWorld, abs(distThreshold), TrajectoryIndexAcceptAll(), closeIds);
 
-              pntCnt++;
+          for (unsigned int i = 0; i < closeIds.size(); i++) {
+              ElectrodeInfo::Pointer otherElectrode = m_ActiveTrajectoriesIndexed[closeIds[i]];
               if (scoreBest < 0 || scoreBest > otherElectrode->m_AggregatedScore) {
                   scoreBest = otherElectrode->m_AggregatedScore;
                   best = otherElectrode;
               }
           }
 
-          cout << "minDist = " << minDist << " maxDist = " << maxDist << endl;
-          cout << "FindNearestDistOptimalTrajectory:: Total number of points tested: " << pntCnt << endl;
+          // valid active candidates still in the table - the best one is returned as a copy (it stays in the table)
+          vector<unsigned int> closeCandidates;
+          m_CandidatesIndex->FindInRadius(electrode->m_ElectrodeVectorWorld, abs(distThreshold), CandidateValidActiveFilter(m_Candidates), closeCandidates);
+          int bestCandidate = -1;
+          for (unsigned int i = 0; i < closeCandidates.size(); i++) {
+              float score = m_Candidates->GetAggregatedScore(closeCandidates[i]);
+              if (scoreBest < 0 || scoreBest > score) {
+                  scoreBest = score;
+                  bestCandidate = closeCandidates[i];
+              }
+          }
+          if (bestCandidate >= 0) {
+              best = CreateCandidateElectrode(bestCandidate);
+          }
+
+          cout << "FindNearestDistOptimalTrajectory:: Total number of points tested: " << closeIds.size() + closeCandidates.size() << endl;
           return best;
       }
 
 
     /**** PROTECTED AND PRIVATE FUNCTIONS ****/
 
+    void SEEGPathPlanner::BuildCandidatesIndex() {
+        m_CandidatesIndex->Clear();
+        m_CandidatesIndex->Reserve(m_Candidates->GetNumberOfCandidates());
+        for (unsigned int iCand=0; iCand<m_Candidates->GetNumberOfCandidates(); iCand++) {
+            m_CandidatesIndex->AddPoint(m_Candidates->GetElectrodeVector(iCand));
+        }
+        m_CandidatesIndex->Build();
+    }
+
+    void SEEGPathPlanner::AddToTrajectoryIndices(ElectrodeInfo::Pointer electrode, bool active) {
+        if (m_TrajectoryIndicesModified) {
+            return; // indices are rebuilt from the lists anyway
+        }
+        m_AllTrajectoriesIndex->AddPoint(electrode->m_ElectrodeVectorWorld);
+        m_AllTrajectoriesIndexed.push_back(electrode);
+        if (active) {
+            m_ActiveTrajectoriesIndex->AddPoint(electrode->m_ElectrodeVectorWorld);
+            m_ActiveTrajectoriesIndexed.push_back(electrode);
+        }
+    }
+
+    void SEEGPathPlanner::UpdateTrajectoryIndices() {
+        if (!m_TrajectoryIndicesModified) {
+            m_AllTrajectoriesIndex->Update();
+            m_ActiveTrajectoriesIndex->Update();
+            return;
+        }
+
+        // IDs of the indices follow the order of the lists (ties are resolved as by a scan of the lists)
+        m_AllTrajectoriesIndexed.assign(m_AllTrajectories.begin(), m_AllTrajectories.end());
+        m_AllTrajectoriesIndex->Clear();
+        m_AllTrajectoriesIndex->Reserve(m_AllTrajectoriesIndexed.size());
+        for (unsigned int i=0; i<m_AllTrajectoriesIndexed.size(); i++) {
+            m_AllTrajectoriesIndex->AddPoint(m_AllTrajectoriesIndexed[i]->m_ElectrodeVectorWorld);
+        }
+        m_AllTrajectoriesIndex->Build();
+
+        m_ActiveTrajectoriesIndexed.assign(m_ActiveTrajectories.begin(), m_ActiveTrajectories.end());
+        m_ActiveTrajectoriesIndex->Clear();
+        m_ActiveTrajectoriesIndex->Reserve(m_ActiveTrajectoriesIndexed.size());
+        for (unsigned int i=0; i<m_ActiveTrajectoriesIndexed.size(); i++) {
+            m_ActiveTrajectoriesIndex->AddPoint(m_ActiveTrajectoriesIndexed[i]->m_ElectrodeVectorWorld);
+        }
+        m_ActiveTrajectoriesIndex->Build();
+
+        m_TrajectoryIndicesModified = false;
+    }
+
+
+    void SEEGPathPlanner::GetRiskDistanceMaps(const vector<string>& binTestNames, const vector<IntVolume::Pointer>& binVols,
+                                              vector<SEEGStructureDistanceMap::Pointer>& binDistanceMaps) {
+        binDistanceMaps.assign(binTestNames.size(), SEEGStructureDistanceMap::Pointer());
+        if (!m_UseRiskDistanceMaps) {
+            return;
+        }
+        for (int i=0; i<binTestNames.size(); i++) {
+            map<string, SEEGStructureDistanceMap::Pointer>::iterator itMap = m_RiskDistanceMaps.find(binTestNames[i]);
+            if (itMap != m_RiskDistanceMaps.end() && itMap->second->GetStructureVolume() == binVols[i]) {
+                binDistanceMaps[i] = itMap->second;
+            }
+        }
+    }
+
+    void SEEGPathPlanner::GetRiskBrickOccupancies(const vector<string>& binTestNames, const vector<IntVolume::Pointer>& binVols,
+                                                  vector<SEEGBrickOccupancy::Pointer>& binBrickOccupancies) {
+        binBrickOccupancies.assign(binTestNames.size(), SEEGBrickOccupancy::Pointer());
+        if (!m_UseRiskBrickOccupancies) {
+            return;
+        }
+        for (int i=0; i<binTestNames.size(); i++) {
+            map<string, SEEGBrickOccupancy::Pointer>::iterator itBricks = m_RiskBrickOccupancies.find(binTestNames[i]);
+            if (itBricks != m_RiskBrickOccupancies.end() && itBricks->second->GetVolume() == binVols[i].GetPointer()) {
+                binBrickOccupancies[i] = itBricks->second;
+            }
+        }
+    }
+
+    void SEEGPathPlanner::CalcNoOverlapScores(const vector<IntVolume::Pointer>& binVols, const vector<BinaryTestCfg>& binTestCfgs,
+                                              GeneralTransform::Pointer nativeToRef, vector<TrajectoryTestScore>& scores) {
+        // TestBinaryOverlap() on a single voxel farther than m_MaxDistToEvaluate: no voxel is scored
+        scores.resize(binTestCfgs.size());
+        for (int i=0; i<binTestCfgs.size(); i++) {
+            IntVolume::RegionType region = binVols[i]->GetBufferedRegion();
+            IntVolume::SizeType size;
+            size.Fill(1);
+            region.SetSize(size);
+            FloatVolume::Pointer distanceMap = FloatVolume::New();
+            distanceMap->SetOrigin(binVols[i]->GetOrigin());
+            distanceMap->SetSpacing(binVols[i]->GetSpacing());
+            distanceMap->SetDirection(binVols[i]->GetDirection());
+            distanceMap->SetRegions(region);
+            distanceMap->Allocate();
+            distanceMap->FillBuffer(binTestCfgs[i].m_MaxDistToEvaluate + 1);
+            scores[i] = TrajectoryTestScore();
+            TestBinaryOverlap(distanceMap, binVols[i], binTestCfgs[i], scores[i], nativeToRef);
+        }
+    }
+
+    int SEEGPathPlanner::ScreenBinaryTest(SEEGBrickOccupancy::Pointer brickOccupancy, const BinaryTestCfg& cfg,
+                                          const Point3D& entryPoint, const Point3D& targetPoint) {
+        if (!brickOccupancy) {
+            return 0;
+        }
+        if (brickOccupancy->IsSegmentFartherThan(entryPoint, targetPoint, cfg.m_MaxDistToEvaluate)) {
+            return 1;
+        }
+        // TestBinaryOverlap() rejects any structure voxel closer than m_k1 under a hard constraint
+        if (cfg.m_HardConstraint &&
+            brickOccupancy->HasValueCloserThan(entryPoint, targetPoint, min((float) cfg.m_k1, (float) cfg.m_MaxDistToEvaluate), 1)) {
+            return -1;
+        }
+        return 0;
+    }
+
+    bool SEEGPathPlanner::TestBinaryOverlapSparse(SEEGTrajectoryROIPipeline::Pointer pipeline,
+                                                  IntVolume::Pointer binaryVol,
+                                                  const BinaryTestCfg& cfgs,
+                                                  const TrajectoryTestScore& noOverlapScore,
+                                                  TrajectoryTestScore& score,
+                                                  GeneralTransform::Pointer nativeToRef) {
+        score = noOverlapScore;
+
+        // same visit order as TestBinaryOverlap() (x fastest), so that ties of the max score give the same voxel
+        const vector<SparseDistanceRun>& runs = pipeline->GetLastSparseRuns();
+        const vector<float>& dists = pipeline->GetLastSparseDistances();
+        const IntVolume::PixelType* buffer = binaryVol->GetBufferPointer();
+        bool reject = false;
+        float scoreMax = 0;
+        float scoreSum = 0;
+        float distAtMaxScore = -1;
+        FloatVolume::OffsetValueType offsetAtMaxScore = 0;
+        for (int r=0; r<runs.size(); r++) {
+            const IntVolume::PixelType* values = buffer + runs[r].m_Offset;
+            const float* runDists = &dists[runs[r].m_FirstDistance];
+            for (unsigned int k=0; k<runs[r].m_Length; k++) {
+                float dist = runDists[k];
+                if (dist > cfgs.m_MaxDistToEvaluate || values[k] == 0) {
+                    continue;
+                }
+                if (cfgs.m_HardConstraint && dist < cfgs.m_k1) {
+                    reject = true;
+                }
+                float voxelScore = CalcDistFromTrajFactor(dist, cfgs.m_k1, cfgs.m_k2);
+                scoreSum += voxelScore;
+                if (voxelScore > scoreMax) {
+                    scoreMax = voxelScore;
+                    distAtMaxScore = dist;
+                    offsetAtMaxScore = runs[r].m_Offset + k;
+                }
+            }
+        }
+
+        if (distAtMaxScore >= 0) {
+            FloatVolume::Pointer templateVol = pipeline->GetTemplateVol();
+            Point3D pointAtMaxScore;
+            templateVol->TransformIndexToPhysicalPoint(templateVol->ComputeIndex(offsetAtMaxScore), pointAtMaxScore);
+            score.scoreMax = scoreMax;
+            score.scoreSum = scoreSum;
+            score.distAtMaxScore = distAtMaxScore;
+            if (nativeToRef) {
+                nativeToRef->TransformPoint(pointAtMaxScore, score.pointAtMaxScore);
+            } else {
+                score.pointAtMaxScore = pointAtMaxScore;
+            }
+        }
+        return reject;
+    }
 
     void SEEGPathPlanner::TestMaximizationOverlap (
                                             FloatVolume::Pointer recDistanceMap,
+                                            double recordingSum,
                                              vector<Point3D> allContactPoints,
                                             const MaximizationTestCfg& cfgs,
                                             TrajectoryTestScore& score,
                                             GeneralTransform::Pointer nativeToRef) {
         float scoreSum = 0;
         float nContacts=0;
-        float distAtMaxScore = -1;
         Point3D pointAtMaxScore = allContactPoints[0]; // keep this first point in the scoring to know to which depth of trajectory it corresponds
 
         if (!recDistanceMap.IsNull()) {
 
-            StatisticsImageFilterType::Pointer statisticsImageFilter = StatisticsImageFilterType::New ();
-            statisticsImageFilter->SetInput(recDistanceMap);
-            statisticsImageFilter->Update();
-            scoreSum = statisticsImageFilter->GetSum();
+            // the sum is accumulated by the contacts pipeline while computing the recording map
+            // (the map only covers the electrode's region - outside of it the recording is 0)
+            FloatVolume::RegionType recRegion = recDistanceMap->GetBufferedRegion();
+            scoreSum = recordingSum;
             //        scoreMax = statisticsImageFilter->GetMaximum();
             //  cout << "Max: " << scoreMax << " - Sum: " <<scoreSum << std::endl;
             //   WriteFloatVolume("/home/rina/test/recMap2.mnc", recDistanceMap);
@@ -1612,22 +4014,25 @@ namespace seeg {
                 Point3D contactPoint = allContactPoints.back();
                 FloatVolume::IndexType contactPointIndex;
                 recDistanceMap->TransformPhysicalPointToIndex(contactPoint, contactPointIndex);
-                if (recDistanceMap->GetPixel(contactPointIndex)>0) {
+                if (recRegion.IsInside(contactPointIndex) && recDistanceMap->GetPixel(contactPointIndex)>0) {
                     nContacts++;
                 }
                 allContactPoints.pop_back();
             }
         }
+        SetMaximizationScore(nContacts, scoreSum, pointAtMaxScore, score, nativeToRef);
+    }
+
+    void SEEGPathPlanner::SetMaximizationScore(float nContacts, float scoreSum, const Point3D& firstContactPoint,
+                                               TrajectoryTestScore& score, GeneralTransform::Pointer nativeToRef) {
         score.scoreMax = nContacts; // use scoreMax to record number of contacts inside volume
         score.scoreSum = scoreSum;  // scoreSum contains the volume recorded
-        score.distAtMaxScore = distAtMaxScore;
+        score.distAtMaxScore = -1;
         if (nativeToRef) {
-            nativeToRef->TransformPoint(pointAtMaxScore, score.pointAtMaxScore);
+            nativeToRef->TransformPoint(firstContactPoint, score.pointAtMaxScore);
         } else {
-            score.pointAtMaxScore = pointAtMaxScore;
+            score.pointAtMaxScore = firstContactPoint;
         }
-
-
     }
 
     bool SEEGPathPlanner::TestVectorOverlap (
@@ -1680,25 +4085,15 @@ namespace seeg {
             IntVolume::IndexType indClosestPtInSkull;
             indClosestPtInSkull[0]=0;indClosestPtInSkull[1]=0;indClosestPtInSkull[2]=0;
             Point3D finalPtInSkull;
-            FloatVolumeRegionIteratorWithIndex it (vectorVol[0], vectorVol[0]->GetRequestedRegion());
-            for (it.GoToBegin(); !it.IsAtEnd(); ++it) {
-                IntVolume::IndexType voxelIndex = it.GetIndex();
-                if (it.Get()) {
-                    Point3D ptInSkull;
-                    vectorVol[0]->TransformIndexToPhysicalPoint(voxelIndex, ptInSkull);
-                    Vector3D_lf v;
-                    v.x = entryPoint[0] - ptInSkull[0];
-                    v.y = entryPoint[1] - ptInSkull[1];
-                    v.z = entryPoint[2] - ptInSkull[2];
-                    float angleSkullPt = CalcAngleBetweenTrajectories(electrodeVector, v);
-                    angleSkullPt = min(abs(angleSkullPt), abs(180-angleSkullPt));
-                    if (angleSkullPt<minAngle){
-                        minAngle=angleSkullPt;
-                        indClosestPtInSkull = voxelIndex;
-                        finalPtInSkull = ptInSkull;
-                        normalVec =v;
-                    }
-                }
+            // skull points are extracted once per normal volume instead of scanning it for every trajectory
+            if (!m_SkullPointIndex || m_SkullPointIndex->GetVolume() != vectorVol[0].GetPointer() ||
+                m_SkullPointIndex->GetVolumeMTime() != vectorVol[0]->GetMTime()) {
+                m_SkullPointIndex = SEEGSkullPointIndex::New(vectorVol[0]);
+            }
+            if (m_SkullPointIndex->FindClosestAngle(entryPoint, electrodeVector, indClosestPtInSkull, finalPtInSkull, minAngle)) {
+                normalVec.x = entryPoint[0] - finalPtInSkull[0];
+                normalVec.y = entryPoint[1] - finalPtInSkull[1];
+                normalVec.z = entryPoint[2] - finalPtInSkull[2];
             }
             sumNorms = norm(normalVec);
             voxelIndexNorm=indClosestPtInSkull;
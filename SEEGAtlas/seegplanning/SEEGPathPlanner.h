@@ -13,6 +13,7 @@
 // Header files to include
 #include <vector>
 #include <string>
+#include <fstream>
 #include "ElectrodeInfo.h"
 #include "GeneralTransform.h"
 #include "VolumeTypes.h"
@@ -21,6 +22,19 @@
 //#include "itkMinimumMaximumImageCalculator.h"
 #include "PathPlanner.h"
 #include "BasicTypes.h"
+#include "SEEGTrajectoryROIPipeline.h"
+#include "SEEGStructureDistanceMap.h"
+#include "SEEGBrickOccupancy.h"
+#include "SEEGTargetRaySweep.h"
+#include "SEEGSkullPointIndex.h"
+#include "SEEGTrajectoryCandidates.h"
+#include "SEEGTrajectoryTestRegistry.h"
+#include "SEEGTrajectoryIndex.h"
+#include "SEEGCandidateGenerator.h"
+#include "SEEGTrajectoryFileReader.h"
+#include "SEEGPlanningResultsFile.h"
+#include "SEEGScoreCache.h"
+#include "SEEGVolumePyramid.h"
 
 using namespace std;
 
@@ -98,6 +112,43 @@ namespace seeg {
     };
 
 
+    /**
+     * Candidates counted at one coarse level of the coarse-to-fine mode (see SEEGPathPlanner::SetCoarseToFineLevels())
+     */
+    struct CoarseToFineLevelReport {
+
+        /** Level of the volume pyramids (volumes downsampled by 2^level) */
+        unsigned int m_Level;
+
+        /** Candidates evaluated at this level */
+        unsigned int m_NumberOfCandidates;
+
+        /**
+         * Candidates rejected by a test on the downsampled volumes (kept for the next level, DoSEEGMultiTest()),
+         * or without any depth in the downsampled targets (DoMaximizationTest())
+         */
+        unsigned int m_NumberOfRejected;
+
+        /** Candidates kept for their coarse score */
+        unsigned int m_NumberOfKeptBest;
+
+        /** Candidates kept only because a risk score is close to the hard limit of its test */
+        unsigned int m_NumberOfKeptNearHardLimit;
+
+        /** Candidates that are not evaluated at finer levels */
+        unsigned int m_NumberOfPruned;
+
+        CoarseToFineLevelReport() {
+            m_Level = 0;
+            m_NumberOfCandidates = 0;
+            m_NumberOfRejected = 0;
+            m_NumberOfKeptBest = 0;
+            m_NumberOfKeptNearHardLimit = 0;
+            m_NumberOfPruned = 0;
+        }
+    };
+
+
      /**
      * The SEEGPathPlanner class performs the automatic trajectory planning algorithm
      * derives from (Simon's) PathPlanner
@@ -119,6 +170,30 @@ namespace seeg {
          * DoBinaryTest() */
         list<ElectrodeInfo::Pointer> m_ActiveTrajectories;
 
+        /** Candidate trajectories created by InitializeTrajectoriesFromVols/File(). They are only
+         * moved to m_AllTrajectories / m_ActiveTrajectories when materialized (see MaterializeCandidate()) */
+        SEEGTrajectoryCandidates::Pointer m_Candidates;
+
+        /** IDs of the trajectory tests (shared by the test columns of all candidate tables) */
+        SEEGTrajectoryTestRegistry::Pointer m_TestRegistry;
+
+        /** k-d tree of the electrode vectors of m_Candidates (ID = candidate index), built by InitializeTrajectoriesFromVols/File() */
+        SEEGTrajectoryIndex::Pointer m_CandidatesIndex;
+
+        /** k-d trees of the electrode vectors of m_AllTrajectories and m_ActiveTrajectories. The
+         * electrode of each ID is in m_AllTrajectoriesIndexed / m_ActiveTrajectoriesIndexed */
+        SEEGTrajectoryIndex::Pointer m_AllTrajectoriesIndex;
+        SEEGTrajectoryIndex::Pointer m_ActiveTrajectoriesIndex;
+        vector<ElectrodeInfo::Pointer> m_AllTrajectoriesIndexed;
+        vector<ElectrodeInfo::Pointer> m_ActiveTrajectoriesIndexed;
+
+        /** Set when trajectories are removed from (or reordered in) the lists: the trajectory indices must be rebuilt */
+        bool m_TrajectoryIndicesModified;
+
+        /** Electrode type of the candidates (only known when read from file) */
+        SEEGElectrodeModel::SEEG_ELECTRODE_MODEL_TYPE m_CandidatesElectrodeType;
+        bool m_HasCandidatesElectrodeType;
+
         /** A map of the RISK weights for all trajectory tests. Those weights are used by the
          * AggregateRisk(). The key for the map are string representing each trajectory tests.
          */
@@ -136,6 +211,55 @@ namespace seeg {
 
         float m_WeightReward;
 
+        /**
+          * Number of threads used to evaluate trajectories in DoSEEGMultiTest()
+          * (0 means use ITK's global default number of threads)
+          */
+        unsigned int m_NumberOfThreads;
+
+        /**
+          * Distance maps of the critical structures used by the binary tests (key: test name)
+          * see PrecomputeRiskDistanceMaps()
+          */
+        map<string, SEEGStructureDistanceMap::Pointer> m_RiskDistanceMaps;
+
+        /** Wether to use m_RiskDistanceMaps to skip the dense binary tests */
+        bool m_UseRiskDistanceMaps;
+
+        /**
+          * Min/max bricks of the critical structures used by the binary tests (key: test name)
+          * see PrecomputeRiskBrickOccupancies()
+          */
+        map<string, SEEGBrickOccupancy::Pointer> m_RiskBrickOccupancies;
+
+        /** Wether to use m_RiskBrickOccupancies to skip or reject before the dense binary tests */
+        bool m_UseRiskBrickOccupancies;
+
+        /** On-disk cache of the test scores (null: disabled), see SetScoreCacheDirectory() */
+        SEEGScoreCache::Pointer m_ScoreCache;
+
+        /** Wether to reorder the binary tests of DoSEEGMultiTest() to reject candidates sooner, see SetAdaptiveBinaryTestOrder() */
+        bool m_AdaptiveBinaryTestOrder;
+
+        /** Number of coarse levels evaluated before full resolution (0: disabled), see SetCoarseToFineLevels() */
+        unsigned int m_CoarseToFineLevels;
+
+        /** Fraction of the candidates kept for their score at each coarse level */
+        float m_CoarseToFineKeepFraction;
+
+        /** Relative margin around the hard limits of the risk tests within which candidates are always kept */
+        float m_CoarseToFineHardLimitMargin;
+
+        /** Max-pooled pyramids of the test volumes used by the coarse levels */
+        SEEGVolumePyramid::Pointer m_VolumePyramid;
+
+        /** Skull points of the normal volume of DoVectorTest(), for entry points without a normal (built on first use) */
+        SEEGSkullPointIndex::Pointer m_SkullPointIndex;
+
+        /** Candidates counted at each coarse level (index: level - 1) since ClearCoarseToFineReport() */
+        vector<CoarseToFineLevelReport> m_MultiTestCoarseToFineReport;
+        vector<CoarseToFineLevelReport> m_MaximizationTestCoarseToFineReport;
+
     public:
         // smart pointer
         typedef mrilSmartPtr<SEEGPathPlanner> Pointer;
@@ -176,8 +300,34 @@ namespace seeg {
             return m_AllTrajectories;
         }
 
+        /**
+         * Accessor for the table of candidate trajectories (those not materialized yet)
+         */
+        SEEGTrajectoryCandidates::Pointer GetCandidates();
+
+        /**
+         * Creates the ElectrodeInfo of a candidate (with its test scores) and moves it to the list of
+         * all trajectories (and to the list of active trajectories if the candidate was active)
+         *
+         * @param index index of the candidate in GetCandidates()
+         * @return the new ElectrodeInfo
+         */
+        ElectrodeInfo::Pointer MaterializeCandidate(unsigned int index);
+
+        /** Materializes all the active candidates (see MaterializeCandidate()) */
+        void MaterializeActiveCandidates();
+
+        /**
+         * Creates a copy of a candidate as ElectrodeInfo (with its test scores); the candidate stays in the table
+         *
+         * @param index index of the candidate in GetCandidates()
+         * @return the new ElectrodeInfo (not in the lists of trajectories)
+         */
+        ElectrodeInfo::Pointer CreateCandidateElectrode(unsigned int index);
+
         /**
          * Accessor for a particular active trajectories -> indicated by index
+         * (only the materialized ones)
          *
          * @return active trajectory that corresponds to index
          */
@@ -206,6 +356,18 @@ namespace seeg {
 
         void SetTrajectoryRewardTestWeights(const string& testName, float weightUsingMax, float weightUsingSum);
 
+        /**
+         * Registers a trajectory test (tests are also registered when their weights are set)
+         *
+         * @return the ID of the test
+         */
+        int RegisterTrajectoryTest(const string& testName);
+
+        /** @return the ID of the test, -1 if it was not registered */
+        int GetTrajectoryTestId(const string& testName);
+
+        SEEGTrajectoryTestRegistry::Pointer GetTestRegistry();
+
          map<string, TrajectoryRiskTestWeights>& GetTrajectoryRiskTestWeights();
 
          map<string, TrajectoryTestWeights>& GetTrajectoryRewardTestWeights();
@@ -223,6 +385,120 @@ namespace seeg {
 
         int GetNumberOfActiveTrajectories();
 
+        /**
+         * Set the number of threads used by DoSEEGMultiTest(). Trajectories are split in
+         * contiguous chunks, each chunk is evaluated by its own trajectory pipeline.
+         *
+         * @param numThreads number of threads (0 = ITK's global default, 1 = no threading)
+         */
+        void SetNumberOfThreads(unsigned int numThreads);
+
+        unsigned int GetNumberOfThreads();
+
+        /**
+         * Compute once (per patient) the signed distance map of each binary test volume.
+         * DoSEEGMultiTest() then samples the distance map along each trajectory and only runs
+         * the dense TestBinaryOverlap() when a structure voxel can be within m_MaxDistToEvaluate.
+         * Trajectories that are skipped get the same score as a dense test without any overlap.
+         *
+         * @param binTestNames names of the binary tests
+         * @param binVols binary volumes of the critical structures (same order as binTestNames)
+         */
+        void PrecomputeRiskDistanceMaps(vector<string>& binTestNames, vector<IntVolume::Pointer>& binVols);
+
+        void ClearRiskDistanceMaps();
+
+        void SetUseRiskDistanceMaps(bool useDistanceMaps);
+
+        bool GetUseRiskDistanceMaps();
+
+        /**
+         * Compute once (per patient) the min/max brick occupancy (SEEGBrickOccupancy) of each binary
+         * test volume. Before the dense TestBinaryOverlap(), DoSEEGMultiTest() then:
+         * - skips the test (score of CalcNoOverlapScores()) if no brick within m_MaxDistToEvaluate contains a structure voxel
+         * - rejects the trajectory if the test is a hard constraint and a brick full of structure
+         *   voxels is surely within m_k1 of the trajectory
+         * Cheaper to compute and to store than the distance maps, and mostly useful for sparse
+         * structures such as vessels.
+         *
+         * @param binTestNames names of the binary tests
+         * @param binVols binary volumes of the critical structures (same order as binTestNames)
+         */
+        void PrecomputeRiskBrickOccupancies(vector<string>& binTestNames, vector<IntVolume::Pointer>& binVols);
+
+        void ClearRiskBrickOccupancies();
+
+        void SetUseRiskBrickOccupancies(bool useBrickOccupancies);
+
+        bool GetUseRiskBrickOccupancies();
+
+        /**
+         * Enables the on-disk score cache: the binary and fuzzy tests of DoSEEGMultiTest(), DoVectorTest()
+         * and DoMaximizationTest() are not evaluated again if their volumes (content), configuration and
+         * trajectories did not change since their scores were cached (possibly in another session).
+         * Only used without nativeToRef transform.
+         *
+         * @param directory directory of the cache files (empty: no cache)
+         */
+        void SetScoreCacheDirectory(const string& directory);
+
+        /** The score cache (null if disabled) */
+        SEEGScoreCache::Pointer GetScoreCache();
+
+        /**
+         * If enabled (default), DoSEEGMultiTest() measures the rejection rate and the cost of each binary
+         * test on a sample of the candidates and evaluates the tests in the order that rejects candidates
+         * the soonest (the scores of the candidates that are not rejected do not depend on the order).
+         */
+        void SetAdaptiveBinaryTestOrder(bool adaptiveOrder);
+
+        bool GetAdaptiveBinaryTestOrder();
+
+        /**
+         * Coarse-to-fine mode of DoSEEGMultiTest() and DoMaximizationTest(): the candidates are first evaluated on
+         * max-pooled versions of the volumes (downsampled by 2^levels, then 2^(levels-1)...). Risk structures can
+         * only grow when pooled, so coarse risks are not lower than at full resolution. At each level only the
+         * best fraction of the candidates (see SetCoarseToFineKeepFraction()) and the candidates with a risk
+         * score close to the hard limit of its test (see SetCoarseToFineHardLimitMargin()) are evaluated at the
+         * next level. Only the candidates evaluated at full resolution can be valid: the pruned candidates
+         * of DoSEEGMultiTest() are rejected, the ones of DoMaximizationTest() get no score.
+         *
+         * Candidates are only pruned by their coarse ranking: the pooled structures can reject trajectories that
+         * are safe at full resolution, so candidates rejected on the downsampled volumes are kept for the next
+         * level (DoSEEGMultiTest()) and the binary tests of DoMaximizationTest() are only done at full resolution.
+         * The ranking is still approximate: a candidate pruned for its coarse score may have been among the best
+         * ones at full resolution.
+         *
+         * @param levels number of coarse levels (0, the default, disables the mode)
+         */
+        void SetCoarseToFineLevels(unsigned int levels);
+
+        unsigned int GetCoarseToFineLevels();
+
+        /** Fraction (0-1] of the candidates kept for their score at each coarse level (default 0.25) */
+        void SetCoarseToFineKeepFraction(float keepFraction);
+
+        float GetCoarseToFineKeepFraction();
+
+        /**
+         * Candidates with a coarse risk score within margin * hardLimit of the hard limit of a risk test
+         * (see SetTrajectoryRiskTestWeights()) are always kept (default 0.25)
+         */
+        void SetCoarseToFineHardLimitMargin(float margin);
+
+        float GetCoarseToFineHardLimitMargin();
+
+        /** Candidates counted at each coarse level (index: level - 1) by DoSEEGMultiTest() */
+        const vector<CoarseToFineLevelReport>& GetMultiTestCoarseToFineReport();
+
+        /** Candidates counted at each coarse level (index: level - 1) by DoMaximizationTest() */
+        const vector<CoarseToFineLevelReport>& GetMaximizationTestCoarseToFineReport();
+
+        void ClearCoarseToFineReport();
+
+        /** Releases the downsampled volumes of the coarse-to-fine mode */
+        void ClearVolumePyramids();
+
         /**
          * Setter for the entry point
          *
@@ -264,7 +540,7 @@ namespace seeg {
          * @param angleBetweenTraj A reference to a double where to store the angle between the supplied Point3D
          *                         and the retrieved trajectory
          * @param nativeToRef native to ref transform -- RIZ: it can probably be removed!
-         * @return Info about the retrieved trajectory
+         * @return Info about the retrieved trajectory (a copy if it is a candidate of the table)
          */
         ElectrodeInfo::Pointer FindElectrodeInfo( Point3D targetPoint,
                                                   Point3D entryPoint,
@@ -279,7 +555,7 @@ namespace seeg {
          * @param angleBetweenTraj A reference to a double where to store the angle between the supplied Point3D
          *                         and the retrieved trajectory
          * @param nativeToRef native to ref transform
-         * @return Info about the retrieved trajectory -- RIZ: it can probably be removed!
+         * @return Info about the retrieved trajectory (a copy if it is a candidate of the table) -- RIZ: it can probably be removed!
          */
         ElectrodeInfo::Pointer FindActiveElectrodeInfo( Point3D targetPoint,
                                                         Point3D entryPoint,
@@ -300,9 +576,33 @@ namespace seeg {
          */
         void InitializeTrajectoriesFromVols(IntVolume::Pointer entryPointMaskVol, IntVolume::Pointer targetMaskVol);
 
+        /**
+         * Initializes the candidates with all the trajectories of a generator (pairs rejected by
+         * the constraints of the generator are never created)
+         */
+        void InitializeTrajectoriesFromGenerator(SEEGCandidateGenerator::Pointer generator);
+
+        /**
+         * Initializes the candidates with the trajectories of a generator that pass the binary and
+         * fuzzy tests of DoSEEGMultiTest(). Candidates are generated and evaluated batchSize at a
+         * time; only the valid ones (with their scores) are kept.
+         */
+        void InitializeValidTrajectoriesFromGenerator(  SEEGCandidateGenerator::Pointer generator,
+                                                        unsigned int batchSize,
+                                                        vector<string>& binTestNames,
+                                                        vector<IntVolume::Pointer>& binVols,
+                                                        vector<BinaryTestCfg>& binTestCfgs,
+                                                        vector<string>& fuzzyTestNames,
+                                                        vector<FloatVolume::Pointer>& fuzzyVols,
+                                                        vector<FuzzyTestCfg>& fuzzyTestCfgs,
+                                                        map<string, float>& extraLengthCfgs,
+                                                        GeneralTransform::Pointer nativeToRef = GeneralTransform::Pointer());
+
         /**
          * This function initializes the m_AllTrajectories and m_ActiveTrajectories using the
          * .dat file with all the trajectories (.dat file contains all targetXYZ entryPointsXYZ).
+         * Files with the .bin extension are read as binary records of 6 little-endian floats in the
+         * same order (see SEEGTrajectoryFileReader).
          *
          * @param filename .dat file with trajectories (created in matlab: function getTrajectoryFromTargetEntryPoint)
          */
@@ -336,6 +636,37 @@ namespace seeg {
                             list<ElectrodeInfo::Pointer>::iterator first,
                             list<ElectrodeInfo::Pointer>::iterator last,
                             GeneralTransform::Pointer nativeToRef = GeneralTransform::Pointer());
+
+        /**
+         * Target-centric version of the binary tests of DoSEEGMultiTest() on the active candidates:
+         * candidates are grouped by target point and all the entry points of a target are scored in
+         * one sweep of rays cast from the target through the distance map of the structure
+         * (SEEGTargetRaySweep, distance maps are computed as with PrecomputeRiskDistanceMaps()).
+         *
+         * Fills the same scores and rejections as TestBinaryOverlap(), with the voxels crossed by the
+         * trajectory instead of its cylinder:
+         * - scoreMax, distAtMaxScore and pointAtMaxScore come from the closest structure voxel (up to
+         *   half a voxel diagonal)
+         * - scoreSum adds the risk of the crossed voxels (ray sum), which is lower than the sum over the
+         *   cylinder: it is stored in the same column as the cylinder sum, so the candidates of a test
+         *   must all be scored by this function or all by DoSEEGMultiTest() to be ranked together
+         * - under a hard constraint, trajectories closer than m_k1 to the structure are rejected
+         *
+         * The rejections of these tests are cleared first (the sweep can be run again with other
+         * configurations); the candidates rejected by other tests are not evaluated.
+         *
+         * @param binTestNames the names of the tests
+         * @param binVols the binary volumes of the critical structures
+         * @param binTestCfgs the configurations of the tests
+         * @param extraLengthCfgs extrapolation beyond the entry point of each test
+         * @param nativeToRef native to ref transform
+         */
+        void DoSEEGRaySweepTest(vector<string>& binTestNames,
+                                vector<IntVolume::Pointer>& binVols,
+                                vector<BinaryTestCfg>& binTestCfgs,
+                                map<string, float>& extraLengthCfgs,
+                                GeneralTransform::Pointer nativeToRef = GeneralTransform::Pointer());
+
         /**
          * Apply the binary test
          *
@@ -403,6 +734,18 @@ namespace seeg {
                                   list<ElectrodeInfo::Pointer>::iterator last,
                                   GeneralTransform::Pointer nativeToRef = GeneralTransform::Pointer());
 
+        /**
+         * Multi-volume maximization test on all the active trajectories: the active candidates (their scores
+         * and the scores of each depth stay in the table) and the trajectories that already are ElectrodeInfo
+         */
+        void DoMaximizationTest(  vector<string> &testNames,
+                                  const vector<FloatVolume::Pointer> &targetDistMaps,
+                                  const MaximizationTestCfg& cfgs,
+                                  vector<string>& binTestNames,
+                                  vector<IntVolume::Pointer>& binVols,
+                                  vector<BinaryTestCfg>& binTestCfgs,
+                                  GeneralTransform::Pointer nativeToRef= GeneralTransform::Pointer());
+
         void DoMaximizationTest(  vector<string> &testNames,
                                   const vector<FloatVolume::Pointer> &targetDistMaps,
                                   const MaximizationTestCfg& cfgs,
@@ -444,32 +787,51 @@ namespace seeg {
 
         void AggregateRewards(int numBins);
 
-        void AggregateRewardsAllDepths(int numBins);
+        /**
+         * Aggregates the rewards at the best depth of each trajectory (moves its target point there) and sorts
+         * the active trajectories by aggregated reward
+         *
+         * @param numBestTrajectories if >= 0, only the best numBestTrajectories are sorted (see AggregateAll())
+         */
+        void AggregateRewardsAllDepths(int numBins, int numBestTrajectories = -1);
 
-        void AggregateAll(int numBins);
+        /**
+         * Combines risk and reward scores and sorts the active trajectories and candidates by aggregated score.
+         * The best candidates are materialized: the list of active trajectories starts with the best ones
+         *
+         * @param numBestTrajectories if >= 0, only the best numBestTrajectories are sorted (they are
+         *        the first ones of the list, in the same order as a full sort) and the others follow
+         *        in their current order; the other candidates stay in the table
+         */
+        void AggregateAll(int numBins, int numBestTrajectories = -1);
 
       //  void AggregateGlobal(int numBins,   otherActivePlans);
 
         /**
-         * Save all planning data to a text file.
+         * Save all planning data to a binary planning results file (see SEEGPlanningResultsFile.h)
+         * or to a text file.
          * (I cannot believe I am doing that rather than using xml or something...)
          *
-         * @param filename the name of the text file where to save planning data
+         * @param filename the name of the file where to save planning data
+         * @param textFormat save as text (one [trajectory] line per trajectory) instead of binary
          */
-        void SaveSEEGPlanningDataToFile (const string& filename);
+        void SaveSEEGPlanningDataToFile (const string& filename, bool textFormat = false);
 
         /**
-         * Save only active planning data to a text file.
+         * Save only active planning data to a binary planning results file or to a text file.
          * (I cannot believe I am doing that rather than using xml or something...)
          *
-         * @param filename the name of the text file where to save planning data
+         * @param filename the name of the file where to save planning data
+         * @param textFormat save as text instead of binary
          */
-        void SaveActiveSEEGPlanningDataToFile (const string& filename);
+        void SaveActiveSEEGPlanningDataToFile (const string& filename, bool textFormat = false);
 
         /**
-         * Load planning data from a text file
+         * Load planning data from a binary planning results file or from a text file (the format
+         * is detected from the content of the file). Trajectories of binary files are loaded as
+         * candidates and only the best active one is materialized.
          *
-         * @param filename the name of the text file where to load the planning data.
+         * @param filename the name of the file where to load the planning data.
          */
         bool LoadSEEGPlanningDataFromFile(const string& filename);
 
@@ -496,15 +858,390 @@ namespace seeg {
 
     private:
 
+        /**
+         * Evaluates the binary and fuzzy tests of DoSEEGMultiTest() on the candidates[indices]
+         * (coarse-to-fine if enabled, see SetCoarseToFineLevels()). Scores and rejections are written to the table.
+         */
+        void EvaluateCandidates(    SEEGTrajectoryCandidates::Pointer candidates,
+                                    const vector<unsigned int>& indices,
+                                    vector<string>& binTestNames,
+                                    vector<IntVolume::Pointer>& binVols,
+                                    vector<BinaryTestCfg>& binTestCfgs,
+                                    vector<string>& fuzzyTestNames,
+                                    vector<FloatVolume::Pointer>& fuzzyVols,
+                                    vector<FuzzyTestCfg>& fuzzyTestCfgs,
+                                    map<string, float>& extraLengthCfgs,
+                                    GeneralTransform::Pointer nativeToRef);
+
+        /**
+         * Evaluates the binary and fuzzy tests on the candidates[indices] with the given volumes
+         * (split in chunks evaluated by several threads)
+         */
+        void EvaluateCandidateTests(SEEGTrajectoryCandidates::Pointer candidates,
+                                    const vector<unsigned int>& indices,
+                                    vector<string>& binTestNames,
+                                    vector<IntVolume::Pointer>& binVols,
+                                    vector<BinaryTestCfg>& binTestCfgs,
+                                    vector<string>& fuzzyTestNames,
+                                    vector<FloatVolume::Pointer>& fuzzyVols,
+                                    vector<FuzzyTestCfg>& fuzzyTestCfgs,
+                                    map<string, float>& extraLengthCfgs,
+                                    GeneralTransform::Pointer nativeToRef);
+
+        /**
+         * Coarse levels of EvaluateCandidates(): evaluates the candidates[indices] on the pyramids of the volumes
+         * (in a temporary table) and rejects the ones that are pruned. Candidates rejected by a test on the pyramids
+         * are kept for the next level.
+         *
+         * @param fineIndices where to store the candidates to evaluate at full resolution
+         */
+        void SelectCandidatesCoarseToFine(  SEEGTrajectoryCandidates::Pointer candidates,
+                                            const vector<unsigned int>& indices,
+                                            vector<string>& binTestNames,
+                                            vector<IntVolume::Pointer>& binVols,
+                                            vector<BinaryTestCfg>& binTestCfgs,
+                                            vector<string>& fuzzyTestNames,
+                                            vector<FloatVolume::Pointer>& fuzzyVols,
+                                            vector<FuzzyTestCfg>& fuzzyTestCfgs,
+                                            map<string, float>& extraLengthCfgs,
+                                            GeneralTransform::Pointer nativeToRef,
+                                            vector<unsigned int>& fineIndices);
+
+        /**
+         * Multi-volume DoMaximizationTest() on the candidates[indices] (coarse-to-fine if enabled, see
+         * SetCoarseToFineLevels()). Scores and the scores of each depth are written to the table.
+         */
+        void EvaluateMaximizationCandidates(vector<string> &testNames,
+                                            const vector<FloatVolume::Pointer> &targetDistMaps,
+                                            const MaximizationTestCfg& cfgs,
+                                            vector<string>& binTestNames,
+                                            vector<IntVolume::Pointer>& binVols,
+                                            vector<BinaryTestCfg>& binTestCfgs,
+                                            SEEGTrajectoryCandidates::Pointer candidates,
+                                            const vector<unsigned int>& indices,
+                                            SEEGElectrodeModel::SEEG_ELECTRODE_MODEL_TYPE electrodeType,
+                                            GeneralTransform::Pointer nativeToRef);
 
+        /**
+         * DoVectorTest() on the candidates[indices]: scores and rejections are stored in the given column
+         */
+        void EvaluateVectorTest(int column,
+                                vector<FloatVolume::Pointer> &vectorVol,
+                                const BinaryTestCfg& cfgs,
+                                SEEGTrajectoryCandidates::Pointer candidates,
+                                const vector<unsigned int>& indices,
+                                GeneralTransform::Pointer nativeToRef);
+
+        /**
+         * Multi-volume DoMaximizationTest() on the candidates[indices] with the given volumes
+         */
+        void EvaluateMaximizationTest(  vector<string> &testNames,
+                                        const vector<FloatVolume::Pointer> &targetDistMaps,
+                                        const MaximizationTestCfg& cfgs,
+                                        vector<string>& binTestNames,
+                                        vector<IntVolume::Pointer>& binVols,
+                                        vector<BinaryTestCfg>& binTestCfgs,
+                                        SEEGTrajectoryCandidates::Pointer candidates,
+                                        const vector<unsigned int>& indices,
+                                        SEEGElectrodeModel::SEEG_ELECTRODE_MODEL_TYPE electrodeType,
+                                        GeneralTransform::Pointer nativeToRef);
+
+        /**
+         * Coarse levels of DoMaximizationTest(): evaluates the candidates[indices] on the pyramids of the target
+         * volumes (in a temporary table, the binary tests are only done at full resolution); the scores of the
+         * pruned candidates are cleared
+         *
+         * @param fineIndices where to store the candidates to evaluate at full resolution
+         */
+        void SelectElectrodesCoarseToFine(  vector<string> &testNames,
+                                            const vector<FloatVolume::Pointer> &targetDistMaps,
+                                            const MaximizationTestCfg& cfgs,
+                                            SEEGTrajectoryCandidates::Pointer candidates,
+                                            const vector<unsigned int>& indices,
+                                            SEEGElectrodeModel::SEEG_ELECTRODE_MODEL_TYPE electrodeType,
+                                            GeneralTransform::Pointer nativeToRef,
+                                            vector<unsigned int>& fineIndices);
+
+        /**
+         * Evaluates the binary and fuzzy tests of DoSEEGMultiTest() on candidates[indices[firstIndex, lastIndex)].
+         * Uses its own SEEGTrajectoryROIPipeline (built on a graft of templateVol) so several
+         * chunks can be evaluated at the same time (singleThreadedPipeline avoids nested threading).
+         */
+        void EvaluateSEEGMultiTest( SEEGTrajectoryCandidates::Pointer candidates,
+                                    const vector<unsigned int>& indices,
+                                    unsigned int firstIndex,
+                                    unsigned int lastIndex,
+                                    FloatVolume::Pointer templateVol,
+                                    const vector<IntVolume::Pointer>& binVols,
+                                    const vector<BinaryTestCfg>& binTestCfgs,
+                                    const vector<float>& binExtraLengths,
+                                    const vector<SEEGStructureDistanceMap::Pointer>& binDistanceMaps,
+                                    const vector<SEEGBrickOccupancy::Pointer>& binBrickOccupancies,
+                                    const vector<int>& binColumns,
+                                    const vector<FloatVolume::Pointer>& fuzzyVols,
+                                    const vector<FuzzyTestCfg>& fuzzyTestCfgs,
+                                    const vector<float>& fuzzyExtraLengths,
+                                    const vector<int>& fuzzyColumns,
+                                    unsigned int numCachedBinTests,
+                                    unsigned int numCachedFuzzyTests,
+                                    bool singleThreadedPipeline,
+                                    GeneralTransform::Pointer nativeToRef);
+
+        /**
+         * Ray sweeps of DoSEEGRaySweepTest() for the candidates indices[firstIndex, lastIndex), which
+         * share their target point
+         */
+        void SweepTargetCandidates( const vector<unsigned int>& indices,
+                                    unsigned int firstIndex,
+                                    unsigned int lastIndex,
+                                    const vector<SEEGTargetRaySweep::Pointer>& sweeps,
+                                    const vector<BinaryTestCfg>& binTestCfgs,
+                                    const vector<TrajectoryTestScore>& binNoOverlapScores,
+                                    const vector<float>& binExtraLengths,
+                                    const vector<int>& binColumns,
+                                    GeneralTransform::Pointer nativeToRef);
+
+        /** Volume on which the distance maps of EvaluateSEEGMultiTest() are computed (only its geometry is used) */
+        FloatVolume::Pointer CreateTemplateVolume(const vector<IntVolume::Pointer>& binVols,
+                                                  const vector<FloatVolume::Pointer>& fuzzyVols);
+
+        /**
+         * Order in which EvaluateCandidates() evaluates the binary tests. The rejection rate and the cost (distance
+         * map, overlap) of each test are measured on a sample of candidates; tests are then taken greedily by
+         * lowest cost per rejection, a test whose distance map is the one of the previous test (same
+         * m_MaxDistToEvaluate and extra length) costing only its overlap. The order is kept in the score cache.
+         *
+         * @param templateVol created if null and needed
+         * @param binOrder indices of the binary tests in evaluation order
+         */
+        void CalcBinaryTestOrder(   SEEGTrajectoryCandidates::Pointer candidates,
+                                    const vector<unsigned int>& indices,
+                                    FloatVolume::Pointer& templateVol,
+                                    const vector<IntVolume::Pointer>& binVols,
+                                    const vector<FloatVolume::Pointer>& fuzzyVols,
+                                    const vector<BinaryTestCfg>& binTestCfgs,
+                                    const vector<float>& binExtraLengths,
+                                    const vector<SEEGStructureDistanceMap::Pointer>& binDistanceMaps,
+                                    const vector<SEEGBrickOccupancy::Pointer>& binBrickOccupancies,
+                                    GeneralTransform::Pointer nativeToRef,
+                                    vector<unsigned int>& binOrder);
+
+        /**
+         * Score cache keys of the tests of EvaluateCandidates() (binary tests then fuzzy tests). The key of
+         * a test includes the key of the previous one, since it is only evaluated on the candidates that
+         * were not rejected before.
+         */
+        void CalcMultiTestCacheKeys(SEEGTrajectoryCandidates::Pointer candidates,
+                                    const vector<unsigned int>& indices,
+                                    const vector<IntVolume::Pointer>& binVols,
+                                    const vector<BinaryTestCfg>& binTestCfgs,
+                                    const vector<float>& binExtraLengths,
+                                    const vector<SEEGStructureDistanceMap::Pointer>& binDistanceMaps,
+                                    const vector<SEEGBrickOccupancy::Pointer>& binBrickOccupancies,
+                                    const vector<FloatVolume::Pointer>& fuzzyVols,
+                                    const vector<FuzzyTestCfg>& fuzzyTestCfgs,
+                                    const vector<float>& fuzzyExtraLengths,
+                                    vector<ScoreCacheKey>& testKeys);
+
+        /**
+         * Restores the scores (and rejections) of the tests found in the score cache, in order, up to the
+         * first test that is not cached
+         *
+         * @return the number of tests restored
+         */
+        unsigned int RestoreMultiTestScores(SEEGTrajectoryCandidates::Pointer candidates,
+                                            const vector<unsigned int>& indices,
+                                            const vector<ScoreCacheKey>& testKeys,
+                                            const vector<int>& binColumns,
+                                            const vector<int>& fuzzyColumns);
+
+        /** Stores the scores of the tests [firstTest, end) of EvaluateCandidates() in the score cache */
+        void StoreMultiTestScores(SEEGTrajectoryCandidates::Pointer candidates,
+                                  const vector<unsigned int>& indices,
+                                  const vector<ScoreCacheKey>& testKeys,
+                                  unsigned int firstTest,
+                                  const vector<int>& binColumns,
+                                  const vector<int>& fuzzyColumns);
+
+        /** Score cache key of the multi-volume DoMaximizationTest() on the candidates[indices] */
+        ScoreCacheKey CalcMaximizationTestCacheKey(const vector<FloatVolume::Pointer> &targetDistMaps,
+                                                   const MaximizationTestCfg& cfgs,
+                                                   vector<string>& binTestNames,
+                                                   vector<IntVolume::Pointer>& binVols,
+                                                   vector<BinaryTestCfg>& binTestCfgs,
+                                                   SEEGTrajectoryCandidates::Pointer candidates,
+                                                   const vector<unsigned int>& indices,
+                                                   SEEGElectrodeModel::SEEG_ELECTRODE_MODEL_TYPE electrodeType);
+
+        /** @return false (and candidates are not modified) if the entry of cacheKey is not in the score cache */
+        bool RestoreMaximizationTestScores(const ScoreCacheKey& cacheKey,
+                                           SEEGTrajectoryCandidates::Pointer candidates,
+                                           const vector<unsigned int>& indices,
+                                           const vector<int>& targetColumns);
+
+        void StoreMaximizationTestScores(const ScoreCacheKey& cacheKey,
+                                         SEEGTrajectoryCandidates::Pointer candidates,
+                                         const vector<unsigned int>& indices,
+                                         const vector<int>& targetColumns);
+
+        /** Adds the fields of a test configuration to a score cache key (field by field: padding bytes are not initialized) */
+        void AddBinaryTestCfgToKey(SEEGScoreCacheKeyBuilder& keyBuilder, const BinaryTestCfg& cfg);
+        void AddFuzzyTestCfgToKey(SEEGScoreCacheKeyBuilder& keyBuilder, const FuzzyTestCfg& cfg);
+
+        /** Appends / reads a TrajectoryTestScore to / from the data of a score cache entry */
+        void AppendCachedTestScore(vector<unsigned char>& data, const TrajectoryTestScore& score);
+        void ReadCachedTestScore(const unsigned char* data, unsigned long long& position, TrajectoryTestScore& score);
+
+        /** Score of a candidate for the test of the given column (default score if not evaluated) */
+        void GetCandidateTestScore(SEEGTrajectoryCandidates::Pointer candidates, unsigned int index, int column, TrajectoryTestScore& score);
+
+        void SetCandidateTestScore(SEEGTrajectoryCandidates::Pointer candidates, unsigned int index, int column, const TrajectoryTestScore& score);
+
+        /** Electrode type of the candidates (the default type of ElectrodeInfo if they were not loaded with one) */
+        SEEGElectrodeModel::SEEG_ELECTRODE_MODEL_TYPE GetCandidatesElectrodeType();
+
+        /** Score of a candidate at its depth iDepth for the test of the given column */
+        void GetCandidateDepthScore(SEEGTrajectoryCandidates::Pointer candidates, unsigned int index, int column,
+                                    unsigned int iDepth, TrajectoryTestScore& score);
+
+        /** Adds a depth with the given score after the depths of a candidate */
+        void AddCandidateDepthScore(SEEGTrajectoryCandidates::Pointer candidates, unsigned int index, int column,
+                                    const TrajectoryTestScore& score);
+
+        /** Copies the evaluated test scores (and scores of each depth), aggregated scores and validity of a candidate to an ElectrodeInfo */
+        void CopyCandidateScoresToElectrode(SEEGTrajectoryCandidates::Pointer candidates, unsigned int index, ElectrodeInfo::Pointer electrode);
+
+        /** Copies the scores of an ElectrodeInfo for the existing test columns (with their depths, and aggregated scores) to a candidate */
+        void CopyElectrodeScoresToCandidate(ElectrodeInfo::Pointer electrode, SEEGTrajectoryCandidates::Pointer candidates, unsigned int index);
+
+        /**
+         * Ranks the trajectories tables[i][tableIndices[i]] in numBins bins of their max and sum scores for
+         * the test testId and adds the weighted rankings to aggregatedScores[i] (one pass over the
+         * columns after the min/max reduction, trajectories are not sorted)
+         */
+        void AggregateTestRankings(int testId, float weightUsingMax, float weightUsingSum, int numBins,
+                                   const vector<SEEGTrajectoryCandidates::Pointer>& tables,
+                                   const vector<vector<unsigned int> >& tableIndices,
+                                   vector<vector<float> >& aggregatedScores);
+
+        /**
+         * Tables of the active trajectories for the aggregation: m_Candidates with its active candidates and
+         * a temporary table with copies of the m_ActiveTrajectories (electrodes), which have a column for every
+         * weighted test
+         *
+         * @return false if there is no active trajectory
+         */
+        bool CreateActiveScoreTables(vector<SEEGTrajectoryCandidates::Pointer>& tables,
+                                     vector<vector<unsigned int> >& tableIndices,
+                                     vector<ElectrodeInfo::Pointer>& electrodes);
+
+        /** Copies the scores of the temporary table of CreateActiveScoreTables() back to the electrodes */
+        void CopyActiveScoreTablesToElectrodes(const vector<SEEGTrajectoryCandidates::Pointer>& tables,
+                                               const vector<ElectrodeInfo::Pointer>& electrodes);
+
+        /**
+         * Min and max of the scores of the trajectories indices, read in place from a column: scores[indices[i]],
+         * or the scores of each depth [firstScores[indices[i]], firstScores[indices[i]] + numberOfScores[indices[i]])
+         * if numberOfScores is not NULL (split among m_NumberOfThreads threads for many trajectories)
+         */
+        void CalcMinMaxScores(const vector<float>& scores, const vector<unsigned int>& indices,
+                              const vector<unsigned int>* firstScores, const vector<unsigned int>* numberOfScores,
+                              float& minVal, float& maxVal);
+
+        /** CalcMinMaxScores() of the max (or sum) scores, or of the scores of each depth, of the test testId over several tables */
+        void CalcMinMaxColumnScores(const vector<SEEGTrajectoryCandidates::Pointer>& tables,
+                                    const vector<vector<unsigned int> >& tableIndices,
+                                    int testId, bool scoreSum, bool depthScores,
+                                    float& minVal, float& maxVal);
+
+        /**
+         * Positions of scores, lowest first: only the first numBest are sorted (all of them if numBest < 0),
+         * the others follow in their current order (ties keep the current order)
+         */
+        void CalcBestFirstOrder(const vector<float>& scores, int numBest, vector<unsigned int>& order);
+
+        /** Builds m_CandidatesIndex with all the candidates of m_Candidates */
+        void BuildCandidatesIndex();
+
+        /** Adds a trajectory appended to m_AllTrajectories (and to m_ActiveTrajectories if active) to the indices */
+        void AddToTrajectoryIndices(ElectrodeInfo::Pointer electrode, bool active);
+
+        /** Rebuilds the indices of m_AllTrajectories and m_ActiveTrajectories if needed (call before querying them) */
+        void UpdateTrajectoryIndices();
+
+        /** Test columns of m_Candidates sorted by test name */
+        void GetCandidateColumnsByName(vector<int>& columnsByName);
+
+        /** Writes a candidate of m_Candidates as a [trajectory] line of the planning data files */
+        void WriteCandidateToFile(ofstream& file, unsigned int index, const vector<int>& columnsByName);
+
+        /** Writes the trajectories and candidates (all or active ones) as a binary planning results file */
+        void WritePlanningResultsFile(const string& filename, PLANNING_RESULTS_FILE_TYPE fileType);
+
+        /** Loads a binary planning results file in m_Candidates (after Reset()) */
+        bool LoadPlanningResultsFile(const string& filename);
+
+        /**
+         * Distance maps of the risk structures to use for the given binary tests (null if not
+         * precomputed, computed from another volume or if SetUseRiskDistanceMaps(false))
+         */
+        void GetRiskDistanceMaps(const vector<string>& binTestNames, const vector<IntVolume::Pointer>& binVols,
+                                 vector<SEEGStructureDistanceMap::Pointer>& binDistanceMaps);
+
+        /**
+         * Brick occupancies of the risk structures to use for the given binary tests (null if not
+         * precomputed, computed from another volume or if SetUseRiskBrickOccupancies(false))
+         */
+        void GetRiskBrickOccupancies(const vector<string>& binTestNames, const vector<IntVolume::Pointer>& binVols,
+                                     vector<SEEGBrickOccupancy::Pointer>& binBrickOccupancies);
+
+        /**
+         * Screens a binary test with its brick occupancy (may be null)
+         *
+         * @return 1 if no structure voxel is within m_MaxDistToEvaluate of the trajectory (score of CalcNoOverlapScores()),
+         *         -1 if the trajectory is surely rejected by the hard constraint, 0 if the dense test is needed
+         */
+        int ScreenBinaryTest(SEEGBrickOccupancy::Pointer brickOccupancy, const BinaryTestCfg& cfg,
+                             const Point3D& entryPoint, const Point3D& targetPoint);
+
+        /**
+         * Scores given by TestBinaryOverlap() to a trajectory without any structure voxel within m_MaxDistToEvaluate
+         * (the scores of the tests skipped by the screening), computed by the test itself on an empty distance map
+         */
+        void CalcNoOverlapScores(const vector<IntVolume::Pointer>& binVols, const vector<BinaryTestCfg>& binTestCfgs,
+                                 GeneralTransform::Pointer nativeToRef, vector<TrajectoryTestScore>& scores);
+
+        /**
+         * Same scores and rejection as TestBinaryOverlap(), from the sparse distance map of the last
+         * SEEGTrajectoryROIPipeline::CalcSparseDistanceMap(): only the voxels within m_MaxDistToEvaluate
+         * are visited. binaryVol must have the same buffered region as the template of the pipeline.
+         * noOverlapScore is the score without any voxel (see CalcNoOverlapScores()).
+         */
+        bool TestBinaryOverlapSparse(SEEGTrajectoryROIPipeline::Pointer pipeline,
+                                     IntVolume::Pointer binaryVol,
+                                     const BinaryTestCfg& cfgs,
+                                     const TrajectoryTestScore& noOverlapScore,
+                                     TrajectoryTestScore& score,
+                                     GeneralTransform::Pointer nativeToRef);
+
+        /**
+         * Scores the recording map of one electrode: number of contacts inside the volume of interest
+         * (scoreMax) and recorded volume (scoreSum = recordingSum, as returned by the contacts pipeline)
+         */
         void TestMaximizationOverlap (
                                FloatVolume::Pointer recDistanceMap,
+                               double recordingSum,
                                vector<Point3D> targetPoint,
                                const MaximizationTestCfg &cfgs,
                                TrajectoryTestScore& score,
                                GeneralTransform::Pointer nativeToRef);
 
-
+        /**
+         * Fills the maximization score from the number of contacts with a recording > 0 and the
+         * recorded volume (pointAtMaxScore is the first contact, to know the depth of the trajectory)
+         */
+        void SetMaximizationScore(float nContacts, float scoreSum, const Point3D& firstContactPoint,
+                                  TrajectoryTestScore& score, GeneralTransform::Pointer nativeToRef);
 
 
         bool TestVectorOverlap(
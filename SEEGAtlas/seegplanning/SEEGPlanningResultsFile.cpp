@@ -0,0 +1,514 @@
+/**
+ * @file SEEGPlanningResultsFile.cpp
+ *
+ * Implementation of the SEEGPlanningResultsWriter and SEEGPlanningResultsReader classes
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include "SEEGPlanningResultsFile.h"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+namespace seeg {
+
+    static const char PLANNING_RESULTS_MAGIC[8] = { 'S', 'E', 'E', 'G', 'P', 'L', 'A', 'N' };
+
+    // test flags of the header
+    static const unsigned int PLANNING_RESULTS_RISK_TEST = 1;
+    static const unsigned int PLANNING_RESULTS_REWARD_TEST = 2;
+
+    // number of values of the header of a test after its name (flags and 5 weights)
+    static const unsigned int TEST_HEADER_VALUES_SIZE = 6 * 4;
+
+    // sizes of the columns of a test: evaluated, 5 float scores and the 3 coordinates of the point at max score
+    static const unsigned int TEST_COLUMN_FLOAT_VALUES = 5;
+    static const unsigned int TEST_COLUMN_DOUBLE_VALUES = 3;
+
+    static bool IsLittleEndianHost() {
+        unsigned int one = 1;
+        return *((unsigned char*) &one) == 1;
+    }
+
+    static unsigned long long AlignTo8(unsigned long long size) {
+        return (size + 7) & ~7ULL;
+    }
+
+    /** Size in bytes of a column of n values of valueSize bytes (padded to a multiple of 8) */
+    static unsigned long long ColumnSize(unsigned long long n, unsigned int valueSize) {
+        return AlignTo8(n * valueSize);
+    }
+
+    static unsigned long long TestColumnsSize(unsigned long long n) {
+        return ColumnSize(n, 1) + TEST_COLUMN_FLOAT_VALUES * ColumnSize(n, 4) + TEST_COLUMN_DOUBLE_VALUES * ColumnSize(n, 8);
+    }
+
+    template <class T>
+    static void AppendValue(vector<unsigned char>& buffer, T value) {
+        unsigned char bytes[sizeof(T)];
+        memcpy(bytes, &value, sizeof(T));
+        if (!IsLittleEndianHost()) {
+            reverse(bytes, bytes + sizeof(T));
+        }
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+    }
+
+    template <class T>
+    static T ReadValue(const unsigned char* data) {
+        unsigned char bytes[sizeof(T)];
+        memcpy(bytes, data, sizeof(T));
+        if (!IsLittleEndianHost()) {
+            reverse(bytes, bytes + sizeof(T));
+        }
+        T value;
+        memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+
+    /** Writes the values of a column followed by the padding to a multiple of 8 bytes */
+    template <class T>
+    static void WriteColumn(ofstream& file, const vector<T>& values) {
+        if (IsLittleEndianHost()) {
+            if (!values.empty()) {
+                file.write((const char*) &values[0], values.size() * sizeof(T));
+            }
+        } else {
+            vector<unsigned char> buffer;
+            buffer.reserve(values.size() * sizeof(T));
+            for (unsigned int i=0; i<values.size(); i++) {
+                AppendValue(buffer, values[i]);
+            }
+            if (!buffer.empty()) {
+                file.write((const char*) &buffer[0], buffer.size());
+            }
+        }
+        static const char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+        file.write(padding, ColumnSize(values.size(), sizeof(T)) - values.size() * sizeof(T));
+    }
+
+    static void ResizeTestColumn(TrajectoryTestColumn& column, unsigned int n) {
+        column.m_ScoreMax.resize(n, 0);
+        column.m_ScoreSum.resize(n, 0);
+        column.m_RankingUsingMax.resize(n, 0);
+        column.m_RankingUsingSum.resize(n, 0);
+        column.m_DistAtMaxScore.resize(n, -1);
+        column.m_PointAtMaxScoreX.resize(n, 0);
+        column.m_PointAtMaxScoreY.resize(n, 0);
+        column.m_PointAtMaxScoreZ.resize(n, 0);
+        column.m_Evaluated.resize(n, 0);
+    }
+
+
+    /**** CONSTRUCTORS / DESTRUCTOR ****/
+
+    SEEGPlanningResultsWriter::SEEGPlanningResultsWriter() {
+        m_FileType = PLANNING_RESULTS_ALL;
+        m_ElectrodeType = -1;
+        m_WeightRisk = 1;
+        m_WeightReward = 1;
+    }
+
+    SEEGPlanningResultsWriter::~SEEGPlanningResultsWriter() {
+        // Do nothing
+    }
+
+    SEEGPlanningResultsReader::SEEGPlanningResultsReader() {
+        m_Data = NULL;
+        m_Size = 0;
+        m_Version = 0;
+        m_FileType = PLANNING_RESULTS_ALL;
+        m_ElectrodeType = -1;
+        m_WeightRisk = 1;
+        m_WeightReward = 1;
+        m_NumberOfTrajectories = 0;
+    }
+
+    SEEGPlanningResultsReader::~SEEGPlanningResultsReader() {
+        Close();
+    }
+
+
+    /**** PUBLIC FUNCTIONS ****/
+
+    void SEEGPlanningResultsWriter::SetFileType(PLANNING_RESULTS_FILE_TYPE fileType) {
+        m_FileType = fileType;
+    }
+
+    void SEEGPlanningResultsWriter::SetElectrodeType(int electrodeType) {
+        m_ElectrodeType = electrodeType;
+    }
+
+    void SEEGPlanningResultsWriter::SetGlobalWeights(float weightRisk, float weightReward) {
+        m_WeightRisk = weightRisk;
+        m_WeightReward = weightReward;
+    }
+
+    int SEEGPlanningResultsWriter::AddTest(const string& testName) {
+        for (int i=0; i<m_Tests.size(); i++) {
+            if (m_Tests[i].m_Name == testName) {
+                return i;
+            }
+        }
+        TestHeader test;
+        test.m_Name = testName;
+        test.m_Flags = 0;
+        test.m_RiskWeightUsingMax = 0;
+        test.m_RiskWeightUsingSum = 0;
+        test.m_HardLimit = -1;
+        test.m_RewardWeightUsingMax = 0;
+        test.m_RewardWeightUsingSum = 0;
+        m_Tests.push_back(test);
+        m_TestColumns.push_back(TrajectoryTestColumn());
+        ResizeTestColumn(m_TestColumns.back(), GetNumberOfTrajectories());
+        return m_Tests.size() - 1;
+    }
+
+    void SEEGPlanningResultsWriter::SetRiskTestWeights(const string& testName, float weightUsingMax, float weightUsingSum, float hardLimit) {
+        TestHeader& test = m_Tests[AddTest(testName)];
+        test.m_Flags |= PLANNING_RESULTS_RISK_TEST;
+        test.m_RiskWeightUsingMax = weightUsingMax;
+        test.m_RiskWeightUsingSum = weightUsingSum;
+        test.m_HardLimit = hardLimit;
+    }
+
+    void SEEGPlanningResultsWriter::SetRewardTestWeights(const string& testName, float weightUsingMax, float weightUsingSum) {
+        TestHeader& test = m_Tests[AddTest(testName)];
+        test.m_Flags |= PLANNING_RESULTS_REWARD_TEST;
+        test.m_RewardWeightUsingMax = weightUsingMax;
+        test.m_RewardWeightUsingSum = weightUsingSum;
+    }
+
+    int SEEGPlanningResultsWriter::GetNumberOfTests() {
+        return m_Tests.size();
+    }
+
+    unsigned int SEEGPlanningResultsWriter::AddTrajectory(const Point3D& entryPoint, const Point3D& targetPoint,
+                                                          float aggregatedScore, float aggregatedRiskScore, float aggregatedRewardScore, bool active) {
+        unsigned int index = m_TargetX.size();
+        m_TargetX.push_back(targetPoint[0]);
+        m_TargetY.push_back(targetPoint[1]);
+        m_TargetZ.push_back(targetPoint[2]);
+        m_EntryX.push_back(entryPoint[0]);
+        m_EntryY.push_back(entryPoint[1]);
+        m_EntryZ.push_back(entryPoint[2]);
+        m_AggregatedScore.push_back(aggregatedScore);
+        m_AggregatedRiskScore.push_back(aggregatedRiskScore);
+        m_AggregatedRewardScore.push_back(aggregatedRewardScore);
+        m_Active.push_back(active ? 1 : 0);
+        for (int i=0; i<m_TestColumns.size(); i++) {
+            ResizeTestColumn(m_TestColumns[i], index + 1);
+        }
+        return index;
+    }
+
+    unsigned int SEEGPlanningResultsWriter::GetNumberOfTrajectories() {
+        return m_TargetX.size();
+    }
+
+    TrajectoryTestColumn& SEEGPlanningResultsWriter::GetTestColumn(int test) {
+        return m_TestColumns[test];
+    }
+
+    bool SEEGPlanningResultsWriter::Write(const string& filename) {
+        ofstream file(filename.c_str(), ios::out | ios::binary);
+        if (!file.is_open()) {
+            cout << "Unable to open file " << filename << endl;
+            return false;
+        }
+
+        vector<unsigned char> header(PLANNING_RESULTS_MAGIC, PLANNING_RESULTS_MAGIC + 8);
+        AppendValue<unsigned int>(header, SEEGPlanningResultsReader::CURRENT_VERSION);
+        unsigned int headerSizePosition = header.size();
+        AppendValue<unsigned int>(header, 0); // header size, set below
+        AppendValue<unsigned long long>(header, GetNumberOfTrajectories());
+        AppendValue<unsigned int>(header, m_FileType);
+        AppendValue<int>(header, m_ElectrodeType);
+        AppendValue<float>(header, m_WeightRisk);
+        AppendValue<float>(header, m_WeightReward);
+        AppendValue<unsigned int>(header, m_Tests.size());
+        for (int i=0; i<m_Tests.size(); i++) {
+            AppendValue<unsigned int>(header, m_Tests[i].m_Name.size());
+            header.insert(header.end(), m_Tests[i].m_Name.begin(), m_Tests[i].m_Name.end());
+            AppendValue<unsigned int>(header, m_Tests[i].m_Flags);
+            AppendValue<float>(header, m_Tests[i].m_RiskWeightUsingMax);
+            AppendValue<float>(header, m_Tests[i].m_RiskWeightUsingSum);
+            AppendValue<float>(header, m_Tests[i].m_HardLimit);
+            AppendValue<float>(header, m_Tests[i].m_RewardWeightUsingMax);
+            AppendValue<float>(header, m_Tests[i].m_RewardWeightUsingSum);
+        }
+        header.resize(AlignTo8(header.size()), 0);
+        vector<unsigned char> headerSize;
+        AppendValue<unsigned int>(headerSize, header.size());
+        copy(headerSize.begin(), headerSize.end(), header.begin() + headerSizePosition);
+        file.write((const char*) &header[0], header.size());
+
+        WriteColumn(file, m_TargetX);
+        WriteColumn(file, m_TargetY);
+        WriteColumn(file, m_TargetZ);
+        WriteColumn(file, m_EntryX);
+        WriteColumn(file, m_EntryY);
+        WriteColumn(file, m_EntryZ);
+        WriteColumn(file, m_AggregatedScore);
+        WriteColumn(file, m_AggregatedRiskScore);
+        WriteColumn(file, m_AggregatedRewardScore);
+        WriteColumn(file, m_Active);
+        for (int i=0; i<m_TestColumns.size(); i++) {
+            TrajectoryTestColumn& column = m_TestColumns[i];
+            WriteColumn(file, column.m_Evaluated);
+            WriteColumn(file, column.m_ScoreMax);
+            WriteColumn(file, column.m_ScoreSum);
+            WriteColumn(file, column.m_RankingUsingMax);
+            WriteColumn(file, column.m_RankingUsingSum);
+            WriteColumn(file, column.m_DistAtMaxScore);
+            WriteColumn(file, column.m_PointAtMaxScoreX);
+            WriteColumn(file, column.m_PointAtMaxScoreY);
+            WriteColumn(file, column.m_PointAtMaxScoreZ);
+        }
+
+        bool status = file.good();
+        file.close();
+        if (!status) {
+            cout << "Error writing file " << filename << endl;
+        }
+        return status;
+    }
+
+    bool SEEGPlanningResultsReader::IsPlanningResultsFile(const string& filename) {
+        ifstream file(filename.c_str(), ios::in | ios::binary);
+        char magic[8];
+        if (!file.read(magic, 8)) {
+            return false;
+        }
+        return memcmp(magic, PLANNING_RESULTS_MAGIC, 8) == 0;
+    }
+
+    bool SEEGPlanningResultsReader::Open(const string& filename) {
+        Close();
+        m_File.setFileName(QString::fromStdString(filename));
+        if (!m_File.open(QIODevice::ReadOnly)) {
+            cout << "Unable to open file " << filename << endl;
+            return false;
+        }
+        m_Size = m_File.size();
+        m_Data = (m_Size > 0) ? m_File.map(0, m_Size) : NULL;
+        if (m_Data == NULL) {
+            cout << "Unable to map file " << filename << endl;
+            Close();
+            return false;
+        }
+        if (!ReadHeader()) {
+            cout << filename << " is not a valid planning results file" << endl;
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void SEEGPlanningResultsReader::Close() {
+        if (m_Data != NULL) {
+            m_File.unmap((uchar*) m_Data);
+            m_Data = NULL;
+        }
+        if (m_File.isOpen()) {
+            m_File.close();
+        }
+        m_Size = 0;
+        m_Tests.clear();
+        m_NumberOfTrajectories = 0;
+    }
+
+    bool SEEGPlanningResultsReader::IsOpen() {
+        return m_Data != NULL;
+    }
+
+    unsigned int SEEGPlanningResultsReader::GetVersion() {
+        return m_Version;
+    }
+
+    PLANNING_RESULTS_FILE_TYPE SEEGPlanningResultsReader::GetFileType() {
+        return m_FileType;
+    }
+
+    int SEEGPlanningResultsReader::GetElectrodeType() {
+        return m_ElectrodeType;
+    }
+
+    float SEEGPlanningResultsReader::GetGlobalRiskWeight() {
+        return m_WeightRisk;
+    }
+
+    float SEEGPlanningResultsReader::GetGlobalRewardWeight() {
+        return m_WeightReward;
+    }
+
+    int SEEGPlanningResultsReader::GetNumberOfTests() {
+        return m_Tests.size();
+    }
+
+    string SEEGPlanningResultsReader::GetTestName(int test) {
+        return m_Tests[test].m_Name;
+    }
+
+    bool SEEGPlanningResultsReader::IsRiskTest(int test) {
+        return (m_Tests[test].m_Flags & PLANNING_RESULTS_RISK_TEST) != 0;
+    }
+
+    bool SEEGPlanningResultsReader::IsRewardTest(int test) {
+        return (m_Tests[test].m_Flags & PLANNING_RESULTS_REWARD_TEST) != 0;
+    }
+
+    void SEEGPlanningResultsReader::GetRiskTestWeights(int test, float& weightUsingMax, float& weightUsingSum, float& hardLimit) {
+        weightUsingMax = m_Tests[test].m_RiskWeightUsingMax;
+        weightUsingSum = m_Tests[test].m_RiskWeightUsingSum;
+        hardLimit = m_Tests[test].m_HardLimit;
+    }
+
+    void SEEGPlanningResultsReader::GetRewardTestWeights(int test, float& weightUsingMax, float& weightUsingSum) {
+        weightUsingMax = m_Tests[test].m_RewardWeightUsingMax;
+        weightUsingSum = m_Tests[test].m_RewardWeightUsingSum;
+    }
+
+    unsigned long long SEEGPlanningResultsReader::GetNumberOfTrajectories() {
+        return m_NumberOfTrajectories;
+    }
+
+    Point3D SEEGPlanningResultsReader::GetTargetPoint(unsigned long long index) {
+        Point3D point;
+        for (int i=0; i<3; i++) {
+            point[i] = ReadValue<double>(m_Data + m_PointColumnsOffset[i] + index * 8);
+        }
+        return point;
+    }
+
+    Point3D SEEGPlanningResultsReader::GetEntryPoint(unsigned long long index) {
+        Point3D point;
+        for (int i=0; i<3; i++) {
+            point[i] = ReadValue<double>(m_Data + m_PointColumnsOffset[3+i] + index * 8);
+        }
+        return point;
+    }
+
+    float SEEGPlanningResultsReader::GetAggregatedScore(unsigned long long index) {
+        return ReadValue<float>(m_Data + m_AggregatedScoreOffset + index * 4);
+    }
+
+    float SEEGPlanningResultsReader::GetAggregatedRiskScore(unsigned long long index) {
+        return ReadValue<float>(m_Data + m_AggregatedRiskScoreOffset + index * 4);
+    }
+
+    float SEEGPlanningResultsReader::GetAggregatedRewardScore(unsigned long long index) {
+        return ReadValue<float>(m_Data + m_AggregatedRewardScoreOffset + index * 4);
+    }
+
+    bool SEEGPlanningResultsReader::IsActive(unsigned long long index) {
+        return m_Data[m_ActiveOffset + index] != 0;
+    }
+
+    bool SEEGPlanningResultsReader::IsTestEvaluated(unsigned long long index, int test) {
+        return m_Data[m_Tests[test].m_ColumnsOffset + index] != 0;
+    }
+
+    void SEEGPlanningResultsReader::ReadTestColumn(int test, unsigned long long first, unsigned long long count,
+                                                   TrajectoryTestColumn& column, unsigned int columnOffset) {
+        unsigned long long n = m_NumberOfTrajectories;
+        const unsigned char* evaluated = m_Data + m_Tests[test].m_ColumnsOffset;
+        const unsigned char* floatColumns = evaluated + ColumnSize(n, 1);
+        const unsigned char* doubleColumns = floatColumns + TEST_COLUMN_FLOAT_VALUES * ColumnSize(n, 4);
+        vector<float>* floatValues[TEST_COLUMN_FLOAT_VALUES] = { &column.m_ScoreMax, &column.m_ScoreSum, &column.m_RankingUsingMax,
+                                                                 &column.m_RankingUsingSum, &column.m_DistAtMaxScore };
+        vector<double>* doubleValues[TEST_COLUMN_DOUBLE_VALUES] = { &column.m_PointAtMaxScoreX, &column.m_PointAtMaxScoreY, &column.m_PointAtMaxScoreZ };
+
+        for (unsigned long long i=0; i<count; i++) {
+            column.m_Evaluated[columnOffset + i] = evaluated[first + i];
+        }
+        for (int c=0; c<TEST_COLUMN_FLOAT_VALUES; c++) {
+            const unsigned char* values = floatColumns + c * ColumnSize(n, 4);
+            for (unsigned long long i=0; i<count; i++) {
+                (*floatValues[c])[columnOffset + i] = ReadValue<float>(values + (first + i) * 4);
+            }
+        }
+        for (int c=0; c<TEST_COLUMN_DOUBLE_VALUES; c++) {
+            const unsigned char* values = doubleColumns + c * ColumnSize(n, 8);
+            for (unsigned long long i=0; i<count; i++) {
+                (*doubleValues[c])[columnOffset + i] = ReadValue<double>(values + (first + i) * 8);
+            }
+        }
+    }
+
+
+    /**** PRIVATE FUNCTIONS ****/
+
+    bool SEEGPlanningResultsReader::ReadHeader() {
+        // fixed part: magic, version, header size, number of trajectories, file type, electrode type, weights, number of tests
+        const unsigned long long fixedSize = 8 + 4 + 4 + 8 + 4 + 4 + 4 + 4 + 4;
+        if (m_Size < fixedSize || memcmp(m_Data, PLANNING_RESULTS_MAGIC, 8) != 0) {
+            return false;
+        }
+        m_Version = ReadValue<unsigned int>(m_Data + 8);
+        if (m_Version < 1 || m_Version > CURRENT_VERSION) {
+            cout << "Planning results file version " << m_Version << " is not supported (current version: " << CURRENT_VERSION << ")" << endl;
+            return false;
+        }
+        unsigned long long headerSize = ReadValue<unsigned int>(m_Data + 12);
+        m_NumberOfTrajectories = ReadValue<unsigned long long>(m_Data + 16);
+        m_FileType = (ReadValue<unsigned int>(m_Data + 24) == PLANNING_RESULTS_ACTIVE) ? PLANNING_RESULTS_ACTIVE : PLANNING_RESULTS_ALL;
+        m_ElectrodeType = ReadValue<int>(m_Data + 28);
+        m_WeightRisk = ReadValue<float>(m_Data + 32);
+        m_WeightReward = ReadValue<float>(m_Data + 36);
+        unsigned int numTests = ReadValue<unsigned int>(m_Data + 40);
+        if (headerSize > m_Size || headerSize % 8 != 0) {
+            return false;
+        }
+
+        unsigned long long position = fixedSize;
+        m_Tests.clear();
+        for (unsigned int i=0; i<numTests; i++) {
+            if (position + 4 > headerSize) {
+                return false;
+            }
+            unsigned int nameLength = ReadValue<unsigned int>(m_Data + position);
+            position += 4;
+            if (position + nameLength + TEST_HEADER_VALUES_SIZE > headerSize) {
+                return false;
+            }
+            TestHeader test;
+            test.m_Name.assign((const char*) m_Data + position, nameLength);
+            position += nameLength;
+            test.m_Flags = ReadValue<unsigned int>(m_Data + position);
+            test.m_RiskWeightUsingMax = ReadValue<float>(m_Data + position + 4);
+            test.m_RiskWeightUsingSum = ReadValue<float>(m_Data + position + 8);
+            test.m_HardLimit = ReadValue<float>(m_Data + position + 12);
+            test.m_RewardWeightUsingMax = ReadValue<float>(m_Data + position + 16);
+            test.m_RewardWeightUsingSum = ReadValue<float>(m_Data + position + 20);
+            position += TEST_HEADER_VALUES_SIZE;
+            m_Tests.push_back(test);
+        }
+
+        // column offsets (fixed width columns)
+        unsigned long long n = m_NumberOfTrajectories;
+        if (n > m_Size) {
+            return false;
+        }
+        unsigned long long offset = headerSize;
+        for (int i=0; i<6; i++) {
+            m_PointColumnsOffset[i] = offset;
+            offset += ColumnSize(n, 8);
+        }
+        m_AggregatedScoreOffset = offset;
+        offset += ColumnSize(n, 4);
+        m_AggregatedRiskScoreOffset = offset;
+        offset += ColumnSize(n, 4);
+        m_AggregatedRewardScoreOffset = offset;
+        offset += ColumnSize(n, 4);
+        m_ActiveOffset = offset;
+        offset += ColumnSize(n, 1);
+        for (unsigned int i=0; i<m_Tests.size(); i++) {
+            m_Tests[i].m_ColumnsOffset = offset;
+            offset += TestColumnsSize(n);
+        }
+        return offset <= m_Size;
+    }
+}
@@ -0,0 +1,246 @@
+#ifndef __SEEG_PLANNING_RESULTS_FILE_H__
+#define __SEEG_PLANNING_RESULTS_FILE_H__
+
+/**
+ * @file SEEGPlanningResultsFile.h
+ *
+ * Defines the SEEGPlanningResultsWriter and SEEGPlanningResultsReader classes: binary
+ * (columnar) files of planning results, see SEEGPathPlanner::SaveSEEGPlanningDataToFile()
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <vector>
+#include <string>
+#include <QFile>
+#include "BasicTypes.h"
+#include "VolumeTypes.h"
+#include "SEEGTrajectoryCandidates.h"
+
+using namespace std;
+
+namespace seeg {
+
+    /**
+     * File layout (version 1, all values little-endian):
+     *
+     * Header
+     *   char[8]   magic "SEEGPLAN"
+     *   uint32    version
+     *   uint32    header size in bytes (offset of the first column, multiple of 8)
+     *   uint64    number of trajectories (n)
+     *   uint32    file type (0: all trajectories, 1: active trajectories)
+     *   int32     electrode type (-1 if unknown)
+     *   float32   global risk weight, global reward weight
+     *   uint32    number of tests, then for each test:
+     *             uint32 name length, name, uint32 flags (1: risk test, 2: reward test),
+     *             float32 risk weight using max, risk weight using sum, hard limit,
+     *             reward weight using max, reward weight using sum
+     * Columns (n values each, every column starts at a multiple of 8 bytes)
+     *   float64   target x, y, z, entry x, y, z
+     *   float32   aggregated score, aggregated risk score, aggregated reward score
+     *   uint8     active
+     *   for each test: uint8 evaluated, float32 score max, score sum, ranking using max,
+     *             ranking using sum, distance at max score, float64 point at max score x, y, z
+     *
+     * Columns have a fixed width, so the position of any value is known from the header and the
+     * reader maps the file and only reads the trajectories asked for.
+     */
+
+    /** Planning file types (see SEEGPathPlanner::SaveSEEGPlanningDataToFile() / SaveActiveSEEGPlanningDataToFile()) */
+    enum PLANNING_RESULTS_FILE_TYPE {
+        PLANNING_RESULTS_ALL = 0,
+        PLANNING_RESULTS_ACTIVE = 1
+    };
+
+    /**
+     * Collects planning results column by column and writes them as a binary planning results file
+     */
+    class SEEGPlanningResultsWriter {
+
+    public:
+        /** SmartPointer type for the SEEGPlanningResultsWriter class */
+        typedef mrilSmartPtr<SEEGPlanningResultsWriter> Pointer;
+
+        static Pointer New() { return Pointer(new SEEGPlanningResultsWriter()); }
+
+    protected:
+        SEEGPlanningResultsWriter();
+
+    public:
+        virtual ~SEEGPlanningResultsWriter();
+
+        void SetFileType(PLANNING_RESULTS_FILE_TYPE fileType);
+
+        /** Electrode type of the trajectories (-1 if unknown) */
+        void SetElectrodeType(int electrodeType);
+
+        void SetGlobalWeights(float weightRisk, float weightReward);
+
+        /** @return index of the test (added with no weights if it does not exist yet) */
+        int AddTest(const string& testName);
+
+        void SetRiskTestWeights(const string& testName, float weightUsingMax, float weightUsingSum, float hardLimit);
+
+        void SetRewardTestWeights(const string& testName, float weightUsingMax, float weightUsingSum);
+
+        int GetNumberOfTests();
+
+        /**
+         * Adds a trajectory (its tests are not evaluated until written in GetTestColumn())
+         *
+         * @return index of the trajectory
+         */
+        unsigned int AddTrajectory(const Point3D& entryPoint, const Point3D& targetPoint,
+                                   float aggregatedScore, float aggregatedRiskScore, float aggregatedRewardScore, bool active);
+
+        unsigned int GetNumberOfTrajectories();
+
+        /** Scores of a test (one entry per trajectory added) */
+        TrajectoryTestColumn& GetTestColumn(int test);
+
+        bool Write(const string& filename);
+
+    private:
+        struct TestHeader {
+            string m_Name;
+            unsigned int m_Flags;
+            float m_RiskWeightUsingMax;
+            float m_RiskWeightUsingSum;
+            float m_HardLimit;
+            float m_RewardWeightUsingMax;
+            float m_RewardWeightUsingSum;
+        };
+
+        PLANNING_RESULTS_FILE_TYPE m_FileType;
+        int m_ElectrodeType;
+        float m_WeightRisk;
+        float m_WeightReward;
+
+        vector<TestHeader> m_Tests;
+        vector<TrajectoryTestColumn> m_TestColumns;
+
+        vector<double> m_TargetX;
+        vector<double> m_TargetY;
+        vector<double> m_TargetZ;
+        vector<double> m_EntryX;
+        vector<double> m_EntryY;
+        vector<double> m_EntryZ;
+        vector<float> m_AggregatedScore;
+        vector<float> m_AggregatedRiskScore;
+        vector<float> m_AggregatedRewardScore;
+        vector<unsigned char> m_Active;
+    };
+
+    /**
+     * Memory maps a binary planning results file: the header is parsed by Open() and the values
+     * of the trajectories are read from the mapping when asked for
+     */
+    class SEEGPlanningResultsReader {
+
+    public:
+        /** SmartPointer type for the SEEGPlanningResultsReader class */
+        typedef mrilSmartPtr<SEEGPlanningResultsReader> Pointer;
+
+        static Pointer New() { return Pointer(new SEEGPlanningResultsReader()); }
+
+        /** Version written by SEEGPlanningResultsWriter (files of newer versions are not opened) */
+        static const unsigned int CURRENT_VERSION = 1;
+
+    protected:
+        SEEGPlanningResultsReader();
+
+    public:
+        virtual ~SEEGPlanningResultsReader();
+
+        /** true if the file starts with the magic of the binary planning results files */
+        static bool IsPlanningResultsFile(const string& filename);
+
+        /** @return false if the file cannot be mapped or is not a valid planning results file */
+        bool Open(const string& filename);
+
+        void Close();
+
+        bool IsOpen();
+
+        unsigned int GetVersion();
+
+        PLANNING_RESULTS_FILE_TYPE GetFileType();
+
+        int GetElectrodeType();
+
+        float GetGlobalRiskWeight();
+        float GetGlobalRewardWeight();
+
+        /*** Tests ***/
+
+        int GetNumberOfTests();
+
+        string GetTestName(int test);
+
+        bool IsRiskTest(int test);
+        bool IsRewardTest(int test);
+
+        void GetRiskTestWeights(int test, float& weightUsingMax, float& weightUsingSum, float& hardLimit);
+        void GetRewardTestWeights(int test, float& weightUsingMax, float& weightUsingSum);
+
+        /*** Trajectories ***/
+
+        unsigned long long GetNumberOfTrajectories();
+
+        Point3D GetTargetPoint(unsigned long long index);
+        Point3D GetEntryPoint(unsigned long long index);
+
+        float GetAggregatedScore(unsigned long long index);
+        float GetAggregatedRiskScore(unsigned long long index);
+        float GetAggregatedRewardScore(unsigned long long index);
+
+        bool IsActive(unsigned long long index);
+
+        bool IsTestEvaluated(unsigned long long index, int test);
+
+        /**
+         * Copies the scores of a test for the trajectories [first, first+count) to
+         * column[columnOffset, columnOffset+count) (the column must be large enough)
+         */
+        void ReadTestColumn(int test, unsigned long long first, unsigned long long count,
+                            TrajectoryTestColumn& column, unsigned int columnOffset);
+
+    private:
+        struct TestHeader {
+            string m_Name;
+            unsigned int m_Flags;
+            float m_RiskWeightUsingMax;
+            float m_RiskWeightUsingSum;
+            float m_HardLimit;
+            float m_RewardWeightUsingMax;
+            float m_RewardWeightUsingSum;
+            unsigned long long m_ColumnsOffset;
+        };
+
+        /** Parses the header and computes the column offsets, false if the file is not valid */
+        bool ReadHeader();
+
+        QFile m_File;
+        const unsigned char* m_Data;
+        unsigned long long m_Size;
+
+        unsigned int m_Version;
+        PLANNING_RESULTS_FILE_TYPE m_FileType;
+        int m_ElectrodeType;
+        float m_WeightRisk;
+        float m_WeightReward;
+        vector<TestHeader> m_Tests;
+        unsigned long long m_NumberOfTrajectories;
+
+        /** Offsets of the columns of the trajectories (target xyz, entry xyz, aggregated scores, active) */
+        unsigned long long m_PointColumnsOffset[6];
+        unsigned long long m_AggregatedScoreOffset;
+        unsigned long long m_AggregatedRiskScoreOffset;
+        unsigned long long m_AggregatedRewardScoreOffset;
+        unsigned long long m_ActiveOffset;
+    };
+}
+
+#endif
@@ -0,0 +1,289 @@
+/**
+ * @file SEEGScoreCache.cpp
+ *
+ * Implementation of the SEEGScoreCache class
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include "SEEGScoreCache.h"
+#include <iostream>
+#include <cstdio>
+#include <QDir>
+#include <QFileInfo>
+
+namespace seeg {
+
+    static const char SCORE_CACHE_MAGIC[8] = { 'S', 'E', 'E', 'G', 'S', 'C', 'O', 'R' };
+
+    static const unsigned int SCORE_CACHE_VERSION = 1;
+
+    // written in the byte order of the host: entries of another byte order are not read
+    static const unsigned int SCORE_CACHE_BYTE_ORDER = 0x01020304;
+
+    // magic, version, byte order, key, data size
+    static const unsigned long long SCORE_CACHE_HEADER_SIZE = 8 + 4 + 4 + 16 + 8;
+
+    static const unsigned long long HASH_MULTIPLIER_1 = 0x9E3779B97F4A7C15ULL;
+    static const unsigned long long HASH_MULTIPLIER_2 = 0xC2B2AE3D27D4EB4FULL;
+
+    static unsigned long long RotateLeft(unsigned long long value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    // final mixing of a lane (splitmix64)
+    static unsigned long long MixLane(unsigned long long value) {
+        value ^= value >> 30;
+        value *= 0xBF58476D1CE4E5B9ULL;
+        value ^= value >> 27;
+        value *= 0x94D049BB133111EBULL;
+        value ^= value >> 31;
+        return value;
+    }
+
+    template <class VolumeType>
+    static ScoreCacheKey CalcVolumeKey(typename VolumeType::Pointer vol) {
+        SEEGScoreCacheKeyBuilder builder;
+        typename VolumeType::RegionType region = vol->GetBufferedRegion();
+        typename VolumeType::SpacingType spacing = vol->GetSpacing();
+        typename VolumeType::PointType origin = vol->GetOrigin();
+        typename VolumeType::DirectionType direction = vol->GetDirection();
+        for (int i=0; i<3; i++) {
+            builder.Add<long long>(region.GetIndex()[i]);
+            builder.Add<unsigned long long>(region.GetSize()[i]);
+            builder.Add<double>(spacing[i]);
+            builder.Add<double>(origin[i]);
+            for (int j=0; j<3; j++) {
+                builder.Add<double>(direction[i][j]);
+            }
+        }
+        builder.AddBytes(vol->GetBufferPointer(), region.GetNumberOfPixels() * sizeof(typename VolumeType::PixelType));
+        return builder.GetKey();
+    }
+
+
+    /**** CONSTRUCTORS / DESTRUCTOR ****/
+
+    SEEGScoreCacheKeyBuilder::SEEGScoreCacheKeyBuilder() {
+        m_Lanes[0] = 0x243F6A8885A308D3ULL;
+        m_Lanes[1] = 0x13198A2E03707344ULL;
+        m_Length = 0;
+        m_TailSize = 0;
+    }
+
+    ScoreCacheEntry::ScoreCacheEntry() {
+        m_Map = NULL;
+        m_MapSize = 0;
+        m_HeaderSize = SCORE_CACHE_HEADER_SIZE;
+    }
+
+    ScoreCacheEntry::~ScoreCacheEntry() {
+        if (m_Map != NULL) {
+            m_File.unmap((uchar*) m_Map);
+        }
+        if (m_File.isOpen()) {
+            m_File.close();
+        }
+    }
+
+    SEEGScoreCache::SEEGScoreCache(const string& directory) {
+        m_Directory = directory;
+        m_NumberOfHits = 0;
+        m_NumberOfMisses = 0;
+        QDir().mkpath(QString::fromStdString(directory));
+    }
+
+    SEEGScoreCache::~SEEGScoreCache() {
+        // Do nothing
+    }
+
+
+    /**** PUBLIC FUNCTIONS ****/
+
+    string ScoreCacheKey::ToString() const {
+        char buffer[33];
+        snprintf(buffer, sizeof(buffer), "%016llx%016llx", m_Hash[0], m_Hash[1]);
+        return string(buffer);
+    }
+
+    void SEEGScoreCacheKeyBuilder::AddBytes(const void* data, unsigned long long size) {
+        const unsigned char* bytes = (const unsigned char*) data;
+        m_Length += size;
+
+        // complete the pending word first
+        while (m_TailSize > 0 && m_TailSize < 8 && size > 0) {
+            m_Tail[m_TailSize++] = *bytes++;
+            size--;
+        }
+        if (m_TailSize == 8) {
+            unsigned long long word;
+            memcpy(&word, m_Tail, 8);
+            AddWord(word);
+            m_TailSize = 0;
+        }
+
+        while (size >= 8) {
+            unsigned long long word;
+            memcpy(&word, bytes, 8);
+            AddWord(word);
+            bytes += 8;
+            size -= 8;
+        }
+        while (size > 0) {
+            m_Tail[m_TailSize++] = *bytes++;
+            size--;
+        }
+    }
+
+    void SEEGScoreCacheKeyBuilder::AddString(const string& value) {
+        Add<unsigned long long>(value.size());
+        AddBytes(value.data(), value.size());
+    }
+
+    void SEEGScoreCacheKeyBuilder::AddKey(const ScoreCacheKey& key) {
+        Add<unsigned long long>(key.m_Hash[0]);
+        Add<unsigned long long>(key.m_Hash[1]);
+    }
+
+    void SEEGScoreCacheKeyBuilder::AddPoint(const Point3D& point) {
+        for (int i=0; i<3; i++) {
+            Add<double>(point[i]);
+        }
+    }
+
+    ScoreCacheKey SEEGScoreCacheKeyBuilder::GetKey() const {
+        unsigned long long lanes[2] = { m_Lanes[0], m_Lanes[1] };
+        unsigned long long tail = 0;
+        memcpy(&tail, m_Tail, m_TailSize);
+        lanes[0] = (lanes[0] ^ tail) * HASH_MULTIPLIER_1;
+        lanes[1] = RotateLeft(lanes[1] + tail, 31) * HASH_MULTIPLIER_2;
+
+        ScoreCacheKey key;
+        key.m_Hash[0] = MixLane(lanes[0] ^ m_Length);
+        key.m_Hash[1] = MixLane(lanes[1] + RotateLeft(m_Length, 17) + lanes[0]);
+        return key;
+    }
+
+    bool ScoreCacheEntry::Open(const string& filename, const ScoreCacheKey& key) {
+        m_File.setFileName(QString::fromStdString(filename));
+        if (!m_File.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        m_MapSize = m_File.size();
+        if (m_MapSize < SCORE_CACHE_HEADER_SIZE) {
+            return false;
+        }
+        m_Map = m_File.map(0, m_MapSize);
+        if (m_Map == NULL) {
+            return false;
+        }
+
+        unsigned long long position = 8;
+        if (memcmp(m_Map, SCORE_CACHE_MAGIC, 8) != 0 ||
+            SEEGScoreCache::ReadValue<unsigned int>(m_Map, position) != SCORE_CACHE_VERSION ||
+            SEEGScoreCache::ReadValue<unsigned int>(m_Map, position) != SCORE_CACHE_BYTE_ORDER) {
+            return false;
+        }
+        ScoreCacheKey fileKey;
+        fileKey.m_Hash[0] = SEEGScoreCache::ReadValue<unsigned long long>(m_Map, position);
+        fileKey.m_Hash[1] = SEEGScoreCache::ReadValue<unsigned long long>(m_Map, position);
+        unsigned long long dataSize = SEEGScoreCache::ReadValue<unsigned long long>(m_Map, position);
+        return fileKey == key && dataSize == m_MapSize - SCORE_CACHE_HEADER_SIZE;
+    }
+
+    const unsigned char* ScoreCacheEntry::GetData() {
+        return m_Map + m_HeaderSize;
+    }
+
+    unsigned long long ScoreCacheEntry::GetSize() {
+        return m_MapSize - m_HeaderSize;
+    }
+
+    string SEEGScoreCache::GetDirectory() {
+        return m_Directory;
+    }
+
+    ScoreCacheEntry::Pointer SEEGScoreCache::Find(const ScoreCacheKey& key) {
+        string filename = GetEntryFilename(key);
+        if (QFileInfo(QString::fromStdString(filename)).exists()) {
+            ScoreCacheEntry::Pointer entry = ScoreCacheEntry::New();
+            if (entry->Open(filename, key)) {
+                m_NumberOfHits++;
+                return entry;
+            }
+        }
+        m_NumberOfMisses++;
+        return ScoreCacheEntry::Pointer();
+    }
+
+    bool SEEGScoreCache::Store(const ScoreCacheKey& key, const vector<unsigned char>& data) {
+        vector<unsigned char> header(SCORE_CACHE_MAGIC, SCORE_CACHE_MAGIC + 8);
+        AppendValue<unsigned int>(header, SCORE_CACHE_VERSION);
+        AppendValue<unsigned int>(header, SCORE_CACHE_BYTE_ORDER);
+        AppendValue<unsigned long long>(header, key.m_Hash[0]);
+        AppendValue<unsigned long long>(header, key.m_Hash[1]);
+        AppendValue<unsigned long long>(header, data.size());
+
+        string filename = GetEntryFilename(key);
+        QString tmpFilename = QString::fromStdString(filename + ".tmp");
+        QFile file(tmpFilename);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            cout << "Unable to write score cache file " << filename << endl;
+            return false;
+        }
+        bool status = file.write((const char*) &header[0], header.size()) == (qint64) header.size();
+        if (status && !data.empty()) {
+            status = file.write((const char*) &data[0], data.size()) == (qint64) data.size();
+        }
+        file.close();
+
+        // entries are replaced only once completely written
+        QFile::remove(QString::fromStdString(filename));
+        if (!status || !QFile::rename(tmpFilename, QString::fromStdString(filename))) {
+            QFile::remove(tmpFilename);
+            cout << "Unable to write score cache file " << filename << endl;
+            return false;
+        }
+        return true;
+    }
+
+    ScoreCacheKey SEEGScoreCache::GetVolumeKey(IntVolume::Pointer vol) {
+        pair<unsigned long, ScoreCacheKey>& volumeKey = m_VolumeKeys[vol.GetPointer()];
+        if (volumeKey.first != vol->GetMTime() || volumeKey.first == 0) {
+            volumeKey.first = vol->GetMTime();
+            volumeKey.second = CalcVolumeKey<IntVolume>(vol);
+        }
+        return volumeKey.second;
+    }
+
+    ScoreCacheKey SEEGScoreCache::GetVolumeKey(FloatVolume::Pointer vol) {
+        pair<unsigned long, ScoreCacheKey>& volumeKey = m_VolumeKeys[vol.GetPointer()];
+        if (volumeKey.first != vol->GetMTime() || volumeKey.first == 0) {
+            volumeKey.first = vol->GetMTime();
+            volumeKey.second = CalcVolumeKey<FloatVolume>(vol);
+        }
+        return volumeKey.second;
+    }
+
+    unsigned int SEEGScoreCache::GetNumberOfHits() {
+        return m_NumberOfHits;
+    }
+
+    unsigned int SEEGScoreCache::GetNumberOfMisses() {
+        return m_NumberOfMisses;
+    }
+
+
+    /**** PRIVATE FUNCTIONS ****/
+
+    void SEEGScoreCacheKeyBuilder::AddWord(unsigned long long word) {
+        m_Lanes[0] = (m_Lanes[0] ^ word) * HASH_MULTIPLIER_1;
+        m_Lanes[0] ^= m_Lanes[0] >> 29;
+        m_Lanes[1] = RotateLeft(m_Lanes[1] + word, 31) * HASH_MULTIPLIER_2;
+    }
+
+    string SEEGScoreCache::GetEntryFilename(const ScoreCacheKey& key) {
+        return m_Directory + "/" + key.ToString() + ".scores";
+    }
+}
@@ -0,0 +1,180 @@
+#ifndef __SEEG_SCORE_CACHE_H__
+#define __SEEG_SCORE_CACHE_H__
+
+/**
+ * @file SEEGScoreCache.h
+ *
+ * Defines the SEEGScoreCache class: on-disk cache of the scores of the trajectory tests
+ * of the SEEGPathPlanner, keyed by a hash of everything the scores depend on.
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <vector>
+#include <string>
+#include <map>
+#include <cstring>
+#include <QFile>
+#include "BasicTypes.h"
+#include "VolumeTypes.h"
+
+using namespace std;
+
+namespace seeg {
+
+    /** 128-bit key of a cache entry */
+    struct ScoreCacheKey {
+
+        unsigned long long m_Hash[2];
+
+        ScoreCacheKey() {
+            m_Hash[0] = m_Hash[1] = 0;
+        }
+
+        bool operator==(const ScoreCacheKey& other) const {
+            return m_Hash[0] == other.m_Hash[0] && m_Hash[1] == other.m_Hash[1];
+        }
+
+        /** 32 hexadecimal digits (name of the file of the entry) */
+        string ToString() const;
+    };
+
+    /**
+     * Incremental (non cryptographic) 128-bit hash of the inputs of a test: volumes, configuration
+     * values, candidate coordinates, keys of previous tests...
+     */
+    class SEEGScoreCacheKeyBuilder {
+
+    public:
+        SEEGScoreCacheKeyBuilder();
+
+        /** Adds the bytes of data (e.g. a volume buffer). Structs are added field by field: their padding bytes are not initialized */
+        void AddBytes(const void* data, unsigned long long size);
+
+        template <class T>
+        void Add(T value) {
+            AddBytes(&value, sizeof(T));
+        }
+
+        void AddString(const string& value);
+
+        void AddKey(const ScoreCacheKey& key);
+
+        void AddPoint(const Point3D& point);
+
+        ScoreCacheKey GetKey() const;
+
+    private:
+        void AddWord(unsigned long long word);
+
+        unsigned long long m_Lanes[2];
+        unsigned long long m_Length;
+
+        /** Bytes that do not fill a word yet */
+        unsigned char m_Tail[8];
+        unsigned int m_TailSize;
+    };
+
+    /**
+     * One entry of the cache, memory mapped (valid as long as the object exists)
+     */
+    class ScoreCacheEntry {
+
+    public:
+        /** SmartPointer type for the ScoreCacheEntry class */
+        typedef mrilSmartPtr<ScoreCacheEntry> Pointer;
+
+        static Pointer New() { return Pointer(new ScoreCacheEntry()); }
+
+    protected:
+        ScoreCacheEntry();
+
+    public:
+        virtual ~ScoreCacheEntry();
+
+        /** Maps the file of an entry, false if it is not a valid entry for key */
+        bool Open(const string& filename, const ScoreCacheKey& key);
+
+        const unsigned char* GetData();
+
+        unsigned long long GetSize();
+
+    private:
+        QFile m_File;
+        const unsigned char* m_Map;
+        unsigned long long m_MapSize;
+        unsigned long long m_HeaderSize;
+    };
+
+    /**
+     * Entries are stored as one file per key in a directory, so they survive the session. The data
+     * of an entry is an opaque byte array (written in the byte order of the host, entries of
+     * hosts of another byte order are ignored). Entries are written to a temporary file and renamed
+     * so that a partially written entry is never read.
+     *
+     * Volume hashes (content, geometry) are kept in memory per volume and recomputed when the volume
+     * is modified (itk::Object::GetMTime()).
+     */
+    class SEEGScoreCache {
+
+    public:
+        /** SmartPointer type for the SEEGScoreCache class */
+        typedef mrilSmartPtr<SEEGScoreCache> Pointer;
+
+        static Pointer New(const string& directory) { return Pointer(new SEEGScoreCache(directory)); }
+
+    protected:
+        SEEGScoreCache(const string& directory);
+
+    public:
+        virtual ~SEEGScoreCache();
+
+        string GetDirectory();
+
+        /** @return the mapped entry of key, null if not in the cache */
+        ScoreCacheEntry::Pointer Find(const ScoreCacheKey& key);
+
+        /** Writes (or replaces) the entry of key */
+        bool Store(const ScoreCacheKey& key, const vector<unsigned char>& data);
+
+        /** Hash of the geometry and pixels of a volume */
+        ScoreCacheKey GetVolumeKey(IntVolume::Pointer vol);
+        ScoreCacheKey GetVolumeKey(FloatVolume::Pointer vol);
+
+        /** Number of Find() calls that found / did not find their entry */
+        unsigned int GetNumberOfHits();
+        unsigned int GetNumberOfMisses();
+
+        /*** Serialization of entry data ***/
+
+        template <class T>
+        static void AppendValue(vector<unsigned char>& data, T value) {
+            unsigned char bytes[sizeof(T)];
+            memcpy(bytes, &value, sizeof(T));
+            data.insert(data.end(), bytes, bytes + sizeof(T));
+        }
+
+        /** Reads a value at position and moves position after it */
+        template <class T>
+        static T ReadValue(const unsigned char* data, unsigned long long& position) {
+            T value;
+            memcpy(&value, data + position, sizeof(T));
+            position += sizeof(T);
+            return value;
+        }
+
+    private:
+        string GetEntryFilename(const ScoreCacheKey& key);
+
+        string m_Directory;
+
+        /** Volume hashes: volume -> (modification time, key) */
+        map<const void*, pair<unsigned long, ScoreCacheKey> > m_VolumeKeys;
+
+        unsigned int m_NumberOfHits;
+        unsigned int m_NumberOfMisses;
+    };
+}
+
+#endif
@@ -0,0 +1,155 @@
+/**
+ * @file SEEGSkullPointIndex.cpp
+ *
+ * Implementation of the SEEGSkullPointIndex class
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include "SEEGSkullPointIndex.h"
+#include <math.h>
+#include <map>
+#include <algorithm>
+
+namespace seeg {
+
+    // margin (degrees) on the bound of a cell, for the rounding of the angles in float
+    static const float ANGLE_BOUND_MARGIN = 1e-3f;
+
+    /**** CONSTRUCTORS / DESTRUCTOR ****/
+
+    SEEGSkullPointIndex::SEEGSkullPointIndex(FloatVolume::Pointer normalVol) {
+        m_Volume = normalVol.GetPointer();
+        m_VolumeMTime = normalVol->GetMTime();
+
+        // same voxels, in the same order, as the scan of TestVectorOverlap()
+        map<long long, vector<unsigned int> > cellPoints;
+        FloatVolumeRegionIteratorWithIndex it(normalVol, normalVol->GetRequestedRegion());
+        for (it.GoToBegin(); !it.IsAtEnd(); ++it) {
+            if (!it.Get()) {
+                continue;
+            }
+            FloatVolume::IndexType voxelIndex = it.GetIndex();
+            Point3D ptInSkull;
+            normalVol->TransformIndexToPhysicalPoint(voxelIndex, ptInSkull);
+            unsigned int id = m_Indices.size();
+            m_Indices.push_back(voxelIndex);
+            for (int i=0; i<3; i++) {
+                m_Coords.push_back(ptInSkull[i]);
+            }
+            long long cellKey = 0;
+            for (int i=2; i>=0; i--) {
+                cellKey = (cellKey << 21) + (((long long) floor((double) voxelIndex[i] / CELL_SIZE)) & 0x1FFFFF);
+            }
+            cellPoints[cellKey].push_back(id);
+        }
+
+        m_PointIds.reserve(m_Indices.size());
+        m_Cells.reserve(cellPoints.size());
+        for (map<long long, vector<unsigned int> >::iterator itCell = cellPoints.begin(); itCell != cellPoints.end(); itCell++) {
+            const vector<unsigned int>& ids = itCell->second;
+            Cell cell;
+            cell.m_FirstPoint = m_PointIds.size();
+            cell.m_NumPoints = ids.size();
+            double minCoords[3], maxCoords[3];
+            for (int i=0; i<3; i++) {
+                minCoords[i] = maxCoords[i] = m_Coords[3 * ids[0] + i];
+            }
+            for (unsigned int iPoint=0; iPoint<ids.size(); iPoint++) {
+                m_PointIds.push_back(ids[iPoint]);
+                for (int i=0; i<3; i++) {
+                    minCoords[i] = min(minCoords[i], m_Coords[3 * ids[iPoint] + i]);
+                    maxCoords[i] = max(maxCoords[i], m_Coords[3 * ids[iPoint] + i]);
+                }
+            }
+            cell.m_Radius = 0;
+            for (int i=0; i<3; i++) {
+                cell.m_Center[i] = 0.5 * (minCoords[i] + maxCoords[i]);
+                cell.m_Radius += 0.25 * (maxCoords[i] - minCoords[i]) * (maxCoords[i] - minCoords[i]);
+            }
+            cell.m_Radius = sqrt(cell.m_Radius);
+            m_Cells.push_back(cell);
+        }
+    }
+
+    SEEGSkullPointIndex::~SEEGSkullPointIndex() {
+        // Do nothing
+    }
+
+
+    /**** PUBLIC FUNCTIONS ****/
+
+    unsigned int SEEGSkullPointIndex::GetNumberOfPoints() {
+        return m_Indices.size();
+    }
+
+    bool SEEGSkullPointIndex::FindClosestAngle(const Point3D& entryPoint, const Vector3D_lf& direction,
+                                               FloatVolume::IndexType& index, Point3D& point, float& angle) {
+        Vector3D_lf lineDir = direction / norm(direction);
+
+        // lower bound of the angle of the points of each cell
+        vector<pair<float, unsigned int> > cellOrder;
+        cellOrder.reserve(m_Cells.size());
+        for (unsigned int iCell=0; iCell<m_Cells.size(); iCell++) {
+            const Cell& cell = m_Cells[iCell];
+            Vector3D_lf v(entryPoint[0] - cell.m_Center[0], entryPoint[1] - cell.m_Center[1], entryPoint[2] - cell.m_Center[2]);
+            double dist = sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+            float bound = 0;
+            if (dist > cell.m_Radius) {
+                bound = CalcLineAngle(lineDir, v) - (float) rad2deg(asin(cell.m_Radius / dist));
+                if (isnan(bound)) {
+                    bound = 0; // dot product rounded below -1: visit the cell
+                }
+            }
+            cellOrder.push_back(make_pair(bound - ANGLE_BOUND_MARGIN, iCell));
+        }
+        sort(cellOrder.begin(), cellOrder.end());
+
+        float minAngle = 90; // as TestVectorOverlap(): only points closer than 90 degrees
+        int closestId = -1;
+        for (unsigned int iOrder=0; iOrder<cellOrder.size() && cellOrder[iOrder].first <= minAngle; iOrder++) {
+            const Cell& cell = m_Cells[cellOrder[iOrder].second];
+            for (unsigned int iPoint=cell.m_FirstPoint; iPoint<cell.m_FirstPoint + cell.m_NumPoints; iPoint++) {
+                unsigned int id = m_PointIds[iPoint];
+                Vector3D_lf v(entryPoint[0] - m_Coords[3 * id],
+                              entryPoint[1] - m_Coords[3 * id + 1],
+                              entryPoint[2] - m_Coords[3 * id + 2]);
+                float angleSkullPt = CalcLineAngle(lineDir, v);
+                if (angleSkullPt < minAngle || (angleSkullPt == minAngle && closestId >= 0 && id < (unsigned int) closestId)) {
+                    minAngle = angleSkullPt;
+                    closestId = id;
+                }
+            }
+        }
+        if (closestId < 0) {
+            return false;
+        }
+        index = m_Indices[closestId];
+        for (int i=0; i<3; i++) {
+            point[i] = m_Coords[3 * closestId + i];
+        }
+        angle = minAngle;
+        return true;
+    }
+
+    const FloatVolume* SEEGSkullPointIndex::GetVolume() {
+        return m_Volume;
+    }
+
+    unsigned long SEEGSkullPointIndex::GetVolumeMTime() {
+        return m_VolumeMTime;
+    }
+
+
+    /**** PRIVATE FUNCTIONS ****/
+
+    float SEEGSkullPointIndex::CalcLineAngle(const Vector3D_lf& lineDir, Vector3D_lf v) {
+        v = v / norm(v);
+        float dotProd = lineDir.x * v.x + lineDir.y * v.y + lineDir.z * v.z;
+        if (dotProd > 1) dotProd = 1;
+        float a = acos(dotProd);
+        a = rad2deg(a);
+        return min(fabs(a), fabs(180 - a));
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef __SEEG_SKULL_POINT_INDEX_H__
+#define __SEEG_SKULL_POINT_INDEX_H__
+
+/**
+ * @file SEEGSkullPointIndex.h
+ *
+ * Defines the SEEGSkullPointIndex class: the voxels of the skull that have a normal, extracted once
+ * in a compact array and grouped in cells, to find the skull point that is the most aligned with a
+ * trajectory without scanning the volume (fallback of SEEGPathPlanner::TestVectorOverlap()).
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <vector>
+#include "BasicTypes.h"
+#include "MathUtils.h"
+#include "VolumeTypes.h"
+
+using namespace std;
+
+namespace seeg {
+
+    /**
+     * Points are the non-zero voxels of a normal volume (x component), in the order of a region
+     * iterator over its requested region. They are grouped in cells of CELL_SIZE^3 voxels, each cell
+     * bounded by a sphere: the angle between a line and the points of a cell, seen from a point on
+     * the line, cannot be smaller than the angle to the center of the sphere minus its angular radius.
+     * Cells are visited by increasing bound, until the bound exceeds the best angle found.
+     *
+     * Angles are computed as SEEGPathPlanner::CalcAngleBetweenTrajectories() and folded in [0, 90]
+     * (a line has no orientation); when several points have the same angle the first one in the
+     * iterator order is returned, as the full scan does.
+     */
+    class SEEGSkullPointIndex {
+
+    public:
+        /** SmartPointer type for the SEEGSkullPointIndex class */
+        typedef mrilSmartPtr<SEEGSkullPointIndex> Pointer;
+
+        /** Size of the cells in voxels */
+        static const int CELL_SIZE = 8;
+
+        static Pointer New(FloatVolume::Pointer normalVol) { return Pointer(new SEEGSkullPointIndex(normalVol)); }
+
+    protected:
+        SEEGSkullPointIndex(FloatVolume::Pointer normalVol);
+
+    public:
+        virtual ~SEEGSkullPointIndex();
+
+        unsigned int GetNumberOfPoints();
+
+        /**
+         * Finds the skull point p with the smallest angle between entryPoint - p and the line of direction
+         *
+         * @param index where to store the voxel index of the point
+         * @param point where to store the point (world coordinates)
+         * @param angle where to store the angle (degrees, in [0, 90))
+         * @return false if no point makes an angle smaller than 90 degrees
+         */
+        bool FindClosestAngle(const Point3D& entryPoint, const Vector3D_lf& direction,
+                              FloatVolume::IndexType& index, Point3D& point, float& angle);
+
+        /** Volume the points were extracted from and its modification time at that moment */
+        const FloatVolume* GetVolume();
+        unsigned long GetVolumeMTime();
+
+    private:
+        /** Points of a cell (m_PointIds[m_FirstPoint, m_FirstPoint + m_NumPoints)) and their bounding sphere */
+        struct Cell {
+            unsigned int m_FirstPoint;
+            unsigned int m_NumPoints;
+            double m_Center[3];
+            double m_Radius;
+        };
+
+        /** Angle (degrees, folded in [0, 90]) between the line of unit direction lineDir and v */
+        static float CalcLineAngle(const Vector3D_lf& lineDir, Vector3D_lf v);
+
+        const FloatVolume* m_Volume;
+        unsigned long m_VolumeMTime;
+
+        /** World coordinates (3 per point) and voxel indices of the points, in iterator order */
+        vector<double> m_Coords;
+        vector<FloatVolume::IndexType> m_Indices;
+
+        vector<Cell> m_Cells;
+
+        /** IDs of the points grouped by cell (increasing IDs within a cell) */
+        vector<unsigned int> m_PointIds;
+    };
+}
+
+#endif
@@ -0,0 +1,118 @@
+/**
+ * @file SEEGStructureDistanceMap.cpp
+ *
+ * Implementation of the SEEGStructureDistanceMap class
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include "SEEGStructureDistanceMap.h"
+#include <math.h>
+#include <float.h>
+
+namespace seeg {
+
+    /**** CONSTRUCTORS / DESTRUCTOR ****/
+
+    SEEGStructureDistanceMap::SEEGStructureDistanceMap(IntVolume::Pointer structureVol) {
+        m_StructureVolume = structureVol;
+
+        // distance in mm (UseImageSpacing), negative inside the structure
+        SignedDistanceFilterType::Pointer distanceFilter = SignedDistanceFilterType::New();
+        distanceFilter->SetInput(structureVol);
+        distanceFilter->SetBackgroundValue(0);
+        distanceFilter->SetInsideIsPositive(false);
+        distanceFilter->SetSquaredDistance(false);
+        distanceFilter->SetUseImageSpacing(true);
+        distanceFilter->Update();
+        m_DistanceMap = distanceFilter->GetOutput();
+        m_DistanceMap->DisconnectPipeline();
+
+        FloatVolume::SpacingType spacing = m_DistanceMap->GetSpacing();
+        m_SamplingStep = spacing[0];
+        for (int i=1; i<3; i++) {
+            if (spacing[i] < m_SamplingStep) {
+                m_SamplingStep = spacing[i];
+            }
+        }
+        m_VoxelDiagonal = sqrt(spacing[0]*spacing[0] + spacing[1]*spacing[1] + spacing[2]*spacing[2]);
+    }
+
+    SEEGStructureDistanceMap::~SEEGStructureDistanceMap() {
+        // Do nothing
+    }
+
+
+    /**** PUBLIC FUNCTIONS ****/
+
+    IntVolume::Pointer SEEGStructureDistanceMap::GetStructureVolume() {
+        return m_StructureVolume;
+    }
+
+    FloatVolume::Pointer SEEGStructureDistanceMap::GetDistanceMap() {
+        return m_DistanceMap;
+    }
+
+    bool SEEGStructureDistanceMap::GetDistance(const Point3D& pointWorld, float& dist) {
+        FloatVolume::IndexType index;
+        if (!m_DistanceMap->TransformPhysicalPointToIndex(pointWorld, index)) {
+            return false;
+        }
+        dist = m_DistanceMap->GetPixel(index);
+        return true;
+    }
+
+    float SEEGStructureDistanceMap::CalcPrefixMinDistances(const Point3D& p1, const Point3D& p2, vector<float>& prefixMinDist) {
+        Vector3D_lf v1(p1[0], p1[1], p1[2]);
+        Vector3D_lf v2(p2[0], p2[1], p2[2]);
+        double length = norm(v2 - v1);
+        int nSamples = (int) ceil(length / m_SamplingStep) + 1;
+
+        prefixMinDist.resize(nSamples);
+        float minDist = FLT_MAX;
+        for (int iSample=0; iSample<nSamples; iSample++) {
+            double t = (nSamples > 1) ? (double) iSample / (nSamples - 1) : 0;
+            Point3D samplePoint;
+            for (int i=0; i<3; i++) {
+                samplePoint[i] = p1[i] + t * (p2[i] - p1[i]);
+            }
+            float dist;
+            if (!GetDistance(samplePoint, dist)) {
+                dist = -FLT_MAX; // outside the volume: nothing beyond this sample can be skipped
+            }
+            minDist = (dist < minDist) ? dist : minDist;
+            prefixMinDist[iSample] = minDist;
+        }
+        return (nSamples > 1) ? length / (nSamples - 1) : 0;
+    }
+
+    float SEEGStructureDistanceMap::GetScreeningMargin() {
+        return m_SamplingStep / 2 + m_VoxelDiagonal;
+    }
+
+    bool SEEGStructureDistanceMap::IsSegmentFartherThan(const Point3D& p1, const Point3D& p2, float maxDist) {
+        // Every point of the segment is within step/2 of a sample. The distance map is read at the
+        // voxel containing the sample (half a diagonal away) and the dense test rounds the end
+        // points to voxel indices (another half diagonal).
+        float threshold = maxDist + GetScreeningMargin();
+
+        Vector3D_lf v1(p1[0], p1[1], p1[2]);
+        Vector3D_lf v2(p2[0], p2[1], p2[2]);
+        double length = norm(v2 - v1);
+        int nSamples = (int) ceil(length / m_SamplingStep) + 1;
+
+        for (int iSample=0; iSample<nSamples; iSample++) {
+            double t = (nSamples > 1) ? (double) iSample / (nSamples - 1) : 0;
+            Point3D samplePoint;
+            for (int i=0; i<3; i++) {
+                samplePoint[i] = p1[i] + t * (p2[i] - p1[i]);
+            }
+            float dist;
+            if (!GetDistance(samplePoint, dist) || dist <= threshold) {
+                return false; // close to the structure (or outside the volume): cannot decide here
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef __SEEG_STRUCTURE_DISTANCE_MAP_H__
+#define __SEEG_STRUCTURE_DISTANCE_MAP_H__
+
+/**
+ * @file SEEGStructureDistanceMap.h
+ *
+ * Defines the SEEGStructureDistanceMap class: a signed euclidean distance transform (EDT)
+ * of a critical structure (ventricles, sulci, vessels, midline), computed once per patient
+ * and sampled along trajectories by the binary risk tests.
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include "BasicTypes.h"
+#include "MathUtils.h"
+#include "VolumeTypes.h"
+#include "itkSignedMaurerDistanceMapImageFilter.h"
+#include <vector>
+
+using namespace std;
+
+namespace seeg {
+
+    /**
+     * Signed distance (in mm) of every voxel to the closest foreground voxel of a binary
+     * structure (negative inside the structure). Once computed, the map is read-only and
+     * can be sampled from several threads.
+     */
+    class SEEGStructureDistanceMap {
+
+    public:
+        /** SmartPointer type for the SEEGStructureDistanceMap class */
+        typedef mrilSmartPtr<SEEGStructureDistanceMap> Pointer;
+
+        static Pointer New(IntVolume::Pointer structureVol) { return Pointer(new SEEGStructureDistanceMap(structureVol)); }
+
+    protected:
+        SEEGStructureDistanceMap(IntVolume::Pointer structureVol);
+
+    public:
+        virtual ~SEEGStructureDistanceMap();
+
+        /**
+         * Signed distance of the voxel containing pointWorld to the structure
+         *
+         * @param pointWorld point in world coordinates
+         * @param dist where to store the distance (in mm)
+         * @return false if the point is outside the volume
+         */
+        bool GetDistance(const Point3D& pointWorld, float& dist);
+
+        /**
+         * Conservative test used to skip the dense binary test: returns true only if no
+         * foreground voxel can be within maxDist of the segment [p1,p2], accounting for the
+         * sampling step and for the voxel rounding of the distance map and of the segment end points.
+         */
+        bool IsSegmentFartherThan(const Point3D& p1, const Point3D& p2, float maxDist);
+
+        /**
+         * Samples the distance map along [p1,p2] (every sampling step, starting at p1) and keeps the
+         * running minimum, so that the segments [p1,p] for every p on the line can be screened at once
+         *
+         * @param prefixMinDist where to store the minimum distance of samples 0..i (-FLT_MAX once a sample falls outside the volume)
+         * @return distance (in mm) between consecutive samples
+         */
+        float CalcPrefixMinDistances(const Point3D& p1, const Point3D& p2, vector<float>& prefixMinDist);
+
+        /** Margin added to maxDist by the screening tests (sampling step and voxel rounding) */
+        float GetScreeningMargin();
+
+        /** Structure volume the distance map was computed from */
+        IntVolume::Pointer GetStructureVolume();
+
+        FloatVolume::Pointer GetDistanceMap();
+
+    private:
+
+        typedef itk::SignedMaurerDistanceMapImageFilter<IntVolume, FloatVolume> SignedDistanceFilterType;
+
+        /** Binary volume of the critical structure */
+        IntVolume::Pointer m_StructureVolume;
+
+        /** Signed distance map (in mm) */
+        FloatVolume::Pointer m_DistanceMap;
+
+        /** Sampling step along the trajectories (smallest voxel spacing) */
+        float m_SamplingStep;
+
+        /** Length of the voxel diagonal (in mm) */
+        float m_VoxelDiagonal;
+    };
+}
+
+#endif
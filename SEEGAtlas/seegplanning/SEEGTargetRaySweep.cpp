@@ -0,0 +1,203 @@
+/**
+ * @file SEEGTargetRaySweep.cpp
+ *
+ * Implementation of the SEEGTargetRaySweep class
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include "SEEGTargetRaySweep.h"
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+namespace seeg {
+
+    /** Rays are sorted by the cell of their direction on a cube map (6 faces of DIRECTION_BINS x DIRECTION_BINS) */
+    static const int DIRECTION_BINS = 16;
+
+    static unsigned int GetDirectionCell(const double direction[3]) {
+        int axis = 0;
+        for (int i=1; i<3; i++) {
+            if (fabs(direction[i]) > fabs(direction[axis])) {
+                axis = i;
+            }
+        }
+        double length = fabs(direction[axis]);
+        if (length == 0) {
+            return 0;
+        }
+        unsigned int face = 2 * axis + (direction[axis] < 0 ? 1 : 0);
+        int u = (int) ((direction[(axis + 1) % 3] / length + 1) * 0.5 * (DIRECTION_BINS - 1) + 0.5);
+        int v = (int) ((direction[(axis + 2) % 3] / length + 1) * 0.5 * (DIRECTION_BINS - 1) + 0.5);
+        return (face * DIRECTION_BINS + u) * DIRECTION_BINS + v;
+    }
+
+
+    /**** CONSTRUCTORS / DESTRUCTOR ****/
+
+    SEEGTargetRaySweep::SEEGTargetRaySweep(FloatVolume::Pointer distanceMap) {
+        m_DistanceMap = distanceMap;
+        m_Buffer = distanceMap->GetBufferPointer();
+
+        FloatVolume::RegionType region = distanceMap->GetBufferedRegion();
+        FloatVolume::SpacingType spacing = distanceMap->GetSpacing();
+        FloatVolume::DirectionType direction = distanceMap->GetDirection();
+        FloatVolume::PointType origin;
+        distanceMap->TransformIndexToPhysicalPoint(region.GetIndex(), origin);
+        for (int i=0; i<3; i++) {
+            m_Size[i] = region.GetSize()[i];
+            m_Origin[i] = origin[i];
+            for (int j=0; j<3; j++) {
+                m_IndexToWorld[i][j] = direction[i][j] * spacing[j];
+                m_WorldToIndex[j][i] = direction[i][j] / spacing[j]; // direction is orthonormal
+            }
+        }
+
+        m_MaxDist = 0;
+        m_StopDist = -1;
+        m_RiskTable.assign(1, 1.0f);
+        m_RiskTableStep = 1;
+    }
+
+    SEEGTargetRaySweep::~SEEGTargetRaySweep() {
+        // Do nothing
+    }
+
+
+    /**** PUBLIC FUNCTIONS ****/
+
+    void SEEGTargetRaySweep::SetMaxDistance(float maxDist) {
+        m_MaxDist = maxDist;
+    }
+
+    float SEEGTargetRaySweep::GetMaxDistance() {
+        return m_MaxDist;
+    }
+
+    void SEEGTargetRaySweep::SetRiskTable(const vector<float>& risk, float step) {
+        if (risk.empty() || step <= 0) {
+            return;
+        }
+        m_RiskTable = risk;
+        m_RiskTableStep = step;
+    }
+
+    void SEEGTargetRaySweep::SetStopDistance(float stopDist) {
+        m_StopDist = stopDist;
+    }
+
+    float SEEGTargetRaySweep::GetStopDistance() {
+        return m_StopDist;
+    }
+
+    void SEEGTargetRaySweep::Sweep(const Point3D& target, const vector<Point3D>& endPoints, vector<RaySweepScore>& scores) const {
+        scores.resize(endPoints.size());
+
+        double targetIndex[3];
+        WorldToIndex(target, targetIndex);
+
+        vector<double> endIndices(3 * endPoints.size());
+        vector<pair<unsigned int, unsigned int> > rayOrder(endPoints.size()); // (direction cell, ray)
+        for (unsigned int iRay=0; iRay<endPoints.size(); iRay++) {
+            WorldToIndex(endPoints[iRay], &endIndices[3 * iRay]);
+            double direction[3];
+            for (int i=0; i<3; i++) {
+                direction[i] = endIndices[3 * iRay + i] - targetIndex[i];
+            }
+            rayOrder[iRay] = make_pair(GetDirectionCell(direction), iRay);
+        }
+        sort(rayOrder.begin(), rayOrder.end());
+
+        for (unsigned int iOrder=0; iOrder<rayOrder.size(); iOrder++) {
+            unsigned int iRay = rayOrder[iOrder].second;
+            CastRay(targetIndex, &endIndices[3 * iRay], scores[iRay]);
+        }
+    }
+
+
+    /**** PRIVATE FUNCTIONS ****/
+
+    void SEEGTargetRaySweep::CastRay(const double p1[3], const double p2[3], RaySweepScore& score) const {
+        score.m_MinDist = FLT_MAX;
+        score.m_RiskSum = 0;
+        score.m_NumVoxels = 0;
+        score.m_Stopped = false;
+        long long minDistVoxel[3] = { 0, 0, 0 };
+
+        // Amanatides & Woo: voxel v covers the continuous indices [v-0.5, v+0.5), t goes from 0 (p1) to 1 (p2)
+        long long voxel[3];
+        int step[3];
+        double tMax[3], tDelta[3];
+        for (int i=0; i<3; i++) {
+            voxel[i] = (long long) floor(p1[i] + 0.5);
+            double delta = p2[i] - p1[i];
+            if (delta > 0) {
+                step[i] = 1;
+                tMax[i] = (voxel[i] + 0.5 - p1[i]) / delta;
+                tDelta[i] = 1 / delta;
+            } else if (delta < 0) {
+                step[i] = -1;
+                tMax[i] = (voxel[i] - 0.5 - p1[i]) / delta;
+                tDelta[i] = -1 / delta;
+            } else {
+                step[i] = 0;
+                tMax[i] = DBL_MAX;
+                tDelta[i] = DBL_MAX;
+            }
+        }
+
+        while (voxel[0] >= 0 && voxel[0] < m_Size[0] &&
+               voxel[1] >= 0 && voxel[1] < m_Size[1] &&
+               voxel[2] >= 0 && voxel[2] < m_Size[2]) {
+            float dist = m_Buffer[(voxel[2] * m_Size[1] + voxel[1]) * m_Size[0] + voxel[0]];
+            score.m_NumVoxels++;
+            if (dist < score.m_MinDist) {
+                score.m_MinDist = dist;
+                for (int i=0; i<3; i++) {
+                    minDistVoxel[i] = voxel[i];
+                }
+            }
+            if (dist <= m_MaxDist) {
+                score.m_RiskSum += GetRisk(dist);
+            }
+            if (dist < m_StopDist) {
+                score.m_Stopped = true;
+                break;
+            }
+
+            int axis = (tMax[0] < tMax[1]) ? ((tMax[0] < tMax[2]) ? 0 : 2) : ((tMax[1] < tMax[2]) ? 1 : 2);
+            if (tMax[axis] > 1) {
+                break; // p2 is in the current voxel
+            }
+            voxel[axis] += step[axis];
+            tMax[axis] += tDelta[axis];
+        }
+
+        if (score.m_NumVoxels > 0) {
+            for (int i=0; i<3; i++) {
+                score.m_PointAtMinDist[i] = m_Origin[i] + m_IndexToWorld[i][0] * minDistVoxel[0]
+                                          + m_IndexToWorld[i][1] * minDistVoxel[1] + m_IndexToWorld[i][2] * minDistVoxel[2];
+            }
+        }
+    }
+
+    void SEEGTargetRaySweep::WorldToIndex(const Point3D& point, double index[3]) const {
+        double offset[3];
+        for (int i=0; i<3; i++) {
+            offset[i] = point[i] - m_Origin[i];
+        }
+        for (int i=0; i<3; i++) {
+            index[i] = m_WorldToIndex[i][0] * offset[0] + m_WorldToIndex[i][1] * offset[1] + m_WorldToIndex[i][2] * offset[2];
+        }
+    }
+
+    float SEEGTargetRaySweep::GetRisk(float dist) const {
+        if (dist <= 0) {
+            return m_RiskTable[0];
+        }
+        unsigned int entry = (unsigned int) (dist / m_RiskTableStep + 0.5f);
+        return m_RiskTable[min(entry, (unsigned int) m_RiskTable.size() - 1)];
+    }
+}
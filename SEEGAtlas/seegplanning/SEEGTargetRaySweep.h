@@ -0,0 +1,120 @@
+#ifndef __SEEG_TARGET_RAY_SWEEP_H__
+#define __SEEG_TARGET_RAY_SWEEP_H__
+
+/**
+ * @file SEEGTargetRaySweep.h
+ *
+ * Defines the SEEGTargetRaySweep class: scores all the trajectories that share a target point by
+ * casting rays from the target through the distance map of a critical structure (3D-DDA).
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <vector>
+#include "BasicTypes.h"
+#include "MathUtils.h"
+#include "VolumeTypes.h"
+
+using namespace std;
+
+namespace seeg {
+
+    /**
+     * Risk of one ray of SEEGTargetRaySweep::Sweep()
+     */
+    struct RaySweepScore {
+
+        /** Smallest distance to the structure of the voxels crossed by the ray (FLT_MAX if none) */
+        float m_MinDist;
+
+        /** Center of the voxel where m_MinDist was found (world coordinates) */
+        Point3D m_PointAtMinDist;
+
+        /** Sum of the risk of the voxels crossed within the maximum distance */
+        float m_RiskSum;
+
+        /** Number of voxels crossed */
+        unsigned int m_NumVoxels;
+
+        /** true if the ray stopped at a voxel closer than the stop distance */
+        bool m_Stopped;
+    };
+
+    /**
+     * The cylinder around a trajectory is handled by the distance map (EDT) of the structure: a
+     * structure voxel is within r of the trajectory when a voxel crossed by the trajectory has a
+     * distance <= r (up to half a voxel diagonal). A ray therefore only reads the voxels it crosses,
+     * from the target outwards, instead of computing the distance map of its own cylinder.
+     *
+     * All the rays of a target are cast in one call, ordered by direction so that consecutive rays
+     * read the same voxels around the target. Rays stop at the end point or at the border of the volume.
+     *
+     * Once configured, Sweep() does not modify the object and can be called from several threads.
+     */
+    class SEEGTargetRaySweep {
+
+    public:
+        /** SmartPointer type for the SEEGTargetRaySweep class */
+        typedef mrilSmartPtr<SEEGTargetRaySweep> Pointer;
+
+        /**
+         * @param distanceMap distance (in mm) of every voxel to the structure, negative inside
+         *                    (see SEEGStructureDistanceMap::GetDistanceMap())
+         */
+        static Pointer New(FloatVolume::Pointer distanceMap) { return Pointer(new SEEGTargetRaySweep(distanceMap)); }
+
+    protected:
+        SEEGTargetRaySweep(FloatVolume::Pointer distanceMap);
+
+    public:
+        virtual ~SEEGTargetRaySweep();
+
+        /** Voxels farther than maxDist from the structure add no risk */
+        void SetMaxDistance(float maxDist);
+        float GetMaxDistance();
+
+        /**
+         * Risk of a voxel as a function of its distance to the structure
+         *
+         * @param risk risk[k] is the risk at distance k*step (the last value is used beyond the table)
+         */
+        void SetRiskTable(const vector<float>& risk, float step);
+
+        /** A ray stops at the first voxel closer than stopDist to the structure (< 0: never) */
+        void SetStopDistance(float stopDist);
+        float GetStopDistance();
+
+        /**
+         * Casts the rays from target to every end point
+         *
+         * @param scores where to store the score of each ray (same order as endPoints)
+         */
+        void Sweep(const Point3D& target, const vector<Point3D>& endPoints, vector<RaySweepScore>& scores) const;
+
+    private:
+        /** Walks the voxels crossed by [p1,p2] (continuous indices) */
+        void CastRay(const double p1[3], const double p2[3], RaySweepScore& score) const;
+
+        /** World -> continuous index */
+        void WorldToIndex(const Point3D& point, double index[3]) const;
+
+        float GetRisk(float dist) const;
+
+        FloatVolume::Pointer m_DistanceMap;
+        const float* m_Buffer;
+        long long m_Size[3];
+
+        /** index -> world: m_Origin + m_IndexToWorld * index (index from the start of the buffered region) */
+        double m_Origin[3];
+        double m_IndexToWorld[3][3];
+        double m_WorldToIndex[3][3];
+
+        float m_MaxDist;
+        float m_StopDist;
+        vector<float> m_RiskTable;
+        float m_RiskTableStep;
+    };
+}
+
+#endif
@@ -0,0 +1,463 @@
+/**
+ * @file SEEGTrajectoryCandidates.cpp
+ *
+ * Implementation of the SEEGTrajectoryCandidates class
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include "SEEGTrajectoryCandidates.h"
+#include <math.h>
+#include <iostream>
+#include <algorithm>
+
+namespace seeg {
+
+    /**** CONSTRUCTORS / DESTRUCTOR ****/
+
+    SEEGTrajectoryCandidates::SEEGTrajectoryCandidates(SEEGTrajectoryTestRegistry::Pointer testRegistry, SEEGElectrodeModel::Pointer electrodeModel) {
+        m_TestRegistry = testRegistry;
+        m_ElectrodeModel = electrodeModel;
+    }
+
+    SEEGTrajectoryCandidates::~SEEGTrajectoryCandidates() {
+        // Do nothing
+    }
+
+
+    /**** PUBLIC FUNCTIONS ****/
+
+    void SEEGTrajectoryCandidates::Clear() {
+        m_EntryX.clear();
+        m_EntryY.clear();
+        m_EntryZ.clear();
+        m_TargetX.clear();
+        m_TargetY.clear();
+        m_TargetZ.clear();
+        m_DirX.clear();
+        m_DirY.clear();
+        m_DirZ.clear();
+        m_Length.clear();
+        m_RejectionMask.clear();
+        m_AggregatedRiskScore.clear();
+        m_AggregatedRewardScore.clear();
+        m_AggregatedScore.clear();
+        m_TestColumns.clear();
+        m_HasTestColumn.clear();
+        m_ActiveIndices.clear();
+        m_Active.clear();
+        m_Materialized.clear();
+    }
+
+    void SEEGTrajectoryCandidates::Reserve(unsigned int numCandidates) {
+        m_EntryX.reserve(numCandidates);
+        m_EntryY.reserve(numCandidates);
+        m_EntryZ.reserve(numCandidates);
+        m_TargetX.reserve(numCandidates);
+        m_TargetY.reserve(numCandidates);
+        m_TargetZ.reserve(numCandidates);
+        m_DirX.reserve(numCandidates);
+        m_DirY.reserve(numCandidates);
+        m_DirZ.reserve(numCandidates);
+        m_Length.reserve(numCandidates);
+        m_RejectionMask.reserve(numCandidates);
+        m_AggregatedRiskScore.reserve(numCandidates);
+        m_AggregatedRewardScore.reserve(numCandidates);
+        m_AggregatedScore.reserve(numCandidates);
+        m_ActiveIndices.reserve(numCandidates);
+        m_Active.reserve(numCandidates);
+        m_Materialized.reserve(numCandidates);
+    }
+
+    unsigned int SEEGTrajectoryCandidates::AddCandidate(const Point3D& entryPoint, const Point3D& targetPoint) {
+        unsigned int index = m_EntryX.size();
+        m_EntryX.push_back(entryPoint[0]);
+        m_EntryY.push_back(entryPoint[1]);
+        m_EntryZ.push_back(entryPoint[2]);
+        m_TargetX.push_back(targetPoint[0]);
+        m_TargetY.push_back(targetPoint[1]);
+        m_TargetZ.push_back(targetPoint[2]);
+
+        Vector3D_lf electrodeVector(entryPoint[0] - targetPoint[0],
+                                    entryPoint[1] - targetPoint[1],
+                                    entryPoint[2] - targetPoint[2]);
+        double length = norm(electrodeVector);
+        double invLength = (length > 0) ? 1.0 / length : 0.0;
+        m_DirX.push_back(electrodeVector.x * invLength);
+        m_DirY.push_back(electrodeVector.y * invLength);
+        m_DirZ.push_back(electrodeVector.z * invLength);
+        m_Length.push_back(length);
+
+        m_RejectionMask.push_back(0);
+        m_AggregatedRiskScore.push_back(-1);
+        m_AggregatedRewardScore.push_back(-1);
+        m_AggregatedScore.push_back(-1);
+
+        for (int iCol=0; iCol<m_TestColumns.size(); iCol++) {
+            if (!m_HasTestColumn[iCol]) {
+                continue;
+            }
+            TrajectoryTestColumn& column = m_TestColumns[iCol];
+            column.m_ScoreMax.push_back(0);
+            column.m_ScoreSum.push_back(0);
+            column.m_RankingUsingMax.push_back(0);
+            column.m_RankingUsingSum.push_back(0);
+            column.m_DistAtMaxScore.push_back(-1);
+            column.m_PointAtMaxScoreX.push_back(0);
+            column.m_PointAtMaxScoreY.push_back(0);
+            column.m_PointAtMaxScoreZ.push_back(0);
+            column.m_Evaluated.push_back(0);
+            column.m_FirstDepth.push_back(0);
+            column.m_NumberOfDepths.push_back(0);
+        }
+
+        m_ActiveIndices.push_back(index);
+        m_Active.push_back(1);
+        m_Materialized.push_back(0);
+        return index;
+    }
+
+    unsigned int SEEGTrajectoryCandidates::AppendCandidate(SEEGTrajectoryCandidates::Pointer source, unsigned int sourceIndex) {
+        unsigned int index = AddCandidate(source->GetEntryPoint(sourceIndex), source->GetTargetPoint(sourceIndex));
+        m_RejectionMask[index] = source->m_RejectionMask[sourceIndex];
+        SetAggregatedScores(index, source->m_AggregatedRiskScore[sourceIndex], source->m_AggregatedRewardScore[sourceIndex], source->m_AggregatedScore[sourceIndex]);
+        for (int iCol=0; iCol<m_TestColumns.size(); iCol++) {
+            if (!m_HasTestColumn[iCol] || !source->HasTestColumn(iCol)) {
+                continue;
+            }
+            TrajectoryTestColumn& column = m_TestColumns[iCol];
+            const TrajectoryTestColumn& sourceColumn = source->m_TestColumns[iCol];
+            column.m_ScoreMax[index] = sourceColumn.m_ScoreMax[sourceIndex];
+            column.m_ScoreSum[index] = sourceColumn.m_ScoreSum[sourceIndex];
+            column.m_RankingUsingMax[index] = sourceColumn.m_RankingUsingMax[sourceIndex];
+            column.m_RankingUsingSum[index] = sourceColumn.m_RankingUsingSum[sourceIndex];
+            column.m_DistAtMaxScore[index] = sourceColumn.m_DistAtMaxScore[sourceIndex];
+            column.m_PointAtMaxScoreX[index] = sourceColumn.m_PointAtMaxScoreX[sourceIndex];
+            column.m_PointAtMaxScoreY[index] = sourceColumn.m_PointAtMaxScoreY[sourceIndex];
+            column.m_PointAtMaxScoreZ[index] = sourceColumn.m_PointAtMaxScoreZ[sourceIndex];
+            column.m_Evaluated[index] = sourceColumn.m_Evaluated[sourceIndex];
+            for (unsigned int iDepth=0; iDepth<sourceColumn.m_NumberOfDepths[sourceIndex]; iDepth++) {
+                unsigned int sourceDepth = sourceColumn.m_FirstDepth[sourceIndex] + iDepth;
+                unsigned int depth = AddDepth(index, iCol);
+                column.m_DepthScoreMax[depth] = sourceColumn.m_DepthScoreMax[sourceDepth];
+                column.m_DepthScoreSum[depth] = sourceColumn.m_DepthScoreSum[sourceDepth];
+                column.m_DepthRankingUsingMax[depth] = sourceColumn.m_DepthRankingUsingMax[sourceDepth];
+                column.m_DepthRankingUsingSum[depth] = sourceColumn.m_DepthRankingUsingSum[sourceDepth];
+                column.m_DepthDistAtMaxScore[depth] = sourceColumn.m_DepthDistAtMaxScore[sourceDepth];
+                column.m_DepthPointAtMaxScoreX[depth] = sourceColumn.m_DepthPointAtMaxScoreX[sourceDepth];
+                column.m_DepthPointAtMaxScoreY[depth] = sourceColumn.m_DepthPointAtMaxScoreY[sourceDepth];
+                column.m_DepthPointAtMaxScoreZ[depth] = sourceColumn.m_DepthPointAtMaxScoreZ[sourceDepth];
+            }
+        }
+        return index;
+    }
+
+    unsigned int SEEGTrajectoryCandidates::GetNumberOfCandidates() {
+        return m_EntryX.size();
+    }
+
+    Point3D SEEGTrajectoryCandidates::GetEntryPoint(unsigned int index) {
+        Point3D point;
+        point[0] = m_EntryX[index];
+        point[1] = m_EntryY[index];
+        point[2] = m_EntryZ[index];
+        return point;
+    }
+
+    Point3D SEEGTrajectoryCandidates::GetTargetPoint(unsigned int index) {
+        Point3D point;
+        point[0] = m_TargetX[index];
+        point[1] = m_TargetY[index];
+        point[2] = m_TargetZ[index];
+        return point;
+    }
+
+    Vector3D_lf SEEGTrajectoryCandidates::GetDirection(unsigned int index) {
+        return Vector3D_lf(m_DirX[index], m_DirY[index], m_DirZ[index]);
+    }
+
+    Vector3D_lf SEEGTrajectoryCandidates::GetElectrodeVector(unsigned int index) {
+        return Vector3D_lf(m_EntryX[index] - m_TargetX[index],
+                           m_EntryY[index] - m_TargetY[index],
+                           m_EntryZ[index] - m_TargetZ[index]);
+    }
+
+    double SEEGTrajectoryCandidates::GetLength(unsigned int index) {
+        return m_Length[index];
+    }
+
+    void SEEGTrajectoryCandidates::SetTargetPoint(unsigned int index, const Point3D& targetPoint) {
+        m_TargetX[index] = targetPoint[0];
+        m_TargetY[index] = targetPoint[1];
+        m_TargetZ[index] = targetPoint[2];
+
+        // as AddCandidate()
+        Vector3D_lf electrodeVector = GetElectrodeVector(index);
+        double length = norm(electrodeVector);
+        double invLength = (length > 0) ? 1.0 / length : 0.0;
+        m_DirX[index] = electrodeVector.x * invLength;
+        m_DirY[index] = electrodeVector.y * invLength;
+        m_DirZ[index] = electrodeVector.z * invLength;
+        m_Length[index] = length;
+    }
+
+    SEEGTrajectoryTestRegistry::Pointer SEEGTrajectoryCandidates::GetTestRegistry() {
+        return m_TestRegistry;
+    }
+
+    bool SEEGTrajectoryCandidates::AddTestColumn(int testId) {
+        if (testId < 0 || testId >= MAX_TEST_COLUMNS) {
+            cout << "Too many trajectory tests - cannot add test " << testId << endl;
+            return false;
+        }
+        if (HasTestColumn(testId)) {
+            return true;
+        }
+        if (testId >= m_TestColumns.size()) {
+            m_TestColumns.resize(testId + 1);
+            m_HasTestColumn.resize(testId + 1, 0);
+        }
+        unsigned int numCandidates = GetNumberOfCandidates();
+        TrajectoryTestColumn& newColumn = m_TestColumns[testId];
+        newColumn.m_ScoreMax.assign(numCandidates, 0);
+        newColumn.m_ScoreSum.assign(numCandidates, 0);
+        newColumn.m_RankingUsingMax.assign(numCandidates, 0);
+        newColumn.m_RankingUsingSum.assign(numCandidates, 0);
+        newColumn.m_DistAtMaxScore.assign(numCandidates, -1);
+        newColumn.m_PointAtMaxScoreX.assign(numCandidates, 0);
+        newColumn.m_PointAtMaxScoreY.assign(numCandidates, 0);
+        newColumn.m_PointAtMaxScoreZ.assign(numCandidates, 0);
+        newColumn.m_Evaluated.assign(numCandidates, 0);
+        newColumn.m_FirstDepth.assign(numCandidates, 0);
+        newColumn.m_NumberOfDepths.assign(numCandidates, 0);
+        m_HasTestColumn[testId] = 1;
+        return true;
+    }
+
+    int SEEGTrajectoryCandidates::AddTestColumn(const string& testName) {
+        int testId = m_TestRegistry->RegisterTest(testName);
+        if (!AddTestColumn(testId)) {
+            return -1;
+        }
+        return testId;
+    }
+
+    bool SEEGTrajectoryCandidates::HasTestColumn(int testId) {
+        return testId >= 0 && testId < m_HasTestColumn.size() && m_HasTestColumn[testId];
+    }
+
+    int SEEGTrajectoryCandidates::GetTestColumnIndex(const string& testName) {
+        int testId = m_TestRegistry->GetTestId(testName);
+        return HasTestColumn(testId) ? testId : -1;
+    }
+
+    int SEEGTrajectoryCandidates::GetNumberOfTestColumns() {
+        return m_TestColumns.size();
+    }
+
+    TrajectoryTestColumn& SEEGTrajectoryCandidates::GetTestColumn(int testId) {
+        return m_TestColumns[testId];
+    }
+
+    void SEEGTrajectoryCandidates::RemoveTestColumn(const string& testName) {
+        int testId = GetTestColumnIndex(testName);
+        if (testId < 0) {
+            return;
+        }
+        m_TestColumns[testId] = TrajectoryTestColumn(); // frees the arrays
+        m_HasTestColumn[testId] = 0;
+        for (unsigned int i=0; i<m_RejectionMask.size(); i++) {
+            SetRejected(i, testId, false);
+        }
+    }
+
+    unsigned int SEEGTrajectoryCandidates::AddDepth(unsigned int index, int testId) {
+        TrajectoryTestColumn& column = m_TestColumns[testId];
+        unsigned int first = column.m_FirstDepth[index];
+        unsigned int numDepths = column.m_NumberOfDepths[index];
+        unsigned int end = column.m_DepthScoreMax.size();
+        if (numDepths == 0) {
+            column.m_FirstDepth[index] = end;
+        } else if (first + numDepths != end) {
+            // another candidate was added after the depths of this one: they are moved to the end
+            column.m_FirstDepth[index] = end;
+            for (unsigned int iDepth=0; iDepth<numDepths; iDepth++) {
+                column.m_DepthScoreMax.push_back(column.m_DepthScoreMax[first + iDepth]);
+                column.m_DepthScoreSum.push_back(column.m_DepthScoreSum[first + iDepth]);
+                column.m_DepthRankingUsingMax.push_back(column.m_DepthRankingUsingMax[first + iDepth]);
+                column.m_DepthRankingUsingSum.push_back(column.m_DepthRankingUsingSum[first + iDepth]);
+                column.m_DepthDistAtMaxScore.push_back(column.m_DepthDistAtMaxScore[first + iDepth]);
+                column.m_DepthPointAtMaxScoreX.push_back(column.m_DepthPointAtMaxScoreX[first + iDepth]);
+                column.m_DepthPointAtMaxScoreY.push_back(column.m_DepthPointAtMaxScoreY[first + iDepth]);
+                column.m_DepthPointAtMaxScoreZ.push_back(column.m_DepthPointAtMaxScoreZ[first + iDepth]);
+            }
+        }
+        column.m_DepthScoreMax.push_back(0);
+        column.m_DepthScoreSum.push_back(0);
+        column.m_DepthRankingUsingMax.push_back(0);
+        column.m_DepthRankingUsingSum.push_back(0);
+        column.m_DepthDistAtMaxScore.push_back(-1);
+        column.m_DepthPointAtMaxScoreX.push_back(0);
+        column.m_DepthPointAtMaxScoreY.push_back(0);
+        column.m_DepthPointAtMaxScoreZ.push_back(0);
+        column.m_NumberOfDepths[index]++;
+        return column.m_DepthScoreMax.size() - 1;
+    }
+
+    void SEEGTrajectoryCandidates::RemoveDepths(unsigned int index, int testId) {
+        m_TestColumns[testId].m_NumberOfDepths[index] = 0;
+    }
+
+    void SEEGTrajectoryCandidates::ClearDepths(int testId) {
+        TrajectoryTestColumn& column = m_TestColumns[testId];
+        column.m_FirstDepth.assign(GetNumberOfCandidates(), 0);
+        column.m_NumberOfDepths.assign(GetNumberOfCandidates(), 0);
+        column.m_DepthScoreMax.clear();
+        column.m_DepthScoreSum.clear();
+        column.m_DepthRankingUsingMax.clear();
+        column.m_DepthRankingUsingSum.clear();
+        column.m_DepthDistAtMaxScore.clear();
+        column.m_DepthPointAtMaxScoreX.clear();
+        column.m_DepthPointAtMaxScoreY.clear();
+        column.m_DepthPointAtMaxScoreZ.clear();
+    }
+
+    void SEEGTrajectoryCandidates::SetRejected(unsigned int index, int testId, bool rejected) {
+        RejectionMaskType bit = ((RejectionMaskType) 1) << testId;
+        if (rejected) {
+            m_RejectionMask[index] |= bit;
+        } else {
+            m_RejectionMask[index] &= ~bit;
+        }
+    }
+
+    void SEEGTrajectoryCandidates::ClearRejected(unsigned int index) {
+        m_RejectionMask[index] = 0;
+    }
+
+    SEEGTrajectoryCandidates::RejectionMaskType SEEGTrajectoryCandidates::GetRejectionMask(unsigned int index) {
+        return m_RejectionMask[index];
+    }
+
+    void SEEGTrajectoryCandidates::SetRejectionMask(unsigned int index, RejectionMaskType mask) {
+        m_RejectionMask[index] = mask;
+    }
+
+    bool SEEGTrajectoryCandidates::IsValid(unsigned int index) {
+        return m_RejectionMask[index] == 0;
+    }
+
+    float SEEGTrajectoryCandidates::GetAggregatedRiskScore(unsigned int index) {
+        return m_AggregatedRiskScore[index];
+    }
+
+    float SEEGTrajectoryCandidates::GetAggregatedRewardScore(unsigned int index) {
+        return m_AggregatedRewardScore[index];
+    }
+
+    float SEEGTrajectoryCandidates::GetAggregatedScore(unsigned int index) {
+        return m_AggregatedScore[index];
+    }
+
+    void SEEGTrajectoryCandidates::SetAggregatedScores(unsigned int index, float riskScore, float rewardScore, float score) {
+        m_AggregatedRiskScore[index] = riskScore;
+        m_AggregatedRewardScore[index] = rewardScore;
+        m_AggregatedScore[index] = score;
+    }
+
+    const vector<unsigned int>& SEEGTrajectoryCandidates::GetActiveIndices() {
+        return m_ActiveIndices;
+    }
+
+    bool SEEGTrajectoryCandidates::IsActive(unsigned int index) {
+        return m_Active[index] != 0;
+    }
+
+    unsigned int SEEGTrajectoryCandidates::GetNumberOfActiveCandidates() {
+        return m_ActiveIndices.size();
+    }
+
+    void SEEGTrajectoryCandidates::ResetActiveSet() {
+        unsigned int numCandidates = GetNumberOfCandidates();
+        m_ActiveIndices.clear();
+        for (unsigned int i=0; i<numCandidates; i++) {
+            m_Active[i] = m_Materialized[i] ? 0 : 1;
+            if (!m_Materialized[i]) {
+                m_ActiveIndices.push_back(i);
+            }
+        }
+    }
+
+    void SEEGTrajectoryCandidates::RemoveInvalidCandidates() {
+        // in place compaction - keeps the order of the active candidates
+        unsigned int numActive = 0;
+        for (unsigned int i=0; i<m_ActiveIndices.size(); i++) {
+            if (m_RejectionMask[m_ActiveIndices[i]] == 0) {
+                m_ActiveIndices[numActive++] = m_ActiveIndices[i];
+            } else {
+                m_Active[m_ActiveIndices[i]] = 0;
+            }
+        }
+        m_ActiveIndices.resize(numActive);
+    }
+
+    void SEEGTrajectoryCandidates::GetValidActiveIndices(vector<unsigned int>& validIndices, vector<unsigned int>* rejectedIndices) {
+        validIndices.clear();
+        if (rejectedIndices) {
+            rejectedIndices->clear();
+        }
+        for (unsigned int i=0; i<m_ActiveIndices.size(); i++) {
+            if (m_RejectionMask[m_ActiveIndices[i]] == 0) {
+                validIndices.push_back(m_ActiveIndices[i]);
+            } else if (rejectedIndices) {
+                rejectedIndices->push_back(m_ActiveIndices[i]);
+            }
+        }
+    }
+
+    void SEEGTrajectoryCandidates::SetActiveIndices(const vector<unsigned int>& activeIndices) {
+        for (unsigned int i=0; i<m_ActiveIndices.size(); i++) {
+            m_Active[m_ActiveIndices[i]] = 0;
+        }
+        m_ActiveIndices = activeIndices;
+        for (unsigned int i=0; i<m_ActiveIndices.size(); i++) {
+            m_Active[m_ActiveIndices[i]] = 1;
+        }
+    }
+
+    SEEGElectrodeModel::Pointer SEEGTrajectoryCandidates::GetElectrodeModel() {
+        return m_ElectrodeModel;
+    }
+
+    void SEEGTrajectoryCandidates::SetElectrodeModel(SEEGElectrodeModel::Pointer electrodeModel) {
+        m_ElectrodeModel = electrodeModel;
+    }
+
+    ElectrodeInfo::Pointer SEEGTrajectoryCandidates::CreateElectrode(unsigned int index) {
+        ElectrodeInfo::Pointer electrode;
+        if (m_ElectrodeModel) {
+            electrode = ElectrodeInfo::New(GetEntryPoint(index), GetTargetPoint(index), m_ElectrodeModel);
+        } else {
+            electrode = ElectrodeInfo::New(GetEntryPoint(index), GetTargetPoint(index));
+        }
+        electrode->m_Valid = IsValid(index);
+        return electrode;
+    }
+
+    ElectrodeInfo::Pointer SEEGTrajectoryCandidates::MaterializeElectrode(unsigned int index) {
+        ElectrodeInfo::Pointer electrode = CreateElectrode(index);
+
+        // the owner keeps the ElectrodeInfo from now on
+        m_Materialized[index] = 1;
+        if (m_Active[index]) {
+            m_Active[index] = 0;
+            m_ActiveIndices.erase(find(m_ActiveIndices.begin(), m_ActiveIndices.end(), index));
+        }
+        return electrode;
+    }
+
+    bool SEEGTrajectoryCandidates::IsMaterialized(unsigned int index) {
+        return m_Materialized[index] != 0;
+    }
+}
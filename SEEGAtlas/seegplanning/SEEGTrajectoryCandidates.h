@@ -0,0 +1,284 @@
+#ifndef __SEEG_TRAJECTORY_CANDIDATES_H__
+#define __SEEG_TRAJECTORY_CANDIDATES_H__
+
+/**
+ * @file SEEGTrajectoryCandidates.h
+ *
+ * Defines the SEEGTrajectoryCandidates class: contiguous (structure of arrays) storage of
+ * the candidate trajectories evaluated by the SEEGPathPlanner.
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <vector>
+#include <string>
+#include "BasicTypes.h"
+#include "MathUtils.h"
+#include "VolumeTypes.h"
+#include "SEEGElectrodeModel.h"
+#include "ElectrodeInfo.h"
+#include "SEEGTrajectoryTestRegistry.h"
+
+using namespace std;
+
+namespace seeg {
+
+    /**
+     * Scores of one trajectory test for all candidates (one entry per candidate)
+     */
+    struct TrajectoryTestColumn {
+
+        vector<float> m_ScoreMax;
+        vector<float> m_ScoreSum;
+        vector<float> m_RankingUsingMax;
+        vector<float> m_RankingUsingSum;
+        vector<float> m_DistAtMaxScore;
+        vector<double> m_PointAtMaxScoreX;
+        vector<double> m_PointAtMaxScoreY;
+        vector<double> m_PointAtMaxScoreZ;
+
+        /**
+         * 1 if the test was computed for the candidate (tests are not run once a candidate is rejected). A rejected
+         * candidate may have no score even for the test that rejected it (hard constraints decided by the screening
+         * of the binary tests): the readers of the scores skip the rejected candidates (see GetValidActiveIndices())
+         */
+        vector<unsigned char> m_Evaluated;
+
+        /**
+         * Scores at each depth analysed by the maximization tests: the depths of candidate i are the
+         * entries [m_FirstDepth[i], m_FirstDepth[i] + m_NumberOfDepths[i]) of the m_Depth* arrays
+         * (see SEEGTrajectoryCandidates::AddDepth())
+         */
+        vector<unsigned int> m_FirstDepth;
+        vector<unsigned int> m_NumberOfDepths;
+        vector<float> m_DepthScoreMax;
+        vector<float> m_DepthScoreSum;
+        vector<float> m_DepthRankingUsingMax;
+        vector<float> m_DepthRankingUsingSum;
+        vector<float> m_DepthDistAtMaxScore;
+        vector<double> m_DepthPointAtMaxScoreX;
+        vector<double> m_DepthPointAtMaxScoreY;
+        vector<double> m_DepthPointAtMaxScoreZ;
+    };
+
+    /**
+     * Candidate trajectories stored column by column: entry/target coordinates, unit direction
+     * (entry - target), length, a bitmask of the tests that rejected each candidate and one
+     * TrajectoryTestColumn per test, indexed by the test ID of a SEEGTrajectoryTestRegistry
+     * (the registry can be shared with other tables). Candidates are addressed by their index; the active
+     * candidates are kept as a list of indices. Full ElectrodeInfo objects are only created on
+     * request: CreateElectrode() returns a copy, MaterializeElectrode() hands the candidate over (from
+     * then on the owner keeps the ElectrodeInfo and the candidate leaves the active set).
+     *
+     * Different candidates can be written from different threads, but columns must be
+     * added (AddTestColumn) before.
+     */
+    class SEEGTrajectoryCandidates {
+
+    public:
+        /** SmartPointer type for the SEEGTrajectoryCandidates class */
+        typedef mrilSmartPtr<SEEGTrajectoryCandidates> Pointer;
+
+        /** Type of the rejection bitmask: one bit per test ID */
+        typedef unsigned long long RejectionMaskType;
+
+        /** Maximum number of test IDs that can have a column (bits of the rejection mask) */
+        static const int MAX_TEST_COLUMNS = 64;
+
+        static Pointer New(SEEGTrajectoryTestRegistry::Pointer testRegistry, SEEGElectrodeModel::Pointer electrodeModel = SEEGElectrodeModel::Pointer()) { return Pointer(new SEEGTrajectoryCandidates(testRegistry, electrodeModel)); }
+
+    protected:
+        SEEGTrajectoryCandidates(SEEGTrajectoryTestRegistry::Pointer testRegistry, SEEGElectrodeModel::Pointer electrodeModel);
+
+    public:
+        virtual ~SEEGTrajectoryCandidates();
+
+        /** Removes all candidates and test columns */
+        void Clear();
+
+        void Reserve(unsigned int numCandidates);
+
+        /**
+         * Adds a candidate (active and valid, without any test score)
+         *
+         * @return index of the new candidate
+         */
+        unsigned int AddCandidate(const Point3D& entryPoint, const Point3D& targetPoint);
+
+        /**
+         * Adds a copy of a candidate of another table (points, rejections, aggregated scores and
+         * the scores of the test columns that exist in both tables). Both tables must share the
+         * same SEEGTrajectoryTestRegistry.
+         *
+         * @return index of the new candidate
+         */
+        unsigned int AppendCandidate(SEEGTrajectoryCandidates::Pointer source, unsigned int sourceIndex);
+
+        unsigned int GetNumberOfCandidates();
+
+        Point3D GetEntryPoint(unsigned int index);
+
+        Point3D GetTargetPoint(unsigned int index);
+
+        /** Unit vector from the target to the entry point */
+        Vector3D_lf GetDirection(unsigned int index);
+
+        /** Vector from the target to the entry point (as ElectrodeInfo::m_ElectrodeVectorWorld) */
+        Vector3D_lf GetElectrodeVector(unsigned int index);
+
+        double GetLength(unsigned int index);
+
+        /** Moves the target point of the candidate (direction and length are updated) */
+        void SetTargetPoint(unsigned int index, const Point3D& targetPoint);
+
+        /*** Test columns (indexed by test ID) ***/
+
+        SEEGTrajectoryTestRegistry::Pointer GetTestRegistry();
+
+        /**
+         * Allocates the column of a test (if it does not exist yet)
+         *
+         * @return false if testId >= MAX_TEST_COLUMNS
+         */
+        bool AddTestColumn(int testId);
+
+        /**
+         * Registers testName and allocates its column
+         *
+         * @return the test ID, -1 if the column cannot be added
+         */
+        int AddTestColumn(const string& testName);
+
+        bool HasTestColumn(int testId);
+
+        /** @return the test ID of testName if it has a column, -1 otherwise */
+        int GetTestColumnIndex(const string& testName);
+
+        /** Number of column slots (test IDs 0..n-1, see HasTestColumn()) */
+        int GetNumberOfTestColumns();
+
+        TrajectoryTestColumn& GetTestColumn(int testId);
+
+        /** Frees the column of the test and clears its rejection bit (the test ID stays registered) */
+        void RemoveTestColumn(const string& testName);
+
+        /**
+         * Adds a depth (with zero scores) at the end of the depths of the candidate for the test testId
+         * (the depths of the candidate are first moved to the end of the arrays if needed)
+         *
+         * @return position of the new depth in the m_Depth* arrays of the column
+         */
+        unsigned int AddDepth(unsigned int index, int testId);
+
+        /** Removes the depths of the candidate (their space is only freed by ClearDepths()) */
+        void RemoveDepths(unsigned int index, int testId);
+
+        /** Removes the depths of all candidates for the test testId */
+        void ClearDepths(int testId);
+
+        /*** Validity ***/
+
+        /** Marks the candidate as rejected (or not) by the test testId */
+        void SetRejected(unsigned int index, int testId, bool rejected);
+
+        /** Clears all the rejection bits of the candidate */
+        void ClearRejected(unsigned int index);
+
+        RejectionMaskType GetRejectionMask(unsigned int index);
+
+        void SetRejectionMask(unsigned int index, RejectionMaskType mask);
+
+        /** A candidate is valid if no test rejected it */
+        bool IsValid(unsigned int index);
+
+        /*** Aggregated scores ***/
+
+        float GetAggregatedRiskScore(unsigned int index);
+        float GetAggregatedRewardScore(unsigned int index);
+        float GetAggregatedScore(unsigned int index);
+        void SetAggregatedScores(unsigned int index, float riskScore, float rewardScore, float score);
+
+        /*** Active set ***/
+
+        /** Indices of the active candidates (in the order they were added, or as given to SetActiveIndices()) */
+        const vector<unsigned int>& GetActiveIndices();
+
+        unsigned int GetNumberOfActiveCandidates();
+
+        bool IsActive(unsigned int index);
+
+        /** Makes all candidates that were not materialized active again */
+        void ResetActiveSet();
+
+        /** Removes the candidates that are not valid from the active set */
+        void RemoveInvalidCandidates();
+
+        /**
+         * Splits the active set (in its order) into the valid candidates and the rejected ones
+         *
+         * @param rejectedIndices where to store the rejected active candidates (may be NULL)
+         */
+        void GetValidActiveIndices(vector<unsigned int>& validIndices, vector<unsigned int>* rejectedIndices = NULL);
+
+        /** Replaces the active set (indices of candidates that were not materialized, in any order) */
+        void SetActiveIndices(const vector<unsigned int>& activeIndices);
+
+        /*** Materialization ***/
+
+        SEEGElectrodeModel::Pointer GetElectrodeModel();
+
+        void SetElectrodeModel(SEEGElectrodeModel::Pointer electrodeModel);
+
+        /**
+         * Creates an ElectrodeInfo for the candidate (entry/target points, electrode model and
+         * validity), the candidate stays in the table. Test scores are copied by the owner of the
+         * table (see SEEGPathPlanner).
+         */
+        ElectrodeInfo::Pointer CreateElectrode(unsigned int index);
+
+        /** As CreateElectrode() but the candidate is handed over: it leaves the active set */
+        ElectrodeInfo::Pointer MaterializeElectrode(unsigned int index);
+
+        bool IsMaterialized(unsigned int index);
+
+    private:
+        /** Names and IDs of the tests */
+        SEEGTrajectoryTestRegistry::Pointer m_TestRegistry;
+
+        /** Electrode model shared by all candidates */
+        SEEGElectrodeModel::Pointer m_ElectrodeModel;
+
+        vector<double> m_EntryX;
+        vector<double> m_EntryY;
+        vector<double> m_EntryZ;
+        vector<double> m_TargetX;
+        vector<double> m_TargetY;
+        vector<double> m_TargetZ;
+        vector<double> m_DirX;
+        vector<double> m_DirY;
+        vector<double> m_DirZ;
+        vector<double> m_Length;
+
+        /** One bit per test column: set if the test rejected the candidate */
+        vector<RejectionMaskType> m_RejectionMask;
+
+        vector<float> m_AggregatedRiskScore;
+        vector<float> m_AggregatedRewardScore;
+        vector<float> m_AggregatedScore;
+
+        /** Columns indexed by test ID (empty if the test has no column in this table) */
+        vector<TrajectoryTestColumn> m_TestColumns;
+        vector<unsigned char> m_HasTestColumn;
+
+        vector<unsigned int> m_ActiveIndices;
+
+        /** 1 if the candidate is in m_ActiveIndices */
+        vector<unsigned char> m_Active;
+
+        /** 1 once the candidate was handed over as an ElectrodeInfo */
+        vector<unsigned char> m_Materialized;
+    };
+}
+
+#endif
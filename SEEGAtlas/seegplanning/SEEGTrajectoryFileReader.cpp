@@ -0,0 +1,320 @@
+/**
+ * @file SEEGTrajectoryFileReader.cpp
+ *
+ * Implementation of the SEEGTrajectoryFileReader class
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include "SEEGTrajectoryFileReader.h"
+#if ITK_VERSION_MAJOR >= 5
+#include "itkMultiThreaderBase.h"
+#endif
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <math.h>
+#include <QFile>
+
+namespace seeg {
+
+    // exact powers of 10 (as doubles) for the fast path of ParseDouble()
+    static const double POWERS_OF_10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                           1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    // below this size a text file is parsed by a single thread
+    static const unsigned long long MIN_BYTES_PER_THREAD = 1 << 20;
+
+    // number of floats per record (target xyz, entry xyz)
+    static const int VALUES_PER_TRAJECTORY = 6;
+
+    static bool IsLittleEndianHost() {
+        unsigned int one = 1;
+        return *((unsigned char*) &one) == 1;
+    }
+
+    static void AddTrajectories(const vector<double>& values, SEEGTrajectoryCandidates::Pointer candidates) {
+        for (unsigned int i=0; i+VALUES_PER_TRAJECTORY<=values.size(); i+=VALUES_PER_TRAJECTORY) {
+            Point3D targetPoint;
+            targetPoint[0] = values[i];   //first 3 points are the target
+            targetPoint[1] = values[i+1];
+            targetPoint[2] = values[i+2];
+            Point3D entryPoint;
+            entryPoint[0] = values[i+3];  // last 3 points are the entry points
+            entryPoint[1] = values[i+4];
+            entryPoint[2] = values[i+5];
+            candidates->AddCandidate(entryPoint, targetPoint); // aggregated scores start at -1
+        }
+    }
+
+    /**** CONSTRUCTORS / DESTRUCTOR ****/
+
+    SEEGTrajectoryFileReader::SEEGTrajectoryFileReader() {
+        m_NumberOfThreads = 0;
+    }
+
+    SEEGTrajectoryFileReader::~SEEGTrajectoryFileReader() {
+        // Do nothing
+    }
+
+
+    /**** PUBLIC FUNCTIONS ****/
+
+    void SEEGTrajectoryFileReader::SetNumberOfThreads(unsigned int numThreads) {
+        m_NumberOfThreads = numThreads;
+    }
+
+    bool SEEGTrajectoryFileReader::IsBinaryFile(const string& filename) {
+        return filename.size() >= 4 && QString::fromStdString(filename.substr(filename.size() - 4)).toLower() == ".bin";
+    }
+
+    bool SEEGTrajectoryFileReader::Read(const string& filename, SEEGTrajectoryCandidates::Pointer candidates) {
+        if (IsBinaryFile(filename)) {
+            return ReadBinary(filename, candidates);
+        }
+        return ReadText(filename, candidates);
+    }
+
+    bool SEEGTrajectoryFileReader::ReadText(const string& filename, SEEGTrajectoryCandidates::Pointer candidates) {
+        QFile file(QString::fromStdString(filename));
+        if (!file.open(QIODevice::ReadOnly)) {
+            cout << "Unable to open file " << filename << endl;
+            return false;
+        }
+        unsigned long long fileSize = file.size();
+        if (fileSize == 0) {
+            return true;
+        }
+        const char* data = (const char*) file.map(0, fileSize);
+        if (data == NULL) {
+            cout << "Unable to map file " << filename << endl;
+            return false;
+        }
+
+        unsigned int numThreads = m_NumberOfThreads;
+#if ITK_VERSION_MAJOR >= 5
+        if (numThreads == 0) {
+            numThreads = itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads();
+        }
+#else
+        numThreads = 1;
+#endif
+        if (numThreads > fileSize / MIN_BYTES_PER_THREAD) {
+            numThreads = fileSize / MIN_BYTES_PER_THREAD;
+        }
+        if (numThreads < 1) {
+            numThreads = 1;
+        }
+
+        // chunks end at line boundaries (after a '\n' or at the end of the file)
+        vector<const char*> chunkStarts(numThreads + 1);
+        chunkStarts[0] = data;
+        chunkStarts[numThreads] = data + fileSize;
+        for (unsigned int chunk=1; chunk<numThreads; chunk++) {
+            const char* start = data + (fileSize * chunk) / numThreads;
+            if (start < chunkStarts[chunk-1]) {
+                start = chunkStarts[chunk-1];
+            }
+            const char* newLine = (const char*) memchr(start, '\n', data + fileSize - start);
+            chunkStarts[chunk] = (newLine != NULL) ? newLine + 1 : data + fileSize;
+        }
+
+        vector<vector<double> > chunkValues(numThreads);
+        if (numThreads == 1) {
+            ParseLines(chunkStarts[0], chunkStarts[1], chunkValues[0]);
+        } else {
+#if ITK_VERSION_MAJOR >= 5
+            itk::MultiThreaderBase::Pointer threader = itk::MultiThreaderBase::New();
+            threader->SetMaximumNumberOfThreads(numThreads);
+            threader->SetNumberOfWorkUnits(numThreads);
+            threader->ParallelizeArray(0, numThreads,
+                [&](itk::SizeValueType chunk) {
+                    ParseLines(chunkStarts[chunk], chunkStarts[chunk+1], chunkValues[chunk]);
+                },
+                nullptr);
+#endif
+        }
+        file.unmap((uchar*) data);
+        file.close();
+
+        // the table is filled in the order of the file
+        unsigned int numTrajectories = 0;
+        for (unsigned int chunk=0; chunk<numThreads; chunk++) {
+            numTrajectories += chunkValues[chunk].size() / VALUES_PER_TRAJECTORY;
+        }
+        candidates->Reserve(candidates->GetNumberOfCandidates() + numTrajectories);
+        for (unsigned int chunk=0; chunk<numThreads; chunk++) {
+            AddTrajectories(chunkValues[chunk], candidates);
+            vector<double>().swap(chunkValues[chunk]); // free as soon as copied
+        }
+        return true;
+    }
+
+    bool SEEGTrajectoryFileReader::ReadBinary(const string& filename, SEEGTrajectoryCandidates::Pointer candidates) {
+        QFile file(QString::fromStdString(filename));
+        if (!file.open(QIODevice::ReadOnly)) {
+            cout << "Unable to open file " << filename << endl;
+            return false;
+        }
+        const unsigned int recordSize = VALUES_PER_TRAJECTORY * sizeof(float);
+        unsigned long long fileSize = file.size();
+        if (fileSize % recordSize != 0) {
+            cout << "Binary trajectory file " << filename << " is not a sequence of " << VALUES_PER_TRAJECTORY << "-float records" << endl;
+            return false;
+        }
+        if (fileSize == 0) {
+            return true;
+        }
+        const unsigned char* data = file.map(0, fileSize);
+        if (data == NULL) {
+            cout << "Unable to map file " << filename << endl;
+            return false;
+        }
+
+        bool swapBytes = !IsLittleEndianHost();
+        unsigned int numTrajectories = fileSize / recordSize;
+        vector<double> values(VALUES_PER_TRAJECTORY);
+        candidates->Reserve(candidates->GetNumberOfCandidates() + numTrajectories);
+        for (unsigned int iTraj=0; iTraj<numTrajectories; iTraj++) {
+            for (int i=0; i<VALUES_PER_TRAJECTORY; i++) {
+                unsigned char bytes[sizeof(float)];
+                memcpy(bytes, data + iTraj * recordSize + i * sizeof(float), sizeof(float));
+                if (swapBytes) {
+                    swap(bytes[0], bytes[3]);
+                    swap(bytes[1], bytes[2]);
+                }
+                float value;
+                memcpy(&value, bytes, sizeof(float));
+                values[i] = value;
+            }
+            AddTrajectories(values, candidates);
+        }
+        file.unmap((uchar*) data);
+        file.close();
+        return true;
+    }
+
+    bool SEEGTrajectoryFileReader::WriteBinary(const string& filename, SEEGTrajectoryCandidates::Pointer candidates) {
+        ofstream file(filename.c_str(), ios::out | ios::binary);
+        if (!file.is_open()) {
+            cout << "Unable to open file " << filename << endl;
+            return false;
+        }
+        bool swapBytes = !IsLittleEndianHost();
+        for (unsigned int iCand=0; iCand<candidates->GetNumberOfCandidates(); iCand++) {
+            Point3D targetPoint = candidates->GetTargetPoint(iCand);
+            Point3D entryPoint = candidates->GetEntryPoint(iCand);
+            float values[VALUES_PER_TRAJECTORY] = { (float) targetPoint[0], (float) targetPoint[1], (float) targetPoint[2],
+                                                    (float) entryPoint[0], (float) entryPoint[1], (float) entryPoint[2] };
+            for (int i=0; i<VALUES_PER_TRAJECTORY; i++) {
+                unsigned char bytes[sizeof(float)];
+                memcpy(bytes, &values[i], sizeof(float));
+                if (swapBytes) {
+                    swap(bytes[0], bytes[3]);
+                    swap(bytes[1], bytes[2]);
+                }
+                file.write((const char*) bytes, sizeof(float));
+            }
+        }
+        file.close();
+        return true;
+    }
+
+
+    /**** PRIVATE FUNCTIONS ****/
+
+    void SEEGTrajectoryFileReader::ParseLines(const char* first, const char* last, vector<double>& values) {
+        const char* lineStart = first;
+        while (lineStart < last) {
+            const char* lineEnd = (const char*) memchr(lineStart, '\n', last - lineStart);
+            if (lineEnd == NULL) {
+                lineEnd = last;
+            }
+            if (lineEnd > lineStart) { // as getline(): empty lines are skipped
+                const char* fieldStart = lineStart;
+                for (int i=0; i<VALUES_PER_TRAJECTORY; i++) {
+                    const char* fieldEnd = fieldStart;
+                    while (fieldEnd < lineEnd && *fieldEnd != ',') {
+                        fieldEnd++;
+                    }
+                    values.push_back(ParseDouble(fieldStart, fieldEnd));
+                    fieldStart = (fieldEnd < lineEnd) ? fieldEnd + 1 : lineEnd;
+                }
+            }
+            lineStart = lineEnd + 1;
+        }
+    }
+
+    double SEEGTrajectoryFileReader::ParseDouble(const char* first, const char* last) {
+        const char* p = first;
+        while (p < last && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\v' || *p == '\f')) {
+            p++;
+        }
+        const char* numberStart = p;
+        bool negative = false;
+        if (p < last && (*p == '-' || *p == '+')) {
+            negative = (*p == '-');
+            p++;
+        }
+
+        // mantissa digits as an integer and the decimal exponent
+        unsigned long long mantissa = 0;
+        int numDigits = 0;
+        int exponent = 0;
+        bool hasDigits = false;
+        while (p < last && *p >= '0' && *p <= '9') {
+            if (numDigits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa > 0) numDigits++;
+            } else {
+                exponent++;
+            }
+            hasDigits = true;
+            p++;
+        }
+        if (p < last && *p == '.') {
+            p++;
+            while (p < last && *p >= '0' && *p <= '9') {
+                if (numDigits < 19) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    if (mantissa > 0) numDigits++;
+                    exponent--;
+                }
+                hasDigits = true;
+                p++;
+            }
+        }
+        if (!hasDigits) {
+            return 0;
+        }
+        if (p < last && (*p == 'e' || *p == 'E')) {
+            const char* q = p + 1;
+            bool negativeExp = false;
+            if (q < last && (*q == '-' || *q == '+')) {
+                negativeExp = (*q == '-');
+                q++;
+            }
+            if (q < last && *q >= '0' && *q <= '9') {
+                int exp = 0;
+                while (q < last && *q >= '0' && *q <= '9') {
+                    if (exp < 10000) exp = exp * 10 + (*q - '0');
+                    q++;
+                }
+                exponent += negativeExp ? -exp : exp;
+            }
+        }
+
+        // exact when the mantissa fits in a double and the power of 10 is exact (correctly rounded, as atof)
+        if (mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+            double value = (double) mantissa;
+            value = (exponent < 0) ? value / POWERS_OF_10[-exponent] : value * POWERS_OF_10[exponent];
+            return negative ? -value : value;
+        }
+
+        // rare cases: strtod on a copy of the number (the file uses '.' as decimal separator, as the "C" locale)
+        string number(numberStart, last);
+        return strtod(number.c_str(), NULL);
+    }
+}
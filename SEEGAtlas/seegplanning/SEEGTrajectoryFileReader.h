@@ -0,0 +1,81 @@
+#ifndef __SEEG_TRAJECTORY_FILE_READER_H__
+#define __SEEG_TRAJECTORY_FILE_READER_H__
+
+/**
+ * @file SEEGTrajectoryFileReader.h
+ *
+ * Defines the SEEGTrajectoryFileReader class: reads the trajectory files of
+ * SEEGPathPlanner::InitializeTrajectoriesFromFile() into a SEEGTrajectoryCandidates table.
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <vector>
+#include <string>
+#include "BasicTypes.h"
+#include "VolumeTypes.h"
+#include "SEEGTrajectoryCandidates.h"
+
+using namespace std;
+
+namespace seeg {
+
+    /**
+     * Trajectory files contain one trajectory per record: targetX, targetY, targetZ, entryX,
+     * entryY, entryZ. Two variants are read:
+     * - text (.dat / .csv): one record per line, comma separated values. The file is memory mapped,
+     *   split in chunks at line boundaries and the chunks are parsed by several threads with a
+     *   locale independent parser.
+     * - binary (.bin): consecutive records of 6 little-endian 32-bit floats (no header).
+     * Candidates are added to the table in the order of the file.
+     */
+    class SEEGTrajectoryFileReader {
+
+    public:
+        /** SmartPointer type for the SEEGTrajectoryFileReader class */
+        typedef mrilSmartPtr<SEEGTrajectoryFileReader> Pointer;
+
+        static Pointer New() { return Pointer(new SEEGTrajectoryFileReader()); }
+
+    protected:
+        SEEGTrajectoryFileReader();
+
+    public:
+        virtual ~SEEGTrajectoryFileReader();
+
+        /** Number of threads used to parse text files (0: ITK default) */
+        void SetNumberOfThreads(unsigned int numThreads);
+
+        /**
+         * Reads a trajectory file (binary if its extension is .bin, text otherwise) and adds its
+         * trajectories to candidates
+         *
+         * @return false if the file cannot be read
+         */
+        bool Read(const string& filename, SEEGTrajectoryCandidates::Pointer candidates);
+
+        bool ReadText(const string& filename, SEEGTrajectoryCandidates::Pointer candidates);
+
+        bool ReadBinary(const string& filename, SEEGTrajectoryCandidates::Pointer candidates);
+
+        /** Writes the trajectories of candidates as a binary trajectory file */
+        static bool WriteBinary(const string& filename, SEEGTrajectoryCandidates::Pointer candidates);
+
+        static bool IsBinaryFile(const string& filename);
+
+    private:
+        /**
+         * Parses the lines of [first, last) (last must be a line boundary) and appends 6 values per
+         * non-empty line to values (missing fields are 0, as atof() of an empty token)
+         */
+        static void ParseLines(const char* first, const char* last, vector<double>& values);
+
+        /** Parses a decimal number as atof() would (0 if there is none), does not depend on the locale */
+        static double ParseDouble(const char* first, const char* last);
+
+        unsigned int m_NumberOfThreads;
+    };
+}
+
+#endif
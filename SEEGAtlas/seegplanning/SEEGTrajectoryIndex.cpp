@@ -0,0 +1,113 @@
+/**
+ * @file SEEGTrajectoryIndex.cpp
+ *
+ * Implementation of the SEEGTrajectoryIndex class
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include "SEEGTrajectoryIndex.h"
+
+namespace seeg {
+
+    // compare two point IDs based on one of their coordinates (passed to std::nth_element())
+    struct CompareIndexCoordinate {
+        const vector<double>& m_Coords;
+        int m_Axis;
+        CompareIndexCoordinate(const vector<double>& coords, int axis) : m_Coords(coords), m_Axis(axis) {}
+        bool operator() (unsigned int first, unsigned int second) const {
+            return m_Coords[3*first+m_Axis] < m_Coords[3*second+m_Axis];
+        }
+    };
+
+    /**** CONSTRUCTORS / DESTRUCTOR ****/
+
+    SEEGTrajectoryIndex::SEEGTrajectoryIndex() {
+        m_NumberOfIndexedPoints = 0;
+    }
+
+    SEEGTrajectoryIndex::~SEEGTrajectoryIndex() {
+        // Do nothing
+    }
+
+
+    /**** PUBLIC FUNCTIONS ****/
+
+    void SEEGTrajectoryIndex::Clear() {
+        m_Coords.clear();
+        m_Order.clear();
+        m_SplitAxis.clear();
+        m_NumberOfIndexedPoints = 0;
+    }
+
+    void SEEGTrajectoryIndex::Reserve(unsigned int numPoints) {
+        m_Coords.reserve(3 * numPoints);
+    }
+
+    unsigned int SEEGTrajectoryIndex::AddPoint(const Vector3D_lf& point) {
+        unsigned int id = m_Coords.size() / 3;
+        m_Coords.push_back(point.x);
+        m_Coords.push_back(point.y);
+        m_Coords.push_back(point.z);
+        return id;
+    }
+
+    unsigned int SEEGTrajectoryIndex::GetNumberOfPoints() {
+        return m_Coords.size() / 3;
+    }
+
+    void SEEGTrajectoryIndex::Build() {
+        unsigned int numPoints = GetNumberOfPoints();
+        m_Order.resize(numPoints);
+        for (unsigned int i = 0; i < numPoints; i++) {
+            m_Order[i] = i;
+        }
+        m_SplitAxis.assign(numPoints, 0);
+        BuildSubtree(0, numPoints);
+        m_NumberOfIndexedPoints = numPoints;
+    }
+
+    void SEEGTrajectoryIndex::Update() {
+        // points out of the tree are scanned by every query: keep them few
+        unsigned int numNotIndexed = GetNumberOfPoints() - m_NumberOfIndexedPoints;
+        if (numNotIndexed > 4 * LEAF_SIZE && numNotIndexed > m_NumberOfIndexedPoints / 16) {
+            Build();
+        }
+    }
+
+
+    /**** PRIVATE FUNCTIONS ****/
+
+    void SEEGTrajectoryIndex::BuildSubtree(unsigned int first, unsigned int last) {
+        if (last - first <= LEAF_SIZE) {
+            return;
+        }
+
+        // split along the axis of largest extent
+        double minCoord[3], maxCoord[3];
+        for (int axis = 0; axis < 3; axis++) {
+            minCoord[axis] = maxCoord[axis] = m_Coords[3*m_Order[first]+axis];
+        }
+        for (unsigned int i = first + 1; i < last; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                double coord = m_Coords[3*m_Order[i]+axis];
+                minCoord[axis] = min(minCoord[axis], coord);
+                maxCoord[axis] = max(maxCoord[axis], coord);
+            }
+        }
+        int splitAxis = 0;
+        for (int axis = 1; axis < 3; axis++) {
+            if (maxCoord[axis] - minCoord[axis] > maxCoord[splitAxis] - minCoord[splitAxis]) {
+                splitAxis = axis;
+            }
+        }
+
+        unsigned int mid = (first + last) / 2;
+        nth_element(m_Order.begin() + first, m_Order.begin() + mid, m_Order.begin() + last, CompareIndexCoordinate(m_Coords, splitAxis));
+        m_SplitAxis[mid] = splitAxis;
+
+        BuildSubtree(first, mid);
+        BuildSubtree(mid + 1, last);
+    }
+}
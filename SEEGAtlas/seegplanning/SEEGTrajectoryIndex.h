@@ -0,0 +1,228 @@
+#ifndef __SEEG_TRAJECTORY_INDEX_H__
+#define __SEEG_TRAJECTORY_INDEX_H__
+
+/**
+ * @file SEEGTrajectoryIndex.h
+ *
+ * Defines the SEEGTrajectoryIndex class: a k-d tree over the electrode vectors (entry - target)
+ * of trajectories, used by the SEEGPathPlanner to find the closest trajectories.
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include "BasicTypes.h"
+#include "MathUtils.h"
+
+using namespace std;
+
+namespace seeg {
+
+    /**
+     * Accepts all the points of a SEEGTrajectoryIndex (default filter of the queries)
+     */
+    struct TrajectoryIndexAcceptAll {
+        bool operator() (unsigned int id) const { return true; }
+    };
+
+    /**
+     * 3-D k-d tree of points (the electrode vectors of trajectories). Points are identified by the
+     * order in which they were added (0, 1, 2...). The distance is the euclidean distance, as in
+     * SEEGPathPlanner::CalcDistanceBetweenPointsInTrajectories().
+     *
+     * Points added after Build() are kept in a short list that queries scan linearly; Update()
+     * rebuilds the tree when that list gets long. When several points are at the same distance,
+     * the queries return the one with the smallest ID (first one added).
+     *
+     * Queries take a filter (functor bool(unsigned int id)) to skip some of the points.
+     */
+    class SEEGTrajectoryIndex {
+
+    public:
+        /** SmartPointer type for the SEEGTrajectoryIndex class */
+        typedef mrilSmartPtr<SEEGTrajectoryIndex> Pointer;
+
+        static Pointer New() { return Pointer(new SEEGTrajectoryIndex()); }
+
+    protected:
+        SEEGTrajectoryIndex();
+
+    public:
+        virtual ~SEEGTrajectoryIndex();
+
+        /** Removes all points */
+        void Clear();
+
+        void Reserve(unsigned int numPoints);
+
+        /**
+         * Adds a point (not in the tree until the next Build())
+         *
+         * @return the ID of the point
+         */
+        unsigned int AddPoint(const Vector3D_lf& point);
+
+        unsigned int GetNumberOfPoints();
+
+        /** Builds the tree with all the points */
+        void Build();
+
+        /** Builds the tree if many points were added since the last Build() */
+        void Update();
+
+        /**
+         * Finds the closest point to query (among the points accepted by filter)
+         *
+         * @param maxDistance only points closer than maxDistance are considered
+         * @param distance distance to the point found
+         * @return the ID of the closest point, -1 if there is none
+         */
+        template <class TFilter>
+        int FindNearest(const Vector3D_lf& query, double maxDistance, const TFilter& filter, double& distance) const;
+
+        /**
+         * Finds all the points (accepted by filter) at a distance <= radius from query
+         *
+         * @param ids IDs of the points found, in increasing order
+         */
+        template <class TFilter>
+        void FindInRadius(const Vector3D_lf& query, double radius, const TFilter& filter, vector<unsigned int>& ids) const;
+
+    private:
+        /** Number of points of the leaves of the tree (scanned linearly) */
+        static const unsigned int LEAF_SIZE = 8;
+
+        /** Orders m_Order[first, last) as a subtree */
+        void BuildSubtree(unsigned int first, unsigned int last);
+
+        double SquareDistance(unsigned int id, const double query[3]) const {
+            double dx = m_Coords[3*id] - query[0];
+            double dy = m_Coords[3*id+1] - query[1];
+            double dz = m_Coords[3*id+2] - query[2];
+            return dx*dx + dy*dy + dz*dz;
+        }
+
+        template <class TFilter>
+        void CheckNearest(unsigned int id, const double query[3], const TFilter& filter, int& bestId, double& bestSquareDist) const;
+
+        template <class TFilter>
+        void SearchNearest(unsigned int first, unsigned int last, const double query[3], const TFilter& filter, int& bestId, double& bestSquareDist) const;
+
+        template <class TFilter>
+        void SearchInRadius(unsigned int first, unsigned int last, const double query[3], double squareRadius, const TFilter& filter, vector<unsigned int>& ids) const;
+
+        /** Coordinates of the points (x, y, z of point i at 3i, 3i+1, 3i+2) */
+        vector<double> m_Coords;
+
+        /** IDs of the points in the tree: the median of each range is the node that splits it */
+        vector<unsigned int> m_Order;
+
+        /** Split axis of the node at each position of m_Order */
+        vector<unsigned char> m_SplitAxis;
+
+        /** Points with ID >= m_NumberOfIndexedPoints were added after Build() */
+        unsigned int m_NumberOfIndexedPoints;
+    };
+
+
+    /**** TEMPLATE FUNCTIONS ****/
+
+    template <class TFilter>
+    int SEEGTrajectoryIndex::FindNearest(const Vector3D_lf& query, double maxDistance, const TFilter& filter, double& distance) const {
+        double q[3] = {query.x, query.y, query.z};
+        int bestId = -1;
+        double bestSquareDist = maxDistance * maxDistance;
+        SearchNearest(0, m_NumberOfIndexedPoints, q, filter, bestId, bestSquareDist);
+        for (unsigned int id = m_NumberOfIndexedPoints; id < m_Coords.size() / 3; id++) {
+            CheckNearest(id, q, filter, bestId, bestSquareDist);
+        }
+        if (bestId >= 0) {
+            distance = sqrt(bestSquareDist);
+        }
+        return bestId;
+    }
+
+    template <class TFilter>
+    void SEEGTrajectoryIndex::FindInRadius(const Vector3D_lf& query, double radius, const TFilter& filter, vector<unsigned int>& ids) const {
+        double q[3] = {query.x, query.y, query.z};
+        double squareRadius = radius * radius;
+        ids.clear();
+        SearchInRadius(0, m_NumberOfIndexedPoints, q, squareRadius, filter, ids);
+        sort(ids.begin(), ids.end());
+        for (unsigned int id = m_NumberOfIndexedPoints; id < m_Coords.size() / 3; id++) {
+            if (SquareDistance(id, q) <= squareRadius && filter(id)) {
+                ids.push_back(id);
+            }
+        }
+    }
+
+    template <class TFilter>
+    void SEEGTrajectoryIndex::CheckNearest(unsigned int id, const double query[3], const TFilter& filter, int& bestId, double& bestSquareDist) const {
+        double squareDist = SquareDistance(id, query);
+        // strictly closer than the current best (or the maximum distance), ties go to the smallest ID
+        if (squareDist < bestSquareDist || (bestId >= 0 && squareDist == bestSquareDist && id < (unsigned int)bestId)) {
+            if (filter(id)) {
+                bestId = id;
+                bestSquareDist = squareDist;
+            }
+        }
+    }
+
+    template <class TFilter>
+    void SEEGTrajectoryIndex::SearchNearest(unsigned int first, unsigned int last, const double query[3], const TFilter& filter, int& bestId, double& bestSquareDist) const {
+        if (last - first <= LEAF_SIZE) {
+            for (unsigned int i = first; i < last; i++) {
+                CheckNearest(m_Order[i], query, filter, bestId, bestSquareDist);
+            }
+            return;
+        }
+        unsigned int mid = (first + last) / 2;
+        unsigned int id = m_Order[mid];
+        int axis = m_SplitAxis[mid];
+        double diff = query[axis] - m_Coords[3*id+axis];
+
+        CheckNearest(id, query, filter, bestId, bestSquareDist);
+        if (diff < 0) {
+            SearchNearest(first, mid, query, filter, bestId, bestSquareDist);
+            if (diff * diff <= bestSquareDist) {
+                SearchNearest(mid + 1, last, query, filter, bestId, bestSquareDist);
+            }
+        } else {
+            SearchNearest(mid + 1, last, query, filter, bestId, bestSquareDist);
+            if (diff * diff <= bestSquareDist) {
+                SearchNearest(first, mid, query, filter, bestId, bestSquareDist);
+            }
+        }
+    }
+
+    template <class TFilter>
+    void SEEGTrajectoryIndex::SearchInRadius(unsigned int first, unsigned int last, const double query[3], double squareRadius, const TFilter& filter, vector<unsigned int>& ids) const {
+        if (last - first <= LEAF_SIZE) {
+            for (unsigned int i = first; i < last; i++) {
+                if (SquareDistance(m_Order[i], query) <= squareRadius && filter(m_Order[i])) {
+                    ids.push_back(m_Order[i]);
+                }
+            }
+            return;
+        }
+        unsigned int mid = (first + last) / 2;
+        unsigned int id = m_Order[mid];
+        int axis = m_SplitAxis[mid];
+        double diff = query[axis] - m_Coords[3*id+axis];
+
+        if (SquareDistance(id, query) <= squareRadius && filter(id)) {
+            ids.push_back(id);
+        }
+        if (diff <= 0 || diff * diff <= squareRadius) {
+            SearchInRadius(first, mid, query, squareRadius, filter, ids);
+        }
+        if (diff >= 0 || diff * diff <= squareRadius) {
+            SearchInRadius(mid + 1, last, query, squareRadius, filter, ids);
+        }
+    }
+}
+
+#endif
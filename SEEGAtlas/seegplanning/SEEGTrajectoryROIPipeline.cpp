@@ -12,6 +12,7 @@
 #include "SEEGTrajectoryROIPipeline.h"
 #include "itkCastImageFilter.h"
 #include <qglobal.h>
+#include <math.h>
 
 namespace seeg {
 
@@ -63,6 +64,14 @@ namespace seeg {
         m_TemplateVolume = templateVol;
     }
 
+    void SEEGTrajectoryROIPipeline::SetNumberOfWorkUnits(unsigned int numWorkUnits) {
+#if ITK_VERSION_MAJOR >= 5
+        m_DistFromTrajVolFilt->SetNumberOfWorkUnits(numWorkUnits);
+#else
+        m_DistFromTrajVolFilt->SetNumberOfThreads(numWorkUnits);
+#endif
+    }
+
 
     /**** PUBLIC FUNCTIONS ****/
     // Changed by RIZ - to include target as input
@@ -75,9 +84,6 @@ namespace seeg {
         FloatVolume::IndexType targetPointIndex;
         m_TemplateVolume->TransformPhysicalPointToIndex(entryPointWorld, entryPointIndex);
         m_TemplateVolume->TransformPhysicalPointToIndex(targetPointWorld, targetPointIndex);
-        FloatVolume::SpacingType spacing;
-        spacing = m_TemplateVolume->GetSpacing();
-
         m_DistFromTrajVolFilt->SetEntryPoint(entryPointIndex);
         m_DistFromTrajVolFilt->SetTargetPoint(targetPointIndex); // RIZ added: CHECK that it is OK that is duplicated
 
@@ -86,50 +92,175 @@ namespace seeg {
         if (fullImage) {
             region = m_TemplateVolume->GetLargestPossibleRegion();
         } else {
-            // Calculate the trajectory's bounding box.
-            FloatVolume::RegionType regionMax;
-            int min[3];
-            int max[3];
-            for (int i=0; i<3; i++) {
-                if (entryPointIndex[i] < targetPointIndex[i]) {
-                    min[i] = (((float)(entryPointIndex[i]*spacing[i]) - maxRadius) / spacing[i]) + 0.5;
-                    max[i] = (((float)(targetPointIndex[i]*spacing[i]) + maxRadius) / spacing[i]) + 0.5;
-                } else {
-                    max[i] = (((float)(entryPointIndex[i]*spacing[i]) + maxRadius) / spacing[i]) + 0.5;
-                    min[i] = (((float)(targetPointIndex[i]*spacing[i]) - maxRadius) / spacing[i]) + 0.5;
-                }
-            }
+            region = CalcTrajectoryBoundingBox(entryPointIndex, targetPointIndex, maxRadius);
+        }
+    //    cout << "m_DistFromTrajVolFilt Region: " << region.GetIndex() <<" - "<< region.GetSize() << std::endl;
+
+        m_DistFromTrajVolFilt->GetOutput()->SetRequestedRegion(region);
+        m_DistFromTrajVolFilt->Update();
+        Q_ASSERT( m_DistFromTrajVolFilt );
+
+    }
+
 
-            regionMax = m_TemplateVolume->GetLargestPossibleRegion();
-            FloatVolume::IndexType start;
-            FloatVolume::SizeType size;
-            start = regionMax.GetIndex();
-            size = regionMax.GetSize();
+    void SEEGTrajectoryROIPipeline::CalcSparseDistanceMap( Point3D entryPointWorld,
+                                                           Point3D targetPointWorld,
+                                                           float maxRadius) {
+        m_SparseRuns.clear();
+        m_SparseDistances.clear();
 
+        FloatVolume::IndexType entryPointIndex;
+        FloatVolume::IndexType targetPointIndex;
+        m_TemplateVolume->TransformPhysicalPointToIndex(entryPointWorld, entryPointIndex);
+        m_TemplateVolume->TransformPhysicalPointToIndex(targetPointWorld, targetPointIndex);
+        FloatVolume::SpacingType spacing = m_TemplateVolume->GetSpacing();
+        FloatVolume::RegionType region = CalcTrajectoryBoundingBox(entryPointIndex, targetPointIndex, maxRadius);
+
+        // same coordinates as DistanceFromTrajectoryImageFilter (index * spacing)
+        float p1[3], dir[3];
+        for (int i=0; i<3; i++) {
+            p1[i] = entryPointIndex[i] * spacing[i];
+            dir[i] = targetPointIndex[i] * spacing[i] - p1[i];
+        }
+        float lengthSq = dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2];
+        float length = sqrt(lengthSq);
+        float invLengthSq = (lengthSq > 0) ? 1.0f / lengthSq : 0.0f;
+        float u[3] = {0, 0, 0}; // unit direction
+        if (length > 0) {
             for (int i=0; i<3; i++) {
-                if (min[i] < start[i]) {
-                    min[i] = start[i];
+                u[i] = dir[i] / length;
+            }
+        }
+        float radiusSq = maxRadius * maxRadius;
+        float sx = spacing[0];
+
+        FloatVolume::IndexType regionIndex = region.GetIndex();
+        FloatVolume::SizeType regionSize = region.GetSize();
+        long xFirst = regionIndex[0];
+        long xLast = regionIndex[0] + (long) regionSize[0] - 1;
+
+        for (long z=regionIndex[2]; z<regionIndex[2] + (long) regionSize[2]; z++) {
+            float wz = z * spacing[2] - p1[2];
+            for (long y=regionIndex[1]; y<regionIndex[1] + (long) regionSize[1]; y++) {
+                float wy = y * spacing[1] - p1[1];
+
+                // The capsule is convex, so its intersection with the scanline is one interval of
+                // q = x*sx - p1x: the hull of the intervals of the 2 end spheres and of the cylinder.
+                bool found = false;
+                float qMin = 0, qMax = 0;
+
+                // end spheres (entry at q=0, target at q=dir[0])
+                for (int iSphere=0; iSphere<2; iSphere++) {
+                    float cy = (iSphere == 0) ? 0 : dir[1];
+                    float cz = (iSphere == 0) ? 0 : dir[2];
+                    float cx = (iSphere == 0) ? 0 : dir[0];
+                    float h = radiusSq - (wy-cy)*(wy-cy) - (wz-cz)*(wz-cz);
+                    if (h >= 0) {
+                        float half = sqrt(h);
+                        if (!found) {
+                            qMin = cx - half;
+                            qMax = cx + half;
+                            found = true;
+                        } else {
+                            qMin = min(qMin, cx - half);
+                            qMax = max(qMax, cx + half);
+                        }
+                    }
                 }
-                if (max[i] >= (int) (start[i] + size[i])) {
-                    max[i] = start[i] + size[i] - 1;
+
+                // cylinder: perpendicular distance <= maxRadius and projection within [0, length]
+                if (length > 0) {
+                    float c0 = wy*u[1] + wz*u[2];
+                    float a = 1 - u[0]*u[0];
+                    float b = -2 * u[0] * c0;
+                    float c = wy*wy + wz*wz - c0*c0 - radiusSq;
+                    float cylMin, cylMax;
+                    bool cylFound = false;
+                    if (a > 1e-6) {
+                        float disc = b*b - 4*a*c;
+                        if (disc >= 0) {
+                            float sq = sqrt(disc);
+                            cylMin = (-b - sq) / (2*a);
+                            cylMax = (-b + sq) / (2*a);
+                            cylFound = true;
+                        }
+                    } else if (c <= 0) { // trajectory along x: constant perpendicular distance
+                        cylMin = -1e30f;
+                        cylMax = 1e30f;
+                        cylFound = true;
+                    }
+                    if (cylFound) {
+                        // 0 <= q*ux + c0 <= length
+                        if (u[0] > 1e-6 || u[0] < -1e-6) {
+                            float t0 = -c0 / u[0];
+                            float t1 = (length - c0) / u[0];
+                            cylMin = max(cylMin, min(t0, t1));
+                            cylMax = min(cylMax, max(t0, t1));
+                        } else if (c0 < 0 || c0 > length) {
+                            cylFound = false;
+                        }
+                    }
+                    if (cylFound && cylMin <= cylMax) {
+                        if (!found) {
+                            qMin = cylMin;
+                            qMax = cylMax;
+                            found = true;
+                        } else {
+                            qMin = min(qMin, cylMin);
+                            qMax = max(qMax, cylMax);
+                        }
+                    }
                 }
 
+                if (!found) {
+                    continue;
+                }
+
+                // one voxel of slack on each side; exact distances decide below
+                long x0 = (long) floor((qMin + p1[0]) / sx) - 1;
+                long x1 = (long) ceil((qMax + p1[0]) / sx) + 1;
+                x0 = max(x0, xFirst);
+                x1 = min(x1, xLast);
+
+                FloatVolume::IndexType lineIndex;
+                lineIndex[1] = y;
+                lineIndex[2] = z;
+                bool inRun = false;
+                for (long x=x0; x<=x1; x++) {
+                    float wx = x * sx - p1[0];
+                    float t = (wx*dir[0] + wy*dir[1] + wz*dir[2]) * invLengthSq;
+                    t = (t < 0.0f) ? 0.0f : ((t > 1.0f) ? 1.0f : t);
+                    float ex = wx - t*dir[0];
+                    float ey = wy - t*dir[1];
+                    float ez = wz - t*dir[2];
+                    float dist = sqrtf(ex*ex + ey*ey + ez*ez);
+                    if (dist <= maxRadius) {
+                        if (!inRun) {
+                            SparseDistanceRun run;
+                            lineIndex[0] = x;
+                            run.m_Offset = m_TemplateVolume->ComputeOffset(lineIndex);
+                            run.m_Length = 0;
+                            run.m_FirstDistance = m_SparseDistances.size();
+                            m_SparseRuns.push_back(run);
+                            inRun = true;
+                        }
+                        m_SparseRuns.back().m_Length++;
+                        m_SparseDistances.push_back(dist);
+                    } else {
+                        inRun = false;
+                    }
+                }
             }
-            for (int i=0; i<3; i++) {
-                start[i] = min[i];
-                size[i] = max[i] - min[i] + 1;
-            }
-            region.SetIndex(start);
-            region.SetSize(size);
         }
-    //    cout << "m_DistFromTrajVolFilt Region: " << region.GetIndex() <<" - "<< region.GetSize() << std::endl;
-
-        m_DistFromTrajVolFilt->GetOutput()->SetRequestedRegion(region);
-        m_DistFromTrajVolFilt->Update();
-        Q_ASSERT( m_DistFromTrajVolFilt );
+    }
 
+    const vector<SparseDistanceRun>& SEEGTrajectoryROIPipeline::GetLastSparseRuns() {
+        return m_SparseRuns;
     }
 
+    const vector<float>& SEEGTrajectoryROIPipeline::GetLastSparseDistances() {
+        return m_SparseDistances;
+    }
 
     FloatVolume::Pointer SEEGTrajectoryROIPipeline::GetLastDistanceMap(bool copy) {
         if (copy) {
@@ -164,6 +295,51 @@ namespace seeg {
 
     /**** PRIVATE FUNCTIONS ****/
 
+    FloatVolume::RegionType SEEGTrajectoryROIPipeline::CalcTrajectoryBoundingBox(const FloatVolume::IndexType& entryPointIndex,
+                                                                                 const FloatVolume::IndexType& targetPointIndex,
+                                                                                 float maxRadius) {
+        FloatVolume::SpacingType spacing;
+        spacing = m_TemplateVolume->GetSpacing();
+
+        // Calculate the trajectory's bounding box.
+        FloatVolume::RegionType region;
+        FloatVolume::RegionType regionMax;
+        int min[3];
+        int max[3];
+        for (int i=0; i<3; i++) {
+            if (entryPointIndex[i] < targetPointIndex[i]) {
+                min[i] = (((float)(entryPointIndex[i]*spacing[i]) - maxRadius) / spacing[i]) + 0.5;
+                max[i] = (((float)(targetPointIndex[i]*spacing[i]) + maxRadius) / spacing[i]) + 0.5;
+            } else {
+                max[i] = (((float)(entryPointIndex[i]*spacing[i]) + maxRadius) / spacing[i]) + 0.5;
+                min[i] = (((float)(targetPointIndex[i]*spacing[i]) - maxRadius) / spacing[i]) + 0.5;
+            }
+        }
+
+        regionMax = m_TemplateVolume->GetLargestPossibleRegion();
+        FloatVolume::IndexType start;
+        FloatVolume::SizeType size;
+        start = regionMax.GetIndex();
+        size = regionMax.GetSize();
+
+        for (int i=0; i<3; i++) {
+            if (min[i] < start[i]) {
+                min[i] = start[i];
+            }
+            if (max[i] >= (int) (start[i] + size[i])) {
+                max[i] = start[i] + size[i] - 1;
+            }
+
+        }
+        for (int i=0; i<3; i++) {
+            start[i] = min[i];
+            size[i] = max[i] - min[i] + 1;
+        }
+        region.SetIndex(start);
+        region.SetSize(size);
+        return region;
+    }
+
     void SEEGTrajectoryROIPipeline::InitPipeline() {
         m_DistFromTrajVolFilt = DistFromTrajVolumeFilter::New();
         m_DistFromTrajVolFilt->SetInput(m_TemplateVolume);
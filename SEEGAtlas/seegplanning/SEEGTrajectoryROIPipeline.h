@@ -19,6 +19,7 @@
 #include "MathUtils.h"
 #include "VolumeTypes.h"
 #include <string>
+#include <vector>
 //#include "SEEGROIPipeline.h"
 #include "itkBinaryThresholdImageFilter.h"
 #include "DistanceFromTrajectoryImageFilter.h"
@@ -29,6 +30,17 @@ using namespace itk;
 
 namespace seeg {
 
+    /**
+     * A run of consecutive voxels (along the x-axis) that are within maxRadius of a trajectory.
+     * m_Offset is the linear offset of the first voxel in the template volume's buffer and
+     * m_FirstDistance the index of its distance in the distances vector of the sparse map.
+     */
+    struct SparseDistanceRun {
+        FloatVolume::OffsetValueType m_Offset;
+        unsigned int m_Length;
+        unsigned int m_FirstDistance;
+    };
+
 
     /**
      * This class contains a small itk pipeline to create a 3D binary mask (e.g. cylinder of interest)
@@ -75,6 +87,30 @@ namespace seeg {
                               bool fullImage = false);
 
 
+        /**
+         * Sparse version of CalcDistanceMap(): only the voxels within maxRadius of the segment
+         * (a capsule) are rasterized. For each scanline the capsule interval is computed
+         * analytically and stored as a SparseDistanceRun. A consumer iterates directly
+         * (see SEEGPathPlanner::TestBinaryOverlapSparse()):
+         *
+         *     const vector<SparseDistanceRun>& runs = pipeline->GetLastSparseRuns();
+         *     const vector<float>& dists = pipeline->GetLastSparseDistances();
+         *     const IntVolume::PixelType* buffer = binaryVol->GetBufferPointer();
+         *     for (int r=0; r<runs.size(); r++)
+         *         for (unsigned int k=0; k<runs[r].m_Length; k++)
+         *             use(buffer[runs[r].m_Offset + k], dists[runs[r].m_FirstDistance + k]);
+         *
+         * The offsets are valid for any volume with the same buffered region as the template.
+         * Distances are the same as the ones of CalcDistanceMap() for those voxels.
+         */
+        void CalcSparseDistanceMap( Point3D entryPointWorld,
+                                    Point3D targetPointWorld,
+                                    float maxRadius);
+
+        const vector<SparseDistanceRun>& GetLastSparseRuns();
+
+        const vector<float>& GetLastSparseDistances();
+
         /**
          * Returns a pointer to the FloatVolume containing a distance map (the distance of each
          * voxel from the trajectory centerline)
@@ -95,6 +131,12 @@ namespace seeg {
 
         void SetTemplateVol(FloatVolume::Pointer templateVol);
 
+        /**
+         * Number of threads (work units) used by the distance filter. Set it to 1 when several
+         * pipelines are already evaluated in parallel.
+         */
+        void SetNumberOfWorkUnits(unsigned int numWorkUnits);
+
 
     private:
 
@@ -103,6 +145,13 @@ namespace seeg {
          */
         void InitPipeline();
 
+        /**
+         * Bounding box (in voxel indices, clipped to the template) of the trajectory plus maxRadius
+         */
+        FloatVolume::RegionType CalcTrajectoryBoundingBox(const FloatVolume::IndexType& entryPointIndex,
+                                                          const FloatVolume::IndexType& targetPointIndex,
+                                                          float maxRadius);
+
 
         /** private type for a DistanceFromtrajectoryImageFilter (for 3D FloatVolume) */
         typedef DistanceFromTrajectoryImageFilter<FloatVolume, FloatVolume> DistFromTrajVolumeFilter;
@@ -113,6 +162,10 @@ namespace seeg {
         /** Instance of a DistFromTrajVolumeFilter */
         DistFromTrajVolumeFilter::Pointer m_DistFromTrajVolFilt;
 
+        /** Runs and distances computed by the last call to CalcSparseDistanceMap() (reused between calls) */
+        vector<SparseDistanceRun> m_SparseRuns;
+        vector<float> m_SparseDistances;
+
 //        SEEGElectrodeModel::Pointer m_ElectrodeModel;
 
     };
@@ -0,0 +1,58 @@
+/**
+ * @file SEEGTrajectoryTestRegistry.cpp
+ *
+ * Implementation of the SEEGTrajectoryTestRegistry class
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include "SEEGTrajectoryTestRegistry.h"
+
+namespace seeg {
+
+    /**** CONSTRUCTORS / DESTRUCTOR ****/
+
+    SEEGTrajectoryTestRegistry::SEEGTrajectoryTestRegistry() {
+        // Do nothing
+    }
+
+    SEEGTrajectoryTestRegistry::~SEEGTrajectoryTestRegistry() {
+        // Do nothing
+    }
+
+
+    /**** PUBLIC FUNCTIONS ****/
+
+    int SEEGTrajectoryTestRegistry::RegisterTest(const string& testName) {
+        map<string, int>::iterator it = m_TestIds.find(testName);
+        if (it != m_TestIds.end()) {
+            return it->second;
+        }
+        int testId = m_TestNames.size();
+        m_TestIds[testName] = testId;
+        m_TestNames.push_back(testName);
+        return testId;
+    }
+
+    int SEEGTrajectoryTestRegistry::GetTestId(const string& testName) const {
+        map<string, int>::const_iterator it = m_TestIds.find(testName);
+        if (it == m_TestIds.end()) {
+            return -1;
+        }
+        return it->second;
+    }
+
+    const string& SEEGTrajectoryTestRegistry::GetTestName(int testId) const {
+        return m_TestNames[testId];
+    }
+
+    int SEEGTrajectoryTestRegistry::GetNumberOfTests() const {
+        return m_TestNames.size();
+    }
+
+    void SEEGTrajectoryTestRegistry::Clear() {
+        m_TestIds.clear();
+        m_TestNames.clear();
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef __SEEG_TRAJECTORY_TEST_REGISTRY_H__
+#define __SEEG_TRAJECTORY_TEST_REGISTRY_H__
+
+/**
+ * @file SEEGTrajectoryTestRegistry.h
+ *
+ * Defines the SEEGTrajectoryTestRegistry class: the names of the trajectory tests of a
+ * planner, each registered once with a small integer ID.
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <vector>
+#include <string>
+#include <map>
+#include "BasicTypes.h"
+
+using namespace std;
+
+namespace seeg {
+
+    /**
+     * Maps trajectory test names to consecutive integer IDs (0, 1, 2...) and back.
+     * IDs are never reused or renumbered, so per-test arrays can be indexed by ID.
+     */
+    class SEEGTrajectoryTestRegistry {
+
+    public:
+        /** SmartPointer type for the SEEGTrajectoryTestRegistry class */
+        typedef mrilSmartPtr<SEEGTrajectoryTestRegistry> Pointer;
+
+        static Pointer New() { return Pointer(new SEEGTrajectoryTestRegistry()); }
+
+    protected:
+        SEEGTrajectoryTestRegistry();
+
+    public:
+        virtual ~SEEGTrajectoryTestRegistry();
+
+        /**
+         * Registers a test (if not registered yet)
+         *
+         * @return the ID of the test
+         */
+        int RegisterTest(const string& testName);
+
+        /** @return the ID of the test, -1 if it is not registered */
+        int GetTestId(const string& testName) const;
+
+        const string& GetTestName(int testId) const;
+
+        int GetNumberOfTests() const;
+
+        /** Removes all the tests (IDs of a new registration start again at 0) */
+        void Clear();
+
+    private:
+        map<string, int> m_TestIds;
+
+        vector<string> m_TestNames;
+    };
+}
+
+#endif
@@ -0,0 +1,118 @@
+/**
+ * @file SEEGVolumePyramid.cpp
+ *
+ * Implementation of the SEEGVolumePyramid class
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include "SEEGVolumePyramid.h"
+#include "itkContinuousIndex.h"
+
+namespace seeg {
+
+    template <class VolumeType>
+    static typename VolumeType::Pointer MaxPoolVolume(typename VolumeType::Pointer vol, unsigned int factor) {
+        typedef typename VolumeType::PixelType PixelType;
+
+        typename VolumeType::RegionType region = vol->GetBufferedRegion();
+        typename VolumeType::SizeType size = region.GetSize();
+        typename VolumeType::SizeType coarseSize;
+        typename VolumeType::SpacingType coarseSpacing = vol->GetSpacing();
+        itk::ContinuousIndex<double, 3> firstCenter;
+        for (int i=0; i<3; i++) {
+            coarseSize[i] = (size[i] + factor - 1) / factor;
+            coarseSpacing[i] *= factor;
+            firstCenter[i] = region.GetIndex()[i] + (factor - 1) / 2.0; // center of the voxels covered by the first coarse voxel
+        }
+        typename VolumeType::PointType coarseOrigin;
+        vol->TransformContinuousIndexToPhysicalPoint(firstCenter, coarseOrigin);
+
+        typename VolumeType::IndexType coarseIndex;
+        coarseIndex.Fill(0);
+        typename VolumeType::RegionType coarseRegion(coarseIndex, coarseSize);
+        typename VolumeType::Pointer coarseVol = VolumeType::New();
+        coarseVol->SetRegions(coarseRegion);
+        coarseVol->SetSpacing(coarseSpacing);
+        coarseVol->SetOrigin(coarseOrigin);
+        coarseVol->SetDirection(vol->GetDirection());
+        coarseVol->Allocate();
+
+        // rows of the fine volume are read once, in memory order
+        const PixelType* fineBuffer = vol->GetBufferPointer();
+        PixelType* coarseBuffer = coarseVol->GetBufferPointer();
+        vector<unsigned char> initialized(coarseRegion.GetNumberOfPixels(), 0);
+        for (unsigned int z=0; z<size[2]; z++) {
+            for (unsigned int y=0; y<size[1]; y++) {
+                const PixelType* fineRow = fineBuffer + ((unsigned long long) z * size[1] + y) * size[0];
+                unsigned long long coarseRowStart = ((unsigned long long)(z / factor) * coarseSize[1] + y / factor) * coarseSize[0];
+                for (unsigned int x=0; x<size[0]; x++) {
+                    unsigned long long coarsePos = coarseRowStart + x / factor;
+                    if (!initialized[coarsePos] || fineRow[x] > coarseBuffer[coarsePos]) {
+                        coarseBuffer[coarsePos] = fineRow[x];
+                        initialized[coarsePos] = 1;
+                    }
+                }
+            }
+        }
+        return coarseVol;
+    }
+
+
+    /**** CONSTRUCTORS / DESTRUCTOR ****/
+
+    SEEGVolumePyramid::SEEGVolumePyramid() {
+        // Do nothing
+    }
+
+    SEEGVolumePyramid::~SEEGVolumePyramid() {
+        // Do nothing
+    }
+
+
+    /**** PUBLIC FUNCTIONS ****/
+
+    IntVolume::Pointer SEEGVolumePyramid::GetLevel(IntVolume::Pointer vol, unsigned int level) {
+        return GetPyramidLevel<IntVolume>(m_IntPyramids, vol, level);
+    }
+
+    FloatVolume::Pointer SEEGVolumePyramid::GetLevel(FloatVolume::Pointer vol, unsigned int level) {
+        return GetPyramidLevel<FloatVolume>(m_FloatPyramids, vol, level);
+    }
+
+    void SEEGVolumePyramid::Clear() {
+        m_IntPyramids.clear();
+        m_FloatPyramids.clear();
+    }
+
+    IntVolume::Pointer SEEGVolumePyramid::MaxPool(IntVolume::Pointer vol, unsigned int factor) {
+        return MaxPoolVolume<IntVolume>(vol, factor);
+    }
+
+    FloatVolume::Pointer SEEGVolumePyramid::MaxPool(FloatVolume::Pointer vol, unsigned int factor) {
+        return MaxPoolVolume<FloatVolume>(vol, factor);
+    }
+
+
+    /**** PRIVATE FUNCTIONS ****/
+
+    template <class VolumeType>
+    typename VolumeType::Pointer SEEGVolumePyramid::GetPyramidLevel(map<const void*, Pyramid<VolumeType> >& pyramids,
+                                                                     typename VolumeType::Pointer vol, unsigned int level) {
+        if (level == 0) {
+            return vol;
+        }
+        Pyramid<VolumeType>& pyramid = pyramids[vol.GetPointer()];
+        if (pyramid.m_MTime != vol->GetMTime()) {
+            pyramid.m_MTime = vol->GetMTime();
+            pyramid.m_Levels.clear();
+        }
+        // each level is pooled from the previous one
+        while (pyramid.m_Levels.size() < level) {
+            typename VolumeType::Pointer finerVol = pyramid.m_Levels.empty() ? vol : pyramid.m_Levels.back();
+            pyramid.m_Levels.push_back(MaxPoolVolume<VolumeType>(finerVol, 2));
+        }
+        return pyramid.m_Levels[level - 1];
+    }
+}
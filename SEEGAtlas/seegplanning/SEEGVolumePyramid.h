@@ -0,0 +1,73 @@
+#ifndef __SEEG_VOLUME_PYRAMID_H__
+#define __SEEG_VOLUME_PYRAMID_H__
+
+/**
+ * @file SEEGVolumePyramid.h
+ *
+ * Defines the SEEGVolumePyramid class: max-pooled downsampled versions of the volumes used by
+ * the trajectory tests, for the coarse-to-fine planning mode of the SEEGPathPlanner.
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <map>
+#include <vector>
+#include "BasicTypes.h"
+#include "VolumeTypes.h"
+
+using namespace std;
+
+namespace seeg {
+
+    /**
+     * Level 0 of a pyramid is the volume itself, level l is downsampled by 2^l in each direction.
+     * Every coarse voxel takes the maximum of the voxels it covers, so a structure (or a target) is
+     * never smaller at a coarse level than at full resolution. Coarse voxels are centered on the
+     * voxels they cover (same direction, spacing multiplied by 2^l).
+     *
+     * Levels are computed on request and kept per volume until the volume is modified (itk::Object::GetMTime()).
+     */
+    class SEEGVolumePyramid {
+
+    public:
+        /** SmartPointer type for the SEEGVolumePyramid class */
+        typedef mrilSmartPtr<SEEGVolumePyramid> Pointer;
+
+        static Pointer New() { return Pointer(new SEEGVolumePyramid()); }
+
+    protected:
+        SEEGVolumePyramid();
+
+    public:
+        virtual ~SEEGVolumePyramid();
+
+        /** Level of the pyramid of vol (vol itself for level 0) */
+        IntVolume::Pointer GetLevel(IntVolume::Pointer vol, unsigned int level);
+        FloatVolume::Pointer GetLevel(FloatVolume::Pointer vol, unsigned int level);
+
+        /** Releases all the levels */
+        void Clear();
+
+        /** Downsamples vol by factor in each direction, keeping the maximum of the voxels covered by each coarse voxel */
+        static IntVolume::Pointer MaxPool(IntVolume::Pointer vol, unsigned int factor);
+        static FloatVolume::Pointer MaxPool(FloatVolume::Pointer vol, unsigned int factor);
+
+    private:
+        template <class VolumeType>
+        struct Pyramid {
+            unsigned long m_MTime;
+            vector<typename VolumeType::Pointer> m_Levels; // levels 1, 2...
+        };
+
+        template <class VolumeType>
+        static typename VolumeType::Pointer GetPyramidLevel(map<const void*, Pyramid<VolumeType> >& pyramids,
+                                                            typename VolumeType::Pointer vol, unsigned int level);
+
+        /** Pyramids of the volumes (key: volume) */
+        map<const void*, Pyramid<IntVolume> > m_IntPyramids;
+        map<const void*, Pyramid<FloatVolume> > m_FloatPyramids;
+    };
+}
+
+#endif
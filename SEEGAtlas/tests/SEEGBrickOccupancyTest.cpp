@@ -0,0 +1,186 @@
+/**
+ * @file SEEGBrickOccupancyTest.cpp
+ *
+ * Checks the queries of SEEGBrickOccupancy against a brute-force scan of all the voxels, on binary and fuzzy
+ * volumes whose size is not a multiple of the bricks, with anisotropic spacing and an oblique direction:
+ * - GetMaxValueNearSegment() is an upper bound of the values of the voxels within maxDist of the segment
+ * - IsSegmentFartherThan() is true only if no voxel > 0 is within maxDist
+ * - HasValueCloserThan() is true only if a voxel >= minValue is closer than maxDist, its projection inside the segment
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <math.h>
+#include <float.h>
+#include "VolumeTypes.h"
+#include "SEEGBrickOccupancy.h"
+
+using namespace std;
+using namespace seeg;
+
+static double RandomValue(double minValue, double maxValue) {
+    return minValue + ((double) rand() / RAND_MAX) * (maxValue - minValue);
+}
+
+// Same geometry for both volumes: 37x29x45 voxels, rotated around z then x
+template <class VolumeType>
+static typename VolumeType::Pointer CreateVolume() {
+    typename VolumeType::SizeType size;
+    size[0] = 37; size[1] = 29; size[2] = 45;
+    typename VolumeType::RegionType region;
+    region.SetSize(size);
+    typename VolumeType::SpacingType spacing;
+    spacing[0] = 0.9; spacing[1] = 1.1; spacing[2] = 1.3;
+    typename VolumeType::PointType origin;
+    origin[0] = -12.3; origin[1] = 4.5; origin[2] = 7.1;
+    double cz = cos(0.5), sz = sin(0.5), cx = cos(0.3), sx = sin(0.3);
+    typename VolumeType::DirectionType direction;
+    direction[0][0] = cz;       direction[0][1] = -sz;      direction[0][2] = 0;
+    direction[1][0] = cx * sz;  direction[1][1] = cx * cz;  direction[1][2] = -sx;
+    direction[2][0] = sx * sz;  direction[2][1] = sx * cz;  direction[2][2] = cx;
+
+    typename VolumeType::Pointer vol = VolumeType::New();
+    vol->SetRegions(region);
+    vol->SetSpacing(spacing);
+    vol->SetOrigin(origin);
+    vol->SetDirection(direction);
+    vol->Allocate();
+    vol->FillBuffer(0);
+    return vol;
+}
+
+// A few isolated voxels and a solid block (whole bricks above the thresholds)
+template <class VolumeType>
+static void FillVolume(typename VolumeType::Pointer vol, bool isFuzzy) {
+    typename VolumeType::SizeType size = vol->GetBufferedRegion().GetSize();
+    for (int i=0; i<40; i++) {
+        typename VolumeType::IndexType index;
+        for (int j=0; j<3; j++) {
+            index[j] = rand() % size[j];
+        }
+        vol->SetPixel(index, isFuzzy ? (typename VolumeType::PixelType) RandomValue(0.05, 1) : 1);
+    }
+    typename VolumeType::IndexType index;
+    for (index[2]=16; index[2]<36; index[2]++) {
+        for (index[1]=4; index[1]<24; index[1]++) {
+            for (index[0]=8; index[0]<28; index[0]++) {
+                vol->SetPixel(index, isFuzzy ? (typename VolumeType::PixelType) RandomValue(0.6, 1) : 1);
+            }
+        }
+    }
+}
+
+static double CalcDistanceToSegment(const Point3D& point, const Point3D& p1, const Point3D& p2, double& projection) {
+    double lengthSq = 0, dot = 0;
+    for (int i=0; i<3; i++) {
+        lengthSq += (p2[i] - p1[i]) * (p2[i] - p1[i]);
+        dot += (p2[i] - p1[i]) * (point[i] - p1[i]);
+    }
+    double t = (lengthSq > 0) ? max(0.0, min(1.0, dot / lengthSq)) : 0;
+    projection = t * sqrt(lengthSq);
+    double distSq = 0;
+    for (int i=0; i<3; i++) {
+        double d = point[i] - p1[i] - t * (p2[i] - p1[i]);
+        distSq += d * d;
+    }
+    return sqrt(distSq);
+}
+
+template <class VolumeType>
+static int CheckSegments(const string& name, typename VolumeType::Pointer vol, float minValue, int numSegments,
+                         int& numFarther, int& numCloser) {
+    SEEGBrickOccupancy::Pointer bricks = SEEGBrickOccupancy::New(vol);
+    typedef itk::ImageRegionConstIteratorWithIndex<VolumeType> IteratorType;
+
+    // world coordinates of the voxel centers
+    vector<Point3D> centers;
+    vector<float> values;
+    IteratorType it(vol, vol->GetBufferedRegion());
+    for (it.GoToBegin(); !it.IsAtEnd(); ++it) {
+        Point3D center;
+        vol->TransformIndexToPhysicalPoint(it.GetIndex(), center);
+        centers.push_back(center);
+        values.push_back((float) it.Get());
+    }
+
+    int numErrors = 0;
+    for (int iSegment=0; iSegment<numSegments; iSegment++) {
+        // end points around the volume (some outside), a few segments of length 0
+        Point3D p1, p2;
+        for (int i=0; i<3; i++) {
+            p1[i] = RandomValue(-25, 60);
+            p2[i] = (iSegment % 20 == 0) ? p1[i] : p1[i] + RandomValue(-30, 30);
+        }
+        float maxDist = (float) RandomValue(0, 12);
+        double length = sqrt((p2[0]-p1[0])*(p2[0]-p1[0]) + (p2[1]-p1[1])*(p2[1]-p1[1]) + (p2[2]-p1[2])*(p2[2]-p1[2]));
+
+        float bruteMaxValue = -FLT_MAX;
+        bool hasForegroundVoxel = false;
+        bool hasCloserVoxel = false;
+        for (unsigned int iVoxel=0; iVoxel<centers.size(); iVoxel++) {
+            double projection;
+            double dist = CalcDistanceToSegment(centers[iVoxel], p1, p2, projection);
+            if (dist <= maxDist) {
+                bruteMaxValue = max(bruteMaxValue, values[iVoxel]);
+                hasForegroundVoxel = hasForegroundVoxel || (values[iVoxel] > 0);
+            }
+            if (dist < maxDist && values[iVoxel] >= minValue && projection > 0 && projection < length) {
+                hasCloserVoxel = true;
+            }
+        }
+
+        float maxValue = bricks->GetMaxValueNearSegment(p1, p2, maxDist);
+        if (maxValue < bruteMaxValue) {
+            cout << name << " segment " << iSegment << ": bound " << maxValue << " below the maximum " << bruteMaxValue << std::endl;
+            numErrors++;
+        }
+        if (bricks->IsSegmentFartherThan(p1, p2, maxDist)) {
+            numFarther++;
+            if (hasForegroundVoxel) {
+                cout << name << " segment " << iSegment << ": farther than " << maxDist << " but a voxel > 0 is within" << std::endl;
+                numErrors++;
+            }
+        }
+        if (bricks->HasValueCloserThan(p1, p2, maxDist, minValue)) {
+            numCloser++;
+            if (!hasCloserVoxel) {
+                cout << name << " segment " << iSegment << ": no voxel >= " << minValue << " closer than " << maxDist << std::endl;
+                numErrors++;
+            }
+        }
+    }
+    return numErrors;
+}
+
+int main(int argc, char* argv[]) {
+    srand(4321);
+    int numErrors = 0;
+    int numFarther = 0, numCloser = 0;
+
+    IntVolume::Pointer binaryVol = CreateVolume<IntVolume>();
+    FillVolume<IntVolume>(binaryVol, false);
+    numErrors += CheckSegments<IntVolume>("Binary", binaryVol, 1, 2000, numFarther, numCloser);
+
+    FloatVolume::Pointer fuzzyVol = CreateVolume<FloatVolume>();
+    FillVolume<FloatVolume>(fuzzyVol, true);
+    numErrors += CheckSegments<FloatVolume>("Fuzzy", fuzzyVol, 0.5f, 2000, numFarther, numCloser);
+
+    // the checks only mean something if both answers happened
+    cout << numFarther << " segments farther than maxDist - " << numCloser << " segments with a value closer than maxDist" << std::endl;
+    if (numFarther == 0 || numCloser == 0) {
+        cout << "The segments do not cover both cases" << std::endl;
+        numErrors++;
+    }
+
+    if (numErrors > 0) {
+        cout << numErrors << " errors" << std::endl;
+        return EXIT_FAILURE;
+    }
+    cout << "All queries are consistent with the brute-force scan" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file SEEGLabelHistogramsTest.cpp
+ *
+ * Checks that SEEGContactsROIPipeline::CalcElectrodeLabelHistograms() (one walk over the atlas per
+ * electrode) gives the counts of the per contact/channel path (GetLabelsInContact(), GetLabelsInChannel()
+ * and GetNumberVoxelsInChannelModel()) on a synthetic atlas, with and without the cylinder, for electrodes
+ * inside the volume and electrodes whose regions are clipped at its border.
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <map>
+#include <string>
+#include <sstream>
+#include "VolumeTypes.h"
+#include "SEEGElectrodeModel.h"
+#include "ElectrodeInfo.h"
+#include "SEEGContactsROIPipeline.h"
+
+using namespace std;
+using namespace seeg;
+
+// Atlas with blocks of labels of different sizes along each axis, label 0 included
+static FloatVolume::Pointer CreateLabelsVolume() {
+    FloatVolume::SizeType size;
+    size[0] = 64; size[1] = 64; size[2] = 56;
+    FloatVolume::RegionType region;
+    region.SetSize(size);
+    FloatVolume::SpacingType spacing;
+    spacing[0] = 1.0; spacing[1] = 1.0; spacing[2] = 1.2;
+    FloatVolume::PointType origin;
+    origin[0] = 0.5; origin[1] = 0.5; origin[2] = 0.5;
+
+    FloatVolume::Pointer vol = FloatVolume::New();
+    vol->SetRegions(region);
+    vol->SetSpacing(spacing);
+    vol->SetOrigin(origin);
+    vol->Allocate();
+    FloatVolumeRegionIteratorWithIndex it(vol, region);
+    for (it.GoToBegin(); !it.IsAtEnd(); ++it) {
+        FloatVolume::IndexType index = it.GetIndex();
+        it.Set((float) ((index[0] / 6 + 4 * (index[1] / 7) + 16 * (index[2] / 5)) % 23));
+    }
+    return vol;
+}
+
+static ElectrodeInfo::Pointer CreateElectrode(double tx, double ty, double tz, double ex, double ey, double ez, SEEGElectrodeModel::Pointer model) {
+    Point3D target, entry;
+    target[0] = tx; target[1] = ty; target[2] = tz;
+    entry[0] = ex; entry[1] = ey; entry[2] = ez;
+    ElectrodeInfo::Pointer electrode = ElectrodeInfo::New(entry, target, model);
+    vector<Point3D> allContactsCentralPt;
+    model->CalcAllContactPositions(target, entry, allContactsCentralPt, false);
+    electrode->AddAllContactsAndChannelsToElectrode(allContactsCentralPt);
+    return electrode;
+}
+
+// Number of histograms that differ (voxels in the region/model or count of any label)
+static int CompareHistograms(const string& name, const vector<LabelHistogram>& oneWalk, const vector<LabelHistogram>& perContact) {
+    if (oneWalk.size() != perContact.size()) {
+        cout << name << ": " << oneWalk.size() << " histograms instead of " << perContact.size() << std::endl;
+        return 1;
+    }
+    int numErrors = 0;
+    for (unsigned int i=0; i<oneWalk.size(); i++) {
+        if (oneWalk[i].m_NumVoxels != perContact[i].m_NumVoxels || oneWalk[i].m_LabelCounts != perContact[i].m_LabelCounts) {
+            cout << name << " " << i << ": " << oneWalk[i].m_NumVoxels << " voxels / " << oneWalk[i].m_LabelCounts.size()
+                 << " labels instead of " << perContact[i].m_NumVoxels << " voxels / " << perContact[i].m_LabelCounts.size() << " labels" << std::endl;
+            for (map<int,int>::const_iterator itLabel = perContact[i].m_LabelCounts.begin(); itLabel != perContact[i].m_LabelCounts.end(); itLabel++) {
+                map<int,int>::const_iterator itOneWalk = oneWalk[i].m_LabelCounts.find(itLabel->first);
+                int count = (itOneWalk == oneWalk[i].m_LabelCounts.end()) ? 0 : itOneWalk->second;
+                if (count != itLabel->second) {
+                    cout << "    label " << itLabel->first << ": " << count << " instead of " << itLabel->second << std::endl;
+                }
+            }
+            numErrors++;
+        }
+    }
+    return numErrors;
+}
+
+int main(int argc, char* argv[]) {
+    FloatVolume::Pointer anatLabelsVol = CreateLabelsVolume();
+    SEEGElectrodeModel::Pointer model = SEEGElectrodeModel::New();
+
+    vector<ElectrodeInfo::Pointer> electrodes;
+    electrodes.push_back(CreateElectrode(20.3, 22.1, 25.7, 55.2, 40.4, 50.9, model));  // oblique, inside the volume
+    electrodes.push_back(CreateElectrode(32.5, 10.2, 30.6, 32.5, 60.2, 30.6, model));  // along y, inside the volume
+    electrodes.push_back(CreateElectrode(1.2, 1.6, 0.9, 30.1, 30.4, 30.2, model));     // clipped at the first voxels
+    electrodes.push_back(CreateElectrode(40.4, 40.2, 40.7, 63.6, 63.8, 66.6, model));  // clipped at the last voxels
+
+    int numErrors = 0;
+    for (int iCylinder=0; iCylinder<2; iCylinder++) {
+        bool useCylinder = (iCylinder == 0);
+        for (unsigned int iElec=0; iElec<electrodes.size(); iElec++) {
+            SEEGContactsROIPipeline::Pointer pipelineContacts = SEEGContactsROIPipeline::New(anatLabelsVol, model);
+            vector<LabelHistogram> contactHistograms, channelHistograms;
+            vector<LabelHistogram> refContactHistograms, refChannelHistograms;
+            pipelineContacts->CalcElectrodeLabelHistograms(electrodes[iElec], anatLabelsVol, useCylinder, contactHistograms, channelHistograms);
+            pipelineContacts->CalcElectrodeLabelHistogramsPerContact(electrodes[iElec], anatLabelsVol, useCylinder, refContactHistograms, refChannelHistograms);
+
+            stringstream name;
+            name << "Electrode " << iElec << (useCylinder ? " (cylinder)" : " (central point)");
+            numErrors += CompareHistograms(name.str() + " contact", contactHistograms, refContactHistograms);
+            numErrors += CompareHistograms(name.str() + " channel", channelHistograms, refChannelHistograms);
+        }
+    }
+
+    if (numErrors > 0) {
+        cout << numErrors << " histograms differ" << std::endl;
+        return EXIT_FAILURE;
+    }
+    cout << "All histograms are the same" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+/**
+ * @file SEEGSkullPointIndexTest.cpp
+ *
+ * Checks SEEGSkullPointIndex::FindClosestAngle() against the full scan of the normal volume it replaces in
+ * SEEGPathPlanner::TestVectorOverlap(): same voxel (the first one in the iterator order when several have
+ * the same angle) and same angle, for entry points inside, on and outside a synthetic skull.
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <math.h>
+#include "VolumeTypes.h"
+#include "MathUtils.h"
+#include "SEEGSkullPointIndex.h"
+
+using namespace std;
+using namespace seeg;
+
+static double RandomValue(double minValue, double maxValue) {
+    return minValue + ((double) rand() / RAND_MAX) * (maxValue - minValue);
+}
+
+// x component of the normals: non-zero on a shell of radius 22mm (and on a small plate with the same voxels in a row)
+static FloatVolume::Pointer CreateNormalVolume(Point3D& center) {
+    FloatVolume::SizeType size;
+    size[0] = 56; size[1] = 52; size[2] = 48;
+    FloatVolume::RegionType region;
+    region.SetSize(size);
+    FloatVolume::SpacingType spacing;
+    spacing[0] = 1.0; spacing[1] = 1.0; spacing[2] = 1.25;
+    FloatVolume::PointType origin;
+    origin[0] = -28; origin[1] = -26; origin[2] = -30;
+
+    FloatVolume::Pointer vol = FloatVolume::New();
+    vol->SetRegions(region);
+    vol->SetSpacing(spacing);
+    vol->SetOrigin(origin);
+    vol->Allocate();
+    center.Fill(0);
+    FloatVolumeRegionIteratorWithIndex it(vol, region);
+    for (it.GoToBegin(); !it.IsAtEnd(); ++it) {
+        Point3D point;
+        vol->TransformIndexToPhysicalPoint(it.GetIndex(), point);
+        double dist = point.EuclideanDistanceTo(center);
+        bool isOnShell = fabs(dist - 22) < 0.8;
+        bool isOnPlate = (it.GetIndex()[2] == 40 && it.GetIndex()[0] > 20 && it.GetIndex()[0] < 30);
+        it.Set((isOnShell || isOnPlate) ? (float) ((point[0] - center[0]) / max(dist, 1.0) + 2) : 0);
+    }
+    return vol;
+}
+
+// The angle of CalcLineAngle(), as computed by the scan
+static float CalcLineAngle(const Vector3D_lf& lineDir, Vector3D_lf v) {
+    v = v / norm(v);
+    float dotProd = lineDir.x * v.x + lineDir.y * v.y + lineDir.z * v.z;
+    if (dotProd > 1) dotProd = 1;
+    float a = acos(dotProd);
+    a = rad2deg(a);
+    return min(fabs(a), fabs(180 - a));
+}
+
+int main(int argc, char* argv[]) {
+    srand(2468);
+    Point3D center;
+    FloatVolume::Pointer normalVol = CreateNormalVolume(center);
+    SEEGSkullPointIndex::Pointer skullIndex = SEEGSkullPointIndex::New(normalVol);
+
+    // skull points in the order of the scan
+    vector<FloatVolume::IndexType> indices;
+    vector<Point3D> points;
+    FloatVolumeRegionIteratorWithIndex it(normalVol, normalVol->GetRequestedRegion());
+    for (it.GoToBegin(); !it.IsAtEnd(); ++it) {
+        if (!it.Get()) {
+            continue;
+        }
+        Point3D point;
+        normalVol->TransformIndexToPhysicalPoint(it.GetIndex(), point);
+        indices.push_back(it.GetIndex());
+        points.push_back(point);
+    }
+    int numErrors = 0;
+    if (skullIndex->GetNumberOfPoints() != points.size()) {
+        cout << skullIndex->GetNumberOfPoints() << " skull points instead of " << points.size() << std::endl;
+        numErrors++;
+    }
+
+    for (int iQuery=0; iQuery<3000; iQuery++) {
+        // entry points on the skull (as planned trajectories), inside and outside of it
+        Point3D entryPoint;
+        if (iQuery % 3 == 0) {
+            entryPoint = points[rand() % points.size()];
+        } else {
+            double radius = (iQuery % 3 == 1) ? RandomValue(0, 20) : RandomValue(24, 40);
+            Vector3D_lf dir(RandomValue(-1, 1), RandomValue(-1, 1), RandomValue(-1, 1));
+            dir = dir / norm(dir);
+            for (int i=0; i<3; i++) {
+                entryPoint[i] = center[i] + radius * (i == 0 ? dir.x : (i == 1 ? dir.y : dir.z));
+            }
+        }
+        // some directions along the axes (several points at the same angle)
+        Vector3D_lf direction(RandomValue(-1, 1), RandomValue(-1, 1), RandomValue(-1, 1));
+        if (iQuery % 10 == 0) {
+            direction = Vector3D_lf(0, 0, 1);
+        }
+
+        Vector3D_lf lineDir = direction / norm(direction);
+        float bruteAngle = 90;
+        int bruteId = -1;
+        for (unsigned int id=0; id<points.size(); id++) {
+            Vector3D_lf v(entryPoint[0] - points[id][0], entryPoint[1] - points[id][1], entryPoint[2] - points[id][2]);
+            float angle = CalcLineAngle(lineDir, v);
+            if (angle < bruteAngle) {
+                bruteAngle = angle;
+                bruteId = id;
+            }
+        }
+
+        FloatVolume::IndexType index;
+        Point3D point;
+        float angle;
+        bool found = skullIndex->FindClosestAngle(entryPoint, direction, index, point, angle);
+        if (found != (bruteId >= 0) || (found && (index != indices[bruteId] || angle != bruteAngle || point != points[bruteId]))) {
+            cout << "Query " << iQuery << ": ";
+            if (found) {
+                cout << index << " at " << angle << " degrees";
+            } else {
+                cout << "no point";
+            }
+            cout << " instead of ";
+            if (bruteId >= 0) {
+                cout << indices[bruteId] << " at " << bruteAngle << " degrees" << std::endl;
+            } else {
+                cout << "no point" << std::endl;
+            }
+            numErrors++;
+        }
+    }
+
+    if (numErrors > 0) {
+        cout << numErrors << " queries differ from the full scan" << std::endl;
+        return EXIT_FAILURE;
+    }
+    cout << "All queries are the same as the full scan" << std::endl;
+    return EXIT_SUCCESS;
+}
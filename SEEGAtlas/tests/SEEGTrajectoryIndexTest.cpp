@@ -0,0 +1,129 @@
+/**
+ * @file SEEGTrajectoryIndexTest.cpp
+ *
+ * Checks the queries of SEEGTrajectoryIndex against a brute-force scan of all the points: random and
+ * duplicated points (ties go to the smallest ID), points added after Build(), filters and distance limits.
+ *
+ * @author Rina Zelmann
+ */
+
+// Header files to include
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <math.h>
+#include "SEEGTrajectoryIndex.h"
+
+using namespace std;
+using namespace seeg;
+
+// Accepts the points with an odd ID
+struct AcceptOdd {
+    bool operator() (unsigned int id) const { return (id % 2) == 1; }
+};
+
+// Accepts no point
+struct AcceptNone {
+    bool operator() (unsigned int id) const { return false; }
+};
+
+static double RandomCoord(bool onGrid) {
+    if (onGrid) {
+        return (double) (rand() % 5) * 2.5 - 5; // few different values: many points at the same distance
+    }
+    return ((double) rand() / RAND_MAX) * 20 - 10;
+}
+
+static double SquareDistance(const vector<Vector3D_lf>& points, unsigned int id, const Vector3D_lf& query) {
+    double dx = points[id].x - query.x;
+    double dy = points[id].y - query.y;
+    double dz = points[id].z - query.z;
+    return dx*dx + dy*dy + dz*dz;
+}
+
+template <class TFilter>
+static int CheckQueries(const string& name, SEEGTrajectoryIndex::Pointer index, const vector<Vector3D_lf>& points,
+                        const Vector3D_lf& query, double maxDistance, const TFilter& filter) {
+    int numErrors = 0;
+
+    // closest point: first (smallest ID) of the points strictly closer than maxDistance
+    int bruteId = -1;
+    double bruteSquareDist = maxDistance * maxDistance;
+    for (unsigned int id=0; id<points.size(); id++) {
+        double squareDist = SquareDistance(points, id, query);
+        if (squareDist < bruteSquareDist && filter(id)) {
+            bruteId = id;
+            bruteSquareDist = squareDist;
+        }
+    }
+    double distance = -1;
+    int id = index->FindNearest(query, maxDistance, filter, distance);
+    if (id != bruteId || (id >= 0 && distance != sqrt(bruteSquareDist))) {
+        cout << name << " FindNearest: " << id << " at " << distance << " instead of " << bruteId << " at " << sqrt(bruteSquareDist) << std::endl;
+        numErrors++;
+    }
+
+    // points within the radius, in increasing order
+    vector<unsigned int> bruteIds;
+    for (unsigned int id=0; id<points.size(); id++) {
+        if (SquareDistance(points, id, query) <= maxDistance * maxDistance && filter(id)) {
+            bruteIds.push_back(id);
+        }
+    }
+    vector<unsigned int> ids;
+    index->FindInRadius(query, maxDistance, filter, ids);
+    if (ids != bruteIds) {
+        cout << name << " FindInRadius: " << ids.size() << " points instead of " << bruteIds.size() << std::endl;
+        numErrors++;
+    }
+    return numErrors;
+}
+
+int main(int argc, char* argv[]) {
+    srand(1234);
+    unsigned int numPoints[] = { 0, 5, 8, 9, 200, 3000 };
+    int numErrors = 0;
+    for (unsigned int iSize=0; iSize<sizeof(numPoints) / sizeof(numPoints[0]); iSize++) {
+        for (int iGrid=0; iGrid<2; iGrid++) {
+            bool onGrid = (iGrid == 1);
+            SEEGTrajectoryIndex::Pointer index = SEEGTrajectoryIndex::New();
+            vector<Vector3D_lf> points;
+            for (unsigned int i=0; i<numPoints[iSize]; i++) {
+                points.push_back(Vector3D_lf(RandomCoord(onGrid), RandomCoord(onGrid), RandomCoord(onGrid)));
+                index->AddPoint(points.back());
+            }
+            index->Build();
+
+            // without and with points added after Build() (scanned linearly until Update() rebuilds the tree)
+            for (int iStep=0; iStep<3; iStep++) {
+                if (iStep > 0) {
+                    for (unsigned int i=0; i<numPoints[iSize] / 10 + 3; i++) {
+                        points.push_back(Vector3D_lf(RandomCoord(onGrid), RandomCoord(onGrid), RandomCoord(onGrid)));
+                        index->AddPoint(points.back());
+                    }
+                }
+                if (iStep == 2) {
+                    index->Update();
+                }
+                for (int iQuery=0; iQuery<200; iQuery++) {
+                    Vector3D_lf query(RandomCoord(onGrid), RandomCoord(onGrid), RandomCoord(onGrid));
+                    double maxDistance = (iQuery % 3 == 0) ? 1e10 : ((double) rand() / RAND_MAX) * 6;
+                    stringstream name;
+                    name << numPoints[iSize] << " points" << (onGrid ? " on grid" : "") << " step " << iStep << " query " << iQuery;
+                    numErrors += CheckQueries(name.str(), index, points, query, maxDistance, TrajectoryIndexAcceptAll());
+                    numErrors += CheckQueries(name.str() + " (odd IDs)", index, points, query, maxDistance, AcceptOdd());
+                    numErrors += CheckQueries(name.str() + " (no ID)", index, points, query, maxDistance, AcceptNone());
+                }
+            }
+        }
+    }
+
+    if (numErrors > 0) {
+        cout << numErrors << " queries differ from the brute-force scan" << std::endl;
+        return EXIT_FAILURE;
+    }
+    cout << "All queries are the same as the brute-force scan" << std::endl;
+    return EXIT_SUCCESS;
+}